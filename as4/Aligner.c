@@ -0,0 +1,315 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    Aligner.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define BASE_CELLS (1 << 14)        // Subproblems this small are solved with a full DP table.
+#define PARALLEL_CELLS (1 << 22)    // Subproblems this large split into two parallel halves.
+
+/**
+ * Subproblem of alignLCSS(): align wav_data1[start1, end1) with
+ * wav_data2[start2, end2).
+ */
+typedef struct Alignment {
+    const u_char *wav_data1;
+    const u_char *wav_data2;
+    u_int start1;
+    u_int end1;
+    u_int start2;
+    u_int end2;
+    u_int *matches;
+    int *status;                // Shared by all the subproblems of an alignment.
+} Alignment;
+
+private void alignRange(Alignment *alignment);
+
+private void alignHalf(void *context, int half);
+
+private int alignTable(Alignment *alignment);
+
+private void lastRow(const u_char *wav_data1, u_int size1, const u_char *wav_data2, u_int size2, int step,
+                     u_int *row, u_int *scratch);
+
+
+/**
+ * Prints the lcss distance of two .wav files and the ranges of their data
+ * that a longest common subsequence matches, runs of at least
+ * @param min_run consecutive bytes in both.
+ * Option ID: 22
+ *
+ * @param wav_filename1
+ * @param wav_filename2
+ * @param min_run
+ * @return EXIT_CODE
+ */
+public int printAlignment(char *wav_filename1, char *wav_filename2, u_int min_run) {
+    int EXIT_CODE;
+    Header *wav_header1 = NULL, *wav_header2 = NULL;
+    FILE *wav_file1 = NULL, *wav_file2 = NULL;
+    u_char *wav_data1 = NULL, *wav_data2 = NULL;
+    u_int *matches = NULL;
+
+    EXIT_CODE = getHeader(NULL, &wav_header1, &wav_file1, wav_filename1);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+    EXIT_CODE = getHeader(NULL, &wav_header2, &wav_file2, wav_filename2);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    if (wav_header1->bitsPerSample != wav_header2->bitsPerSample
+     || wav_header1->numChannels != wav_header2->numChannels) {
+        EXIT_CODE = FAILURE;
+        printf("Incompatible files: %s, %s\n\n", wav_filename1, wav_filename2);
+        goto END;
+    }
+
+    EXIT_CODE = getData(wav_header1, wav_file1, &wav_data1);
+    if (EXIT_CODE == SUCCESS)
+        EXIT_CODE = getData(wav_header2, wav_file2, &wav_data2);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    u_int size1 = wav_header1->subchunk2Size, size2 = wav_header2->subchunk2Size;
+    matches = malloc(max(size1, 1) * sizeof(u_int));
+    long long length = matches == NULL ? -1 : alignLCSS(wav_data1, wav_data2, size1, size2, matches);
+    if (length < 0) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    printf("LCSS distance: %.3f\n", 1 - (double) length / min(size1, size2));
+    printf("Matched %lld bytes, runs of at least %u bytes:\n", length, min_run);
+
+    // A run continues while both sides advance by one byte
+    double rate1 = max(wav_header1->byteRate, 1), rate2 = max(wav_header2->byteRate, 1);
+    for (u_int i = 0; i < size1;) {
+        if (matches[i] == NO_MATCH) {
+            i++;
+            continue;
+        }
+        u_int run = 1;
+        while (i + run < size1 && matches[i + run] == matches[i] + run)
+            run++;
+        if (run >= min_run)
+            printf("%s %.3f s to %.3f s matches %s %.3f s to %.3f s, %u bytes\n",
+                   wav_filename1, i / rate1, (i + run) / rate1,
+                   wav_filename2, matches[i] / rate2, (matches[i] + run) / rate2, run);
+        i += run;
+    }
+    printf("\n");
+
+    END:
+    freePointer(wav_header1);
+    freePointer(wav_header2);
+    releaseBuffer(wav_data1);
+    releaseBuffer(wav_data2);
+    freePointer(matches);
+    closeFile(wav_file1);
+    closeFile(wav_file2);
+    return EXIT_CODE;
+}
+
+/**
+ * Finds a longest common subsequence of two data buffers in O(size1 +
+ * size2) memory with Hirschberg's divide and conquer: the middle byte of
+ * wav_data1 is matched to the split of wav_data2 that maximizes the lcss
+ * of the first halves, found with a forward pass, plus that of the second
+ * halves, found with a backward pass, and both halves are solved the same
+ * way, in parallel while large.
+ *
+ * @param wav_data1
+ * @param wav_data2
+ * @param size1
+ * @param size2
+ * @param matches, receives for every byte of wav_data1 the byte of
+ * wav_data2 it is matched to, or NO_MATCH
+ * @return length of the subsequence, -1 if out of memory
+ */
+public long long alignLCSS(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2, u_int *matches) {
+    int status = SUCCESS;
+    Alignment alignment = {wav_data1, wav_data2, 0, size1, 0, size2, matches, &status};
+
+    for (u_int i = 0; i < size1; i++)
+        matches[i] = NO_MATCH;
+    alignRange(&alignment);
+    if (status != SUCCESS)
+        return -1;
+
+    long long length = 0;
+    for (u_int i = 0; i < size1; i++)
+        length += matches[i] != NO_MATCH;
+    return length;
+}
+
+/**
+ * Aligns one subproblem, splitting it in two while it is too large for a
+ * table.
+ *
+ * @param alignment
+ */
+private void alignRange(Alignment *alignment) {
+    u_int size1 = alignment->end1 - alignment->start1;
+    u_int size2 = alignment->end2 - alignment->start2;
+    if (size1 == 0 || size2 == 0)
+        return;
+
+    // One byte matches the first equal byte, if any
+    if (size1 == 1) {
+        for (u_int j = alignment->start2; j < alignment->end2; j++)
+            if (alignment->wav_data2[j] == alignment->wav_data1[alignment->start1]) {
+                alignment->matches[alignment->start1] = j;
+                break;
+            }
+        return;
+    }
+    if ((unsigned long long) (size1 + 1) * (size2 + 1) <= BASE_CELLS) {
+        if (alignTable(alignment) != SUCCESS)
+            *alignment->status = FAILURE;
+        return;
+    }
+
+    u_int middle = alignment->start1 + size1 / 2;
+    u_int *forward = malloc(((size_t) size2 + 1) * sizeof(u_int));
+    u_int *backward = malloc(((size_t) size2 + 1) * sizeof(u_int));
+    u_int *scratch = malloc(((size_t) size2 + 1) * sizeof(u_int));
+    if (forward == NULL || backward == NULL || scratch == NULL) {
+        *alignment->status = FAILURE;
+        freePointer(forward);
+        freePointer(backward);
+        freePointer(scratch);
+        return;
+    }
+
+    // forward[k]: lcss of the first half and the first k bytes, backward[k]:
+    // lcss of the second half and the last k bytes
+    lastRow(alignment->wav_data1 + alignment->start1, middle - alignment->start1,
+            alignment->wav_data2 + alignment->start2, size2, 1, forward, scratch);
+    lastRow(alignment->wav_data1 + alignment->end1 - 1, alignment->end1 - middle,
+            alignment->wav_data2 + alignment->end2 - 1, size2, -1, backward, scratch);
+
+    u_int split = 0, best = 0;
+    for (u_int k = 0; k <= size2; k++)
+        if (forward[k] + backward[size2 - k] > best || k == 0) {
+            best = forward[k] + backward[size2 - k];
+            split = k;
+        }
+    freePointer(forward);
+    freePointer(backward);
+    freePointer(scratch);
+
+    Alignment halves[2] = {*alignment, *alignment};
+    halves[0].end1 = middle;
+    halves[0].end2 = alignment->start2 + split;
+    halves[1].start1 = middle;
+    halves[1].start2 = alignment->start2 + split;
+
+    // The halves write disjoint matches, so they can run at once
+    if ((unsigned long long) size1 * size2 >= PARALLEL_CELLS)
+        parallelFor(2, alignHalf, halves);
+    else {
+        alignRange(&halves[0]);
+        alignRange(&halves[1]);
+    }
+}
+
+/**
+ * Aligns one of the two halves of a split subproblem.
+ *
+ * @param context, the two Alignments
+ * @param half
+ */
+private void alignHalf(void *context, int half) {
+    alignRange((Alignment *) context + half);
+}
+
+/**
+ * Aligns a small subproblem with the full DP table and a walk back from
+ * its last cell.
+ *
+ * @param alignment
+ * @return EXIT_CODE
+ */
+private int alignTable(Alignment *alignment) {
+    u_int size1 = alignment->end1 - alignment->start1;
+    u_int size2 = alignment->end2 - alignment->start2;
+    const u_char *data1 = alignment->wav_data1 + alignment->start1;
+    const u_char *data2 = alignment->wav_data2 + alignment->start2;
+    u_int *table = calloc(((size_t) size1 + 1) * (size2 + 1), sizeof(u_int));
+    if (table == NULL)
+        return FAILURE;
+
+#define CELL(i, j) table[(size_t) (i) * (size2 + 1) + (j)]
+    for (u_int i = 1; i <= size1; i++)
+        for (u_int j = 1; j <= size2; j++)
+            CELL(i, j) = data1[i - 1] == data2[j - 1] ? CELL(i - 1, j - 1) + 1 : max(CELL(i - 1, j), CELL(i, j - 1));
+
+    for (u_int i = size1, j = size2; i > 0 && j > 0;) {
+        if (data1[i - 1] == data2[j - 1]) {
+            alignment->matches[alignment->start1 + i - 1] = alignment->start2 + j - 1;
+            i--;
+            j--;
+        } else if (CELL(i - 1, j) >= CELL(i, j - 1))
+            i--;
+        else
+            j--;
+    }
+#undef CELL
+
+    freePointer(table);
+    return SUCCESS;
+}
+
+/**
+ * The two row lcss DP of LCSS(), keeping its last row: row[k] is the lcss
+ * of all of wav_data1 and the first k bytes of wav_data2. With a step of
+ * -1 both buffers are read backwards from the given bytes.
+ *
+ * @param wav_data1
+ * @param size1
+ * @param wav_data2
+ * @param size2
+ * @param step, 1 or -1
+ * @param row, size2 + 1 entries
+ * @param scratch, size2 + 1 entries
+ */
+private void lastRow(const u_char *wav_data1, u_int size1, const u_char *wav_data2, u_int size2, int step,
+                     u_int *row, u_int *scratch) {
+    u_int *row1 = row, *row2 = scratch;
+    memset(row1, 0, ((size_t) size2 + 1) * sizeof(u_int));
+    row2[0] = 0;
+
+    for (u_int i = 1; i < size1 + 1; i++) {
+        u_char value = wav_data1[step * (long) (i - 1)];
+        for (u_int j = 1; j < size2 + 1; j++) {
+            if (value == wav_data2[step * (long) (j - 1)])
+                row2[j] = 1 + row1[j - 1];
+            else
+                row2[j] = max(row1[j], row2[j - 1]);
+        }
+        u_int *temp = row1;
+        row1 = row2;
+        row2 = temp;
+    }
+    if (row1 != row)
+        memcpy(row, row1, ((size_t) size2 + 1) * sizeof(u_int));
+}
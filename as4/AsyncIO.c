@@ -0,0 +1,485 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    AsyncIO.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <errno.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#ifdef WAVENGINE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/**
+  * @author Aristos Georgiou
+  */
+
+/**
+ * Requests of one runIO() call, shared by the thread pool fallback.
+ */
+typedef struct IOBatch {
+    IORequest *requests;
+} IOBatch;
+
+private IOQueue shared_queue;
+private pthread_once_t shared_queue_once = PTHREAD_ONCE_INIT;
+
+private void openSharedIOQueue();
+
+private int transferQueued(IOQueue *queue, int fd, int write, void *buffer, size_t size, off_t offset);
+
+private void transferTask(void *context, int request_id);
+
+private void transferSynchronously(IORequest *request);
+
+private void closeRing(IOQueue *queue);
+
+#ifdef WAVENGINE_IO_URING
+private int openRing(IOQueue *queue, u_int depth);
+
+private int runRing(IOQueue *queue, IORequest *requests, int number_of_requests);
+
+private void reapCompletions(IOQueue *queue);
+
+private void prepareEntry(IOQueue *queue, IORequest *request);
+#endif
+
+
+/**
+ * Opens an I/O queue that keeps up to @param depth requests in flight.
+ * It uses io_uring when built with WAVENGINE_IO_URING and the kernel
+ * allows it, unless WAVENGINE_IO=threads, otherwise a pool of threads
+ * issuing pread()/pwrite().
+ *
+ * @param queue
+ * @param depth
+ * @return EXIT_CODE, SUCCESS whichever backend was chosen
+ */
+public int openIOQueue(IOQueue *queue, u_int depth) {
+    memset(queue, 0, sizeof(IOQueue));
+    queue->ring_fd = -1;
+    queue->depth = max(depth, 1);
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->completed, NULL);
+
+#ifdef WAVENGINE_IO_URING
+    char *backend = getenv("WAVENGINE_IO");
+    if (backend == NULL || strcmp(backend, "threads") != 0)
+        openRing(queue, queue->depth);
+#endif
+    return SUCCESS;
+}
+
+/**
+ * Releases a queue and its io_uring rings, if any. No thread may be
+ * running requests through it.
+ *
+ * @param queue
+ */
+public void closeIOQueue(IOQueue *queue) {
+    closeRing(queue);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->completed);
+}
+
+/**
+ * The I/O queue of the process, opened with IO_DEPTH on first use and kept
+ * open until the process exits, so the reads and writes of every file and
+ * thread share one ring instead of setting up their own.
+ *
+ * @return the shared queue
+ */
+public IOQueue *getSharedIOQueue() {
+    pthread_once(&shared_queue_once, openSharedIOQueue);
+    return &shared_queue;
+}
+
+/**
+ * @param queue
+ * @return name of the backend serving the queue
+ */
+public const char *getIOBackend(IOQueue *queue) {
+    return queue->ring_fd >= 0 && !queue->broken ? "io_uring" : "threads";
+}
+
+/**
+ * Registers buffers with the kernel so requests naming them by
+ * buffer_index skip the per request page pinning. Only io_uring uses them,
+ * the thread pool ignores the registration.
+ *
+ * @param queue
+ * @param buffers
+ * @param sizes
+ * @param number_of_buffers
+ * @return EXIT_CODE
+ */
+public int registerIOBuffers(IOQueue *queue, void **buffers, size_t *sizes, int number_of_buffers) {
+#ifdef WAVENGINE_IO_URING
+    if (queue->ring_fd >= 0) {
+        struct iovec vectors[number_of_buffers];
+        for (int i = 0; i < number_of_buffers; i++) {
+            vectors[i].iov_base = buffers[i];
+            vectors[i].iov_len = sizes[i];
+        }
+        if (syscall(__NR_io_uring_register, queue->ring_fd, IORING_REGISTER_BUFFERS,
+                    vectors, number_of_buffers) != 0)
+            return FAILURE;
+        queue->registered = 1;
+    }
+#endif
+    return SUCCESS;
+}
+
+/**
+ * Runs every request, keeping up to queue->depth of them in flight, and
+ * returns once all completed. Each request receives in its result the
+ * number of bytes transferred, which is smaller than its size only at the
+ * end of a file, or -errno.
+ *
+ * @param queue
+ * @param requests
+ * @param number_of_requests
+ * @return EXIT_CODE, FAILURE if any request failed
+ */
+public int runIO(IOQueue *queue, IORequest *requests, int number_of_requests) {
+    for (int i = 0; i < number_of_requests; i++)
+        requests[i].result = 0;
+
+    // If the ring broke down, the threads finish what is left without it
+#ifdef WAVENGINE_IO_URING
+    if (queue->ring_fd < 0 || runRing(queue, requests, number_of_requests) != SUCCESS)
+#endif
+    {
+        IOBatch batch = {requests};
+        parallelForThreads((int) queue->depth, number_of_requests, transferTask, &batch);
+    }
+
+    for (int i = 0; i < number_of_requests; i++)
+        if (requests[i].result < 0)
+            return FAILURE;
+    return SUCCESS;
+}
+
+/**
+ * Reads exactly @param size bytes at @param offset of a regular file as
+ * IO_CHUNK sized requests of @param queue, so threads reading at the same
+ * time keep requests of all their files in flight together.
+ *
+ * @param queue, usually getSharedIOQueue()
+ * @param fd
+ * @param buffer
+ * @param size
+ * @param offset
+ * @return EXIT_CODE, FAILURE if a read failed or the file ended first
+ */
+public int readQueued(IOQueue *queue, int fd, void *buffer, size_t size, off_t offset) {
+    return transferQueued(queue, fd, 0, buffer, size, offset);
+}
+
+/**
+ * Writes @param size bytes at @param offset of a regular file as IO_CHUNK
+ * sized requests of @param queue.
+ *
+ * @param queue, usually getSharedIOQueue()
+ * @param fd
+ * @param buffer
+ * @param size
+ * @param offset
+ * @return EXIT_CODE, FAILURE if a write failed
+ */
+public int writeQueued(IOQueue *queue, int fd, const void *buffer, size_t size, off_t offset) {
+    return transferQueued(queue, fd, 1, (void *) buffer, size, offset);
+}
+
+/**
+ * Opens the queue of getSharedIOQueue().
+ */
+private void openSharedIOQueue() {
+    openIOQueue(&shared_queue, IO_DEPTH);
+}
+
+/**
+ * Transfers exactly @param size bytes as IO_CHUNK sized requests.
+ *
+ * @param queue
+ * @param fd
+ * @param write
+ * @param buffer
+ * @param size
+ * @param offset
+ * @return EXIT_CODE
+ */
+private int transferQueued(IOQueue *queue, int fd, int write, void *buffer, size_t size, off_t offset) {
+    int EXIT_CODE = SUCCESS;
+    int number_of_requests = (int) ((size + IO_CHUNK - 1) / IO_CHUNK);
+    IORequest *requests = malloc(max(number_of_requests, 1) * sizeof(IORequest));
+    if (requests == NULL)
+        return FAILURE;
+
+    for (int i = 0; i < number_of_requests; i++) {
+        size_t start = (size_t) i * IO_CHUNK;
+        requests[i].fd = fd;
+        requests[i].write = write;
+        requests[i].buffer = (u_char *) buffer + start;
+        requests[i].size = min((size_t) IO_CHUNK, size - start);
+        requests[i].offset = offset + (off_t) start;
+        requests[i].buffer_index = -1;
+    }
+
+    EXIT_CODE = runIO(queue, requests, number_of_requests);
+    for (int i = 0; EXIT_CODE == SUCCESS && i < number_of_requests; i++)
+        if ((size_t) requests[i].result != requests[i].size)
+            EXIT_CODE = FAILURE;
+    free(requests);
+    return EXIT_CODE;
+}
+
+/**
+ * Thread pool task running one request.
+ *
+ * @param context, the IOBatch
+ * @param request_id
+ */
+private void transferTask(void *context, int request_id) {
+    transferSynchronously(&((IOBatch *) context)->requests[request_id]);
+}
+
+/**
+ * Completes the part of a request that is still left with pread()/pwrite().
+ *
+ * @param request
+ */
+private void transferSynchronously(IORequest *request) {
+    while (request->result >= 0 && (size_t) request->result < request->size) {
+        u_char *buffer = (u_char *) request->buffer + request->result;
+        size_t left = request->size - (size_t) request->result;
+        off_t offset = request->offset + request->result;
+
+        ssize_t bytes = request->write ? pwrite(request->fd, buffer, left, offset)
+                                       : pread(request->fd, buffer, left, offset);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0)
+            request->result = -errno;
+        else if (bytes == 0)
+            break;
+        else
+            request->result += bytes;
+    }
+}
+
+/**
+ * Unmaps the io_uring rings of a queue, if any, and closes the ring.
+ *
+ * @param queue
+ */
+private void closeRing(IOQueue *queue) {
+#ifdef WAVENGINE_IO_URING
+    if (queue->ring_fd >= 0) {
+        if (queue->sq_ring != NULL)
+            munmap(queue->sq_ring, queue->sq_ring_size);
+        if (queue->cq_ring != NULL && queue->cq_ring != queue->sq_ring)
+            munmap(queue->cq_ring, queue->cq_ring_size);
+        if (queue->entries != NULL)
+            munmap(queue->entries, queue->entries_size);
+        close(queue->ring_fd);
+    }
+#endif
+    queue->ring_fd = -1;
+}
+
+#ifdef WAVENGINE_IO_URING
+/**
+ * Sets up an io_uring instance and maps its submission and completion rings.
+ *
+ * @param queue
+ * @param depth
+ * @return EXIT_CODE, FAILURE leaves the queue on the thread pool
+ */
+private int openRing(IOQueue *queue, u_int depth) {
+    struct io_uring_params parameters;
+    memset(&parameters, 0, sizeof(parameters));
+
+    int fd = (int) syscall(__NR_io_uring_setup, depth, &parameters);
+    if (fd < 0)
+        return FAILURE;
+    queue->ring_fd = fd;
+
+    queue->sq_ring_size = parameters.sq_off.array + parameters.sq_entries * sizeof(u_int);
+    queue->cq_ring_size = parameters.cq_off.cqes + parameters.cq_entries * sizeof(struct io_uring_cqe);
+    if (parameters.features & IORING_FEAT_SINGLE_MMAP)
+        queue->sq_ring_size = queue->cq_ring_size = max(queue->sq_ring_size, queue->cq_ring_size);
+
+    queue->sq_ring = mmap(NULL, queue->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd, IORING_OFF_SQ_RING);
+    if (queue->sq_ring == MAP_FAILED) {
+        queue->sq_ring = NULL;
+        closeRing(queue);
+        return FAILURE;
+    }
+
+    if (parameters.features & IORING_FEAT_SINGLE_MMAP) {
+        queue->cq_ring = queue->sq_ring;
+    } else {
+        queue->cq_ring = mmap(NULL, queue->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              fd, IORING_OFF_CQ_RING);
+        if (queue->cq_ring == MAP_FAILED) {
+            queue->cq_ring = NULL;
+            closeRing(queue);
+            return FAILURE;
+        }
+    }
+
+    queue->entries_size = parameters.sq_entries * sizeof(struct io_uring_sqe);
+    queue->entries = mmap(NULL, queue->entries_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd, IORING_OFF_SQES);
+    if (queue->entries == MAP_FAILED) {
+        queue->entries = NULL;
+        closeRing(queue);
+        return FAILURE;
+    }
+
+    u_char *sq = queue->sq_ring, *cq = queue->cq_ring;
+    queue->sq_head = (u_int *) (sq + parameters.sq_off.head);
+    queue->sq_tail = (u_int *) (sq + parameters.sq_off.tail);
+    queue->sq_mask = *(u_int *) (sq + parameters.sq_off.ring_mask);
+    queue->sq_array = (u_int *) (sq + parameters.sq_off.array);
+    queue->cq_head = (u_int *) (cq + parameters.cq_off.head);
+    queue->cq_tail = (u_int *) (cq + parameters.cq_off.tail);
+    queue->cq_mask = *(u_int *) (cq + parameters.cq_off.ring_mask);
+    queue->completions = cq + parameters.cq_off.cqes;
+    queue->depth = min(depth, parameters.sq_entries);
+    return SUCCESS;
+}
+
+/**
+ * Queues requests while the rings have room until every request completed.
+ * Other threads may run their own requests at the same time: whichever
+ * thread finds no one waiting submits the entries of all of them and waits
+ * in io_uring_enter(), the rest wait for it to reap a completion. Entries
+ * the kernel did not take, because io_uring_enter() was interrupted or
+ * submitted only part of them, stay in the ring for the next call.
+ *
+ * @param queue
+ * @param requests
+ * @param number_of_requests
+ * @return EXIT_CODE, FAILURE if io_uring_enter() failed, now or before
+ */
+private int runRing(IOQueue *queue, IORequest *requests, int number_of_requests) {
+    int next = 0, left = number_of_requests;
+    for (int i = 0; i < number_of_requests; i++)
+        requests[i].left = &left;
+
+    pthread_mutex_lock(&queue->lock);
+    while (left > 0 && !queue->broken) {
+        while (next < number_of_requests && queue->in_flight < queue->depth)
+            prepareEntry(queue, &requests[next++]);
+
+        if (queue->waiting) {
+            pthread_cond_wait(&queue->completed, &queue->lock);
+        } else {
+            // Wait for a completion only if the kernel holds a request to complete
+            u_int submitting = queue->unsubmitted, wait = queue->in_flight > submitting ? 1 : 0;
+            queue->waiting = 1;
+            pthread_mutex_unlock(&queue->lock);
+            long entered = syscall(__NR_io_uring_enter, queue->ring_fd, submitting, wait,
+                                   IORING_ENTER_GETEVENTS, NULL, 0);
+            int error = entered < 0 ? errno : 0;
+            pthread_mutex_lock(&queue->lock);
+            queue->waiting = 0;
+
+            if (error != 0 && error != EINTR && error != EAGAIN && error != EBUSY)
+                queue->broken = 1;
+            if (entered > 0)
+                queue->unsubmitted -= min((u_int) entered, queue->unsubmitted);
+            reapCompletions(queue);
+            pthread_cond_broadcast(&queue->completed);
+        }
+    }
+    int EXIT_CODE = left > 0 ? FAILURE : SUCCESS;
+    pthread_mutex_unlock(&queue->lock);
+    return EXIT_CODE;
+}
+
+/**
+ * Hands every completion in the ring to its request and queues again the
+ * bytes left of short transfers. Called with queue->lock held.
+ *
+ * @param queue
+ */
+private void reapCompletions(IOQueue *queue) {
+    u_int head = *queue->cq_head;
+    while (head != __atomic_load_n(queue->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *completion = (struct io_uring_cqe *) queue->completions + (head & queue->cq_mask);
+        IORequest *request = (IORequest *) (uintptr_t) completion->user_data;
+        int result = completion->res;
+        head++;
+        queue->in_flight--;
+
+        if (result == -EINVAL || result == -EOPNOTSUPP) {
+            // Kernels without IORING_OP_READ/WRITE
+            transferSynchronously(request);
+            (*request->left)--;
+        } else if (result < 0 && result != -EINTR && result != -EAGAIN) {
+            request->result = result;
+            (*request->left)--;
+        } else if (result == 0 && request->size > 0) {
+            (*request->left)--;
+        } else {
+            if (result > 0)
+                request->result += result;
+            if ((size_t) request->result < request->size)
+                prepareEntry(queue, request);
+            else
+                (*request->left)--;
+        }
+    }
+    __atomic_store_n(queue->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * Fills the next submission queue entry with the part of a request left.
+ * Called with queue->lock held.
+ *
+ * @param queue
+ * @param request
+ */
+private void prepareEntry(IOQueue *queue, IORequest *request) {
+    u_int tail = *queue->sq_tail, index = tail & queue->sq_mask;
+    struct io_uring_sqe *entry = (struct io_uring_sqe *) queue->entries + index;
+    int fixed = queue->registered && request->buffer_index >= 0;
+
+    memset(entry, 0, sizeof(struct io_uring_sqe));
+    if (request->write)
+        entry->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    else
+        entry->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    entry->fd = request->fd;
+    entry->addr = (unsigned long) ((u_char *) request->buffer + request->result);
+    entry->len = (u_int) (request->size - (size_t) request->result);
+    entry->off = (unsigned long long) (request->offset + request->result);
+    entry->buf_index = fixed ? (unsigned short) request->buffer_index : 0;
+    entry->user_data = (unsigned long long) (uintptr_t) request;
+
+    queue->sq_array[index] = index;
+    __atomic_store_n(queue->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    queue->in_flight++;
+    queue->unsubmitted++;
+}
+#endif
@@ -0,0 +1,426 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    ChannelRouter.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define ROUTE_TILE 64               // Frames transposed at once, so a tile stays in L1.
+
+private int routeFile(char *wav_filename, char *spec);
+
+private void downmixFrames(ChannelRoute *route, const u_char *input, size_t frames, u_char *output);
+
+#ifdef __SSE2__
+private size_t gatherStereo16(const u_char *const *frames, const u_int *channels, u_int output_channels,
+                              size_t count, u_char *output);
+#endif
+
+
+/**
+ * Routes the channels of .wav files into route-a.wav files, or stdout for
+ * -, through a matrix given by @param spec: "mono" averages every channel,
+ * otherwise the outputs are separated by commas and each sums terms of an
+ * input channel, numbered from 0, optionally scaled as w*c. So "2,0,1"
+ * reorders, "0,1" drops all but the first two and "0.5*0+0.5*1" downmixes.
+ * Option ID: 29
+ *
+ * @param spec
+ * @param files
+ * @param number_of_files
+ * @return EXIT_CODE
+ */
+public int routeFiles(char *spec, char **files, int number_of_files) {
+    int EXIT_CODE = SUCCESS;
+    for (int i = 0; i < number_of_files; i++)
+        if (routeFile(files[i], spec) != SUCCESS)
+            EXIT_CODE = FAILURE;
+
+    return EXIT_CODE;
+}
+
+/**
+ * Parses the route of @param spec, see routeFiles(), for frames of
+ * @param input_channels.
+ *
+ * @param spec
+ * @param input_channels
+ * @param sample_size
+ * @param route
+ * @return EXIT_CODE
+ */
+public int parseRoute(const char *spec, u_int input_channels, u_int sample_size, ChannelRoute *route) {
+    memset(route, 0, sizeof(ChannelRoute));
+    route->input_channels = input_channels;
+    route->sample_size = sample_size;
+    route->select = 1;
+    if (input_channels == 0 || input_channels > MAX_ROUTE_CHANNELS)
+        return FAILURE;
+
+    if (strcmp(spec, "mono") == 0) {
+        route->output_channels = 1;
+        route->select = input_channels == 1;
+        for (u_int c = 0; c < input_channels; c++)
+            route->weights[0][c] = 1.0 / input_channels;
+        return SUCCESS;
+    }
+
+    // output (',' output)*, output: term ('+' term)*, term: [weight '*'] channel
+    const char *p = spec;
+    for (;;) {
+        u_int output = route->output_channels;
+        u_int terms = 0;
+        if (output == MAX_ROUTE_CHANNELS)
+            return FAILURE;
+        for (;;) {
+            char *end;
+            double weight = 1;
+            double value = strtod(p, &end);
+            if (end == p)
+                return FAILURE;
+            if (*end == '*') {
+                weight = value;
+                p = end + 1;
+                value = strtod(p, &end);
+                if (end == p)
+                    return FAILURE;
+            }
+            if (value < 0 || value >= input_channels || value != (u_int) value)
+                return FAILURE;
+
+            route->weights[output][(u_int) value] += weight;
+            route->sources[output] = (u_int) value;
+            if (weight != 1)
+                route->select = 0;
+            terms++;
+            p = end;
+            if (*p != '+')
+                break;
+            p++;
+        }
+        if (terms > 1)
+            route->select = 0;
+        route->output_channels++;
+        if (*p == '\0')
+            return SUCCESS;
+        if (*p++ != ',')
+            return FAILURE;
+    }
+}
+
+/**
+ * Makes the route of frames of @param input_channels that keeps the
+ * input channels listed in @param sources, in that order.
+ *
+ * @param route
+ * @param input_channels
+ * @param sample_size
+ * @param sources
+ * @param output_channels
+ */
+public void selectChannels(ChannelRoute *route, u_int input_channels, u_int sample_size,
+                           const u_int *sources, u_int output_channels) {
+    memset(route, 0, sizeof(ChannelRoute));
+    route->input_channels = input_channels;
+    route->output_channels = min(output_channels, MAX_ROUTE_CHANNELS);
+    route->sample_size = sample_size;
+    route->select = 1;
+    for (u_int c = 0; c < route->output_channels; c++) {
+        route->sources[c] = sources[c];
+        route->weights[c][sources[c]] = 1;
+    }
+}
+
+/**
+ * Pipeline stage applying a ChannelRoute to a block of frames. Selections
+ * copy samples through gatherChannels(), bit exact, every other route
+ * goes through downmixFrames().
+ *
+ * @param context, the ChannelRoute
+ * @param input
+ * @param size
+ * @param output
+ * @return bytes in output
+ */
+public size_t routeFrames(void *context, u_char *input, size_t size, u_char *output) {
+    ChannelRoute *route = context;
+    size_t frame_size = (size_t) route->input_channels * route->sample_size;
+    size_t frames = size / frame_size;
+
+    if (route->select) {
+        const u_char *sources[MAX_ROUTE_CHANNELS];
+        size_t frame_sizes[MAX_ROUTE_CHANNELS];
+        for (u_int c = 0; c < route->output_channels; c++) {
+            sources[c] = input;
+            frame_sizes[c] = frame_size;
+        }
+        gatherChannels(sources, frame_sizes, route->sources, route->output_channels, route->sample_size,
+                       frames, output);
+    } else
+        downmixFrames(route, input, frames, output);
+    return frames * route->output_channels * route->sample_size;
+}
+
+/**
+ * Interleaves @param output_channels channels, channel c of every output
+ * frame being sample channels[c] of the same frame of frames[c], whose
+ * frames are frame_sizes[c] bytes. One kernel covers deinterleaving (one
+ * output channel), interleaving (planes as frames of one sample), channel
+ * selection and mixing channels of several files. Frames go in tiles of
+ * ROUTE_TILE, transposed one output channel at a time, so every tile is
+ * read from cache; 16 bit stereo inputs go through SSE2 shuffles.
+ *
+ * @param frames
+ * @param frame_sizes
+ * @param channels
+ * @param output_channels
+ * @param sample_size
+ * @param count, frames
+ * @param output
+ */
+public void gatherChannels(const u_char *const *frames, const size_t *frame_sizes, const u_int *channels,
+                           u_int output_channels, u_int sample_size, size_t count, u_char *output) {
+    size_t output_frame = (size_t) output_channels * sample_size;
+    size_t done = 0;
+
+#ifdef __SSE2__
+    int stereo16 = sample_size == 2 && output_channels <= 2;
+    for (u_int c = 0; c < output_channels; c++)
+        stereo16 = stereo16 && frame_sizes[c] == 4 && channels[c] < 2;
+    if (stereo16)
+        done = gatherStereo16(frames, channels, output_channels, count, output);
+#endif
+
+    for (size_t tile = done; tile < count; tile += ROUTE_TILE) {
+        size_t end = min(tile + ROUTE_TILE, count);
+        for (u_int c = 0; c < output_channels; c++) {
+            const u_char *in = frames[c] + tile * frame_sizes[c] + (size_t) channels[c] * sample_size;
+            u_char *out = output + tile * output_frame + (size_t) c * sample_size;
+            size_t stride = frame_sizes[c];
+            switch (sample_size) {
+                case 1:
+                    for (register size_t f = tile; f < end; f++, in += stride, out += output_frame)
+                        out[0] = in[0];
+                    break;
+                case 2:
+                    for (register size_t f = tile; f < end; f++, in += stride, out += output_frame)
+                        memcpy(out, in, 2);
+                    break;
+                case 3:
+                    for (register size_t f = tile; f < end; f++, in += stride, out += output_frame)
+                        memcpy(out, in, 3);
+                    break;
+                case 4:
+                    for (register size_t f = tile; f < end; f++, in += stride, out += output_frame)
+                        memcpy(out, in, 4);
+                    break;
+                default:
+                    for (register size_t f = tile; f < end; f++, in += stride, out += output_frame)
+                        memcpy(out, in, sample_size);
+                    break;
+            }
+        }
+    }
+}
+
+/**
+ * Routes one .wav file into route-wav_filename.
+ *
+ * @param wav_filename
+ * @param spec
+ * @return EXIT_CODE
+ */
+private int routeFile(char *wav_filename, char *spec) {
+    int EXIT_CODE;
+    Arena *arena = acquireArena();
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+    Output output = {NULL, -1, 0, -1};
+    char *new_wav_filename = NULL;
+    ChannelRoute *route = NULL;
+    int stream = isStream(wav_filename);
+
+    if (arena == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return FAILURE;
+    }
+
+    EXIT_CODE = getHeader(arena, &wav_header, &wav_file, wav_filename);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+    int unknown_size = stream && wav_header->subchunk2Size == STREAM_SIZE;
+
+    route = arenaAlloc(arena, sizeof(ChannelRoute));
+    if (route == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+    u_int input_channels = max(wav_header->numChannels, 1);
+    if (wav_header->blockAlign == 0 || wav_header->blockAlign % input_channels != 0) {
+        EXIT_CODE = FAILURE;
+        printf("Invalid wav header.\n\n");
+        goto END;
+    }
+    if (parseRoute(spec, input_channels, wav_header->blockAlign / input_channels, route) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        printf("Invalid channel route: %s\n\n", spec);
+        goto END;
+    }
+
+    // Create new file name, a stream goes to stdout instead
+    if (!stream) {
+        new_wav_filename = arenaAlloc(arena, 7 + strlen(wav_filename));
+        if (new_wav_filename == NULL) {
+            EXIT_CODE = FAILURE;
+            printf("Sorry, program run out of memory.\n\n");
+            goto END;
+        }
+        snprintf(new_wav_filename, 7 + strlen(wav_filename), "route-%s", wav_filename);
+    }
+
+    {
+        Header routed_header = *wav_header;
+        setChannelCount(&routed_header, route->output_channels);
+        EXIT_CODE = openOutput(&output, stream, new_wav_filename, &routed_header);
+        if (EXIT_CODE != SUCCESS)
+            goto END;
+
+        size_t frame_size = wav_header->blockAlign;
+        FileRange range = {fileno(wav_file), HEADER_SIZE,
+                           unknown_size ? -1 : HEADER_SIZE + (off_t) (wav_header->subchunk2Size / frame_size * frame_size),
+                           0, stream, HEADER_SIZE};
+        size_t block = getBlockSize(wav_header->blockAlign);
+        Pipeline pipeline = {readFileRange, &range, routeFrames, route, block,
+                             block / frame_size * routed_header.blockAlign, output.fd, output.data_offset};
+
+        if (runParallelPipeline(&pipeline, unknown_size ? -1 : range.end - range.start) != SUCCESS
+         || finishOutput(&output, &routed_header, pipeline.written) != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            printf("Header information mismatch, exiting program.\n\n");
+            goto END;
+        }
+    }
+
+    END:
+    releaseArena(arena);
+    closeFile(wav_file);
+    closeOutput(&output);
+    return EXIT_CODE;
+}
+
+/**
+ * Applies the weights of a route to frames, a tile at a time: the tile is
+ * transposed into one row of doubles per input channel, so every output
+ * channel is a sum of scaled rows the compiler vectorizes, then saturated
+ * and interleaved back.
+ *
+ * @param route
+ * @param input
+ * @param frames
+ * @param output
+ */
+private void downmixFrames(ChannelRoute *route, const u_char *input, size_t frames, u_char *output) {
+    u_int inputs = route->input_channels, outputs = route->output_channels, sample_size = route->sample_size;
+    double rows[MAX_ROUTE_CHANNELS][ROUTE_TILE];
+    double mixed[ROUTE_TILE];
+    int packed[MAX_ROUTE_CHANNELS * ROUTE_TILE];   // A tile of 24 bit samples, by load24() and store24()
+    double largest = ldexp(1, 8 * (int) sample_size - 1) - 1;
+
+    for (size_t tile = 0; tile < frames; tile += ROUTE_TILE) {
+        size_t count = min((size_t) ROUTE_TILE, frames - tile);
+        const u_char *in = input + tile * inputs * sample_size;
+        if (sample_size == 3) {
+            load24(in, packed, count * inputs);
+            for (u_int c = 0; c < inputs; c++)
+                for (size_t f = 0; f < count; f++)
+                    rows[c][f] = packed[f * inputs + c];
+        } else
+            for (u_int c = 0; c < inputs; c++)
+                for (size_t f = 0; f < count; f++)
+                    rows[c][f] = (double) readSample(in + (f * inputs + c) * sample_size, sample_size);
+
+        u_char *out = output + tile * outputs * sample_size;
+        for (u_int o = 0; o < outputs; o++) {
+            memset(mixed, 0, sizeof(mixed));
+            for (u_int c = 0; c < inputs; c++) {
+                double weight = route->weights[o][c];
+                if (weight == 0)
+                    continue;
+                for (size_t f = 0; f < count; f++)
+                    mixed[f] += weight * rows[c][f];
+            }
+            for (size_t f = 0; f < count; f++) {
+                double value = min(max(mixed[f], -largest - 1), largest);
+                if (sample_size == 3)
+                    packed[f * outputs + o] = (int) lrint(value);
+                else
+                    writeSample(out + (f * outputs + o) * sample_size, sample_size, lrint(value));
+            }
+        }
+        if (sample_size == 3)
+            store24(packed, out, count * outputs);
+    }
+}
+
+#ifdef __SSE2__
+/**
+ * gatherChannels() of 16 bit stereo frames into one or two channels, 8
+ * frames per step. A frame is one 32 bit lane: shifts move the wanted
+ * sample into either half of the lane, a pack or an or joins the halves.
+ *
+ * @param frames
+ * @param channels
+ * @param output_channels
+ * @param count
+ * @param output
+ * @return frames done, the rest is left to the scalar loop
+ */
+private size_t gatherStereo16(const u_char *const *frames, const u_int *channels, u_int output_channels,
+                              size_t count, u_char *output) {
+    size_t f = 0;
+    if (output_channels == 1) {
+        // Sign extending the wanted half of every lane keeps it exact through the saturating pack
+        for (; f + 8 <= count; f += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (frames[0] + 4 * f));
+            __m128i b = _mm_loadu_si128((const __m128i *) (frames[0] + 4 * f + 16));
+            if (channels[0] == 0) {
+                a = _mm_slli_epi32(a, 16);
+                b = _mm_slli_epi32(b, 16);
+            }
+            _mm_storeu_si128((__m128i *) (output + 2 * f), _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+        }
+        return f;
+    }
+
+    __m128i low = _mm_set1_epi32(0xFFFF);
+    for (; f + 4 <= count; f += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (frames[0] + 4 * f));
+        __m128i b = _mm_loadu_si128((const __m128i *) (frames[1] + 4 * f));
+        a = channels[0] == 0 ? _mm_and_si128(a, low) : _mm_srli_epi32(a, 16);
+        b = channels[1] == 1 ? _mm_andnot_si128(low, b) : _mm_slli_epi32(b, 16);
+        _mm_storeu_si128((__m128i *) (output + 4 * f), _mm_or_si128(a, b));
+    }
+    return f;
+}
+#endif
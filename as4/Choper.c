@@ -35,11 +35,13 @@
 public int chop(char *wav_filename, int start_sec, int end_second) {
     int EXIT_CODE;
     Header *wav_header = NULL;
-    FILE *wav_file = NULL, *new_wav_file = NULL;
+    FILE *wav_file = NULL;
+    Output output = {NULL, -1, 0, -1};
     char *new_wav_filename = NULL;
+    int stream = isStream(wav_filename);
 
     // Initialise wav_header from wav_file
-    EXIT_CODE = getHeader(&wav_header, &wav_file, wav_filename);
+    EXIT_CODE = getHeader(NULL, &wav_header, &wav_file, wav_filename);
     if (EXIT_CODE != SUCCESS)
         goto END;
 
@@ -53,43 +55,38 @@ public int chop(char *wav_filename, int start_sec, int end_second) {
         goto END;
     }
 
-    // Create new file name
-    new_wav_filename = malloc(9 + strlen(wav_filename));
-    if (new_wav_filename == NULL) {
-        EXIT_CODE = FAILURE;
-        printf("Sorry, program run out of memory.\n\n");
-        goto END;
+    // Create new file name, a stream goes to stdout instead
+    if (!stream) {
+        new_wav_filename = malloc(9 + strlen(wav_filename));
+        if (new_wav_filename == NULL) {
+            EXIT_CODE = FAILURE;
+            printf("Sorry, program run out of memory.\n\n");
+            goto END;
+        }
+        snprintf(new_wav_filename, 9 + strlen(wav_filename), "chopped-%s", wav_filename);
     }
-    snprintf(new_wav_filename, 9 + strlen(wav_filename), "chopped-%s", wav_filename);
 
     {
-        // Create the buffer of LR samples
-        size_t sample_size = (size_t) wav_header->blockAlign;
-        u_char sample[sample_size];
-
-        // Skip i seconds of samples
-        for (register u_int q = 0; q < secondsToSamples(wav_header, start_sec) / sample_size; q++) {
-            if (fread(&sample, sample_size, 1, wav_file) != 1) {
-                EXIT_CODE = FAILURE;
-                printf("Header information mismatch, exiting program.\n\n");
-                goto END;
-            }
-        }
+        // Data of the chopped range starts after start_sec seconds of samples
+        off_t start = HEADER_SIZE + (off_t) secondsToSamples(wav_header, start_sec);
+
         // Modify header to match a duration of j - i seconds
         changeHeaderDuration(wav_header, end_second - start_sec);
 
-        // Open new_wav_file and write the modified header to it
-        new_wav_file = fopen(new_wav_filename, "wb");
-        fwrite(wav_header, HEADER_SIZE, 1, new_wav_file);
-
-        // Write rest of the bytes
-        for (register u_int q = 0; q < wav_header->subchunk2Size / sample_size; q++) {
-            if (fread(&sample, sample_size, 1, wav_file) != 1) {
-                EXIT_CODE = FAILURE;
-                printf("Header information mismatch, exiting program.\n\n");
-                goto END;
-            }
-            fwrite(&sample, sample_size, 1, new_wav_file);
+        // Open the output and write the modified header to it
+        EXIT_CODE = openOutput(&output, stream, new_wav_filename, wav_header);
+        if (EXIT_CODE != SUCCESS)
+            goto END;
+
+        // Copy the range, reading ahead while earlier blocks are written
+        FileRange range = {fileno(wav_file), start, start + (off_t) wav_header->subchunk2Size, 0, stream, HEADER_SIZE};
+        size_t block = getBlockSize(wav_header->blockAlign);
+        Pipeline pipeline = {readFileRange, &range, NULL, NULL, block, block, output.fd, output.data_offset};
+
+        if (runPipeline(&pipeline) != SUCCESS || finishOutput(&output, wav_header, pipeline.written) != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            printf("Header information mismatch, exiting program.\n\n");
+            goto END;
         }
     }
 
@@ -97,7 +94,6 @@ public int chop(char *wav_filename, int start_sec, int end_second) {
     freePointer(wav_header);
     freePointer(new_wav_filename);
     closeFile(wav_file);
-    closeFile(new_wav_file);
+    closeOutput(&output);
     return EXIT_CODE;
 }
-
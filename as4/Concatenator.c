@@ -0,0 +1,355 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    Concatenator.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+/**
+ * Files of a -concat run. File i starts at output frame starts[i] and
+ * overlaps the next one by fade frames.
+ */
+typedef struct Concatenation {
+    char **files;
+    int number_of_files;
+    Header *headers;
+    u_int *frames;
+    dev_t *devices;
+    ino_t *inodes;
+    unsigned long long *starts;
+    u_int fade;                     // Frames of every crossfade.
+    float *ramp;                    // Weight of the incoming file for every sample of a crossfade.
+    int output_fd;
+    int *status;
+} Concatenation;
+
+private void readConcatHeader(void *context, int file_id);
+
+private void writeConcatFile(void *context, int file_id);
+
+private void crossfade(Concatenation *concatenation, const u_char *outgoing, const u_char *incoming,
+                       u_char *output);
+
+private void crossfade16(const short *outgoing, const short *incoming, short *output, const float *ramp,
+                         size_t samples);
+
+private void crossfade24(const u_char *outgoing, const u_char *incoming, u_char *output, const float *ramp,
+                         size_t samples);
+
+
+/**
+ * Joins .wav files gaplessly into @param output_filename, optionally with
+ * a linear crossfade of @param seconds between each and the next. The
+ * headers are checked and merged first, then every file is copied into
+ * its place on its own thread, in the kernel with copy_file_range()
+ * where the file systems allow it, so only the samples of the crossfades
+ * are computed.
+ * Option ID: 28
+ *
+ * @param output_filename
+ * @param files
+ * @param number_of_files
+ * @param seconds, of every crossfade, 0 for none
+ * @return EXIT_CODE
+ */
+public int concatenateFiles(char *output_filename, char **files, int number_of_files, double seconds) {
+    int EXIT_CODE = SUCCESS;
+    Concatenation concatenation;
+    struct stat output_stat;
+
+    memset(&concatenation, 0, sizeof(Concatenation));
+    concatenation.files = files;
+    concatenation.number_of_files = number_of_files;
+    concatenation.output_fd = -1;
+    concatenation.headers = calloc((size_t) number_of_files, sizeof(Header));
+    concatenation.frames = calloc((size_t) number_of_files, sizeof(u_int));
+    concatenation.devices = calloc((size_t) number_of_files, sizeof(dev_t));
+    concatenation.inodes = calloc((size_t) number_of_files, sizeof(ino_t));
+    concatenation.starts = calloc((size_t) number_of_files, sizeof(unsigned long long));
+    concatenation.status = calloc((size_t) number_of_files, sizeof(int));
+    if (concatenation.headers == NULL || concatenation.frames == NULL || concatenation.devices == NULL
+     || concatenation.inodes == NULL || concatenation.starts == NULL || concatenation.status == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    parallelFor(number_of_files, readConcatHeader, &concatenation);
+    for (int i = 0; i < number_of_files; i++)
+        if (concatenation.status[i] != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            goto END;
+        }
+
+    // Every file must have the format of the first and be long enough for its crossfades
+    Header *first = &concatenation.headers[0];
+    concatenation.fade = (u_int) (max(seconds, 0) * first->sampleRate);
+    unsigned long long frames = 0;
+    for (int i = 0; i < number_of_files; i++) {
+        Header *wav_header = &concatenation.headers[i];
+        if (wav_header->numChannels != first->numChannels || wav_header->sampleRate != first->sampleRate
+         || wav_header->bitsPerSample != first->bitsPerSample || wav_header->blockAlign != first->blockAlign) {
+            EXIT_CODE = FAILURE;
+            printf("Incompatible files: %s, %s\n\n", files[0], files[i]);
+            goto END;
+        }
+        u_int needed = concatenation.fade * ((i > 0) + (i < number_of_files - 1));
+        if (concatenation.frames[i] < needed) {
+            EXIT_CODE = FAILURE;
+            printf("Parameters for seconds are invalid.\n\n");
+            goto END;
+        }
+        concatenation.starts[i] = frames;
+        frames += concatenation.frames[i] - (i < number_of_files - 1 ? concatenation.fade : 0);
+    }
+
+    Header wav_header = *first;
+    if (frames * wav_header.blockAlign > (unsigned long long) STREAM_SIZE - 36) {
+        EXIT_CODE = FAILURE;
+        printf("Header information mismatch, exiting program.\n\n");
+        goto END;
+    }
+    wav_header.subchunk2Size = (u_int) (frames * wav_header.blockAlign);
+    wav_header.chunkSize = wav_header.subchunk2Size + 36;
+
+    // Truncating one of the inputs would lose it before it is read
+    if (stat(output_filename, &output_stat) == 0)
+        for (int i = 0; i < number_of_files; i++)
+            if (output_stat.st_dev == concatenation.devices[i] && output_stat.st_ino == concatenation.inodes[i]) {
+                EXIT_CODE = FAILURE;
+                printf("Incompatible files: %s, %s\n\n", output_filename, files[i]);
+                goto END;
+            }
+
+    // Weights rise across the crossfade, the same for every channel of a frame
+    if (concatenation.fade > 0 && number_of_files > 1) {
+        size_t samples = (size_t) concatenation.fade * first->numChannels;
+        concatenation.ramp = malloc(samples * sizeof(float));
+        if (concatenation.ramp == NULL) {
+            EXIT_CODE = FAILURE;
+            printf("Sorry, program run out of memory.\n\n");
+            goto END;
+        }
+        for (size_t i = 0; i < samples; i++)
+            concatenation.ramp[i] = ((float) (i / first->numChannels) + 0.5f) / (float) concatenation.fade;
+    }
+
+    concatenation.output_fd = open(output_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (concatenation.output_fd < 0) {
+        EXIT_CODE = FAILURE;
+        printf("Error in opening file: %s\n\n", output_filename);
+        goto END;
+    }
+    if (pwriteFully(concatenation.output_fd, &wav_header, HEADER_SIZE, 0) != SUCCESS
+     || ftruncate(concatenation.output_fd, HEADER_SIZE + (off_t) wav_header.subchunk2Size) != 0) {
+        EXIT_CODE = FAILURE;
+        printf("Error in writing file: %s\n\n", output_filename);
+        goto END;
+    }
+
+    parallelFor(number_of_files, writeConcatFile, &concatenation);
+    for (int i = 0; i < number_of_files; i++)
+        if (concatenation.status[i] != SUCCESS)
+            EXIT_CODE = FAILURE;
+
+    END:
+    if (concatenation.output_fd >= 0)
+        close(concatenation.output_fd);
+    freePointer(concatenation.headers);
+    freePointer(concatenation.frames);
+    freePointer(concatenation.devices);
+    freePointer(concatenation.inodes);
+    freePointer(concatenation.starts);
+    freePointer(concatenation.ramp);
+    freePointer(concatenation.status);
+    return EXIT_CODE;
+}
+
+/**
+ * Reads and checks the header of one file of a Concatenation, counting
+ * only the frames the file really holds.
+ *
+ * @param context, the Concatenation
+ * @param file_id
+ */
+private void readConcatHeader(void *context, int file_id) {
+    Concatenation *concatenation = context;
+    char *wav_filename = concatenation->files[file_id];
+    Header *wav_header = &concatenation->headers[file_id];
+    struct stat wav_stat;
+
+    concatenation->status[file_id] = FAILURE;
+    if (isStream(wav_filename)) {
+        printf("Streams are not supported: %s\n\n", wav_filename);
+        return;
+    }
+
+    int fd = open(wav_filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &wav_stat) != 0)
+        printf("Error in opening file: %s\n\n", wav_filename);
+    else if (preadFully(fd, wav_header, HEADER_SIZE, 0) != SUCCESS)
+        printf("File not even 44 bytes: %s\n\n", wav_filename);
+    else if (wavCheck(wav_header) == FAILURE || wav_header->blockAlign == 0)
+        printf("Invalid wav header.\n\n");
+    else {
+        off_t size = min((off_t) wav_header->subchunk2Size, wav_stat.st_size - HEADER_SIZE);
+        concatenation->frames[file_id] = (u_int) (size / wav_header->blockAlign);
+        concatenation->devices[file_id] = wav_stat.st_dev;
+        concatenation->inodes[file_id] = wav_stat.st_ino;
+        concatenation->status[file_id] = SUCCESS;
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+/**
+ * Copies the frames of one file that no crossfade touches into place and
+ * computes the crossfade into the next file.
+ *
+ * @param context, the Concatenation
+ * @param file_id
+ */
+private void writeConcatFile(void *context, int file_id) {
+    Concatenation *concatenation = context;
+    int last = file_id == concatenation->number_of_files - 1;
+    size_t frame_size = concatenation->headers[0].blockAlign;
+    u_int fade = concatenation->fade;
+    u_int head = file_id > 0 ? fade : 0, tail = last ? 0 : fade;
+    u_char *outgoing = NULL, *incoming = NULL;
+    int fd = -1, next_fd = -1;
+
+    fd = open(concatenation->files[file_id], O_RDONLY);
+    if (fd < 0) {
+        printf("Error in opening file: %s\n\n", concatenation->files[file_id]);
+        goto END;
+    }
+    off_t output_offset = HEADER_SIZE + (off_t) ((concatenation->starts[file_id] + head) * frame_size);
+    if (copyRange(fd, HEADER_SIZE + (off_t) (head * frame_size), concatenation->output_fd, output_offset,
+                  (off_t) ((concatenation->frames[file_id] - head - tail) * frame_size)) != SUCCESS) {
+        printf("Error in writing file: %s\n\n", concatenation->files[file_id]);
+        goto END;
+    }
+
+    // The crossfade ends this file and starts the next
+    if (tail > 0) {
+        size_t size = (size_t) fade * frame_size;
+        next_fd = open(concatenation->files[file_id + 1], O_RDONLY);
+        outgoing = getBuffer(size);
+        incoming = getBuffer(size);
+        if (next_fd < 0 || outgoing == NULL || incoming == NULL
+         || preadFully(fd, outgoing, size, HEADER_SIZE + (off_t) ((concatenation->frames[file_id] - fade) * frame_size)) != SUCCESS
+         || preadFully(next_fd, incoming, size, HEADER_SIZE) != SUCCESS) {
+            printf("Error in reading file: %s\n\n", concatenation->files[file_id + 1]);
+            goto END;
+        }
+        crossfade(concatenation, outgoing, incoming, outgoing);
+        if (pwriteFully(concatenation->output_fd, outgoing, size,
+                        HEADER_SIZE + (off_t) (concatenation->starts[file_id + 1] * frame_size)) != SUCCESS) {
+            printf("Error in writing file: %s\n\n", concatenation->files[file_id]);
+            goto END;
+        }
+    }
+    concatenation->status[file_id] = SUCCESS;
+
+    END:
+    if (fd >= 0)
+        close(fd);
+    if (next_fd >= 0)
+        close(next_fd);
+    releaseBuffer(outgoing);
+    releaseBuffer(incoming);
+}
+
+/**
+ * Mixes the end of a file into the start of the next along the ramp of
+ * the crossfade. 16 and 24 bit samples go through crossfade16() and
+ * crossfade24(), others through readSample() and writeSample().
+ *
+ * @param concatenation
+ * @param outgoing, the last fade frames of a file
+ * @param incoming, the first fade frames of the next file
+ * @param output, may be outgoing or incoming
+ */
+private void crossfade(Concatenation *concatenation, const u_char *outgoing, const u_char *incoming,
+                       u_char *output) {
+    u_int sample_size = concatenation->headers[0].blockAlign / concatenation->headers[0].numChannels;
+    size_t samples = (size_t) concatenation->fade * concatenation->headers[0].numChannels;
+
+    if (sample_size == 2) {
+        crossfade16((const short *) outgoing, (const short *) incoming, (short *) output, concatenation->ramp, samples);
+        return;
+    }
+    if (sample_size == 3) {
+        crossfade24(outgoing, incoming, output, concatenation->ramp, samples);
+        return;
+    }
+    for (register size_t i = 0; i < samples; i++) {
+        long from = readSample(outgoing + i * sample_size, sample_size);
+        long to = readSample(incoming + i * sample_size, sample_size);
+        writeSample(output + i * sample_size, sample_size, lrint(from + (to - from) * (double) concatenation->ramp[i]));
+    }
+}
+
+/**
+ * Crossfade kernel of 16 bit samples. One weight per sample and no
+ * branches, so the compiler vectorizes the loop; a blend of two samples
+ * never leaves their range, so nothing saturates.
+ *
+ * @param outgoing
+ * @param incoming
+ * @param output
+ * @param ramp
+ * @param samples
+ */
+private void crossfade16(const short *outgoing, const short *incoming, short *output, const float *ramp,
+                         size_t samples) {
+    for (register size_t i = 0; i < samples; i++) {
+        float from = outgoing[i], to = incoming[i];
+        float value = from + (to - from) * ramp[i];
+        output[i] = (short) (value + (value < 0 ? -0.5f : 0.5f));
+    }
+}
+
+/**
+ * Crossfade kernel of packed 24 bit samples, a tile of both files at a
+ * time unpacked by load24() into 32 bit lanes and packed back by
+ * store24(). Blends are computed in double, as a float cannot hold every
+ * 24 bit sample and its fraction.
+ *
+ * @param outgoing
+ * @param incoming
+ * @param output
+ * @param ramp
+ * @param samples
+ */
+private void crossfade24(const u_char *outgoing, const u_char *incoming, u_char *output, const float *ramp,
+                         size_t samples) {
+    int from[PACKED_TILE], to[PACKED_TILE];
+    for (size_t first = 0; first < samples; first += PACKED_TILE) {
+        size_t count = min((size_t) PACKED_TILE, samples - first);
+        load24(outgoing + 3 * first, from, count);
+        load24(incoming + 3 * first, to, count);
+        for (size_t i = 0; i < count; i++)
+            from[i] = (int) lrint(from[i] + (to[i] - from[i]) * (double) ramp[first + i]);
+        store24(from, output + 3 * first, count);
+    }
+}
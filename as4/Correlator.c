@@ -0,0 +1,256 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    Correlator.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define ALIGNED_LCSS_BYTES (1 << 14)    // Of each file, the LCSS of whole files is O(n * m).
+
+
+/**
+ * Prints the best alignment lag and peak correlation coefficient of file[0]
+ * in comparison with the rest, followed by the euclidean distance of the
+ * aligned data and the lcss distance of its first ALIGNED_LCSS_BYTES.
+ * Option ID: 9
+ *
+ * @param files
+ * @param number_of_files
+ * @return EXIT_CODE
+ */
+public int correlateFiles(char **files, int number_of_files) {
+    int EXIT_CODE;
+    Header *wav_header1 = NULL;
+    FILE *wav_file1 = NULL;
+    u_char *wav_file_data1 = NULL;
+    double *signal1 = NULL;
+    u_int length1;
+
+    // Initialise wav_header1 and its signal from first file to be compared with the rest
+    EXIT_CODE = getHeader(NULL, &wav_header1, &wav_file1, files[0]);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    EXIT_CODE = getData(wav_header1, wav_file1, &wav_file_data1);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    signal1 = getMonoSamples(wav_header1, wav_file_data1, &length1);
+    if (signal1 == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    for (int i = 1; i < number_of_files; i++) {
+        Arena *arena = acquireArena();
+        Header *wav_header2 = NULL;
+        FILE *wav_file2 = NULL;
+        u_char *wav_file_data2 = NULL;
+        double *signal2 = NULL;
+        u_int length2;
+
+        if (arena == NULL) {
+            EXIT_CODE = FAILURE;
+            printf("Sorry, program run out of memory.\n\n");
+            goto LOOP;
+        }
+
+        EXIT_CODE = getHeader(arena, &wav_header2, &wav_file2, files[i]);
+        if (EXIT_CODE != SUCCESS)
+            goto LOOP;
+
+        // Compatibility check
+        if (wav_header1->bitsPerSample != wav_header2->bitsPerSample
+         || wav_header1->numChannels != wav_header2->numChannels) {
+            EXIT_CODE = FAILURE;
+            printf("Incompatible files: %s, %s\n\n", files[0], files[i]);
+            goto LOOP;
+        }
+
+        EXIT_CODE = getData(wav_header2, wav_file2, &wav_file_data2);
+        if (EXIT_CODE != SUCCESS)
+            goto LOOP;
+
+        signal2 = getMonoSamples(wav_header2, wav_file_data2, &length2);
+        if (signal2 == NULL) {
+            EXIT_CODE = FAILURE;
+            printf("Sorry, program run out of memory.\n\n");
+            goto LOOP;
+        }
+
+        int lag;
+        double coefficient;
+        EXIT_CODE = crossCorrelate(signal1, length1, signal2, length2, &lag, &coefficient);
+        if (EXIT_CODE != SUCCESS) {
+            printf("Sorry, program run out of memory.\n\n");
+            goto LOOP;
+        }
+        printf("Best lag: %d frames (%.3f ms)\n", lag, 1000.0 * lag / wav_header1->sampleRate);
+        printf("Peak coefficient: %.3f\n", coefficient);
+
+        // Skip the leading frames of whichever file starts later
+        u_char *aligned1 = wav_file_data1, *aligned2 = wav_file_data2;
+        u_int size1 = wav_header1->subchunk2Size, size2 = wav_header2->subchunk2Size;
+        u_int shift = (u_int) abs(lag) * wav_header1->blockAlign;
+        if (lag > 0) {
+            aligned2 += shift;
+            size2 -= shift;
+        } else {
+            aligned1 += shift;
+            size1 -= shift;
+        }
+
+        printf("Aligned Euclidean distance: %.3f\n", wav_header1->bitsPerSample == 24
+                                                      ? euclidean24(aligned1, aligned2, size1, size2)
+                                                      : euclidean(aligned1, aligned2, size1, size2));
+        printf("Aligned LCSS distance of the first %u bytes: %.3f\n\n", min(min(size1, size2), ALIGNED_LCSS_BYTES),
+               LCSS(aligned1, aligned2, min(size1, ALIGNED_LCSS_BYTES), min(size2, ALIGNED_LCSS_BYTES)));
+
+        LOOP:
+        releaseArena(arena);
+        releaseBuffer(wav_file_data2);
+        freePointer(signal2);
+        closeFile(wav_file2);
+    }
+
+    END:
+    freePointer(wav_header1);
+    releaseBuffer(wav_file_data1);
+    freePointer(signal1);
+    closeFile(wav_file1);
+    freeFFTPlans();
+    return EXIT_CODE;
+}
+
+/**
+ * Normalised cross-correlation of two signals through a real FFT in
+ * O((n + m) log(n + m)). A positive @param lag means signal2 starts lag
+ * frames later than signal1. Every lag is scored by the Pearson
+ * correlation of the frames that overlap at it, their means and energies
+ * kept in running sums as by findClip(), so an exact match scores 1
+ * whatever its length. Lags overlapping less than half of the shorter
+ * signal are not considered, their few frames would match by chance.
+ *
+ * @param signal1
+ * @param length1
+ * @param signal2
+ * @param length2
+ * @param lag, receives the lag with the highest coefficient
+ * @param coefficient, receives the peak coefficient in [-1, 1]
+ * @return EXIT_CODE, FAILURE only when out of memory
+ */
+public int crossCorrelate(double *signal1, u_int length1, double *signal2, u_int length2,
+                          int *lag, double *coefficient) {
+    int EXIT_CODE = SUCCESS;
+    u_int size = nextPowerOfTwo(length1 + length2);
+    double *padded1 = calloc(size, sizeof(double));
+    double *padded2 = calloc(size, sizeof(double));
+    double *spectrum = malloc(4 * (size / 2 + 1) * sizeof(double));
+    double *sums = malloc(2 * ((size_t) length1 + length2 + 2) * sizeof(double));
+    FFTPlan *plan = getFFTPlan(size);
+
+    *lag = 0;
+    *coefficient = 0;
+    if (padded1 == NULL || padded2 == NULL || spectrum == NULL || sums == NULL || plan == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    // Remove the DC offset so silence does not dominate the correlation
+    double mean1 = 0, mean2 = 0, energy1 = 0, energy2 = 0;
+    for (u_int i = 0; i < length1; i++)
+        mean1 += signal1[i];
+    for (u_int i = 0; i < length2; i++)
+        mean2 += signal2[i];
+    mean1 /= max(length1, 1);
+    mean2 /= max(length2, 1);
+
+    for (u_int i = 0; i < length1; i++) {
+        padded1[i] = signal1[i] - mean1;
+        energy1 += padded1[i] * padded1[i];
+    }
+    for (u_int i = 0; i < length2; i++) {
+        padded2[i] = signal2[i] - mean2;
+        energy2 += padded2[i] * padded2[i];
+    }
+    if (energy1 == 0 || energy2 == 0)
+        goto END;
+
+    // Prefix sums of samples and squares give the mean and energy of any overlap
+    double *sum1 = sums, *squares1 = sum1 + length1 + 1;
+    double *sum2 = squares1 + length1 + 1, *squares2 = sum2 + length2 + 1;
+    sum1[0] = squares1[0] = sum2[0] = squares2[0] = 0;
+    for (u_int i = 0; i < length1; i++) {
+        sum1[i + 1] = sum1[i] + padded1[i];
+        squares1[i + 1] = squares1[i] + padded1[i] * padded1[i];
+    }
+    for (u_int i = 0; i < length2; i++) {
+        sum2[i + 1] = sum2[i] + padded2[i];
+        squares2[i + 1] = squares2[i] + padded2[i] * padded2[i];
+    }
+
+    u_int bins = size / 2 + 1;
+    double *re1 = spectrum, *im1 = re1 + bins, *re2 = im1 + bins, *im2 = re2 + bins;
+    realFFT(plan, padded1, re1, im1);
+    realFFT(plan, padded2, re2, im2);
+
+    // conj(X1) * X2 gives r[k] = sum signal1[t] * signal2[t + k]
+    for (register u_int k = 0; k < bins; k++) {
+        double re = re1[k] * re2[k] + im1[k] * im2[k];
+        double im = re1[k] * im2[k] - im1[k] * re2[k];
+        re1[k] = re;
+        im1[k] = im;
+    }
+    inverseRealFFT(plan, re1, im1, padded1);
+
+    // Lags 0..length2 - 1 are stored first, negative lags wrap to the end
+    u_int least_overlap = max(min(length1, length2) / 2, 1);
+    double best = -INFINITY;
+    for (long k = 1 - (long) length1; k < (long) length2; k++) {
+        // Frames start1.. of signal1 meet frames start2.. of signal2
+        u_int start1 = k < 0 ? (u_int) -k : 0, start2 = k < 0 ? 0 : (u_int) k;
+        u_int overlap = min(length1 - start1, length2 - start2);
+        if (overlap < least_overlap)
+            continue;
+
+        double mean1 = (sum1[start1 + overlap] - sum1[start1]) / overlap;
+        double mean2 = (sum2[start2 + overlap] - sum2[start2]) / overlap;
+        double variance1 = (squares1[start1 + overlap] - squares1[start1]) / overlap - mean1 * mean1;
+        double variance2 = (squares2[start2 + overlap] - squares2[start2]) / overlap - mean2 * mean2;
+        if (variance1 <= 1e-12 || variance2 <= 1e-12)
+            continue;
+
+        double product = padded1[k < 0 ? (size_t) (size + k) : (size_t) k];
+        double correlation = (product / overlap - mean1 * mean2) / sqrt(variance1 * variance2);
+        if (correlation > best) {
+            best = correlation;
+            *lag = (int) k;
+        }
+    }
+    *coefficient = best > -INFINITY ? min(best, 1.0) : 0;
+
+    END:
+    freePointer(padded1);
+    freePointer(padded2);
+    freePointer(spectrum);
+    freePointer(sums);
+    return EXIT_CODE;
+}
@@ -0,0 +1,540 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    Daemon.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define FRAME_JOB 1        // Client to daemon: working directory, then the arguments.
+#define FRAME_OUTPUT 2     // Daemon to client: bytes the job printed.
+#define FRAME_EXIT 3       // Daemon to client: EXIT_CODE of the job, ends it.
+#define FRAME_ERROR 4      // Daemon to client: bytes the job printed to stderr.
+#define MAX_FRAME (1 << 20)
+#define OUTPUT_CHUNK (64 << 10)
+
+/**
+ * Precedes the payload of every frame on the socket. The payload of a job
+ * is NUL terminated strings, the payload of an exit is one int.
+ */
+typedef struct FrameHeader {
+    u_int type;
+    u_int length;
+} FrameHeader;
+
+/**
+ * Forwards what a job prints to stdout or stderr to its client, as frames
+ * of @param type. Both relays of a job share lock, so frames never mix.
+ */
+typedef struct Relay {
+    int pipe_fd;
+    int connection;
+    u_int type;
+    pthread_mutex_t *lock;
+} Relay;
+
+/**
+ * Jobs run one at a time, since they share the working directory and
+ * stdout of the daemon. Each job still uses every thread of the pool.
+ */
+private pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+private volatile sig_atomic_t stopping = 0;
+
+private void stop(int signal_number);
+
+private int bindSocket(int listen_fd, struct sockaddr_un *address);
+
+private int isOwnUser(int connection);
+
+private void *serveConnection(void *argument);
+
+private int runCapturedJob(int connection, char *directory, int argc, char **arguments);
+
+private void *relayOutput(void *argument);
+
+private int writeFrame(int fd, u_int type, const void *payload, u_int length);
+
+private int fillAddress(struct sockaddr_un *address, char *socket_path);
+
+
+/**
+ * Serves jobs on a Unix socket until SIGINT or SIGTERM. The thread pool,
+ * the buffer pools and the header cache live as long as the daemon, so a
+ * job costs a round trip instead of a start of the program. Jobs run with
+ * the environment of the daemon in the working directory of the client.
+ *
+ * @param socket_path
+ * @return EXIT_CODE
+ */
+public int runDaemon(char *socket_path) {
+    int EXIT_CODE = SUCCESS;
+    int listen_fd = -1;
+    int directory = -1;
+
+    struct sockaddr_un address;
+    if (fillAddress(&address, socket_path) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    // Jobs change directory, remember where the socket is to remove it
+    directory = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (directory < 0 || listen_fd < 0 || bindSocket(listen_fd, &address) != SUCCESS) {
+        printf("Error in opening socket: %s\n\n", socket_path);
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    // Signals only reach the accepting thread, and only while it waits
+    sigset_t blocked, waiting;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &blocked, &waiting);
+    sigdelset(&waiting, SIGINT);
+    sigdelset(&waiting, SIGTERM);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, NULL);
+
+    enableHeaderCache();
+    printf("Serving jobs on %s.\n", socket_path);
+    fflush(stdout);
+
+    while (!stopping) {
+        struct pollfd ready = {listen_fd, POLLIN, 0};
+        if (ppoll(&ready, 1, NULL, &waiting) <= 0)
+            continue;
+
+        int connection = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (connection < 0)
+            continue;
+        if (!isOwnUser(connection)) {
+            close(connection);
+            continue;
+        }
+
+        pthread_t thread;
+        int *argument = malloc(sizeof(int));
+        if (argument != NULL)
+            *argument = connection;
+        if (argument == NULL || pthread_create(&thread, NULL, serveConnection, argument) != 0) {
+            free(argument);
+            close(connection);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    // Let the running job finish, later ones never start
+    pthread_mutex_lock(&job_lock);
+    printf("Daemon on %s stopped.\n", socket_path);
+
+    END:
+    if (listen_fd >= 0)
+        close(listen_fd);
+    if (directory >= 0) {
+        if (EXIT_CODE == SUCCESS)
+            unlinkat(directory, socket_path, 0);
+        close(directory);
+    }
+    return EXIT_CODE;
+}
+
+/**
+ * Sends a job to the daemon of @param socket_path and prints what it
+ * prints. With -repeat n the job is sent n times over one connection and
+ * the rate of jobs is printed to stderr.
+ *
+ * @param socket_path
+ * @param arguments, [-repeat n] followed by an option and its arguments
+ * @param number_of_arguments
+ * @return EXIT_CODE of the last job
+ */
+public int runClient(char *socket_path, char **arguments, int number_of_arguments) {
+    int EXIT_CODE = SUCCESS;
+    int connection = -1;
+    char *payload = NULL;
+    char *output = NULL;
+
+    int repeat = 1;
+    if (strcmp(arguments[0], "-repeat") == 0) {
+        if (number_of_arguments < 3 || atoi(arguments[1]) <= 0)
+            return FAILURE;
+        repeat = atoi(arguments[1]);
+        arguments += 2;
+        number_of_arguments -= 2;
+    }
+
+    char directory[4096];
+    if (getcwd(directory, sizeof(directory)) == NULL) {
+        printf("Error in opening directory: .\n\n");
+        return FAILURE;
+    }
+
+    size_t length = strlen(directory) + 1;
+    for (int i = 0; i < number_of_arguments; i++)
+        length += strlen(arguments[i]) + 1;
+    if (length > MAX_FRAME) {
+        printf("Too many arguments for the daemon.\n\n");
+        return FAILURE;
+    }
+
+    payload = malloc(length);
+    output = malloc(OUTPUT_CHUNK);
+    if (payload == NULL || output == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    size_t used = strlen(directory) + 1;
+    memcpy(payload, directory, used);
+    for (int i = 0; i < number_of_arguments; i++) {
+        memcpy(payload + used, arguments[i], strlen(arguments[i]) + 1);
+        used += strlen(arguments[i]) + 1;
+    }
+
+    struct sockaddr_un address;
+    if (fillAddress(&address, socket_path) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0 || connect(connection, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        printf("Error in opening socket: %s\n\n", socket_path);
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int jobs = 0;
+    while (jobs < repeat && EXIT_CODE == SUCCESS) {
+        if (writeFrame(connection, FRAME_JOB, payload, (u_int) length) != SUCCESS) {
+            printf("Error in writing file: %s\n\n", socket_path);
+            EXIT_CODE = FAILURE;
+            goto END;
+        }
+
+        // Print the output of the job as it arrives, up to its exit
+        for (;;) {
+            FrameHeader header;
+            if (readFully(connection, &header, sizeof(header)) != (ssize_t) sizeof(header)
+             || header.length > MAX_FRAME
+             || (header.type == FRAME_EXIT && header.length != sizeof(int))) {
+                printf("Daemon closed the connection: %s\n\n", socket_path);
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+
+            for (u_int received = 0; received < header.length;) {
+                size_t size = min(header.length - received, OUTPUT_CHUNK);
+                if (readFully(connection, output, size) != (ssize_t) size) {
+                    printf("Daemon closed the connection: %s\n\n", socket_path);
+                    EXIT_CODE = FAILURE;
+                    goto END;
+                }
+                if (header.type == FRAME_OUTPUT)
+                    writeFully(STDOUT_FILENO, output, size);
+                else if (header.type == FRAME_ERROR)
+                    writeFully(STDERR_FILENO, output, size);
+                received += size;
+            }
+
+            if (header.type == FRAME_EXIT) {
+                memcpy(&EXIT_CODE, output, sizeof(int));
+                break;
+            }
+        }
+        jobs++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (repeat > 1) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "Ran %d jobs in %.3f s, %.1f jobs/s\n", jobs, seconds, jobs / max(seconds, 1e-9));
+    }
+
+    END:
+    if (connection >= 0)
+        close(connection);
+    freePointer(payload);
+    freePointer(output);
+    return EXIT_CODE;
+}
+
+/**
+ * Handler of SIGINT and SIGTERM in the daemon.
+ *
+ * @param signal_number
+ */
+private void stop(int signal_number) {
+    stopping = signal_number;
+}
+
+/**
+ * Binds and listens on a Unix socket. A socket file left behind by a
+ * daemon that is gone is replaced, one still served is not. The socket
+ * file is created under a umask of 077, so only the user of the daemon can
+ * connect to it.
+ *
+ * @param listen_fd
+ * @param address
+ * @return EXIT_CODE
+ */
+private int bindSocket(int listen_fd, struct sockaddr_un *address) {
+    int EXIT_CODE = SUCCESS;
+    mode_t mask = umask(0077);
+
+    if (bind(listen_fd, (struct sockaddr *) address, sizeof(*address)) != 0) {
+        if (errno != EADDRINUSE) {
+            EXIT_CODE = FAILURE;
+            goto END;
+        }
+
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int served = probe >= 0 && connect(probe, (struct sockaddr *) address, sizeof(*address)) == 0;
+        if (probe >= 0)
+            close(probe);
+        if (served || unlink(address->sun_path) != 0
+         || bind(listen_fd, (struct sockaddr *) address, sizeof(*address)) != 0) {
+            EXIT_CODE = FAILURE;
+            goto END;
+        }
+    }
+    if (listen(listen_fd, SOMAXCONN) != 0)
+        EXIT_CODE = FAILURE;
+
+    END:
+    umask(mask);
+    return EXIT_CODE;
+}
+
+/**
+ * Jobs read and write files as the daemon's user, so only that user may
+ * send them, whatever the mode of the socket file became.
+ *
+ * @param connection
+ * @return if the peer of @param connection runs as the user of the daemon
+ */
+private int isOwnUser(int connection) {
+    struct ucred peer;
+    socklen_t length = sizeof(peer);
+    return getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &peer, &length) == 0
+        && length == sizeof(peer) && peer.uid == geteuid();
+}
+
+/**
+ * Runs the jobs of one client until it disconnects.
+ *
+ * @param argument, malloc'd descriptor of the connection
+ * @return NULL
+ */
+private void *serveConnection(void *argument) {
+    int connection = *(int *) argument;
+    free(argument);
+
+    for (;;) {
+        FrameHeader header;
+        if (readFully(connection, &header, sizeof(header)) != (ssize_t) sizeof(header)
+         || header.type != FRAME_JOB || header.length == 0 || header.length > MAX_FRAME)
+            break;
+
+        char *payload = malloc(header.length);
+        if (payload == NULL || readFully(connection, payload, header.length) != (ssize_t) header.length
+         || payload[header.length - 1] != '\0') {
+            free(payload);
+            break;
+        }
+
+        // The working directory of the client, then argv[1..] of the job
+        int argc = 0;
+        for (u_int i = 0; i < header.length; i++)
+            argc += payload[i] == '\0';
+        char **arguments = malloc((argc + 1) * sizeof(char *));
+        if (arguments == NULL) {
+            free(payload);
+            break;
+        }
+        char *directory = payload;
+        arguments[0] = "wavengine";
+        char *next = payload + strlen(payload) + 1;
+        for (int i = 1; i < argc; i++) {
+            arguments[i] = next;
+            next += strlen(next) + 1;
+        }
+        arguments[argc] = NULL;
+
+        int EXIT_CODE = runCapturedJob(connection, directory, argc, arguments);
+        free(arguments);
+        free(payload);
+        if (writeFrame(connection, FRAME_EXIT, &EXIT_CODE, sizeof(int)) != SUCCESS)
+            break;
+    }
+
+    close(connection);
+    return NULL;
+}
+
+/**
+ * Runs a job with what it prints to stdout and stderr sent to the client
+ * as it is printed, each in frames of its own.
+ *
+ * @param connection
+ * @param directory, working directory of the client
+ * @param argc
+ * @param arguments
+ * @return EXIT_CODE of the job
+ */
+private int runCapturedJob(int connection, char *directory, int argc, char **arguments) {
+    // The daemon has no stdin or stdout of the client to stream through
+    for (int i = 1; i < argc; i++)
+        if (isStream(arguments[i])) {
+            char message[] = "Streams are not served by the daemon, use the program itself.\n\n";
+            writeFrame(connection, FRAME_OUTPUT, message, sizeof(message) - 1);
+            return FAILURE;
+        }
+
+    pthread_mutex_lock(&job_lock);
+    int EXIT_CODE = FAILURE;
+    int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    int saved_fds[2] = {-1, -1};
+    int relaying = 0;
+    pthread_t threads[2];
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    Relay relays[2] = {{-1, connection, FRAME_OUTPUT, &lock}, {-1, connection, FRAME_ERROR, &lock}};
+
+    if (chdir(directory) != 0) {
+        char message[] = "Error in opening directory of the client.\n\n";
+        writeFrame(connection, FRAME_OUTPUT, message, sizeof(message) - 1);
+        goto END;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    for (; relaying < 2; relaying++) {
+        int pipe_fds[2];
+        if (pipe2(pipe_fds, O_CLOEXEC) != 0)
+            goto END;
+        relays[relaying].pipe_fd = pipe_fds[0];
+        saved_fds[relaying] = dup(fds[relaying]);
+        if (saved_fds[relaying] < 0 || dup2(pipe_fds[1], fds[relaying]) < 0
+         || pthread_create(&threads[relaying], NULL, relayOutput, &relays[relaying]) != 0) {
+            close(pipe_fds[1]);
+            goto END;
+        }
+        close(pipe_fds[1]);
+    }
+
+    EXIT_CODE = runJob(argc, arguments);
+    fflush(stdout);
+    fflush(stderr);
+
+    // Restoring stdout and stderr closes the last write ends, which ends the relays
+    END:
+    for (int i = 0; i < 2; i++)
+        if (saved_fds[i] >= 0) {
+            dup2(saved_fds[i], fds[i]);
+            close(saved_fds[i]);
+        }
+    for (int i = 0; i < relaying; i++)
+        pthread_join(threads[i], NULL);
+    for (int i = 0; i < 2; i++)
+        if (relays[i].pipe_fd >= 0)
+            close(relays[i].pipe_fd);
+    pthread_mutex_destroy(&lock);
+    pthread_mutex_unlock(&job_lock);
+    return EXIT_CODE;
+}
+
+/**
+ * Sends what a job writes to one of its outputs to its client. Keeps
+ * draining the pipe after the client is gone, so the job never blocks on
+ * it.
+ *
+ * @param argument, the Relay
+ * @return NULL
+ */
+private void *relayOutput(void *argument) {
+    Relay *relay = argument;
+    char output[OUTPUT_CHUNK];
+    int connected = 1;
+
+    for (;;) {
+        ssize_t size = read(relay->pipe_fd, output, sizeof(output));
+        if (size < 0 && errno == EINTR)
+            continue;
+        if (size <= 0)
+            break;
+        if (connected) {
+            pthread_mutex_lock(relay->lock);
+            connected = writeFrame(relay->connection, relay->type, output, (u_int) size) == SUCCESS;
+            pthread_mutex_unlock(relay->lock);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Writes a frame to a socket.
+ *
+ * @param fd
+ * @param type
+ * @param payload
+ * @param length
+ * @return EXIT_CODE
+ */
+private int writeFrame(int fd, u_int type, const void *payload, u_int length) {
+    FrameHeader header = {type, length};
+    if (writeFully(fd, &header, sizeof(header)) != SUCCESS)
+        return FAILURE;
+    return writeFully(fd, payload, length);
+}
+
+/**
+ * @param address, receives the address of @param socket_path
+ * @param socket_path
+ * @return EXIT_CODE, FAILURE if the path does not fit in an address
+ */
+private int fillAddress(struct sockaddr_un *address, char *socket_path) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        printf("Socket path too long: %s\n\n", socket_path);
+        return FAILURE;
+    }
+    strcpy(address->sun_path, socket_path);
+    return SUCCESS;
+}
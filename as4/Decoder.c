@@ -41,12 +41,12 @@ public int decodeFromFile(char *encoded_wav, int msg_length, char *output_msg_fi
     u_int *permutations = NULL;
 
     // Initialise wav_header from encoded_wav_file
-    EXIT_CODE = getHeader(&wav_header, &encoded_wav_file, encoded_wav);
+    EXIT_CODE = getHeader(NULL, &wav_header, &encoded_wav_file, encoded_wav);
     if (EXIT_CODE != SUCCESS)
         goto END;
 
     // Initialise wav_file_data from encoded_wav
-    wav_file_data = malloc(wav_header->subchunk2Size);
+    wav_file_data = getBuffer(wav_header->subchunk2Size);
     if (wav_file_data == NULL) {
         EXIT_CODE = FAILURE;
         printf("Sorry, program run out of memory.\n\n");
@@ -92,7 +92,7 @@ public int decodeFromFile(char *encoded_wav, int msg_length, char *output_msg_fi
 
     END:
     freePointer(wav_header);
-    freePointer(wav_file_data);
+    releaseBuffer(wav_file_data);
     freePointer(msg);
     freePointer(permutations);
     closeFile(output_file);
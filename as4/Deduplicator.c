@@ -0,0 +1,633 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    Deduplicator.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define PRIME1 11400714785074694791ULL
+#define PRIME2 14029467366897019727ULL
+#define PRIME3 1609587929392839161ULL
+#define STRIPE 32                   // Bytes taken by the four lanes of a hash at once.
+#define MAX_CACHE_ENTRIES (1 << 24)
+
+static const char CACHE_MAGIC[8] = "WAVDDP1";
+
+/**
+ * One file of a -dedup run. Files are only hashed if another one has as
+ * many bytes of data, and only compared byte for byte if another one has
+ * the same hash.
+ */
+typedef struct DedupFile {
+    int file_id;
+    int status;
+    int hashed;                     // hash is known, from the data or the cache.
+    int repeated;                   // The same file as an earlier argument, left out.
+    int group;                      // file_id of the first file of the same data, -1 if not known.
+    u_int data_size;
+    unsigned long long hash;
+    unsigned long long device;
+    unsigned long long inode;
+    long long size;
+    long long modified_sec;
+    long long modified_nsec;
+} DedupFile;
+
+/**
+ * Record of a hash cache file, which holds a u_int count and then the
+ * records, ordered by device and inode, after CACHE_MAGIC.
+ */
+typedef struct CacheEntry {
+    unsigned long long device;
+    unsigned long long inode;
+    long long size;
+    long long modified_sec;
+    long long modified_nsec;
+    unsigned long long hash;
+} CacheEntry;
+
+/**
+ * Files of a -dedup run.
+ */
+typedef struct DedupCorpus {
+    char **files;
+    DedupFile *entries;
+    int *pending;                   // Ids of the files hashDedupFile() reads.
+} DedupCorpus;
+
+/**
+ * Running state of hashData().
+ */
+typedef struct DataHash {
+    unsigned long long lanes[4];
+    unsigned long long length;
+    u_char tail[STRIPE];
+    u_int tail_size;
+} DataHash;
+
+private void readDedupHeader(void *context, int file_id);
+
+private void hashDedupFile(void *context, int file_id);
+
+private void startHash(DataHash *state);
+
+private void hashData(DataHash *state, const u_char *data, size_t size);
+
+private unsigned long long finishHash(DataHash *state);
+
+private CacheEntry *readCache(char *cache_filename, u_int *number_of_entries);
+
+private int writeCache(char *cache_filename, CacheEntry *entries, u_int number_of_entries);
+
+private int compareBySize(const void *file1, const void *file2);
+
+private int compareByHash(const void *file1, const void *file2);
+
+private int compareByGroup(const void *file1, const void *file2);
+
+private int compareByInode(const void *file1, const void *file2);
+
+private int sameHash(const DedupFile *file1, const DedupFile *file2);
+
+private int groupByData(DedupCorpus *corpus, DedupFile *sorted, int number_of_hashed);
+
+private void compareDedupFile(void *context, int task_id);
+
+private int compareCacheEntries(const void *entry1, const void *entry2);
+
+
+/**
+ * Groups .wav files whose data chunks are byte for byte the same, whatever
+ * their headers. Only files that share the size of their data with another
+ * are read, in parallel, and their data hashed, and only files that share
+ * the hash too are compared byte for byte. A file given twice, by the same
+ * path or another link to it, counts once. With @param cache_filename
+ * the hashes are kept in a cache file and reused for files whose inode,
+ * size and modification time did not change.
+ * Option ID: 23
+ *
+ * @param files
+ * @param number_of_files
+ * @param cache_filename, or NULL
+ * @return EXIT_CODE
+ */
+public int findDuplicates(char **files, int number_of_files, char *cache_filename) {
+    int EXIT_CODE = SUCCESS;
+    DedupCorpus corpus = {files, NULL, NULL};
+    DedupFile *sorted = NULL;
+    CacheEntry *cache = NULL, *merged = NULL;
+    u_int cache_entries = 0;
+
+    corpus.entries = calloc((size_t) number_of_files, sizeof(DedupFile));
+    corpus.pending = malloc((size_t) number_of_files * sizeof(int));
+    sorted = malloc((size_t) number_of_files * sizeof(DedupFile));
+    if (corpus.entries == NULL || corpus.pending == NULL || sorted == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+    if (cache_filename != NULL)
+        cache = readCache(cache_filename, &cache_entries);
+
+    parallelFor(number_of_files, readDedupHeader, &corpus);
+
+    // A file given again is the same file, not a duplicate of it
+    int number_of_valid = 0;
+    for (int i = 0; i < number_of_files; i++)
+        if (corpus.entries[i].status == SUCCESS)
+            sorted[number_of_valid++] = corpus.entries[i];
+    qsort(sorted, (size_t) number_of_valid, sizeof(DedupFile), compareByInode);
+    for (int i = 1; i < number_of_valid; i++)
+        if (sorted[i - 1].device == sorted[i].device && sorted[i - 1].inode == sorted[i].inode)
+            corpus.entries[sorted[i].file_id].repeated = 1;
+
+    // Files with a size of data no other file has cannot have a duplicate
+    number_of_valid = 0;
+    for (int i = 0; i < number_of_files; i++)
+        if (corpus.entries[i].status != SUCCESS)
+            EXIT_CODE = FAILURE;
+        else if (!corpus.entries[i].repeated)
+            sorted[number_of_valid++] = corpus.entries[i];
+    qsort(sorted, (size_t) number_of_valid, sizeof(DedupFile), compareBySize);
+
+    int number_of_pending = 0, number_of_cached = 0;
+    for (int i = 0; i < number_of_valid; i++) {
+        int shared = (i > 0 && sorted[i - 1].data_size == sorted[i].data_size)
+                  || (i + 1 < number_of_valid && sorted[i + 1].data_size == sorted[i].data_size);
+        if (!shared)
+            continue;
+
+        DedupFile *entry = &corpus.entries[sorted[i].file_id];
+        CacheEntry key = {entry->device, entry->inode, 0, 0, 0, 0};
+        CacheEntry *cached = cache == NULL ? NULL
+                           : bsearch(&key, cache, cache_entries, sizeof(CacheEntry), compareCacheEntries);
+        if (cached != NULL && cached->size == entry->size && cached->modified_sec == entry->modified_sec
+         && cached->modified_nsec == entry->modified_nsec) {
+            entry->hash = cached->hash;
+            entry->hashed = 1;
+            number_of_cached++;
+        } else
+            corpus.pending[number_of_pending++] = sorted[i].file_id;
+    }
+    parallelFor(number_of_pending, hashDedupFile, &corpus);
+
+    int number_of_hashed = 0;
+    for (int i = 0; i < number_of_files; i++)
+        if (corpus.entries[i].hashed)
+            sorted[number_of_hashed++] = corpus.entries[i];
+        else if (corpus.entries[i].status != SUCCESS)
+            EXIT_CODE = FAILURE;
+    qsort(sorted, (size_t) number_of_hashed, sizeof(DedupFile), compareByHash);
+    if (groupByData(&corpus, sorted, number_of_hashed) != SUCCESS)
+        EXIT_CODE = FAILURE;
+
+    // Groups come out in the order of their first file, which leads them
+    number_of_hashed = 0;
+    for (int i = 0; i < number_of_files; i++)
+        if (corpus.entries[i].hashed)
+            sorted[number_of_hashed++] = corpus.entries[i];
+    qsort(sorted, (size_t) number_of_hashed, sizeof(DedupFile), compareByGroup);
+    int number_of_groups = 0;
+    for (int i = 0, next; i < number_of_hashed; i = next) {
+        for (next = i + 1; next < number_of_hashed && sorted[next].group == sorted[i].group; next++)
+            ;
+        if (sorted[i].group < 0 || next - i < 2)
+            continue;
+
+        printf("Duplicates, %u bytes of data:\n", sorted[i].data_size);
+        for (int copy = i; copy < next; copy++)
+            printf("  %s\n", files[sorted[copy].file_id]);
+        number_of_groups++;
+    }
+    printf("%d files, %d groups of duplicates, %d read, %d from the cache.\n\n",
+           number_of_files, number_of_groups, number_of_pending, number_of_cached);
+
+    // The cache keeps its other entries and takes the hashes of this run
+    if (cache_filename != NULL) {
+        merged = malloc(((size_t) cache_entries + number_of_hashed + 1) * sizeof(CacheEntry));
+        if (merged == NULL) {
+            EXIT_CODE = FAILURE;
+            printf("Sorry, program run out of memory.\n\n");
+            goto END;
+        }
+        u_int number_of_merged = 0;
+        for (int i = 0; i < number_of_hashed; i++) {
+            CacheEntry entry = {sorted[i].device, sorted[i].inode, sorted[i].size,
+                                sorted[i].modified_sec, sorted[i].modified_nsec, sorted[i].hash};
+            merged[number_of_merged++] = entry;
+        }
+        qsort(merged, number_of_merged, sizeof(CacheEntry), compareCacheEntries);
+        u_int number_of_new = number_of_merged;
+        for (u_int i = 0; i < cache_entries && number_of_merged < MAX_CACHE_ENTRIES; i++)
+            if (bsearch(&cache[i], merged, number_of_new, sizeof(CacheEntry), compareCacheEntries) == NULL)
+                merged[number_of_merged++] = cache[i];
+        qsort(merged, number_of_merged, sizeof(CacheEntry), compareCacheEntries);
+
+        if (writeCache(cache_filename, merged, number_of_merged) != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            printf("Error in writing file: %s\n\n", cache_filename);
+        }
+    }
+
+    END:
+    freePointer(corpus.entries);
+    freePointer(corpus.pending);
+    freePointer(sorted);
+    freePointer(cache);
+    freePointer(merged);
+    return EXIT_CODE;
+}
+
+/**
+ * Reads the header and identity of one file of a DedupCorpus.
+ *
+ * @param context, the DedupCorpus
+ * @param file_id
+ */
+private void readDedupHeader(void *context, int file_id) {
+    DedupCorpus *corpus = context;
+    DedupFile *entry = &corpus->entries[file_id];
+    char *wav_filename = corpus->files[file_id];
+    Header wav_header;
+    struct stat wav_stat;
+
+    entry->file_id = file_id;
+    entry->status = FAILURE;
+    entry->group = -1;
+    if (isStream(wav_filename)) {
+        printf("Streams are not supported: %s\n\n", wav_filename);
+        return;
+    }
+
+    int fd = open(wav_filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &wav_stat) != 0)
+        printf("Error in opening file: %s\n\n", wav_filename);
+    else if (preadFully(fd, &wav_header, HEADER_SIZE, 0) != SUCCESS)
+        printf("File not even 44 bytes: %s\n\n", wav_filename);
+    else if (wavCheck(&wav_header) == FAILURE)
+        printf("Invalid wav header.\n\n");
+    else {
+        entry->data_size = wav_header.subchunk2Size;
+        entry->device = (unsigned long long) wav_stat.st_dev;
+        entry->inode = (unsigned long long) wav_stat.st_ino;
+        entry->size = (long long) wav_stat.st_size;
+        entry->modified_sec = (long long) wav_stat.st_mtim.tv_sec;
+        entry->modified_nsec = (long long) wav_stat.st_mtim.tv_nsec;
+        entry->status = SUCCESS;
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+/**
+ * Hashes the data of one pending file of a -dedup run, block by block.
+ *
+ * @param context, the DedupCorpus
+ * @param task_id, index of the file among the pending ones
+ */
+private void hashDedupFile(void *context, int task_id) {
+    DedupCorpus *corpus = context;
+    int file_id = corpus->pending[task_id];
+    DedupFile *entry = &corpus->entries[file_id];
+    char *wav_filename = corpus->files[file_id];
+
+    int fd = open(wav_filename, O_RDONLY);
+    size_t block_size = getBlockSize(1);
+    u_char *block = getBuffer(block_size);
+    if (fd < 0 || block == NULL) {
+        entry->status = FAILURE;
+        printf(fd < 0 ? "Error in opening file: %s\n\n" : "Sorry, program run out of memory.\n\n", wav_filename);
+        goto END;
+    }
+
+    DataHash state;
+    startHash(&state);
+    FileRange range = {fd, HEADER_SIZE, HEADER_SIZE + (off_t) entry->data_size, 0, 0, HEADER_SIZE};
+    for (off_t offset = 0; offset < (off_t) entry->data_size; offset += (off_t) block_size) {
+        ssize_t size = readRange(&range, block, block_size, offset);
+        if (size <= 0) {
+            entry->status = FAILURE;
+            printf("Error in reading file: %s\n\n", wav_filename);
+            goto END;
+        }
+        hashData(&state, block, (size_t) size);
+    }
+    entry->hash = finishHash(&state);
+    entry->hashed = 1;
+
+    END:
+    releaseBuffer(block);
+    if (fd >= 0)
+        close(fd);
+}
+
+/**
+ * Starts a 64 bit hash in the manner of xxHash64.
+ *
+ * @param state
+ */
+private void startHash(DataHash *state) {
+    memset(state, 0, sizeof(DataHash));
+    state->lanes[0] = PRIME1 + PRIME2;
+    state->lanes[1] = PRIME2;
+    state->lanes[2] = 0;
+    state->lanes[3] = -PRIME1;
+}
+
+/**
+ * Adds bytes to a hash. Whole stripes of 32 bytes feed four independent
+ * lanes of 8 bytes each, so the lanes proceed side by side without waiting
+ * for each other; bytes short of a stripe wait in the tail.
+ *
+ * @param state
+ * @param data
+ * @param size
+ */
+private void hashData(DataHash *state, const u_char *data, size_t size) {
+    state->length += size;
+    while (state->tail_size > 0 && size > 0) {
+        state->tail[state->tail_size++] = *data++;
+        size--;
+        if (state->tail_size == STRIPE) {
+            state->tail_size = 0;
+            hashData(state, state->tail, STRIPE);
+            state->length -= STRIPE;
+        }
+    }
+
+    unsigned long long lane0 = state->lanes[0], lane1 = state->lanes[1];
+    unsigned long long lane2 = state->lanes[2], lane3 = state->lanes[3];
+    for (; size >= STRIPE; data += STRIPE, size -= STRIPE) {
+        unsigned long long words[4];
+        memcpy(words, data, STRIPE);
+        lane0 += words[0] * PRIME2;
+        lane1 += words[1] * PRIME2;
+        lane2 += words[2] * PRIME2;
+        lane3 += words[3] * PRIME2;
+        lane0 = (lane0 << 31 | lane0 >> 33) * PRIME1;
+        lane1 = (lane1 << 31 | lane1 >> 33) * PRIME1;
+        lane2 = (lane2 << 31 | lane2 >> 33) * PRIME1;
+        lane3 = (lane3 << 31 | lane3 >> 33) * PRIME1;
+    }
+    state->lanes[0] = lane0;
+    state->lanes[1] = lane1;
+    state->lanes[2] = lane2;
+    state->lanes[3] = lane3;
+
+    memcpy(state->tail + state->tail_size, data, size);
+    state->tail_size += (u_int) size;
+}
+
+/**
+ * @param state
+ * @return the hash of every byte given to hashData()
+ */
+private unsigned long long finishHash(DataHash *state) {
+    unsigned long long hash = (state->lanes[0] << 1 | state->lanes[0] >> 63)
+                            + (state->lanes[1] << 7 | state->lanes[1] >> 57)
+                            + (state->lanes[2] << 12 | state->lanes[2] >> 52)
+                            + (state->lanes[3] << 18 | state->lanes[3] >> 46);
+    hash += state->length;
+    for (u_int i = 0; i < state->tail_size; i++) {
+        hash ^= state->tail[i] * PRIME3;
+        hash = (hash << 11 | hash >> 53) * PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/**
+ * Reads a hash cache. A missing or damaged cache reads as empty.
+ *
+ * @param cache_filename
+ * @param number_of_entries
+ * @return malloc'd entries ordered by device and inode, or NULL
+ */
+private CacheEntry *readCache(char *cache_filename, u_int *number_of_entries) {
+    char magic[8];
+    u_int count;
+    CacheEntry *entries = NULL;
+
+    *number_of_entries = 0;
+    int fd = open(cache_filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    if (preadFully(fd, magic, sizeof(magic), 0) == SUCCESS && memcmp(magic, CACHE_MAGIC, sizeof(magic)) == 0
+     && preadFully(fd, &count, sizeof(u_int), sizeof(magic)) == SUCCESS && count <= MAX_CACHE_ENTRIES) {
+        entries = malloc(max(count, 1) * sizeof(CacheEntry));
+        if (entries != NULL
+         && preadFully(fd, entries, count * sizeof(CacheEntry), sizeof(magic) + sizeof(u_int)) == SUCCESS)
+            *number_of_entries = count;
+    }
+    close(fd);
+    return entries;
+}
+
+/**
+ * Writes a hash cache under a temporary name and renames it into place.
+ *
+ * @param cache_filename
+ * @param entries, ordered by device and inode
+ * @param number_of_entries
+ * @return EXIT_CODE
+ */
+private int writeCache(char *cache_filename, CacheEntry *entries, u_int number_of_entries) {
+    char *temporary_filename = malloc(8 + strlen(cache_filename));
+    if (temporary_filename == NULL)
+        return FAILURE;
+    snprintf(temporary_filename, 8 + strlen(cache_filename), "%s.XXXXXX", cache_filename);
+
+    int fd = mkstemp(temporary_filename);
+    int EXIT_CODE = fd < 0 ? FAILURE : SUCCESS;
+    if (EXIT_CODE == SUCCESS && (pwriteFully(fd, CACHE_MAGIC, sizeof(CACHE_MAGIC), 0) != SUCCESS
+     || pwriteFully(fd, &number_of_entries, sizeof(u_int), sizeof(CACHE_MAGIC)) != SUCCESS
+     || pwriteFully(fd, entries, number_of_entries * sizeof(CacheEntry), sizeof(CACHE_MAGIC) + sizeof(u_int)) != SUCCESS
+     || fchmod(fd, 0644) != 0 || rename(temporary_filename, cache_filename) != 0)) {
+        EXIT_CODE = FAILURE;
+        unlink(temporary_filename);
+    }
+
+    if (fd >= 0)
+        close(fd);
+    freePointer(temporary_filename);
+    return EXIT_CODE;
+}
+
+/**
+ * qsort() comparator ordering files by size of data.
+ */
+private int compareBySize(const void *file1, const void *file2) {
+    u_int size1 = ((const DedupFile *) file1)->data_size, size2 = ((const DedupFile *) file2)->data_size;
+    return (size1 > size2) - (size1 < size2);
+}
+
+/**
+ * qsort() comparator ordering files by size of data, then hash, then
+ * position among the arguments.
+ */
+private int compareByHash(const void *file1, const void *file2) {
+    const DedupFile *a = file1, *b = file2;
+    if (a->data_size != b->data_size)
+        return (a->data_size > b->data_size) - (a->data_size < b->data_size);
+    if (a->hash != b->hash)
+        return (a->hash > b->hash) - (a->hash < b->hash);
+    return (a->file_id > b->file_id) - (a->file_id < b->file_id);
+}
+
+/**
+ * qsort() comparator ordering files by the first file of their data, then
+ * position among the arguments.
+ */
+private int compareByGroup(const void *file1, const void *file2) {
+    const DedupFile *a = file1, *b = file2;
+    if (a->group != b->group)
+        return (a->group > b->group) - (a->group < b->group);
+    return (a->file_id > b->file_id) - (a->file_id < b->file_id);
+}
+
+/**
+ * qsort() comparator ordering files by device and inode, then position
+ * among the arguments.
+ */
+private int compareByInode(const void *file1, const void *file2) {
+    const DedupFile *a = file1, *b = file2;
+    if (a->device != b->device)
+        return (a->device > b->device) - (a->device < b->device);
+    if (a->inode != b->inode)
+        return (a->inode > b->inode) - (a->inode < b->inode);
+    return (a->file_id > b->file_id) - (a->file_id < b->file_id);
+}
+
+/**
+ * @param file1
+ * @param file2
+ * @return whether two hashed files may have the same data
+ */
+private int sameHash(const DedupFile *file1, const DedupFile *file2) {
+    return file1->data_size == file2->data_size && file1->hash == file2->hash;
+}
+
+/**
+ * Sets the group of every hashed file to the first file whose data is
+ * byte for byte the same. In every run of equal hashes the first file not
+ * yet grouped leads a group, and every other one not yet grouped is
+ * compared with it, in parallel; those that differ, which takes a hash
+ * collision, are tried against the next leader of the run.
+ *
+ * @param corpus
+ * @param sorted, the hashed files, by hash
+ * @param number_of_hashed
+ * @return EXIT_CODE, FAILURE if a file could not be read
+ */
+private int groupByData(DedupCorpus *corpus, DedupFile *sorted, int number_of_hashed) {
+    int EXIT_CODE = SUCCESS;
+    for (int number_of_pending = -1; number_of_pending != 0;) {
+        number_of_pending = 0;
+        for (int i = 0, next; i < number_of_hashed; i = next) {
+            int leader = -1;
+            for (next = i; next < number_of_hashed && sameHash(&sorted[next], &sorted[i]); next++) {
+                DedupFile *entry = &corpus->entries[sorted[next].file_id];
+                if (entry->group >= 0)
+                    continue;
+                if (leader < 0)
+                    leader = entry->group = entry->file_id;
+                else {
+                    entry->group = leader;
+                    corpus->pending[number_of_pending++] = entry->file_id;
+                }
+            }
+        }
+        parallelFor(number_of_pending, compareDedupFile, corpus);
+    }
+
+    for (int i = 0; i < number_of_hashed; i++)
+        if (corpus->entries[sorted[i].file_id].status != SUCCESS)
+            EXIT_CODE = FAILURE;
+    return EXIT_CODE;
+}
+
+/**
+ * Compares the data of one pending file of a -dedup run with that of the
+ * leader of its group, block by block, and takes it out of the group if
+ * they differ. A file that cannot be read is left in a group of its own.
+ *
+ * @param context, the DedupCorpus
+ * @param task_id, index of the file among the pending ones
+ */
+private void compareDedupFile(void *context, int task_id) {
+    DedupCorpus *corpus = context;
+    DedupFile *entry = &corpus->entries[corpus->pending[task_id]];
+    DedupFile *leader = &corpus->entries[entry->group];
+    char *filenames[2] = {corpus->files[leader->file_id], corpus->files[entry->file_id]};
+    size_t block_size = getBlockSize(1);
+    u_char *blocks[2] = {getBuffer(block_size), getBuffer(block_size)};
+    int fds[2] = {open(filenames[0], O_RDONLY), open(filenames[1], O_RDONLY)};
+    int same = 1;
+
+    for (int f = 0; f < 2; f++)
+        if (fds[f] < 0 || blocks[f] == NULL) {
+            printf(fds[f] < 0 ? "Error in opening file: %s\n\n" : "Sorry, program run out of memory.\n\n",
+                   filenames[f]);
+            entry->status = FAILURE;
+            goto END;
+        }
+
+    FileRange ranges[2] = {{fds[0], HEADER_SIZE, HEADER_SIZE + (off_t) entry->data_size, 0, 0, HEADER_SIZE},
+                           {fds[1], HEADER_SIZE, HEADER_SIZE + (off_t) entry->data_size, 0, 0, HEADER_SIZE}};
+    for (off_t offset = 0; same && offset < (off_t) entry->data_size; offset += (off_t) block_size) {
+        ssize_t sizes[2];
+        for (int f = 0; f < 2; f++)
+            if ((sizes[f] = readRange(&ranges[f], blocks[f], block_size, offset)) <= 0) {
+                printf("Error in reading file: %s\n\n", filenames[f]);
+                entry->status = FAILURE;
+                goto END;
+            }
+        same = sizes[0] == sizes[1] && memcmp(blocks[0], blocks[1], (size_t) sizes[0]) == 0;
+    }
+
+    END:
+    if (entry->status != SUCCESS)
+        entry->group = entry->file_id;
+    else if (!same)
+        entry->group = -1;
+    for (int f = 0; f < 2; f++) {
+        releaseBuffer(blocks[f]);
+        if (fds[f] >= 0)
+            close(fds[f]);
+    }
+}
+
+/**
+ * qsort() comparator ordering cache entries by device and inode.
+ */
+private int compareCacheEntries(const void *entry1, const void *entry2) {
+    const CacheEntry *a = entry1, *b = entry2;
+    if (a->device != b->device)
+        return (a->device > b->device) - (a->device < b->device);
+    return (a->inode > b->inode) - (a->inode < b->inode);
+}
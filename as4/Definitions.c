@@ -17,35 +17,89 @@
  */
 
 #include "Definitions.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 /**
   * @author Aristos Georgiou
   */
 
+#define HEADER_CACHE_SIZE 1024
+
+/**
+ * A checked Header of a file, valid while the file keeps its size and
+ * modification time.
+ */
+typedef struct CachedHeader {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+    Header header;
+} CachedHeader;
+
+/**
+ * Headers of recently opened files by inode, for long running processes.
+ * Guarded by lock, off unless enableHeaderCache() was called.
+ */
+private struct {
+    int enabled;
+    CachedHeader entries[HEADER_CACHE_SIZE];
+    pthread_mutex_t lock;
+} header_cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ * Descriptor of the .wav stream of a - output, see separateStream().
+ */
+private int stream_fd = STDOUT_FILENO;
+
+private int cachedHeader(int fd, Header *wav_header, int store);
+
 
 /**
 * Initialises a Header* with the header of a .wav file.
 * Initialises a FILE* with the file called @param wav_filename.
 * FILE* will be at 44 bytes where the data section starts at the end.
+* A @param wav_filename of "-" reads the header from stdin instead.
+* The Header is allocated from @param arena, or malloc'd if it is NULL.
 *
+* @param arena
 * @param wav_header
 * @param wav_file
 * @param wav_filename
 * @return EXIT_CODE
 */
-public int getHeader(Header **wav_header, FILE **wav_file, char *wav_filename) {
-    *wav_header = malloc(HEADER_SIZE);
+public int getHeader(Arena *arena, Header **wav_header, FILE **wav_file, char *wav_filename) {
+    *wav_header = arena != NULL ? arenaAlloc(arena, HEADER_SIZE) : malloc(HEADER_SIZE);
     if (*wav_header == NULL) {
         printf("Sorry, program run out of memory.\n\n");
         return FAILURE;
     }
 
+    // Read the header of a stream unbuffered, so the data stays in the pipe
+    if (isStream(wav_filename)) {
+        *wav_file = stdin;
+        if (readFully(STDIN_FILENO, *wav_header, HEADER_SIZE) != HEADER_SIZE) {
+            printf("File not even 44 bytes: %s\n\n", wav_filename);
+            return FAILURE;
+        }
+        if (wavCheck(*wav_header) == FAILURE) {
+            printf("Invalid wav header.\n\n");
+            return FAILURE;
+        }
+        return SUCCESS;
+    }
+
     *wav_file = fopen(wav_filename, "rb");
     if (*wav_file == NULL) {
         printf("Error in opening file: %s\n\n", wav_filename);
         return FAILURE;
     }
 
+    if (header_cache.enabled && cachedHeader(fileno(*wav_file), *wav_header, 0) == SUCCESS)
+        return fseek(*wav_file, HEADER_SIZE, SEEK_SET) == 0 ? SUCCESS : FAILURE;
+
     if (fread(*wav_header, HEADER_SIZE, 1, *wav_file) != 1) {
         printf("File not even 44 bytes: %s\n\n", wav_filename);
         return FAILURE;
@@ -56,9 +110,20 @@ public int getHeader(Header **wav_header, FILE **wav_file, char *wav_filename) {
         return FAILURE;
     }
 
+    if (header_cache.enabled)
+        cachedHeader(fileno(*wav_file), *wav_header, 1);
     return SUCCESS;
 }
 
+/**
+ * Lets getHeader() skip reading and checking headers of files it has seen
+ * unchanged before. Meant for the daemon, which opens the same files job
+ * after job.
+ */
+public void enableHeaderCache() {
+    header_cache.enabled = 1;
+}
+
 /**
  * Checks if Header is actually a .wav Header.
  *
@@ -109,7 +174,7 @@ public void freePointer(void *pointer) {
 }
 
 /**
- * Converts a Header from stereo to mono.
+ * Converts a Header to mono.
  *
  * @param wav_header
  * @return EXIT CODE
@@ -118,16 +183,12 @@ public int makeHeaderMono(Header *wav_header) {
     if (wav_header->numChannels == 1)
         return FAILURE;
 
-    wav_header->numChannels = 1;
-    wav_header->subchunk2Size /= 2;
-    wav_header->chunkSize = wav_header->subchunk2Size + 36;
-    wav_header->byteRate /= 2;
-    wav_header->blockAlign /= 2;
+    setChannelCount(wav_header, 1);
     return SUCCESS;
 }
 
 /**
- * Converts a Header from mono to stereo.
+ * Converts a Header to stereo.
  *
  * @param wav_header
  */
@@ -135,11 +196,27 @@ public void makeHeaderStereo(Header *wav_header) {
     if (wav_header->numChannels == 2)
         return;
 
-    wav_header->numChannels = 2;
-    wav_header->subchunk2Size *= 2;
-    wav_header->chunkSize = wav_header->subchunk2Size + 36;
-    wav_header->byteRate *= 2;
-    wav_header->blockAlign *= 2;
+    setChannelCount(wav_header, 2);
+}
+
+/**
+ * Changes the number of channels of a Header, keeping the number of frames
+ * and the size of a sample. A stream of unknown length keeps STREAM_SIZE.
+ *
+ * @param wav_header
+ * @param channels
+ */
+public void setChannelCount(Header *wav_header, u_int channels) {
+    u_int sample_size = wav_header->blockAlign / max(wav_header->numChannels, 1);
+    u_int frames = wav_header->subchunk2Size / max(wav_header->blockAlign, 1);
+
+    wav_header->numChannels = (s_int) channels;
+    wav_header->blockAlign = (s_int) (sample_size * channels);
+    wav_header->byteRate = wav_header->sampleRate * wav_header->blockAlign;
+    if (wav_header->subchunk2Size != STREAM_SIZE) {
+        wav_header->subchunk2Size = frames * wav_header->blockAlign;
+        wav_header->chunkSize = wav_header->subchunk2Size + 36;
+    }
 }
 
 /**
@@ -150,7 +227,7 @@ public void makeHeaderStereo(Header *wav_header) {
  */
 public void changeHeaderDuration(Header *wav_header, int seconds) {
     wav_header->subchunk2Size = secondsToSamples(wav_header, seconds);
-    wav_header->chunkSize = wav_header->chunkSize + 36;
+    wav_header->chunkSize = wav_header->subchunk2Size + 36;
 }
 
 /**
@@ -169,3 +246,218 @@ public int headerToSeconds(Header *wav_header) {
 public u_int secondsToSamples(Header *wav_header, int seconds) {
     return seconds * wav_header->byteRate;
 }
+
+/**
+ * Initialises a u_char* with the whole data section of a file whose
+ * Header was read by getHeader(). The data lives in a pooled buffer, so
+ * release it with releaseBuffer(). The data of regular files is read by
+ * readQueued(), many parts at once.
+ *
+ * @param wav_header
+ * @param wav_file
+ * @param wav_data
+ * @return EXIT_CODE
+ */
+public int getData(Header *wav_header, FILE *wav_file, u_char **wav_data) {
+    *wav_data = getBuffer(max(wav_header->subchunk2Size, 1));
+    if (*wav_data == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return FAILURE;
+    }
+
+    // Regular files are read through the I/O queue, pipes with stdio
+    struct stat status;
+    off_t offset = ftello(wav_file);
+    if (wav_header->subchunk2Size > 0 && offset >= 0
+     && fstat(fileno(wav_file), &status) == 0 && S_ISREG(status.st_mode)) {
+        if (readQueued(getSharedIOQueue(), fileno(wav_file), *wav_data, wav_header->subchunk2Size, offset) != SUCCESS
+         || fseeko(wav_file, offset + wav_header->subchunk2Size, SEEK_SET) != 0) {
+            printf("Header information mismatch, exiting program.\n\n");
+            return FAILURE;
+        }
+    } else if (wav_header->subchunk2Size > 0
+     && fread(*wav_data, wav_header->subchunk2Size, 1, wav_file) != 1) {
+        printf("Header information mismatch, exiting program.\n\n");
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Reads exactly @param size bytes at @param offset of a file descriptor
+ * without moving its file offset, so threads can share the descriptor.
+ *
+ * @param fd
+ * @param buffer
+ * @param size
+ * @param offset
+ * @return EXIT_CODE
+ */
+public int preadFully(int fd, void *buffer, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t bytes = pread(fd, buffer, size, offset);
+        if (bytes <= 0)
+            return FAILURE;
+        buffer = (u_char *) buffer + bytes;
+        size -= (size_t) bytes;
+        offset += bytes;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Writes exactly @param size bytes at @param offset of a file descriptor
+ * without moving its file offset.
+ *
+ * @param fd
+ * @param buffer
+ * @param size
+ * @param offset
+ * @return EXIT_CODE
+ */
+public int pwriteFully(int fd, const void *buffer, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t bytes = pwrite(fd, buffer, size, offset);
+        if (bytes <= 0)
+            return FAILURE;
+        buffer = (const u_char *) buffer + bytes;
+        size -= (size_t) bytes;
+        offset += bytes;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Reads from a file descriptor until @param size bytes are read or the
+ * end of the file, for pipes that return less than asked.
+ *
+ * @param fd
+ * @param buffer
+ * @param size
+ * @return bytes read or -1 on error
+ */
+public ssize_t readFully(int fd, void *buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t bytes = read(fd, (u_char *) buffer + done, size - done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0)
+            return -1;
+        if (bytes == 0)
+            break;
+        done += (size_t) bytes;
+    }
+    return (ssize_t) done;
+}
+
+/**
+ * Writes exactly @param size bytes to a file descriptor at its offset.
+ *
+ * @param fd
+ * @param buffer
+ * @param size
+ * @return EXIT_CODE
+ */
+public int writeFully(int fd, const void *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t bytes = write(fd, buffer, size);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return FAILURE;
+        buffer = (const u_char *) buffer + bytes;
+        size -= (size_t) bytes;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @param wav_filename
+ * @return if @param wav_filename is "-", standing for stdin as input and
+ * stdout as output
+ */
+public int isStream(const char *wav_filename) {
+    return strcmp(wav_filename, "-") == 0;
+}
+
+/**
+ * Moves the .wav stream written to stdout to a descriptor of its own,
+ * returned from then on by getStreamFd(), and points stdout at stderr, so
+ * messages printed while streaming do not end up in the stream.
+ *
+ * @return EXIT_CODE
+ */
+public int separateStream() {
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        if (fd >= 0)
+            close(fd);
+        return FAILURE;
+    }
+    stream_fd = fd;
+    return SUCCESS;
+}
+
+/**
+ * @return the descriptor a .wav stream is written to, stdout unless
+ * separateStream() moved it
+ */
+public int getStreamFd() {
+    return stream_fd;
+}
+
+/**
+ * Prints a string as a CSV field or a JSON string, quoted and escaped.
+ *
+ * @param string
+ * @param json, escape for JSON instead of CSV
+ */
+public void printQuoted(const char *string, int json) {
+    putchar('"');
+    for (; *string != '\0'; string++) {
+        if (json && (*string == '"' || *string == '\\'))
+            printf("\\%c", *string);
+        else if (json && (u_char) *string < 0x20)
+            printf("\\u%04x", (u_char) *string);
+        else if (*string == '"')
+            printf("\"\"");
+        else
+            putchar(*string);
+    }
+    putchar('"');
+}
+
+/**
+ * Looks up or stores the Header of an open file in the header cache.
+ *
+ * @param fd
+ * @param wav_header, receives the cached Header, or is the one to store
+ * @param store
+ * @return EXIT_CODE, FAILURE on a miss
+ */
+private int cachedHeader(int fd, Header *wav_header, int store) {
+    struct stat status;
+    if (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode))
+        return FAILURE;
+
+    int EXIT_CODE = FAILURE;
+    pthread_mutex_lock(&header_cache.lock);
+    CachedHeader *entry = &header_cache.entries[(status.st_ino ^ status.st_dev) % HEADER_CACHE_SIZE];
+    if (store) {
+        entry->device = status.st_dev;
+        entry->inode = status.st_ino;
+        entry->size = status.st_size;
+        entry->modified = status.st_mtim;
+        entry->header = *wav_header;
+        EXIT_CODE = SUCCESS;
+    } else if (entry->inode == status.st_ino && entry->device == status.st_dev && entry->size == status.st_size
+            && entry->modified.tv_sec == status.st_mtim.tv_sec && entry->modified.tv_nsec == status.st_mtim.tv_nsec) {
+        *wav_header = entry->header;
+        EXIT_CODE = SUCCESS;
+    }
+    pthread_mutex_unlock(&header_cache.lock);
+    return EXIT_CODE;
+}
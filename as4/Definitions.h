@@ -29,6 +29,9 @@
 #include <ctype.h>
 #include <math.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
 
 /**
   * @author Aristos Georgiou
@@ -46,6 +49,29 @@
 #define SUCCESS 0
 #define FAILURE -1
 
+#define PIPELINE_BLOCK (1 << 20)
+#define IO_CHUNK (1 << 20)          // Bytes of one request of readQueued() and writeQueued().
+#define IO_DEPTH 32                 // Requests in flight in the I/O queue shared by the process.
+#define STREAM_SIZE 0xFFFFFFFF   // Chunk sizes of a stream of unknown length.
+
+#define JOURNAL_REVERSE 1
+#define JOURNAL_MONO 2
+#define JOURNAL_ENCODE 3
+
+#define LIVE_GAIN 1
+#define LIVE_MONO 2
+#define LIVE_MIX 3
+#define LIVE_EMBED 4
+
+#define EDIT_CHOP 1
+#define EDIT_REVERSE 2
+#define EDIT_GAIN 3
+#define EDIT_CONCAT 4
+
+#define MAX_ROUTE_CHANNELS 64
+
+#define PACKED_TILE 1024            // 24 bit samples unpacked at once by load24().
+
 typedef unsigned char u_char;
 typedef unsigned short int s_int;
 typedef unsigned int u_int;
@@ -78,22 +104,328 @@ typedef struct Header {
 
 } __attribute__((__packed__)) Header;
 
+/**
+ * Cached plan of a real FFT of @size samples, computed through a complex
+ * radix-2 transform of @half values.
+ */
+typedef struct FFTPlan {
+    u_int size;           // Number of real samples, a power of two.
+    u_int half;           // size / 2, length of the complex transform.
+    u_int *bit_reverse;   // Bit reversal permutation of [0..half - 1].
+    double *twiddle_re;   // Twiddles of every butterfly stage, stored contiguously.
+    double *twiddle_im;
+    double *split_re;     // exp(-2 * pi * i * k / size) for k = 0..half.
+    double *split_im;
+    struct FFTPlan *next;
+} FFTPlan;
+
+/**
+ * A pair of spectral peaks hashed into a fingerprint, and the STFT frame
+ * of its anchor peak.
+ */
+typedef struct Landmark {
+    u_int hash;
+    u_int time;
+} Landmark;
+
+/**
+ * One read or write of an I/O batch run by runIO().
+ */
+typedef struct IORequest {
+    int fd;
+    int write;          // 0 reads into buffer, 1 writes it.
+    void *buffer;
+    size_t size;
+    off_t offset;
+    int buffer_index;   // Index of a registered buffer containing buffer, or -1.
+    ssize_t result;     // Bytes transferred or -errno.
+    int *left;          // Requests of its runIO() call not completed yet, set by runIO().
+} IORequest;
+
+/**
+ * Queue of in flight I/O, backed by io_uring or by a pool of threads when
+ * ring_fd is -1. Threads may run requests through the same queue at once:
+ * lock guards the rings, one of them at a time waits in the kernel for
+ * completions and wakes the others through completed.
+ */
+typedef struct IOQueue {
+    int ring_fd;
+    u_int depth;
+    int registered;
+    void *sq_ring, *cq_ring, *entries, *completions;
+    size_t sq_ring_size, cq_ring_size, entries_size;
+    u_int *sq_head, *sq_tail, *sq_array, *cq_head, *cq_tail;
+    u_int sq_mask, cq_mask;
+    u_int in_flight;        // Entries in the rings, submitted or not.
+    u_int unsubmitted;      // Entries the kernel has not taken yet.
+    int waiting;            // Set while a thread waits in io_uring_enter().
+    int broken;             // Set once io_uring_enter() failed, the threads take over.
+    pthread_mutex_t lock;
+    pthread_cond_t completed;
+} IOQueue;
+
+/**
+ * A streaming operation split in three stages that run concurrently:
+ * read() fills input blocks, process() turns each into an output block, or
+ * copies it when NULL, and the output blocks are written back to back to
+ * output_fd from output_offset on.
+ */
+typedef struct Pipeline {
+    ssize_t (*read)(void *context, u_char *block, size_t capacity, u_int sequence);
+    void *read_context;
+    size_t (*process)(void *context, u_char *input, size_t size, u_char *output);
+    void *process_context;
+    size_t input_block;     // Capacity of input blocks.
+    size_t output_block;    // Capacity of output blocks, the output of a full input block.
+    int output_fd;
+    off_t output_offset;    // -1 writes at the offset of output_fd, for pipes.
+    off_t written;          // Bytes written, set by runPipeline().
+} Pipeline;
+
+/**
+ * Bytes [start, end) of a file, the source of readFileRange().
+ */
+typedef struct FileRange {
+    int fd;
+    off_t start;
+    off_t end;              // -1 up to the end of a stream.
+    int backwards;          // Read the blocks from the end towards the start.
+    int stream;             // Read fd sequentially, as a pipe.
+    off_t position;         // Offset of the next byte of a stream.
+} FileRange;
+
+/**
+ * Output of a streaming operation, a new file or stdout.
+ */
+typedef struct Output {
+    FILE *file;             // NULL for stdout.
+    int fd;
+    off_t data_offset;      // Pipeline output_offset of the data.
+    off_t header_offset;    // Offset of a header to patch at the end, or -1.
+} Output;
+
+/**
+ * An in place transform of a .wav file, done in steps whose bytes are
+ * logged to a redo journal first. Defined in Journal.c.
+ */
+typedef struct Journal {
+    int fd;                 // The journal, -1 until the first step.
+    int wav_fd;
+    char *filename;
+    u_int operation;
+    long long step;         // Next step to run.
+    Header header;          // Header of the .wav file before the transform.
+    u_char *record;         // Bytes of the next step, see reserveExtent().
+    size_t capacity;
+    size_t record_size;
+} Journal;
+
+/**
+ * Allocator of the small blocks of one job, such as a Header and a file
+ * name, released all at once. Defined in Memory.c.
+ */
+typedef struct Arena Arena;
+
+/**
+ * Allocation counters of the buffer pool and the arenas.
+ */
+typedef struct MemoryStats {
+    unsigned long buffer_requests;   // Calls to getBuffer().
+    unsigned long buffer_reuses;     // Requests served by an idle buffer.
+    unsigned long buffer_maps;       // Requests that mapped fresh memory.
+    unsigned long huge_buffers;      // Mappings on reserved huge pages.
+    unsigned long mapped_bytes;      // Bytes of buffers currently mapped.
+    unsigned long peak_mapped_bytes;
+    unsigned long arenas_acquired;
+    unsigned long arena_allocations;
+    unsigned long arena_chunks;      // Chunks malloc'd by arenas.
+} MemoryStats;
+
+/**
+ * Levels of one channel, relative to full scale.
+ */
+typedef struct ChannelStats {
+    double peak;
+    double rms;
+    double dc_offset;                // Mean sample value.
+    unsigned long long clipped;      // Samples at the largest or smallest value.
+    double zero_crossing_rate;       // Sign changes per second.
+} ChannelStats;
+
+/**
+ * Minimum, maximum and RMS of one channel over a range of frames.
+ */
+typedef struct PeakSummary {
+    double min;
+    double max;
+    double rms;
+} PeakSummary;
+
+/**
+ * A .wav file opened with its mapped peak file by openPeaks(). Defined in
+ * PeakPyramid.c.
+ */
+typedef struct Peaks {
+    int wav_fd;
+    Header header;                   // Of the .wav file.
+    u_int frames;
+    u_int levels;
+    u_int level_start[32];           // First entry of every level.
+    const struct PeakEntry *entries;
+    void *mapping;
+    size_t mapping_size;
+} Peaks;
+
+#define PAA_LEVELS 4
+
+/**
+ * Piecewise aggregate approximation of a data buffer at PAA_LEVELS
+ * resolutions, coarsest first, with the histogram of its byte values.
+ * Built by buildPAA() in PiecewiseAggregate.c.
+ */
+typedef struct PAA {
+    u_int size;
+    u_int *sums[PAA_LEVELS];         // Sum of every whole segment.
+    u_char *lows[PAA_LEVELS];
+    u_char *highs[PAA_LEVELS];
+    u_int histogram[256];
+} PAA;
+
+/**
+ * Counters of a run of runRealTime(), latencies in seconds.
+ */
+typedef struct RealTimeStats {
+    unsigned long long periods;      // Periods processed.
+    unsigned long long underruns;    // Periods that arrived more than a period late.
+    unsigned long long overruns;     // Periods the source had to hold while processing fell behind.
+    double mean_latency;             // From the last byte of a period read to its output written.
+    double max_latency;
+} RealTimeStats;
+
+/**
+ * A live stream processed in periods of a fixed number of frames by
+ * runRealTime(), defined in RealTime.c. process() turns the frames of one
+ * period into as many output frames and must not allocate or block.
+ */
+typedef struct RealTime {
+    int input_fd;                    // Read past its header.
+    Header header;                   // Of the input.
+    int output_fd;
+    off_t output_offset;             // -1 writes at the offset of output_fd, for pipes.
+    u_int period;                    // Frames per period.
+    u_int output_frame_size;
+    void (*process)(void *context, u_char *input, u_char *output, u_int frames);
+    void *context;
+    off_t written;                   // Bytes written, set by runRealTime().
+    RealTimeStats stats;
+} RealTime;
+
+/**
+ * Frames of a source .wav file an edit list plays.
+ */
+typedef struct Edit {
+    u_int source;                    // Index in the sources of the EditList.
+    u_int start;                     // First frame of the source range.
+    u_int frames;
+    u_int reverse;                   // Plays the range from its last frame to its first.
+    double gain;                     // Factor the samples are scaled by.
+} Edit;
+
+/**
+ * Edits played one after the other, in the format of header, instead of
+ * their rendered data. Defined in EditList.c.
+ */
+typedef struct EditList {
+    Header header;
+    u_int number_of_sources;
+    char **sources;                  // Absolute paths of the source .wav files.
+    int *fds;                        // Sources opened by openEditSources().
+    u_int number_of_edits;
+    Edit *edits;
+    unsigned long long *offsets;     // Frame of the list every edit starts at, by openEditSources().
+} EditList;
+
+/**
+ * A routing matrix from the channels of input frames to those of output
+ * frames, see ChannelRouter.c.
+ */
+typedef struct ChannelRoute {
+    u_int input_channels;
+    u_int output_channels;
+    u_int sample_size;
+    int select;                      // Every output is one input channel, unscaled.
+    u_int sources[MAX_ROUTE_CHANNELS];                      // Input channel of each output, if select.
+    double weights[MAX_ROUTE_CHANNELS][MAX_ROUTE_CHANNELS]; // Weight of input channel c in output o, [o][c].
+} ChannelRoute;
+
+// WavEngine.c
+public int runJob(int argc, char *arguments[]);
+
 // Definitions.c
-public int getHeader(Header **wav_header, FILE **wav_file, char *wav_filename);
+public int getHeader(Arena *arena, Header **wav_header, FILE **wav_file, char *wav_filename);
 public int wavCheck(Header *wav_header);
 public void closeFile(FILE *wav_file);
 public void freePointer(void *pointer);
 public int makeHeaderMono(Header *wav_header);
 public void makeHeaderStereo(Header *wav_header);
+public void setChannelCount(Header *wav_header, u_int channels);
 public void changeHeaderDuration(Header *wav_header, int seconds);
 public int headerToSeconds(Header *wav_header);
 public u_int secondsToSamples(Header *wav_header, int seconds);
+public int getData(Header *wav_header, FILE *wav_file, u_char **wav_data);
+public int preadFully(int fd, void *buffer, size_t size, off_t offset);
+public int pwriteFully(int fd, const void *buffer, size_t size, off_t offset);
+public ssize_t readFully(int fd, void *buffer, size_t size);
+public int writeFully(int fd, const void *buffer, size_t size);
+public int isStream(const char *wav_filename);
+public int separateStream();
+public int getStreamFd();
+public void enableHeaderCache();
+public void printQuoted(const char *string, int json);
+
+// Memory.c
+public Arena *acquireArena();
+public void *arenaAlloc(Arena *arena, size_t size);
+public void releaseArena(Arena *arena);
+public void *getBuffer(size_t size);
+public void releaseBuffer(void *data);
+public void freeMemoryPools();
+public void getMemoryStats(MemoryStats *stats);
+public void printMemoryStats();
+
+// Journal.c
+public int openJournal(Journal *journal, char *wav_filename, u_int operation);
+public int beginRecord(Journal *journal, size_t capacity, size_t extents);
+public u_char *reserveExtent(Journal *journal, off_t offset, size_t size);
+public int commitStep(Journal *journal, off_t truncate_size);
+public void closeJournal(Journal *journal, int finished);
 
 // HeaderDisplay.c
 public int displayHeaders(char **files, int number_of_files);
 
 // StereoToMonoConverter.c
 public int convertToMonos(char **files, int number_of_files);
+public int convertToMonosInPlace(char **files, int number_of_files);
+
+// AsyncIO.c
+public int openIOQueue(IOQueue *queue, u_int depth);
+public void closeIOQueue(IOQueue *queue);
+public const char *getIOBackend(IOQueue *queue);
+public int registerIOBuffers(IOQueue *queue, void **buffers, size_t *sizes, int number_of_buffers);
+public int runIO(IOQueue *queue, IORequest *requests, int number_of_requests);
+public IOQueue *getSharedIOQueue();
+public int readQueued(IOQueue *queue, int fd, void *buffer, size_t size, off_t offset);
+public int writeQueued(IOQueue *queue, int fd, const void *buffer, size_t size, off_t offset);
+
+// Pipeline.c
+public int runPipeline(Pipeline *pipeline);
+public int runParallelPipeline(Pipeline *pipeline, off_t input_size);
+public ssize_t readFileRange(void *context, u_char *block, size_t capacity, u_int sequence);
+public size_t getBlockSize(u_int frame_size);
+public ssize_t readRange(FileRange *range, u_char *buffer, size_t size, off_t offset);
+public int openOutput(Output *output, int stream, char *output_filename, Header *wav_header);
+public int finishOutput(Output *output, Header *wav_header, off_t data_size);
+public void closeOutput(Output *output);
 
 // Mixer.c
 public int mix(char *wav_filename1, char *wav_filename2);
@@ -101,14 +433,132 @@ public int mix(char *wav_filename1, char *wav_filename2);
 // Choper.c
 public int chop(char *wav_filename, int start_sec, int end_second);
 
+// Splitter.c
+public int splitByCount(char *wav_filename, int number_of_segments);
+public int splitBySeconds(char *wav_filename, double seconds);
+public int splitByCues(char *wav_filename, char *cue_filename);
+public int writeSegments(char *prefix, char *wav_filename, Header *wav_header, int fd,
+                         u_int *starts, u_int *ends, int number_of_segments);
+public int copyRange(int in_fd, off_t in_offset, int out_fd, off_t out_offset, off_t size);
+
+// SilenceDetector.c
+public int trimSilence(char *wav_filename, double threshold_db);
+public int splitOnSilence(char *wav_filename, double threshold_db, double min_silence);
+
+// SignalStatistics.c
+public int printSignalStats(char **files, int number_of_files, int json);
+public int getSignalStats(Header *wav_header, int fd, int stream, ChannelStats *stats);
+
+// PeakPyramid.c
+public int printPeaks(char *wav_filename, double start, double end, int points);
+public int openPeaks(Peaks *peaks, char *wav_filename);
+public int queryPeaks(Peaks *peaks, u_int start, u_int end, PeakSummary *summary);
+public void closePeaks(Peaks *peaks);
+
 // Reverser.c
 public int reverseFiles(char **files, int number_of_files);
+public int reverseFilesInPlace(char **files, int number_of_files);
 
 // SimilarityCalculator.c
 public int calculateDistance(char **files, int number_of_files);
+public int similarityMatrix(char **files, int number_of_files, int lcss, double threshold);
+public double euclidean(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2);
+public double euclidean24(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2);
+public double LCSS(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2);
+public double resumableLCSS(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2,
+                            char *checkpoint_filename, int *checkpointed);
+
+// Aligner.c
+#define NO_MATCH 0xFFFFFFFF
+public int printAlignment(char *wav_filename1, char *wav_filename2, u_int min_run);
+public long long alignLCSS(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2, u_int *matches);
+
+// Deduplicator.c
+public int findDuplicates(char **files, int number_of_files, char *cache_filename);
+
+// RealTime.c
+public int runRealTime(RealTime *stream);
+public int processLive(char *input_filename, char *output_filename, u_int period, int effect, char *parameter);
+public int writeTone(char *output_filename, double seconds, double frequency);
+
+// EditList.c
+public int editFiles(char *output_filename, int operation, char **inputs, int number_of_inputs,
+                     double first, double second);
+public int renderEditList(char *list_filename, char *output_filename, double start, double end);
+public int loadEditList(char *filename, EditList *list);
+public int saveEditList(char *filename, EditList *list);
+public int openEditSources(EditList *list);
+public int renderEdits(EditList *list, unsigned long long first, size_t frames, u_char *output);
+public void freeEditList(EditList *list);
+
+// Concatenator.c
+public int concatenateFiles(char *output_filename, char **files, int number_of_files, double seconds);
+
+// ChannelRouter.c
+public int routeFiles(char *spec, char **files, int number_of_files);
+public int parseRoute(const char *spec, u_int input_channels, u_int sample_size, ChannelRoute *route);
+public void selectChannels(ChannelRoute *route, u_int input_channels, u_int sample_size,
+                           const u_int *sources, u_int output_channels);
+public size_t routeFrames(void *context, u_char *input, size_t size, u_char *output);
+public void gatherChannels(const u_char *const *frames, const size_t *frame_sizes, const u_int *channels,
+                           u_int output_channels, u_int sample_size, size_t count, u_char *output);
+
+// PiecewiseAggregate.c
+public int buildPAA(u_char *wav_data, u_int size, PAA *paa);
+public void freePAA(PAA *paa);
+public double cascadeDistance(PAA *paa1, PAA *paa2, u_char *wav_data1, u_char *wav_data2, int lcss, double threshold);
+
+// SampleConverter.c
+public double sampleToDouble(const u_char *sample, int sample_size);
+public double *getMonoSamples(Header *wav_header, u_char *wav_data, u_int *number_of_frames);
+public void decodeMonoFrames(Header *wav_header, u_char *wav_data, u_int number_of_frames, double *samples);
+public double *getEnvelope(double *signal, u_int length, u_int frames_per_point, u_int *points);
+public void scaleSamples(const u_char *input, u_char *output, size_t samples, u_int sample_size, double gain);
+public long readSample(const u_char *sample, u_int sample_size);
+public void writeSample(u_char *sample, u_int sample_size, long value);
+public void load24(const u_char *input, int *output, size_t samples);
+public void store24(const int *input, u_char *output, size_t samples);
+
+// FourierTransform.c
+public u_int nextPowerOfTwo(u_int n);
+public FFTPlan *getFFTPlan(u_int size);
+public void freeFFTPlans();
+public void realFFT(FFTPlan *plan, const double *input, double *re, double *im);
+public void inverseRealFFT(FFTPlan *plan, double *re, double *im, double *output);
+
+// Correlator.c
+public int correlateFiles(char **files, int number_of_files);
+public int crossCorrelate(double *signal1, u_int length1, double *signal2, u_int length2,
+                          int *lag, double *coefficient);
+
+// Daemon.c
+public int runDaemon(char *socket_path);
+public int runClient(char *socket_path, char **arguments, int number_of_arguments);
+
+// ThreadPool.c
+public int getThreadCount();
+public int parallelFor(int number_of_tasks, void (*task)(void *context, int task_id), void *context);
+public int parallelForThreads(int number_of_threads, int number_of_tasks,
+                              void (*task)(void *context, int task_id), void *context);
+
+// Finder.c
+public int findClip(char *probe_filename, char *haystack_filename, double threshold);
+
+// Fingerprinter.c
+public int buildIndex(char *index_filename, char **files, int number_of_files);
+public int lookupIndex(char *index_filename, char *probe_filename);
+public int fingerprint(double *signal, u_int length, u_int sample_rate,
+                       Landmark **landmarks, u_int *number_of_landmarks);
+
+// TimeWarper.c
+public int dtwNearest(char **files, int number_of_files);
+public double dtwDistance(const double *query, const double *candidate, u_int length, u_int band,
+                          const double *cumulative_bound, u_int bound_shift, double best_so_far,
+                          double *rows);
 
 // Encoder.c
 public int encodeToFile(char *wav_filename, char *text_filename);
+public int encodeInPlace(char *wav_filename, char *text_filename);
 public u_int *createPermutations(int msg_length, u_int key);
 
 // Decoder.c
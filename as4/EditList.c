@@ -0,0 +1,632 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    EditList.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define MAX_EDITS (1 << 24)
+#define NO_SOURCE 0xFFFFFFFF
+
+static const char EDIT_MAGIC[8] = "WAVEDL1";
+
+/**
+ * Layout of an edit list file: the counts after EDIT_MAGIC, then the
+ * length and bytes of every source name, then the edits.
+ */
+typedef struct EditListHeader {
+    char magic[8];
+    Header header;
+    u_int number_of_sources;
+    u_int number_of_edits;
+} __attribute__((__packed__)) EditListHeader;
+
+/**
+ * Frames of an edit list rendered by the pipeline reader readEdits().
+ */
+typedef struct EditRange {
+    EditList *list;
+    unsigned long long first;
+    unsigned long long frames;
+} EditRange;
+
+private int loadSource(char *filename, EditList *list);
+
+private int appendEdit(EditList *list, Edit edit);
+
+private int appendList(EditList *list, EditList *other, unsigned long long from, unsigned long long to);
+
+private u_int addSource(EditList *list, char *source);
+
+private unsigned long long countFrames(EditList *list);
+
+private ssize_t readEdits(void *context, u_char *block, size_t capacity, u_int sequence);
+
+private void reverseInPlace(u_char *frames, size_t number_of_frames, size_t frame_size);
+
+
+/**
+ * Writes an edit list to @param output_filename instead of new data: the
+ * first input, a .wav file or an edit list, chopped from @param first to
+ * @param second seconds, reversed, scaled by @param first dB, or followed
+ * by the other inputs. Only the list is read and written, never the data.
+ * Option ID: 26
+ *
+ * @param output_filename
+ * @param operation, EDIT_CHOP, EDIT_REVERSE, EDIT_GAIN or EDIT_CONCAT
+ * @param inputs, .wav files or edit lists
+ * @param number_of_inputs
+ * @param first
+ * @param second
+ * @return EXIT_CODE
+ */
+public int editFiles(char *output_filename, int operation, char **inputs, int number_of_inputs,
+                     double first, double second) {
+    int EXIT_CODE;
+    EditList list, result, other;
+    memset(&result, 0, sizeof(EditList));
+    memset(&other, 0, sizeof(EditList));
+
+    EXIT_CODE = loadEditList(inputs[0], &list);
+    if (EXIT_CODE != SUCCESS)
+        return FAILURE;
+
+    switch (operation) {
+        case EDIT_CHOP: {
+            unsigned long long frames = countFrames(&list);
+            unsigned long long from = (unsigned long long) (max(first, 0) * list.header.sampleRate);
+            unsigned long long to = (unsigned long long) (max(second, 0) * list.header.sampleRate);
+            if (second <= first || from >= frames) {
+                EXIT_CODE = FAILURE;
+                printf("Parameters for seconds are invalid.\n\n");
+                goto END;
+            }
+            result.header = list.header;
+            EXIT_CODE = appendList(&result, &list, from, min(to, frames));
+            break;
+        }
+        case EDIT_REVERSE:
+            result.header = list.header;
+            for (u_int i = list.number_of_edits; i > 0 && EXIT_CODE == SUCCESS; i--) {
+                Edit edit = list.edits[i - 1];
+                edit.reverse = !edit.reverse;
+                edit.source = addSource(&result, list.sources[edit.source]);
+                EXIT_CODE = edit.source == NO_SOURCE ? FAILURE : appendEdit(&result, edit);
+            }
+            break;
+        case EDIT_GAIN:
+            for (u_int i = 0; i < list.number_of_edits; i++)
+                list.edits[i].gain *= pow(10, first / 20);
+            result = list;
+            memset(&list, 0, sizeof(EditList));
+            break;
+        case EDIT_CONCAT:
+            result.header = list.header;
+            EXIT_CODE = appendList(&result, &list, 0, countFrames(&list));
+            for (int i = 1; i < number_of_inputs && EXIT_CODE == SUCCESS; i++) {
+                EXIT_CODE = loadEditList(inputs[i], &other);
+                if (EXIT_CODE != SUCCESS)
+                    goto END;
+                if (other.header.blockAlign != result.header.blockAlign
+                 || other.header.numChannels != result.header.numChannels
+                 || other.header.sampleRate != result.header.sampleRate) {
+                    EXIT_CODE = FAILURE;
+                    printf("Incompatible files: %s, %s\n\n", inputs[0], inputs[i]);
+                    goto END;
+                }
+                EXIT_CODE = appendList(&result, &other, 0, countFrames(&other));
+                freeEditList(&other);
+            }
+            break;
+        default:
+            EXIT_CODE = FAILURE;
+            goto END;
+    }
+    if (EXIT_CODE != SUCCESS) {
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    EXIT_CODE = saveEditList(output_filename, &result);
+    if (EXIT_CODE != SUCCESS) {
+        printf("Error in writing file: %s\n\n", output_filename);
+        goto END;
+    }
+    printf("%s: %u edits of %u sources, %.3f s\n\n", output_filename, result.number_of_edits,
+           result.number_of_sources, (double) countFrames(&result) / max(result.header.sampleRate, 1));
+
+    END:
+    freeEditList(&list);
+    freeEditList(&result);
+    freeEditList(&other);
+    return EXIT_CODE;
+}
+
+/**
+ * Renders an edit list, or the frames from @param start to @param end
+ * seconds of it, into a .wav file. Only the source ranges the frames come
+ * from are read, block by block, on every thread.
+ * Option ID: 27
+ *
+ * @param list_filename
+ * @param output_filename, or - for stdout
+ * @param start
+ * @param end, -1 for the end of the list
+ * @return EXIT_CODE
+ */
+public int renderEditList(char *list_filename, char *output_filename, double start, double end) {
+    int EXIT_CODE;
+    EditList list;
+    Output output = {NULL, -1, 0, -1};
+
+    EXIT_CODE = loadEditList(list_filename, &list);
+    if (EXIT_CODE != SUCCESS)
+        return FAILURE;
+
+    unsigned long long frames = countFrames(&list);
+    unsigned long long first = (unsigned long long) (max(start, 0) * list.header.sampleRate);
+    unsigned long long last = end < 0 ? frames : min((unsigned long long) (end * list.header.sampleRate), frames);
+    if ((end >= 0 && end <= start) || first >= last) {
+        EXIT_CODE = FAILURE;
+        printf("Parameters for seconds are invalid.\n\n");
+        goto END;
+    }
+
+    EXIT_CODE = openEditSources(&list);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    size_t frame_size = list.header.blockAlign;
+    last = min(last, first + (STREAM_SIZE - 36) / frame_size);
+    Header wav_header = list.header;
+    wav_header.subchunk2Size = (u_int) ((last - first) * frame_size);
+    wav_header.chunkSize = wav_header.subchunk2Size + 36;
+    EXIT_CODE = openOutput(&output, isStream(output_filename), output_filename, &wav_header);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    EditRange range = {&list, first, last - first};
+    size_t block = getBlockSize((u_int) frame_size);
+    Pipeline pipeline = {readEdits, &range, NULL, NULL, block, block, output.fd, output.data_offset};
+    if (runParallelPipeline(&pipeline, (off_t) (range.frames * frame_size)) != SUCCESS
+     || finishOutput(&output, &wav_header, pipeline.written) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        printf("Header information mismatch, exiting program.\n\n");
+    }
+
+    END:
+    freeEditList(&list);
+    closeOutput(&output);
+    return EXIT_CODE;
+}
+
+/**
+ * Reads an edit list file, or makes the list of one edit that plays a
+ * .wav file whole.
+ *
+ * @param filename
+ * @param list, released with freeEditList()
+ * @return EXIT_CODE
+ */
+public int loadEditList(char *filename, EditList *list) {
+    EditListHeader file_header;
+    memset(list, 0, sizeof(EditList));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Error in opening file: %s\n\n", filename);
+        return FAILURE;
+    }
+    if (preadFully(fd, &file_header, sizeof(EditListHeader), 0) != SUCCESS
+     || memcmp(file_header.magic, EDIT_MAGIC, sizeof(EDIT_MAGIC)) != 0) {
+        close(fd);
+        return loadSource(filename, list);
+    }
+
+    // The counts are checked against the size before anything is allocated
+    struct stat list_stat;
+    int EXIT_CODE = fstat(fd, &list_stat) == 0 && file_header.number_of_edits <= MAX_EDITS
+                    && file_header.number_of_sources <= MAX_EDITS && file_header.header.blockAlign > 0
+                    && (off_t) sizeof(EditListHeader) + (off_t) file_header.number_of_edits * (off_t) sizeof(Edit)
+                       + (off_t) file_header.number_of_sources * (off_t) sizeof(u_int) <= list_stat.st_size
+                    ? SUCCESS : FAILURE;
+    list->header = file_header.header;
+    list->sources = EXIT_CODE == SUCCESS ? calloc(max(file_header.number_of_sources, 1), sizeof(char *)) : NULL;
+    list->edits = EXIT_CODE == SUCCESS ? malloc(max(file_header.number_of_edits, 1) * sizeof(Edit)) : NULL;
+    if (list->sources == NULL || list->edits == NULL)
+        EXIT_CODE = FAILURE;
+
+    off_t offset = sizeof(EditListHeader);
+    for (u_int i = 0; i < file_header.number_of_sources && EXIT_CODE == SUCCESS; i++) {
+        u_int length;
+        EXIT_CODE = preadFully(fd, &length, sizeof(u_int), offset);
+        if (EXIT_CODE != SUCCESS || length > PATH_MAX || (list->sources[i] = malloc(length + 1)) == NULL) {
+            EXIT_CODE = FAILURE;
+            break;
+        }
+        list->number_of_sources++;
+        EXIT_CODE = preadFully(fd, list->sources[i], length, offset + (off_t) sizeof(u_int));
+        list->sources[i][length] = '\0';
+        offset += (off_t) (sizeof(u_int) + length);
+    }
+    if (EXIT_CODE == SUCCESS)
+        EXIT_CODE = preadFully(fd, list->edits, file_header.number_of_edits * sizeof(Edit), offset);
+    for (u_int i = 0; i < file_header.number_of_edits && EXIT_CODE == SUCCESS; i++)
+        if (list->edits[i].source >= list->number_of_sources)
+            EXIT_CODE = FAILURE;
+    list->number_of_edits = file_header.number_of_edits;
+    close(fd);
+
+    if (EXIT_CODE != SUCCESS) {
+        printf("Error in reading file: %s\n\n", filename);
+        freeEditList(list);
+    }
+    return EXIT_CODE;
+}
+
+/**
+ * Writes an edit list under a temporary name and renames it into place.
+ *
+ * @param filename
+ * @param list
+ * @return EXIT_CODE
+ */
+public int saveEditList(char *filename, EditList *list) {
+    EditListHeader file_header;
+    memcpy(file_header.magic, EDIT_MAGIC, sizeof(EDIT_MAGIC));
+    file_header.header = list->header;
+    file_header.header.subchunk2Size = (u_int) min(countFrames(list) * list->header.blockAlign,
+                                                   (unsigned long long) STREAM_SIZE - 36);
+    file_header.header.chunkSize = file_header.header.subchunk2Size + 36;
+    file_header.number_of_sources = list->number_of_sources;
+    file_header.number_of_edits = list->number_of_edits;
+
+    char *temporary_filename = malloc(8 + strlen(filename));
+    if (temporary_filename == NULL)
+        return FAILURE;
+    snprintf(temporary_filename, 8 + strlen(filename), "%s.XXXXXX", filename);
+
+    int fd = mkstemp(temporary_filename);
+    int EXIT_CODE = fd < 0 ? FAILURE : pwriteFully(fd, &file_header, sizeof(EditListHeader), 0);
+    off_t offset = sizeof(EditListHeader);
+    for (u_int i = 0; i < list->number_of_sources && EXIT_CODE == SUCCESS; i++) {
+        u_int length = (u_int) strlen(list->sources[i]);
+        EXIT_CODE = pwriteFully(fd, &length, sizeof(u_int), offset);
+        if (EXIT_CODE == SUCCESS)
+            EXIT_CODE = pwriteFully(fd, list->sources[i], length, offset + (off_t) sizeof(u_int));
+        offset += (off_t) (sizeof(u_int) + length);
+    }
+    if (EXIT_CODE == SUCCESS)
+        EXIT_CODE = pwriteFully(fd, list->edits, list->number_of_edits * sizeof(Edit), offset);
+    if (EXIT_CODE == SUCCESS && (fchmod(fd, 0644) != 0 || rename(temporary_filename, filename) != 0))
+        EXIT_CODE = FAILURE;
+
+    if (fd >= 0) {
+        if (EXIT_CODE != SUCCESS)
+            unlink(temporary_filename);
+        close(fd);
+    }
+    freePointer(temporary_filename);
+    return EXIT_CODE;
+}
+
+/**
+ * Opens the sources of an edit list for renderEdits() and notes where
+ * every edit starts, checking that each source still holds the frames its
+ * edits play.
+ *
+ * @param list
+ * @return EXIT_CODE
+ */
+public int openEditSources(EditList *list) {
+    list->fds = malloc(max(list->number_of_sources, 1) * sizeof(int));
+    list->offsets = malloc(((size_t) list->number_of_edits + 1) * sizeof(unsigned long long));
+    if (list->fds == NULL || list->offsets == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return FAILURE;
+    }
+    for (u_int i = 0; i < list->number_of_sources; i++)
+        list->fds[i] = -1;
+
+    int EXIT_CODE = SUCCESS;
+    u_int *frames = calloc(max(list->number_of_sources, 1), sizeof(u_int));
+    for (u_int i = 0; i < list->number_of_sources && frames != NULL; i++) {
+        Header wav_header;
+        list->fds[i] = open(list->sources[i], O_RDONLY);
+        if (list->fds[i] < 0 || preadFully(list->fds[i], &wav_header, HEADER_SIZE, 0) != SUCCESS
+         || wavCheck(&wav_header) != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            printf("Error in opening file: %s\n\n", list->sources[i]);
+            break;
+        }
+        // A source rewritten since the list was made must still play the same way
+        if (wav_header.blockAlign != list->header.blockAlign || wav_header.numChannels != list->header.numChannels
+         || wav_header.sampleRate != list->header.sampleRate) {
+            EXIT_CODE = FAILURE;
+            printf("Header information mismatch, exiting program.\n\n");
+            break;
+        }
+        frames[i] = wav_header.subchunk2Size / wav_header.blockAlign;
+    }
+
+    list->offsets[0] = 0;
+    for (u_int i = 0; i < list->number_of_edits && EXIT_CODE == SUCCESS && frames != NULL; i++) {
+        Edit *edit = &list->edits[i];
+        if ((unsigned long long) edit->start + edit->frames > frames[edit->source]) {
+            EXIT_CODE = FAILURE;
+            printf("Header information mismatch, exiting program.\n\n");
+        }
+        list->offsets[i + 1] = list->offsets[i] + edit->frames;
+    }
+    if (frames == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+    }
+    freePointer(frames);
+    return EXIT_CODE;
+}
+
+/**
+ * Renders @param frames frames of an edit list from frame @param first on,
+ * reading only the source frames they come from. The first edit is found
+ * by binary search, so a region costs O(log e) plus its own edits.
+ * Thread safe once openEditSources() succeeded.
+ *
+ * @param list
+ * @param first
+ * @param frames
+ * @param output, receives the frames
+ * @return EXIT_CODE
+ */
+public int renderEdits(EditList *list, unsigned long long first, size_t frames, u_char *output) {
+    size_t frame_size = list->header.blockAlign;
+    u_int sample_size = list->header.blockAlign / max(list->header.numChannels, 1);
+    unsigned long long end = first + frames;
+
+    // The last edit starting at or before first
+    u_int low = 0, high = list->number_of_edits;
+    while (high - low > 1) {
+        u_int middle = low + (high - low) / 2;
+        if (list->offsets[middle] <= first)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    for (u_int i = low; i < list->number_of_edits && list->offsets[i] < end; i++) {
+        Edit *edit = &list->edits[i];
+        unsigned long long from = max(first, list->offsets[i]) - list->offsets[i];
+        unsigned long long to = min(end, list->offsets[i + 1]) - list->offsets[i];
+        if (from >= to)
+            continue;
+
+        // A reversed edit plays its source range from the last frame
+        size_t count = (size_t) (to - from);
+        unsigned long long source_frame = edit->reverse ? edit->start + edit->frames - to : edit->start + from;
+        u_char *out = output + (size_t) (list->offsets[i] + from - first) * frame_size;
+        if (preadFully(list->fds[edit->source], out, count * frame_size,
+                       HEADER_SIZE + (off_t) (source_frame * frame_size)) != SUCCESS)
+            return FAILURE;
+        if (edit->reverse)
+            reverseInPlace(out, count, frame_size);
+        if (edit->gain != 1)
+            scaleSamples(out, out, count * list->header.numChannels, sample_size, edit->gain);
+    }
+    return SUCCESS;
+}
+
+/**
+ * Frees an edit list and closes its sources.
+ *
+ * @param list
+ */
+public void freeEditList(EditList *list) {
+    for (u_int i = 0; i < list->number_of_sources; i++) {
+        if (list->fds != NULL && list->fds[i] >= 0)
+            close(list->fds[i]);
+        freePointer(list->sources[i]);
+    }
+    freePointer(list->sources);
+    freePointer(list->fds);
+    freePointer(list->edits);
+    freePointer(list->offsets);
+    memset(list, 0, sizeof(EditList));
+}
+
+/**
+ * Makes the list of one edit that plays a .wav file whole.
+ *
+ * @param filename
+ * @param list
+ * @return EXIT_CODE
+ */
+private int loadSource(char *filename, EditList *list) {
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+    char *source = NULL;
+
+    int EXIT_CODE = getHeader(NULL, &wav_header, &wav_file, filename);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    // Sources are kept by absolute path, so the list can be used from anywhere
+    source = realpath(filename, NULL);
+    if (source == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Error in opening file: %s\n\n", filename);
+        goto END;
+    }
+    list->header = *wav_header;
+    Edit edit = {0, 0, wav_header->subchunk2Size / max(wav_header->blockAlign, 1), 0, 1};
+    if ((edit.source = addSource(list, source)) == NO_SOURCE
+     || appendEdit(list, edit) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        freeEditList(list);
+    }
+
+    END:
+    freePointer(wav_header);
+    freePointer(source);
+    closeFile(wav_file);
+    return EXIT_CODE;
+}
+
+/**
+ * Appends an edit, merged into the last one when it continues it.
+ *
+ * @param list
+ * @param edit
+ * @return EXIT_CODE
+ */
+private int appendEdit(EditList *list, Edit edit) {
+    if (edit.frames == 0)
+        return SUCCESS;
+
+    if (list->number_of_edits > 0) {
+        Edit *last = &list->edits[list->number_of_edits - 1];
+        int continues = edit.reverse ? edit.start + edit.frames == last->start : last->start + last->frames == edit.start;
+        if (last->source == edit.source && last->reverse == edit.reverse && last->gain == edit.gain && continues
+         && (unsigned long long) last->frames + edit.frames <= 0xFFFFFFFF) {
+            if (edit.reverse)
+                last->start = edit.start;
+            last->frames += edit.frames;
+            return SUCCESS;
+        }
+    }
+
+    // Capacity doubles at every power of two
+    u_int count = list->number_of_edits;
+    if (count >= MAX_EDITS)
+        return FAILURE;
+    if ((count & (count - 1)) == 0) {
+        Edit *edits = realloc(list->edits, max(2 * (size_t) count, 1) * sizeof(Edit));
+        if (edits == NULL)
+            return FAILURE;
+        list->edits = edits;
+    }
+    list->edits[list->number_of_edits++] = edit;
+    return SUCCESS;
+}
+
+/**
+ * Appends the frames from @param from to @param to of another list.
+ *
+ * @param list
+ * @param other
+ * @param from
+ * @param to
+ * @return EXIT_CODE
+ */
+private int appendList(EditList *list, EditList *other, unsigned long long from, unsigned long long to) {
+    unsigned long long position = 0;
+    for (u_int i = 0; i < other->number_of_edits && position < to; i++) {
+        Edit edit = other->edits[i];
+        unsigned long long start = max(from, position) - position;
+        unsigned long long end = min(to, position + edit.frames) - position;
+        position += edit.frames;
+        if (start >= end)
+            continue;
+
+        // A reversed edit keeps the end of its source range for its first frames
+        edit.start = edit.reverse ? edit.start + edit.frames - (u_int) end : edit.start + (u_int) start;
+        edit.frames = (u_int) (end - start);
+        edit.source = addSource(list, other->sources[edit.source]);
+        if (edit.source == NO_SOURCE || appendEdit(list, edit) != SUCCESS)
+            return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @param list
+ * @param source
+ * @return index of the source in the list, added if new, NO_SOURCE if out
+ * of memory
+ */
+private u_int addSource(EditList *list, char *source) {
+    for (u_int i = 0; i < list->number_of_sources; i++)
+        if (strcmp(list->sources[i], source) == 0)
+            return i;
+
+    char **sources = realloc(list->sources, ((size_t) list->number_of_sources + 1) * sizeof(char *));
+    if (sources == NULL)
+        return NO_SOURCE;
+    list->sources = sources;
+    list->sources[list->number_of_sources] = strdup(source);
+    if (list->sources[list->number_of_sources] == NULL)
+        return NO_SOURCE;
+    return list->number_of_sources++;
+}
+
+/**
+ * @param list
+ * @return frames the list plays
+ */
+private unsigned long long countFrames(EditList *list) {
+    unsigned long long frames = 0;
+    for (u_int i = 0; i < list->number_of_edits; i++)
+        frames += list->edits[i].frames;
+    return frames;
+}
+
+/**
+ * Pipeline reader rendering the blocks of an EditRange.
+ *
+ * @param context, the EditRange
+ * @param block
+ * @param capacity
+ * @param sequence
+ * @return bytes rendered, 0 after the last frame or -1 on error
+ */
+private ssize_t readEdits(void *context, u_char *block, size_t capacity, u_int sequence) {
+    EditRange *range = context;
+    size_t frame_size = range->list->header.blockAlign;
+    size_t frames_per_block = capacity / frame_size;
+    unsigned long long done = (unsigned long long) sequence * frames_per_block;
+    if (done >= range->frames)
+        return 0;
+
+    size_t frames = (size_t) min((unsigned long long) frames_per_block, range->frames - done);
+    if (renderEdits(range->list, range->first + done, frames, block) != SUCCESS)
+        return -1;
+    return (ssize_t) (frames * frame_size);
+}
+
+/**
+ * Reverses the order of frames in place.
+ *
+ * @param frames
+ * @param number_of_frames
+ * @param frame_size
+ */
+private void reverseInPlace(u_char *frames, size_t number_of_frames, size_t frame_size) {
+    if (number_of_frames < 2)
+        return;
+    for (size_t i = 0, j = number_of_frames - 1; i < j; i++, j--)
+        for (size_t b = 0; b < frame_size; b++) {
+            u_char temp = frames[i * frame_size + b];
+            frames[i * frame_size + b] = frames[j * frame_size + b];
+            frames[j * frame_size + b] = temp;
+        }
+}
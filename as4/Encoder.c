@@ -17,12 +17,17 @@
  */
 
 #include "Definitions.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /**
   * @author Aristos Georgiou
   */
 
 
+private int getMessage(Header *wav_header, char *text_filename, char **msg, long *msg_length,
+                      u_int **permutations);
+
 private int getBit(char *msg, int n);
 
 /**
@@ -36,18 +41,18 @@ private int getBit(char *msg, int n);
 public int encodeToFile(char *wav_filename, char *text_filename) {
     int EXIT_CODE;
     Header *wav_header = NULL;
-    FILE *wav_file = NULL, *text_file = NULL;
+    FILE *wav_file = NULL;
     u_char *wav_file_data = NULL;
     char *msg_to_encode = NULL, *new_wav_filename = NULL;
     u_int *permutations = NULL;
 
     // Initialise wav_header from wav_file
-    EXIT_CODE = getHeader(&wav_header, &wav_file, wav_filename);
+    EXIT_CODE = getHeader(NULL, &wav_header, &wav_file, wav_filename);
     if (EXIT_CODE != SUCCESS)
         goto END;
 
     // Initialise wav_file_data from the data of wav_file
-    wav_file_data = malloc(wav_header->subchunk2Size);
+    wav_file_data = getBuffer(wav_header->subchunk2Size);
     if (wav_file_data == NULL) {
         EXIT_CODE = FAILURE;
         printf("Sorry, program run out of memory.\n\n");
@@ -60,47 +65,10 @@ public int encodeToFile(char *wav_filename, char *text_filename) {
         goto END;
     }
 
-    // Open file with the text to be encoded
-    text_file = fopen(text_filename, "r");
-    if (text_file == NULL) {
-        EXIT_CODE = FAILURE;
-        printf("Error in opening file: %s\n\n", text_filename);
-        goto END;
-    }
-
-    // Get number of chars in the file
-    fseek(text_file, 0, SEEK_END);
-    long msg_length = ftell(text_file);
-    rewind(text_file);
-
-    // Check if message can fit in file
-    if ((msg_length + 1) * 8 >= wav_header->subchunk2Size) {
-        EXIT_CODE = FAILURE;
-        printf("Message cannot fit in file.\n\n");
-        goto END;
-    }
-
-    // Initialise msg_to_encode from text_file
-    msg_to_encode = calloc((size_t) (msg_length + 1), sizeof(char));
-    if (msg_to_encode == NULL) {
-        EXIT_CODE = FAILURE;
-        printf("Sorry, program run out of memory.\n\n");
-        goto END;
-    }
-
-    if (fread(msg_to_encode, (size_t) msg_length, 1, text_file) != 1) {
-        EXIT_CODE = FAILURE;
-        printf("Could not read encoded message from file: %s\n\n", text_filename);
-        goto END;
-    }
-
-    // Create permutations randomly based on syskey
-    permutations = createPermutations(strlen(msg_to_encode), syskey);
-    if (permutations == NULL) {
-        EXIT_CODE = FAILURE;
-        printf("Sorry, program run out of memory.\n\n");
+    long msg_length;
+    EXIT_CODE = getMessage(wav_header, text_filename, &msg_to_encode, &msg_length, &permutations);
+    if (EXIT_CODE != SUCCESS)
         goto END;
-    }
 
     // Encode bits of the msg based on the permutations
     for (u_int i = 0; i < (msg_length + 1) * 8; i++) {
@@ -134,11 +102,143 @@ public int encodeToFile(char *wav_filename, char *text_filename) {
 
     END:
     freePointer(wav_header);
-    freePointer(wav_file_data);
+    releaseBuffer(wav_file_data);
     freePointer(msg_to_encode);
     freePointer(new_wav_filename);
     freePointer(permutations);
     closeFile(wav_file);
+    return EXIT_CODE;
+}
+
+/**
+ * Encodes the bits of a msg contained within the file @param text_filename
+ * to the bytes of given .wav file itself. Only the sample bytes whose LSB
+ * changes are read, through a shared mapping of the file, and written, as
+ * one step of a journal so an interrupted run is completed by running it
+ * again.
+ *
+ * @param wav_filename
+ * @param text_filename
+ * @return EXIT CODE
+ */
+public int encodeInPlace(char *wav_filename, char *text_filename) {
+    int EXIT_CODE;
+    Journal journal;
+    char *msg_to_encode = NULL;
+    u_int *permutations = NULL;
+    u_char *mapping = MAP_FAILED;
+    size_t mapping_size = 0;
+
+    EXIT_CODE = openJournal(&journal, wav_filename, JOURNAL_ENCODE);
+    if (EXIT_CODE != SUCCESS || journal.step > 0)
+        goto END;
+
+    long msg_length;
+    EXIT_CODE = getMessage(&journal.header, text_filename, &msg_to_encode, &msg_length, &permutations);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    // Mapping past the end of the file would fault instead of failing
+    struct stat wav_stat;
+    mapping_size = HEADER_SIZE + (size_t) journal.header.subchunk2Size;
+    if (fstat(journal.wav_fd, &wav_stat) != 0 || (size_t) wav_stat.st_size < mapping_size) {
+        EXIT_CODE = FAILURE;
+        printf("Header information mismatch, exiting program.\n\n");
+        goto END;
+    }
+    mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, journal.wav_fd, 0);
+    if (mapping == MAP_FAILED) {
+        EXIT_CODE = FAILURE;
+        printf("Error in opening file: %s\n\n", wav_filename);
+        goto END;
+    }
+
+    u_int bits = (u_int) (msg_length + 1) * 8;
+    EXIT_CODE = beginRecord(&journal, bits, bits);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    // Encode bits of the msg based on the permutations
+    u_char *wav_file_data = mapping + HEADER_SIZE;
+    for (u_int i = 0; i < bits; i++) {
+        u_int x = permutations[i];
+        if (x >= journal.header.subchunk2Size) {
+            EXIT_CODE = FAILURE;
+            printf("Encoding failed, file should be bigger.\n\n");
+            goto END;
+        }
+        // Delete LSB and add u to it
+        *reserveExtent(&journal, HEADER_SIZE + (off_t) x, 1) = (u_char) ((wav_file_data[x] & 0xfe) | getBit(msg_to_encode, i));
+    }
+
+    EXIT_CODE = commitStep(&journal, 0);
+
+    END:
+    if (mapping != MAP_FAILED)
+        munmap(mapping, mapping_size);
+    closeJournal(&journal, EXIT_CODE == SUCCESS);
+    freePointer(msg_to_encode);
+    freePointer(permutations);
+    return EXIT_CODE;
+}
+
+/**
+ * Reads the msg to encode in a .wav file from @param text_filename and
+ * creates the permutations that spread its bits over the file.
+ *
+ * @param wav_header
+ * @param text_filename
+ * @param msg, receives the malloc'd msg
+ * @param msg_length
+ * @param permutations, receives the malloc'd permutations
+ * @return EXIT_CODE
+ */
+private int getMessage(Header *wav_header, char *text_filename, char **msg, long *msg_length,
+                      u_int **permutations) {
+    int EXIT_CODE = SUCCESS;
+
+    // Open file with the text to be encoded
+    FILE *text_file = fopen(text_filename, "r");
+    if (text_file == NULL) {
+        printf("Error in opening file: %s\n\n", text_filename);
+        return FAILURE;
+    }
+
+    // Get number of chars in the file
+    fseek(text_file, 0, SEEK_END);
+    *msg_length = ftell(text_file);
+    rewind(text_file);
+
+    // Check if message can fit in file
+    if ((*msg_length + 1) * 8 >= wav_header->subchunk2Size) {
+        EXIT_CODE = FAILURE;
+        printf("Message cannot fit in file.\n\n");
+        goto END;
+    }
+
+    // Initialise msg from text_file
+    *msg = calloc((size_t) (*msg_length + 1), sizeof(char));
+    if (*msg == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    if (fread(*msg, (size_t) *msg_length, 1, text_file) != 1) {
+        EXIT_CODE = FAILURE;
+        printf("Could not read encoded message from file: %s\n\n", text_filename);
+        goto END;
+    }
+
+    // Create permutations randomly based on syskey
+    *permutations = createPermutations(strlen(*msg), syskey);
+    if (*permutations == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    END:
     closeFile(text_file);
     return EXIT_CODE;
 }
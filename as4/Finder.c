@@ -0,0 +1,359 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    Finder.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define MIN_BLOCK_FRAMES 65536
+
+/**
+ * A haystack position whose distance from the probe is below the threshold.
+ */
+typedef struct Match {
+    u_int frame;
+    double distance;
+} Match;
+
+/**
+ * State shared by the segment workers of one search. The haystack is
+ * split into blocks of @block frames which overlap by probe_length - 1
+ * frames (overlap-save), and consecutive blocks are grouped into segments.
+ */
+typedef struct Search {
+    Header *haystack_header;
+    int haystack_fd;
+    u_int positions;            // Number of probe placements in the haystack.
+    u_int probe_length;
+    FFTPlan *plan;
+    u_int block;
+    u_int step;                 // New positions covered by each block.
+    double *probe_re;           // Spectrum of the reversed z-normalised probe.
+    double *probe_im;
+    u_int blocks_per_segment;
+    double threshold;
+    Match **matches;            // Run minima found by each segment.
+    u_int *number_of_matches;
+    int *status;
+} Search;
+
+private void searchSegment(void *context, int segment);
+
+private int addMatch(Match **matches, u_int *number_of_matches, u_int frame, double distance);
+
+private int compareMatches(const void *match1, const void *match2);
+
+
+/**
+ * Prints every offset of @param haystack_filename where the probe clip
+ * occurs, using a MASS distance profile: the z-normalised euclidean distance
+ * of the probe from every haystack window, computed with FFT convolutions
+ * over overlapping blocks that are processed in parallel.
+ * Distances are scaled to sqrt(1 - correlation), so 0 is a perfect match.
+ * Option ID: 10
+ *
+ * @param probe_filename
+ * @param haystack_filename
+ * @param threshold, largest distance reported as a match
+ * @return EXIT_CODE
+ */
+public int findClip(char *probe_filename, char *haystack_filename, double threshold) {
+    int EXIT_CODE;
+    Header *probe_header = NULL, *haystack_header = NULL;
+    FILE *probe_file = NULL, *haystack_file = NULL;
+    u_char *probe_data = NULL;
+    double *probe = NULL, *spectrum = NULL;
+    Match *all_matches = NULL;
+    Search search;
+    memset(&search, 0, sizeof(Search));
+    int number_of_segments = 0;
+
+    EXIT_CODE = getHeader(NULL, &probe_header, &probe_file, probe_filename);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    EXIT_CODE = getHeader(NULL, &haystack_header, &haystack_file, haystack_filename);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    if (probe_header->sampleRate != haystack_header->sampleRate) {
+        EXIT_CODE = FAILURE;
+        printf("Incompatible files: %s, %s\n\n", probe_filename, haystack_filename);
+        goto END;
+    }
+
+    EXIT_CODE = getData(probe_header, probe_file, &probe_data);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    u_int m;
+    probe = getMonoSamples(probe_header, probe_data, &m);
+    if (probe == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    u_int haystack_frames = haystack_header->subchunk2Size / haystack_header->blockAlign;
+    if (m == 0 || m > haystack_frames) {
+        EXIT_CODE = FAILURE;
+        printf("Probe must be shorter than the file searched.\n\n");
+        goto END;
+    }
+
+    // z-normalise the probe so only the haystack statistics vary per window
+    double mean = 0, deviation = 0;
+    for (u_int i = 0; i < m; i++)
+        mean += probe[i];
+    mean /= m;
+    for (u_int i = 0; i < m; i++)
+        deviation += (probe[i] - mean) * (probe[i] - mean);
+    deviation = sqrt(deviation / m);
+    if (deviation == 0) {
+        EXIT_CODE = FAILURE;
+        printf("Probe is silent: %s\n\n", probe_filename);
+        goto END;
+    }
+
+    search.haystack_header = haystack_header;
+    search.haystack_fd = fileno(haystack_file);
+    search.positions = haystack_frames - m + 1;
+    search.probe_length = m;
+    search.block = nextPowerOfTwo(max(4 * m, MIN_BLOCK_FRAMES));
+    search.step = search.block - m + 1;
+    search.threshold = threshold;
+    search.plan = getFFTPlan(search.block);
+
+    u_int bins = search.block / 2 + 1;
+    spectrum = calloc(search.block + 2 * bins, sizeof(double));
+    if (search.plan == NULL || spectrum == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    // Correlation becomes convolution with the reversed probe
+    for (u_int i = 0; i < m; i++)
+        spectrum[i] = (probe[m - 1 - i] - mean) / deviation;
+    search.probe_re = spectrum + search.block;
+    search.probe_im = search.probe_re + bins;
+    realFFT(search.plan, spectrum, search.probe_re, search.probe_im);
+
+    u_int number_of_blocks = (search.positions + search.step - 1) / search.step;
+    number_of_segments = (int) min(number_of_blocks, (u_int) getThreadCount() * 4);
+    search.blocks_per_segment = (number_of_blocks + number_of_segments - 1) / number_of_segments;
+    number_of_segments = (int) ((number_of_blocks + search.blocks_per_segment - 1) / search.blocks_per_segment);
+
+    search.matches = calloc((size_t) number_of_segments, sizeof(Match *));
+    search.number_of_matches = calloc((size_t) number_of_segments, sizeof(u_int));
+    search.status = calloc((size_t) number_of_segments, sizeof(int));
+    if (search.matches == NULL || search.number_of_matches == NULL || search.status == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    parallelFor(number_of_segments, searchSegment, &search);
+
+    // Gather the matches of every segment
+    u_int total = 0;
+    for (int s = 0; s < number_of_segments; s++) {
+        if (search.status[s] != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            printf("Could not search file: %s\n\n", haystack_filename);
+            goto END;
+        }
+        total += search.number_of_matches[s];
+    }
+
+    all_matches = malloc(max(total, 1) * sizeof(Match));
+    if (all_matches == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+    total = 0;
+    for (int s = 0; s < number_of_segments; s++) {
+        memcpy(all_matches + total, search.matches[s], search.number_of_matches[s] * sizeof(Match));
+        total += search.number_of_matches[s];
+    }
+    qsort(all_matches, total, sizeof(Match), compareMatches);
+
+    // Matches closer than half a probe are the same occurrence, keep the best
+    u_int kept = 0;
+    for (u_int i = 0; i < total; i++) {
+        if (kept > 0 && all_matches[i].frame - all_matches[kept - 1].frame < m / 2) {
+            if (all_matches[i].distance < all_matches[kept - 1].distance)
+                all_matches[kept - 1] = all_matches[i];
+        } else {
+            all_matches[kept++] = all_matches[i];
+        }
+    }
+
+    for (u_int i = 0; i < kept; i++)
+        printf("Match at frame %u (%.3f s), distance: %.3f\n", all_matches[i].frame,
+               (double) all_matches[i].frame / haystack_header->sampleRate, all_matches[i].distance);
+    printf("%u matches found.\n\n", kept);
+
+    END:
+    if (search.matches != NULL)
+        for (int s = 0; s < number_of_segments; s++)
+            freePointer(search.matches[s]);
+    freePointer(search.matches);
+    freePointer(search.number_of_matches);
+    freePointer(search.status);
+    freePointer(all_matches);
+    freePointer(spectrum);
+    freePointer(probe);
+    releaseBuffer(probe_data);
+    freePointer(probe_header);
+    freePointer(haystack_header);
+    closeFile(probe_file);
+    closeFile(haystack_file);
+    freeFFTPlans();
+    return EXIT_CODE;
+}
+
+/**
+ * Computes the distance profile of the blocks of one segment. Each block
+ * reads its frames with pread() so segments never share a file offset.
+ *
+ * @param context, the Search
+ * @param segment
+ */
+private void searchSegment(void *context, int segment) {
+    Search *search = context;
+    Header *header = search->haystack_header;
+    u_int m = search->probe_length, block = search->block;
+    u_int bins = block / 2 + 1;
+    u_char *raw = getBuffer((size_t) block * header->blockAlign);
+    double *buffer = getBuffer((2 * block + 2 * bins) * sizeof(double));
+    int in_run = 0;
+    u_int run_frame = 0;
+    double run_distance = 0;
+
+    if (raw == NULL || buffer == NULL) {
+        search->status[segment] = FAILURE;
+        goto END;
+    }
+    double *samples = buffer, *profile = samples + block, *re = profile + block, *im = re + bins;
+
+    for (u_int b = 0; b < search->blocks_per_segment; b++) {
+        u_int start = (segment * search->blocks_per_segment + b) * search->step;
+        if (start >= search->positions)
+            break;
+
+        // Overlap-save: read the block including the tail shared with the next one
+        u_int frames = min(block, search->positions + m - 1 - start);
+        if (preadFully(search->haystack_fd, raw, (size_t) frames * header->blockAlign,
+                       HEADER_SIZE + (off_t) start * header->blockAlign) != SUCCESS) {
+            search->status[segment] = FAILURE;
+            goto END;
+        }
+        decodeMonoFrames(header, raw, frames, samples);
+        memset(samples + frames, 0, (block - frames) * sizeof(double));
+
+        realFFT(search->plan, samples, re, im);
+        for (register u_int k = 0; k < bins; k++) {
+            double product_re = re[k] * search->probe_re[k] - im[k] * search->probe_im[k];
+            double product_im = re[k] * search->probe_im[k] + im[k] * search->probe_re[k];
+            re[k] = product_re;
+            im[k] = product_im;
+        }
+        inverseRealFFT(search->plan, re, im, profile);
+
+        // Sliding window sums give the mean and deviation of every window
+        double sum = 0, squares = 0;
+        for (u_int j = 0; j < m - 1; j++) {
+            sum += samples[j];
+            squares += samples[j] * samples[j];
+        }
+
+        u_int count = min(search->step, search->positions - start);
+        for (u_int i = 0; i < count; i++) {
+            double entering = samples[i + m - 1];
+            sum += entering;
+            squares += entering * entering;
+
+            double mean = sum / m;
+            double variance = squares / m - mean * mean;
+            double correlation = variance > 1e-12 ? profile[i + m - 1] / (m * sqrt(variance)) : 0;
+            double distance = sqrt(max(0, 1 - correlation));
+
+            double leaving = samples[i];
+            sum -= leaving;
+            squares -= leaving * leaving;
+
+            if (distance <= search->threshold) {
+                if (!in_run || distance < run_distance) {
+                    run_frame = start + i;
+                    run_distance = distance;
+                }
+                in_run = 1;
+            } else if (in_run) {
+                in_run = 0;
+                if (addMatch(&search->matches[segment], &search->number_of_matches[segment],
+                             run_frame, run_distance) != SUCCESS) {
+                    search->status[segment] = FAILURE;
+                    goto END;
+                }
+            }
+        }
+    }
+
+    if (in_run && addMatch(&search->matches[segment], &search->number_of_matches[segment],
+                           run_frame, run_distance) != SUCCESS)
+        search->status[segment] = FAILURE;
+
+    END:
+    releaseBuffer(raw);
+    releaseBuffer(buffer);
+}
+
+/**
+ * Appends a match to a growing array, doubling its capacity on powers of two.
+ *
+ * @param matches
+ * @param number_of_matches
+ * @param frame
+ * @param distance
+ * @return EXIT_CODE
+ */
+private int addMatch(Match **matches, u_int *number_of_matches, u_int frame, double distance) {
+    u_int n = *number_of_matches;
+    if ((n & (n - 1)) == 0) {
+        Match *grown = realloc(*matches, max(2 * n, 1) * sizeof(Match));
+        if (grown == NULL)
+            return FAILURE;
+        *matches = grown;
+    }
+    (*matches)[n].frame = frame;
+    (*matches)[n].distance = distance;
+    *number_of_matches = n + 1;
+    return SUCCESS;
+}
+
+/**
+ * qsort() comparator ordering matches by frame.
+ */
+private int compareMatches(const void *match1, const void *match2) {
+    u_int frame1 = ((const Match *) match1)->frame, frame2 = ((const Match *) match2)->frame;
+    return (frame1 > frame2) - (frame1 < frame2);
+}
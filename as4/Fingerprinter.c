@@ -0,0 +1,558 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    Fingerprinter.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define TARGET_RATE 11025
+#define WINDOW_SIZE 1024
+#define HOP_SIZE 128
+#define PEAKS_PER_FRAME 5
+#define FAN_OUT 5
+#define MAX_DELTA_TIME 63
+#define MAX_DELTA_BIN 63
+#define ENVELOPE_DECAY 0.95
+#define MIN_VOTES 10
+#define MAX_RESULTS 10
+
+static const char INDEX_MAGIC[8] = "WAVIDX1";
+
+/**
+ * Layout of an index file, every section follows the previous one:
+ * IndexHeader, IndexFile[number_of_files], u_int buckets[number_of_buckets + 1],
+ * Posting[number_of_postings], names[names_size].
+ * buckets[b] is the first posting whose hash falls into bucket b.
+ */
+typedef struct IndexHeader {
+    char magic[8];
+    u_int number_of_files;
+    u_int number_of_buckets;
+    u_int number_of_postings;
+    u_int names_size;
+} IndexHeader;
+
+typedef struct IndexFile {
+    u_int name_offset;
+    u_int sample_rate;
+} IndexFile;
+
+typedef struct Posting {
+    u_int hash;
+    u_int file_id;
+    u_int time;
+} Posting;
+
+/**
+ * Fingerprints of the files of an index under construction.
+ */
+typedef struct Corpus {
+    char **files;
+    Landmark **landmarks;
+    u_int *number_of_landmarks;
+    u_int *sample_rates;
+    int *status;
+} Corpus;
+
+/**
+ * A (file, offset) pair voted for by one matching hash.
+ */
+typedef struct Vote {
+    u_int file_id;
+    int offset;
+} Vote;
+
+/**
+ * Best offset of one indexed file and the votes it received.
+ */
+typedef struct Result {
+    u_int file_id;
+    int offset;
+    u_int votes;
+} Result;
+
+private void fingerprintTask(void *context, int file_id);
+
+private int fingerprintFile(char *wav_filename, Landmark **landmarks, u_int *number_of_landmarks,
+                            u_int *sample_rate);
+
+private u_int bucketOf(u_int hash, u_int number_of_buckets);
+
+private int compareVotes(const void *vote1, const void *vote2);
+
+private int compareResults(const void *result1, const void *result2);
+
+
+/**
+ * Fingerprints the given .wav files in parallel and writes an inverted hash
+ * index of their landmarks to @param index_filename.
+ * Option ID: 11
+ *
+ * @param index_filename
+ * @param files
+ * @param number_of_files
+ * @return EXIT_CODE
+ */
+public int buildIndex(char *index_filename, char **files, int number_of_files) {
+    int EXIT_CODE = SUCCESS;
+    FILE *index_file = NULL;
+    u_int *buckets = NULL;
+    Posting *postings = NULL;
+    IndexFile *entries = NULL;
+    Corpus corpus = {files, NULL, NULL, NULL, NULL};
+
+    corpus.landmarks = calloc((size_t) number_of_files, sizeof(Landmark *));
+    corpus.number_of_landmarks = calloc((size_t) number_of_files, sizeof(u_int));
+    corpus.sample_rates = calloc((size_t) number_of_files, sizeof(u_int));
+    corpus.status = calloc((size_t) number_of_files, sizeof(int));
+    entries = calloc((size_t) number_of_files, sizeof(IndexFile));
+    if (corpus.landmarks == NULL || corpus.number_of_landmarks == NULL
+     || corpus.sample_rates == NULL || corpus.status == NULL || entries == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    parallelFor(number_of_files, fingerprintTask, &corpus);
+
+    u_int number_of_postings = 0, names_size = 0;
+    for (int i = 0; i < number_of_files; i++) {
+        if (corpus.status[i] != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            goto END;
+        }
+        entries[i].name_offset = names_size;
+        entries[i].sample_rate = corpus.sample_rates[i];
+        names_size += strlen(files[i]) + 1;
+        number_of_postings += corpus.number_of_landmarks[i];
+    }
+
+    // About four postings per bucket keeps lookups short and the table small
+    u_int number_of_buckets = min(nextPowerOfTwo(number_of_postings / 4), 1u << 24);
+    buckets = calloc(number_of_buckets + 1, sizeof(u_int));
+    postings = malloc(max(number_of_postings, 1) * sizeof(Posting));
+    if (buckets == NULL || postings == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    // Counting sort of every landmark into its bucket
+    for (int i = 0; i < number_of_files; i++)
+        for (u_int j = 0; j < corpus.number_of_landmarks[i]; j++)
+            buckets[bucketOf(corpus.landmarks[i][j].hash, number_of_buckets) + 1]++;
+    for (u_int b = 0; b < number_of_buckets; b++)
+        buckets[b + 1] += buckets[b];
+    for (int i = 0; i < number_of_files; i++) {
+        for (u_int j = 0; j < corpus.number_of_landmarks[i]; j++) {
+            Landmark *landmark = &corpus.landmarks[i][j];
+            Posting *posting = &postings[buckets[bucketOf(landmark->hash, number_of_buckets)]++];
+            posting->hash = landmark->hash;
+            posting->file_id = (u_int) i;
+            posting->time = landmark->time;
+        }
+    }
+    // Filling advanced every bucket start to the next one, shift them back
+    for (u_int b = number_of_buckets; b > 0; b--)
+        buckets[b] = buckets[b - 1];
+    buckets[0] = 0;
+
+    index_file = fopen(index_filename, "wb");
+    if (index_file == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Error in opening file: %s\n\n", index_filename);
+        goto END;
+    }
+
+    IndexHeader header;
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.number_of_files = (u_int) number_of_files;
+    header.number_of_buckets = number_of_buckets;
+    header.number_of_postings = number_of_postings;
+    header.names_size = names_size;
+
+    fwrite(&header, sizeof(IndexHeader), 1, index_file);
+    fwrite(entries, sizeof(IndexFile), (size_t) number_of_files, index_file);
+    fwrite(buckets, sizeof(u_int), number_of_buckets + 1, index_file);
+    fwrite(postings, sizeof(Posting), number_of_postings, index_file);
+    for (int i = 0; i < number_of_files; i++)
+        fwrite(files[i], strlen(files[i]) + 1, 1, index_file);
+
+    if (ferror(index_file)) {
+        EXIT_CODE = FAILURE;
+        printf("Could not write to file: %s\n\n", index_filename);
+        goto END;
+    }
+    printf("Indexed %d files, %u landmarks.\n\n", number_of_files, number_of_postings);
+
+    END:
+    if (corpus.landmarks != NULL)
+        for (int i = 0; i < number_of_files; i++)
+            freePointer(corpus.landmarks[i]);
+    freePointer(corpus.landmarks);
+    freePointer(corpus.number_of_landmarks);
+    freePointer(corpus.sample_rates);
+    freePointer(corpus.status);
+    freePointer(entries);
+    freePointer(buckets);
+    freePointer(postings);
+    closeFile(index_file);
+    freeFFTPlans();
+    return EXIT_CODE;
+}
+
+/**
+ * Prints the indexed files that contain the probe clip and the offset of the
+ * clip inside them. The index is memory mapped and only the buckets of the
+ * probe hashes are touched, so the cost does not depend on the corpus size.
+ * Option ID: 12
+ *
+ * @param index_filename
+ * @param probe_filename
+ * @return EXIT_CODE
+ */
+public int lookupIndex(char *index_filename, char *probe_filename) {
+    int EXIT_CODE;
+    int fd = -1;
+    void *mapping = MAP_FAILED;
+    size_t mapping_size = 0;
+    Landmark *landmarks = NULL;
+    Vote *votes = NULL;
+    Result *results = NULL;
+    u_int number_of_landmarks, sample_rate;
+
+    EXIT_CODE = fingerprintFile(probe_filename, &landmarks, &number_of_landmarks, &sample_rate);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    fd = open(index_filename, O_RDONLY);
+    struct stat index_stat;
+    if (fd < 0 || fstat(fd, &index_stat) != 0) {
+        EXIT_CODE = FAILURE;
+        printf("Error in opening file: %s\n\n", index_filename);
+        goto END;
+    }
+    mapping_size = (size_t) index_stat.st_size;
+    if (mapping_size >= sizeof(IndexHeader))
+        mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    // Validate that every section fits in the file before using it
+    IndexHeader *header = mapping;
+    if (mapping == MAP_FAILED || memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0
+     || sizeof(IndexHeader) + (size_t) header->number_of_files * sizeof(IndexFile)
+        + ((size_t) header->number_of_buckets + 1) * sizeof(u_int)
+        + (size_t) header->number_of_postings * sizeof(Posting) + header->names_size != mapping_size
+     || header->number_of_buckets < 2 || (header->number_of_buckets & (header->number_of_buckets - 1))) {
+        EXIT_CODE = FAILURE;
+        printf("Invalid index file: %s\n\n", index_filename);
+        goto END;
+    }
+    IndexFile *entries = (IndexFile *) (header + 1);
+    u_int *buckets = (u_int *) (entries + header->number_of_files);
+    Posting *postings = (Posting *) (buckets + header->number_of_buckets + 1);
+    char *names = (char *) (postings + header->number_of_postings);
+
+    // Every posting with the same hash votes for the offset it implies
+    u_int number_of_votes = 0, capacity = 0;
+    for (u_int i = 0; i < number_of_landmarks; i++) {
+        u_int bucket = bucketOf(landmarks[i].hash, header->number_of_buckets);
+        for (u_int p = buckets[bucket]; p < buckets[bucket + 1] && p < header->number_of_postings; p++) {
+            if (postings[p].hash != landmarks[i].hash || postings[p].file_id >= header->number_of_files)
+                continue;
+            if (number_of_votes == capacity) {
+                capacity = max(2 * capacity, 1024);
+                Vote *grown = realloc(votes, capacity * sizeof(Vote));
+                if (grown == NULL) {
+                    EXIT_CODE = FAILURE;
+                    printf("Sorry, program run out of memory.\n\n");
+                    goto END;
+                }
+                votes = grown;
+            }
+            votes[number_of_votes].file_id = postings[p].file_id;
+            votes[number_of_votes].offset = (int) postings[p].time - (int) landmarks[i].time;
+            number_of_votes++;
+        }
+    }
+    qsort(votes, number_of_votes, sizeof(Vote), compareVotes);
+
+    // At most one result per vote
+    results = malloc(max(number_of_votes, 1) * sizeof(Result));
+    if (results == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    // Runs of equal votes are consecutive, keep the longest run of each file
+    u_int number_of_results = 0;
+    for (u_int i = 0; i < number_of_votes;) {
+        u_int j = i;
+        while (j < number_of_votes && votes[j].file_id == votes[i].file_id && votes[j].offset == votes[i].offset)
+            j++;
+        u_int count = j - i;
+        if (count >= MIN_VOTES) {
+            if (number_of_results > 0 && results[number_of_results - 1].file_id == votes[i].file_id) {
+                Result *last = &results[number_of_results - 1];
+                if (count > last->votes) {
+                    last->offset = votes[i].offset;
+                    last->votes = count;
+                }
+            } else {
+                results[number_of_results].file_id = votes[i].file_id;
+                results[number_of_results].offset = votes[i].offset;
+                results[number_of_results].votes = count;
+                number_of_results++;
+            }
+        }
+        i = j;
+    }
+    qsort(results, number_of_results, sizeof(Result), compareResults);
+    number_of_results = min(number_of_results, MAX_RESULTS);
+
+    for (u_int r = 0; r < number_of_results; r++) {
+        IndexFile *entry = &entries[results[r].file_id];
+        double seconds_per_hop = (double) HOP_SIZE * max(entry->sample_rate / TARGET_RATE, 1) / entry->sample_rate;
+        printf("Match: %s at %.3f s, %u matching landmarks\n",
+               entry->name_offset < header->names_size ? names + entry->name_offset : "?",
+               results[r].offset * seconds_per_hop, results[r].votes);
+    }
+    printf("%u matches found.\n\n", number_of_results);
+
+    END:
+    if (mapping != MAP_FAILED)
+        munmap(mapping, mapping_size);
+    if (fd >= 0)
+        close(fd);
+    freePointer(landmarks);
+    freePointer(votes);
+    freePointer(results);
+    freeFFTPlans();
+    return EXIT_CODE;
+}
+
+/**
+ * Computes the landmarks of a decoded signal: spectral peaks of a Hann
+ * windowed STFT that rise above a decaying masking envelope, paired with
+ * the next few peaks that follow them. Each pair hashes its anchor bin,
+ * bin difference and frame difference into 22 bits.
+ *
+ * @param signal, mono samples at @param sample_rate
+ * @param length
+ * @param sample_rate
+ * @param landmarks, receives a malloc'd array
+ * @param number_of_landmarks
+ * @return EXIT_CODE, FAILURE only when out of memory
+ */
+public int fingerprint(double *signal, u_int length, u_int sample_rate,
+                       Landmark **landmarks, u_int *number_of_landmarks) {
+    int EXIT_CODE = SUCCESS;
+    u_int decimation = max(sample_rate / TARGET_RATE, 1);
+    u_int decimated = length / decimation;
+    u_int frames = decimated >= WINDOW_SIZE ? (decimated - WINDOW_SIZE) / HOP_SIZE + 1 : 0;
+    u_int bins = WINDOW_SIZE / 2 + 1;
+
+    FFTPlan *plan = getFFTPlan(WINDOW_SIZE);
+    double *buffer = getBuffer((2 * WINDOW_SIZE + 4 * bins) * sizeof(double));
+    u_int *peaks = getBuffer(max(frames * PEAKS_PER_FRAME, 1) * 2 * sizeof(u_int));
+    *landmarks = malloc(max(frames * PEAKS_PER_FRAME * FAN_OUT, 1) * sizeof(Landmark));
+    *number_of_landmarks = 0;
+    if (plan == NULL || buffer == NULL || peaks == NULL || *landmarks == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    double *window = buffer, *frame = window + WINDOW_SIZE;
+    double *re = frame + WINDOW_SIZE, *im = re + bins, *magnitude = im + bins, *envelope = magnitude + bins;
+
+    for (u_int i = 0; i < WINDOW_SIZE; i++)
+        window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / WINDOW_SIZE);
+    for (u_int k = 0; k < bins; k++)
+        envelope[k] = 0;
+
+    u_int number_of_peaks = 0;
+    for (u_int f = 0; f < frames; f++) {
+        // Average decimation doubles as a crude low pass filter
+        for (u_int i = 0; i < WINDOW_SIZE; i++) {
+            double sum = 0;
+            size_t start = ((size_t) f * HOP_SIZE + i) * decimation;
+            for (u_int d = 0; d < decimation; d++)
+                sum += signal[start + d];
+            frame[i] = sum / decimation * window[i];
+        }
+        realFFT(plan, frame, re, im);
+        for (u_int k = 0; k < bins; k++) {
+            magnitude[k] = sqrt(re[k] * re[k] + im[k] * im[k]);
+            envelope[k] *= ENVELOPE_DECAY;
+        }
+
+        // Keep the strongest local maxima that beat the masking envelope
+        u_int chosen[PEAKS_PER_FRAME], number_chosen = 0;
+        for (u_int k = 2; k < bins - 1; k++) {
+            if (magnitude[k] <= magnitude[k - 1] || magnitude[k] < magnitude[k + 1]
+             || magnitude[k] <= envelope[k] || magnitude[k] < 1e-3)
+                continue;
+            u_int slot = number_chosen;
+            if (number_chosen == PEAKS_PER_FRAME) {
+                slot = 0;
+                for (u_int c = 1; c < PEAKS_PER_FRAME; c++)
+                    if (magnitude[chosen[c]] < magnitude[chosen[slot]])
+                        slot = c;
+                if (magnitude[chosen[slot]] >= magnitude[k])
+                    continue;
+            } else {
+                number_chosen++;
+            }
+            chosen[slot] = k;
+        }
+
+        for (u_int c = 0; c < number_chosen; c++) {
+            u_int k = chosen[c];
+            for (u_int j = k > 8 ? k - 8 : 0; j < min(k + 9, bins); j++) {
+                double spread = (double) j - k;
+                envelope[j] = max(envelope[j], magnitude[k] * exp(-spread * spread / 32));
+            }
+            peaks[2 * number_of_peaks] = f;
+            peaks[2 * number_of_peaks + 1] = k;
+            number_of_peaks++;
+        }
+    }
+
+    // Pair every anchor with the first peaks of its target zone
+    for (u_int i = 0; i < number_of_peaks; i++) {
+        u_int anchor_time = peaks[2 * i], anchor_bin = peaks[2 * i + 1], paired = 0;
+        for (u_int j = i + 1; j < number_of_peaks && paired < FAN_OUT; j++) {
+            u_int delta_time = peaks[2 * j] - anchor_time;
+            int delta_bin = (int) peaks[2 * j + 1] - (int) anchor_bin;
+            if (delta_time > MAX_DELTA_TIME)
+                break;
+            if (delta_time == 0 || abs(delta_bin) > MAX_DELTA_BIN)
+                continue;
+
+            Landmark *landmark = &(*landmarks)[(*number_of_landmarks)++];
+            landmark->hash = (anchor_bin & 0x1ff) << 13 | (u_int) (delta_bin + 64) << 6 | delta_time;
+            landmark->time = anchor_time;
+            paired++;
+        }
+    }
+
+    END:
+    releaseBuffer(buffer);
+    releaseBuffer(peaks);
+    return EXIT_CODE;
+}
+
+/**
+ * Fingerprints one file of a Corpus.
+ *
+ * @param context, the Corpus
+ * @param file_id
+ */
+private void fingerprintTask(void *context, int file_id) {
+    Corpus *corpus = context;
+    corpus->status[file_id] = fingerprintFile(corpus->files[file_id], &corpus->landmarks[file_id],
+                                              &corpus->number_of_landmarks[file_id],
+                                              &corpus->sample_rates[file_id]);
+}
+
+/**
+ * Reads and fingerprints a .wav file.
+ *
+ * @param wav_filename
+ * @param landmarks
+ * @param number_of_landmarks
+ * @param sample_rate
+ * @return EXIT_CODE
+ */
+private int fingerprintFile(char *wav_filename, Landmark **landmarks, u_int *number_of_landmarks,
+                            u_int *sample_rate) {
+    int EXIT_CODE;
+    Arena *arena = acquireArena();
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+    u_char *wav_data = NULL;
+    double *signal = NULL;
+    u_int length;
+
+    if (arena == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return FAILURE;
+    }
+
+    EXIT_CODE = getHeader(arena, &wav_header, &wav_file, wav_filename);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    EXIT_CODE = getData(wav_header, wav_file, &wav_data);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    signal = getMonoSamples(wav_header, wav_data, &length);
+    if (signal == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    *sample_rate = wav_header->sampleRate;
+    EXIT_CODE = fingerprint(signal, length, wav_header->sampleRate, landmarks, number_of_landmarks);
+    if (EXIT_CODE != SUCCESS)
+        printf("Sorry, program run out of memory.\n\n");
+
+    END:
+    releaseArena(arena);
+    releaseBuffer(wav_data);
+    freePointer(signal);
+    closeFile(wav_file);
+    return EXIT_CODE;
+}
+
+/**
+ * Fibonacci hashing of a landmark hash into one of a power of two buckets,
+ * at least 2, so the shift stays under 32 bits. buildIndex() makes 4 or
+ * more, lookupIndex() rejects index files with fewer.
+ *
+ * @param hash
+ * @param number_of_buckets
+ * @return bucket index
+ */
+private u_int bucketOf(u_int hash, u_int number_of_buckets) {
+    return (hash * 2654435769u) >> (32 - __builtin_ctz(number_of_buckets));
+}
+
+/**
+ * qsort() comparator ordering votes by file and then offset.
+ */
+private int compareVotes(const void *vote1, const void *vote2) {
+    const Vote *a = vote1, *b = vote2;
+    if (a->file_id != b->file_id)
+        return (a->file_id > b->file_id) - (a->file_id < b->file_id);
+    return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+/**
+ * qsort() comparator ordering results by descending votes.
+ */
+private int compareResults(const void *result1, const void *result2) {
+    u_int votes1 = ((const Result *) result1)->votes, votes2 = ((const Result *) result2)->votes;
+    return (votes1 < votes2) - (votes1 > votes2);
+}
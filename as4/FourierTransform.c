@@ -0,0 +1,304 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    FourierTransform.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+  * @author Aristos Georgiou
+  */
+
+private FFTPlan *createFFTPlan(u_int size);
+
+private void complexFFT(FFTPlan *plan, double *re, double *im, int inverse);
+
+private void butterflies(double *re_a, double *im_a, double *re_b, double *im_b,
+                         const double *w_re, const double *w_im, u_int half, double sign);
+
+// Plans are cached for the lifetime of the program, one per transform size.
+private FFTPlan *plans = NULL;
+private pthread_mutex_t plans_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * @param n
+ * @return smallest power of two which is >= n and at least 4.
+ */
+public u_int nextPowerOfTwo(u_int n) {
+    u_int power = 4;
+    while (power < n)
+        power <<= 1;
+    return power;
+}
+
+/**
+ * Returns the cached plan for a real transform of @param size samples,
+ * creating it the first time it is requested. Safe to call from many threads.
+ *
+ * @param size, must be a power of two >= 4
+ * @return the plan or NULL if out of memory
+ */
+public FFTPlan *getFFTPlan(u_int size) {
+    pthread_mutex_lock(&plans_lock);
+
+    FFTPlan *plan = plans;
+    while (plan != NULL && plan->size != size)
+        plan = plan->next;
+
+    if (plan == NULL) {
+        plan = createFFTPlan(size);
+        if (plan != NULL) {
+            plan->next = plans;
+            plans = plan;
+        }
+    }
+
+    pthread_mutex_unlock(&plans_lock);
+    return plan;
+}
+
+/**
+ * Frees every cached plan.
+ */
+public void freeFFTPlans() {
+    pthread_mutex_lock(&plans_lock);
+    while (plans != NULL) {
+        FFTPlan *next = plans->next;
+        freePointer(plans->bit_reverse);
+        freePointer(plans->twiddle_re);
+        freePointer(plans->twiddle_im);
+        freePointer(plans->split_re);
+        freePointer(plans->split_im);
+        free(plans);
+        plans = next;
+    }
+    pthread_mutex_unlock(&plans_lock);
+}
+
+/**
+ * Forward transform of plan->size real samples. The real input is packed into
+ * a complex sequence of half the length, transformed, and then split into the
+ * spectrum of the real signal.
+ *
+ * @param plan
+ * @param input, plan->size samples
+ * @param re, receives plan->half + 1 real parts
+ * @param im, receives plan->half + 1 imaginary parts
+ */
+public void realFFT(FFTPlan *plan, const double *input, double *re, double *im) {
+    u_int n = plan->half;
+
+    for (register u_int k = 0; k < n; k++) {
+        re[k] = input[2 * k];
+        im[k] = input[2 * k + 1];
+    }
+    complexFFT(plan, re, im, 0);
+
+    // Split Z into the even and odd spectra, pairing bins k and n - k
+    double z0 = re[0];
+    re[0] = z0 + im[0];
+    re[n] = z0 - im[0];
+    im[0] = im[n] = 0;
+
+    for (register u_int k = 1; k <= n / 2; k++) {
+        u_int m = n - k;
+        double even_re = (re[k] + re[m]) / 2, even_im = (im[k] - im[m]) / 2;
+        double odd_re = (im[k] + im[m]) / 2, odd_im = (re[m] - re[k]) / 2;
+        double w_re = plan->split_re[k], w_im = plan->split_im[k];
+        double t_re = w_re * odd_re - w_im * odd_im;
+        double t_im = w_re * odd_im + w_im * odd_re;
+
+        re[k] = even_re + t_re;
+        im[k] = even_im + t_im;
+        re[m] = even_re - t_re;
+        im[m] = t_im - even_im;
+    }
+}
+
+/**
+ * Inverse of realFFT(). The spectrum in @param re and @param im is used as
+ * scratch space and is destroyed.
+ *
+ * @param plan
+ * @param re, plan->half + 1 real parts
+ * @param im, plan->half + 1 imaginary parts
+ * @param output, receives plan->size samples
+ */
+public void inverseRealFFT(FFTPlan *plan, double *re, double *im, double *output) {
+    u_int n = plan->half;
+
+    double x0 = re[0], xn = re[n];
+    re[0] = (x0 + xn) / 2;
+    im[0] = (x0 - xn) / 2;
+
+    for (register u_int k = 1; k <= n / 2; k++) {
+        u_int m = n - k;
+        double even_re = (re[k] + re[m]) / 2, even_im = (im[k] - im[m]) / 2;
+        double diff_re = (re[k] - re[m]) / 2, diff_im = (im[k] + im[m]) / 2;
+        double w_re = plan->split_re[k], w_im = -plan->split_im[k];
+        double odd_re = diff_re * w_re - diff_im * w_im;
+        double odd_im = diff_re * w_im + diff_im * w_re;
+
+        re[k] = even_re - odd_im;
+        im[k] = even_im + odd_re;
+        re[m] = even_re + odd_im;
+        im[m] = odd_re - even_im;
+    }
+    complexFFT(plan, re, im, 1);
+
+    double scale = 1.0 / n;
+    for (register u_int k = 0; k < n; k++) {
+        output[2 * k] = re[k] * scale;
+        output[2 * k + 1] = im[k] * scale;
+    }
+}
+
+/**
+ * Builds the bit reversal table, the per stage twiddles and the split
+ * twiddles used by the real transform.
+ *
+ * @param size
+ * @return a new plan or NULL if out of memory
+ */
+private FFTPlan *createFFTPlan(u_int size) {
+    FFTPlan *plan = calloc(1, sizeof(FFTPlan));
+    if (plan == NULL)
+        return NULL;
+
+    u_int n = size / 2;
+    plan->size = size;
+    plan->half = n;
+    plan->bit_reverse = malloc(n * sizeof(u_int));
+    plan->twiddle_re = malloc(n * sizeof(double));
+    plan->twiddle_im = malloc(n * sizeof(double));
+    plan->split_re = malloc((n + 1) * sizeof(double));
+    plan->split_im = malloc((n + 1) * sizeof(double));
+    if (plan->bit_reverse == NULL || plan->twiddle_re == NULL || plan->twiddle_im == NULL
+     || plan->split_re == NULL || plan->split_im == NULL) {
+        freePointer(plan->bit_reverse);
+        freePointer(plan->twiddle_re);
+        freePointer(plan->twiddle_im);
+        freePointer(plan->split_re);
+        freePointer(plan->split_im);
+        free(plan);
+        return NULL;
+    }
+
+    u_int bits = 0;
+    while ((1u << bits) < n)
+        bits++;
+    for (u_int i = 0; i < n; i++) {
+        u_int reversed = 0;
+        for (u_int b = 0; b < bits; b++)
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        plan->bit_reverse[i] = reversed;
+    }
+
+    // Stage with butterflies of half size h keeps its h twiddles at offset h - 1
+    for (u_int h = 1; h < n; h <<= 1) {
+        for (u_int j = 0; j < h; j++) {
+            plan->twiddle_re[h - 1 + j] = cos(-M_PI * j / h);
+            plan->twiddle_im[h - 1 + j] = sin(-M_PI * j / h);
+        }
+    }
+
+    for (u_int k = 0; k <= n; k++) {
+        plan->split_re[k] = cos(-2 * M_PI * k / size);
+        plan->split_im[k] = sin(-2 * M_PI * k / size);
+    }
+    return plan;
+}
+
+/**
+ * Iterative radix-2 transform of plan->half complex values in place.
+ *
+ * @param plan
+ * @param re
+ * @param im
+ * @param inverse, non zero for the (unscaled) inverse transform
+ */
+private void complexFFT(FFTPlan *plan, double *re, double *im, int inverse) {
+    u_int n = plan->half;
+
+    for (u_int i = 0; i < n; i++) {
+        u_int j = plan->bit_reverse[i];
+        if (i < j) {
+            double temp = re[i];
+            re[i] = re[j];
+            re[j] = temp;
+            temp = im[i];
+            im[i] = im[j];
+            im[j] = temp;
+        }
+    }
+
+    double sign = inverse ? -1 : 1;
+    for (u_int h = 1; h < n; h <<= 1) {
+        const double *w_re = plan->twiddle_re + h - 1;
+        const double *w_im = plan->twiddle_im + h - 1;
+        for (u_int i = 0; i < n; i += 2 * h)
+            butterflies(re + i, im + i, re + i + h, im + i + h, w_re, w_im, h, sign);
+    }
+}
+
+/**
+ * Applies @param half butterflies between the a and b halves of a block.
+ * Twiddles are contiguous per stage so two butterflies fit one SSE2 register.
+ *
+ * @param re_a
+ * @param im_a
+ * @param re_b
+ * @param im_b
+ * @param w_re
+ * @param w_im
+ * @param half
+ * @param sign, -1 conjugates the twiddles for the inverse transform
+ */
+private void butterflies(double *re_a, double *im_a, double *re_b, double *im_b,
+                         const double *w_re, const double *w_im, u_int half, double sign) {
+    u_int j = 0;
+#ifdef __SSE2__
+    __m128d vsign = _mm_set1_pd(sign);
+    for (; j + 2 <= half; j += 2) {
+        __m128d wr = _mm_loadu_pd(w_re + j);
+        __m128d wi = _mm_mul_pd(_mm_loadu_pd(w_im + j), vsign);
+        __m128d br = _mm_loadu_pd(re_b + j);
+        __m128d bi = _mm_loadu_pd(im_b + j);
+        __m128d tr = _mm_sub_pd(_mm_mul_pd(wr, br), _mm_mul_pd(wi, bi));
+        __m128d ti = _mm_add_pd(_mm_mul_pd(wr, bi), _mm_mul_pd(wi, br));
+        __m128d ar = _mm_loadu_pd(re_a + j);
+        __m128d ai = _mm_loadu_pd(im_a + j);
+        _mm_storeu_pd(re_b + j, _mm_sub_pd(ar, tr));
+        _mm_storeu_pd(im_b + j, _mm_sub_pd(ai, ti));
+        _mm_storeu_pd(re_a + j, _mm_add_pd(ar, tr));
+        _mm_storeu_pd(im_a + j, _mm_add_pd(ai, ti));
+    }
+#endif
+    for (; j < half; j++) {
+        double wi = w_im[j] * sign;
+        double tr = w_re[j] * re_b[j] - wi * im_b[j];
+        double ti = w_re[j] * im_b[j] + wi * re_b[j];
+        re_b[j] = re_a[j] - tr;
+        im_b[j] = im_a[j] - ti;
+        re_a[j] += tr;
+        im_a[j] += ti;
+    }
+}
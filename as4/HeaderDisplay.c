@@ -17,16 +17,23 @@
  */
 
 #include "Definitions.h"
+#include <fcntl.h>
 
 /**
   * @author Aristos Georgiou
   */
 
-private int displayHeader(char *wav_filename);
+#define HEADER_BATCH 256
+#define QUEUE_DEPTH 64
+
+private int displayHeaderBatch(IOQueue *queue, char **files, int number_of_files, u_char *headers);
+
+private void displayHeader(Header *wav_header);
 
 
 /**
  * Displays the meta-data(Header) of .wav files.
+ * Headers are read in batches whose reads are all in flight at once.
  * Option ID: 1
  *
  * @param files
@@ -35,27 +42,87 @@ private int displayHeader(char *wav_filename);
  */
 public int displayHeaders(char **files, int number_of_files) {
     int EXIT_CODE = SUCCESS;
-    for (int i = 0; i < number_of_files; i++)
-        EXIT_CODE += displayHeader(files[i]);
+    IOQueue queue;
+    u_char *headers = getBuffer(HEADER_BATCH * HEADER_SIZE);
+    if (headers == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return FAILURE;
+    }
+
+    openIOQueue(&queue, QUEUE_DEPTH);
+    void *buffers[1] = {headers};
+    size_t sizes[1] = {HEADER_BATCH * HEADER_SIZE};
+    registerIOBuffers(&queue, buffers, sizes, 1);
 
+    for (int first = 0; first < number_of_files; first += HEADER_BATCH)
+        EXIT_CODE += displayHeaderBatch(&queue, files + first, min(HEADER_BATCH, number_of_files - first),
+                                        headers);
+
+    closeIOQueue(&queue);
+    releaseBuffer(headers);
     return EXIT_CODE;
 }
 
 /**
- * Displays the meta-data(Header) of a .wav file.
+ * Reads the headers of up to HEADER_BATCH files through the I/O queue and
+ * displays them in the order given.
  *
- * @param wav_filename
- * @return EXIT CODE
+ * @param queue
+ * @param files
+ * @param number_of_files
+ * @param headers, registered buffer for HEADER_BATCH headers
+ * @return EXIT CODE, the sum of the EXIT CODE of every file
  */
-private int displayHeader(char *wav_filename) {
-    int EXIT_CODE;
-    // Initialise wav_header from wav_file
-    Header *wav_header = NULL;
-    FILE *wav_file = NULL;
-    EXIT_CODE = getHeader(&wav_header, &wav_file, wav_filename);
-    if (EXIT_CODE != SUCCESS)
-        goto END;
+private int displayHeaderBatch(IOQueue *queue, char **files, int number_of_files, u_char *headers) {
+    int EXIT_CODE = SUCCESS;
+    IORequest requests[number_of_files];
+    int request_of[number_of_files];
+    int number_of_requests = 0;
+
+    for (int i = 0; i < number_of_files; i++) {
+        request_of[i] = -1;
+        int fd = open(files[i], O_RDONLY);
+        if (fd < 0)
+            continue;
+
+        IORequest *request = &requests[number_of_requests];
+        request->fd = fd;
+        request->write = 0;
+        request->buffer = headers + i * HEADER_SIZE;
+        request->size = HEADER_SIZE;
+        request->offset = 0;
+        request->buffer_index = 0;
+        request_of[i] = number_of_requests++;
+    }
+
+    runIO(queue, requests, number_of_requests);
 
+    for (int i = 0; i < number_of_files; i++) {
+        if (request_of[i] < 0) {
+            EXIT_CODE += FAILURE;
+            printf("Error in opening file: %s\n\n", files[i]);
+        } else if (requests[request_of[i]].result != HEADER_SIZE) {
+            EXIT_CODE += FAILURE;
+            printf("File not even 44 bytes: %s\n\n", files[i]);
+        } else if (wavCheck((Header *) (headers + i * HEADER_SIZE)) == FAILURE) {
+            EXIT_CODE += FAILURE;
+            printf("Invalid wav header.\n\n");
+        } else {
+            displayHeader((Header *) (headers + i * HEADER_SIZE));
+        }
+    }
+
+    for (int r = 0; r < number_of_requests; r++)
+        close(requests[r].fd);
+    return EXIT_CODE;
+}
+
+/**
+ * Displays the meta-data(Header) of a .wav file.
+ *
+ * @param wav_header
+ */
+private void displayHeader(Header *wav_header) {
     printf("RIFF_CHUNK_HEADER\n");
     printf("=================\n");
     printf("chunkID: %.*s\n", 4, wav_header->chunkID);
@@ -76,9 +143,4 @@ private int displayHeader(char *wav_filename) {
     printf("subChunk2ID: %.*s\n", 4, wav_header->subchunk2ID);
     printf("subChunk2Size: %d\n", wav_header->subchunk2Size);
     printf("*************************************\n\n");
-
-    END:
-    freePointer(wav_header);
-    closeFile(wav_file);
-    return EXIT_CODE;
 }
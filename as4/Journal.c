@@ -0,0 +1,358 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    Journal.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <fcntl.h>
+#include <libgen.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define JOURNAL_MAGIC "WAVJRNL"
+#define STATE_SIZE 4096             // The state is followed by two record slots.
+#define EXTENT_HEADER (2 * sizeof(long long))
+
+/**
+ * State at the start of a journal file. While pending is set, the record
+ * of step is durable in slot step % 2 and may or may not have reached the
+ * .wav file. Every step alternates slots, so writing the record of a step
+ * never damages the record of the one before.
+ */
+typedef struct JournalState {
+    char magic[8];
+    u_int operation;
+    u_int pending;
+    long long step;
+    long long slot_size;
+    long long record_size;
+    long long truncate_size;        // Size of the .wav file after step, or 0.
+    unsigned long long checksum;    // Of the record and the fields above.
+    Header header;                  // Header of the .wav file before the first step.
+} __attribute__((__packed__)) JournalState;
+
+private int writeState(Journal *journal, JournalState *state);
+
+private int createJournal(Journal *journal);
+
+private int applyRecord(int wav_fd, u_char *record, size_t record_size, long long truncate_size);
+
+private unsigned long long checksumOf(JournalState *state, u_char *record);
+
+
+/**
+ * Opens a .wav file for an in place transform. If a journal of an earlier
+ * run of @param operation exists, the .wav file is brought up to date with
+ * its last durable step and journal->step is set to the step to continue
+ * from; journal->header is then the header the file had before that run.
+ * Otherwise journal->step is 0 and the journal is created by the first
+ * commitStep().
+ *
+ * @param journal
+ * @param wav_filename
+ * @param operation, JOURNAL_REVERSE, JOURNAL_MONO or JOURNAL_ENCODE
+ * @return EXIT_CODE
+ */
+public int openJournal(Journal *journal, char *wav_filename, u_int operation) {
+    memset(journal, 0, sizeof(Journal));
+    journal->fd = -1;
+    journal->wav_fd = -1;
+    journal->operation = operation;
+
+    journal->filename = malloc(9 + strlen(wav_filename));
+    if (journal->filename == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return FAILURE;
+    }
+    snprintf(journal->filename, 9 + strlen(wav_filename), "%s.journal", wav_filename);
+
+    journal->wav_fd = open(wav_filename, O_RDWR);
+    if (journal->wav_fd < 0) {
+        printf("Error in opening file: %s\n\n", wav_filename);
+        return FAILURE;
+    }
+
+    // A run stopped before the first state reached its journal never changed the file
+    JournalState state;
+    memset(&state, 0, sizeof(JournalState));
+    journal->fd = open(journal->filename, O_RDWR);
+    if (journal->fd >= 0 && (preadFully(journal->fd, &state, sizeof(JournalState), 0) != SUCCESS
+     || state.magic[0] == '\0')) {
+        close(journal->fd);
+        journal->fd = -1;
+        unlink(journal->filename);
+    }
+    if (journal->fd < 0) {
+        if (preadFully(journal->wav_fd, &journal->header, HEADER_SIZE, 0) != SUCCESS) {
+            printf("File not even 44 bytes: %s\n\n", wav_filename);
+            return FAILURE;
+        }
+        if (wavCheck(&journal->header) == FAILURE) {
+            printf("Invalid wav header.\n\n");
+            return FAILURE;
+        }
+        return SUCCESS;
+    }
+
+    if (memcmp(state.magic, JOURNAL_MAGIC, sizeof(state.magic)) != 0 || state.operation != operation) {
+        printf("Journal of another operation exists: %s\n\n", journal->filename);
+        return FAILURE;
+    }
+    printf("Resuming interrupted run on %s.\n", wav_filename);
+    journal->header = state.header;
+    journal->step = state.step;
+
+    // A record that did not reach the journal whole never reached the file either
+    if (state.pending) {
+        u_char *record = getBuffer((size_t) max(state.record_size, 1));
+        if (record == NULL) {
+            printf("Sorry, program run out of memory.\n\n");
+            return FAILURE;
+        }
+        off_t slot = STATE_SIZE + (state.step % 2) * state.slot_size;
+        int replay = preadFully(journal->fd, record, (size_t) state.record_size, slot) == SUCCESS
+                  && checksumOf(&state, record) == state.checksum;
+        if (replay && (applyRecord(journal->wav_fd, record, (size_t) state.record_size, state.truncate_size) != SUCCESS
+                    || fdatasync(journal->wav_fd) != 0)) {
+            releaseBuffer(record);
+            printf("Error in writing file: %s\n\n", wav_filename);
+            return FAILURE;
+        }
+        releaseBuffer(record);
+        journal->step += replay;
+    }
+
+    // Start the next step from a clean state, whatever slot size it uses
+    state.pending = 0;
+    state.step = journal->step;
+    if (writeState(journal, &state) != SUCCESS) {
+        printf("Error in writing file: %s\n\n", journal->filename);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Starts the record of the next step.
+ *
+ * @param journal
+ * @param capacity, bytes of data the record will hold at most
+ * @param extents, number of extents the record will hold at most
+ * @return EXIT_CODE
+ */
+public int beginRecord(Journal *journal, size_t capacity, size_t extents) {
+    capacity += extents * EXTENT_HEADER;
+    if (capacity > journal->capacity) {
+        releaseBuffer(journal->record);
+        journal->record = getBuffer(capacity);
+        journal->capacity = journal->record != NULL ? capacity : 0;
+        if (journal->record == NULL) {
+            printf("Sorry, program run out of memory.\n\n");
+            return FAILURE;
+        }
+    }
+    journal->record_size = 0;
+    return SUCCESS;
+}
+
+/**
+ * Adds an extent to the record of the next step, the caller fills in the
+ * bytes that commitStep() will write at @param offset of the .wav file.
+ *
+ * @param journal
+ * @param offset
+ * @param size
+ * @return the bytes of the extent
+ */
+public u_char *reserveExtent(Journal *journal, off_t offset, size_t size) {
+    long long extent[2] = {(long long) offset, (long long) size};
+    u_char *data = journal->record + journal->record_size;
+    memcpy(data, extent, EXTENT_HEADER);
+    journal->record_size += EXTENT_HEADER + size;
+    return data + EXTENT_HEADER;
+}
+
+/**
+ * Makes the record durable in the journal, then applies it to the .wav
+ * file and makes that durable too. An interrupted step is replayed by the
+ * next openJournal() if its record made it to the journal, and otherwise
+ * left for the next run to redo.
+ *
+ * @param journal
+ * @param truncate_size, size to truncate the .wav file to, or 0
+ * @return EXIT_CODE
+ */
+public int commitStep(Journal *journal, off_t truncate_size) {
+    if (journal->fd < 0 && createJournal(journal) != SUCCESS) {
+        printf("Error in opening file: %s\n\n", journal->filename);
+        return FAILURE;
+    }
+
+    JournalState state;
+    memset(&state, 0, sizeof(JournalState));
+    memcpy(state.magic, JOURNAL_MAGIC, sizeof(state.magic));
+    state.operation = journal->operation;
+    state.pending = 1;
+    state.step = journal->step;
+    state.slot_size = (long long) journal->capacity;
+    state.record_size = (long long) journal->record_size;
+    state.truncate_size = (long long) truncate_size;
+    state.header = journal->header;
+    state.checksum = checksumOf(&state, journal->record);
+
+    off_t slot = STATE_SIZE + (journal->step % 2) * state.slot_size;
+    if (pwriteFully(journal->fd, journal->record, journal->record_size, slot) != SUCCESS
+     || writeState(journal, &state) != SUCCESS) {
+        printf("Error in writing file: %s\n\n", journal->filename);
+        return FAILURE;
+    }
+
+    if (applyRecord(journal->wav_fd, journal->record, journal->record_size, truncate_size) != SUCCESS
+     || fdatasync(journal->wav_fd) != 0) {
+        printf("Header information mismatch, exiting program.\n\n");
+        return FAILURE;
+    }
+    journal->step++;
+    return SUCCESS;
+}
+
+/**
+ * Closes the files of a journal. The journal is deleted if @param finished
+ * is set, since every step is then in the .wav file, and kept otherwise so
+ * that the next run resumes from it.
+ *
+ * @param journal
+ * @param finished
+ */
+public void closeJournal(Journal *journal, int finished) {
+    if (journal->fd >= 0) {
+        close(journal->fd);
+        if (finished)
+            unlink(journal->filename);
+    }
+    if (journal->wav_fd >= 0)
+        close(journal->wav_fd);
+    releaseBuffer(journal->record);
+    freePointer(journal->filename);
+}
+
+/**
+ * Writes and syncs the state of a journal.
+ *
+ * @param journal
+ * @param state
+ * @return EXIT_CODE
+ */
+private int writeState(Journal *journal, JournalState *state) {
+    if (pwriteFully(journal->fd, state, sizeof(JournalState), 0) != SUCCESS || fdatasync(journal->fd) != 0)
+        return FAILURE;
+    return SUCCESS;
+}
+
+/**
+ * Creates the journal file and syncs its directory, so the journal cannot
+ * be lost after the .wav file has been changed.
+ *
+ * @param journal
+ * @return EXIT_CODE
+ */
+private int createJournal(Journal *journal) {
+    journal->fd = open(journal->filename, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (journal->fd < 0)
+        return FAILURE;
+
+    char *path = strdup(journal->filename);
+    if (path == NULL)
+        return FAILURE;
+    int directory = open(dirname(path), O_RDONLY | O_DIRECTORY);
+    free(path);
+    if (directory < 0)
+        return FAILURE;
+    int EXIT_CODE = fsync(directory) == 0 ? SUCCESS : FAILURE;
+    close(directory);
+    return EXIT_CODE;
+}
+
+/**
+ * Writes every extent of a record to the .wav file, all of them in flight
+ * at once through the shared I/O queue. Applying a record twice has the
+ * same effect as applying it once.
+ *
+ * @param wav_fd
+ * @param record
+ * @param record_size
+ * @param truncate_size
+ * @return EXIT_CODE
+ */
+private int applyRecord(int wav_fd, u_char *record, size_t record_size, long long truncate_size) {
+    int number_of_extents = 0;
+    for (size_t used = 0; used + EXTENT_HEADER <= record_size; number_of_extents++) {
+        long long extent[2];
+        memcpy(extent, record + used, EXTENT_HEADER);
+        used += EXTENT_HEADER;
+        if (extent[1] < 0 || (size_t) extent[1] > record_size - used)
+            return FAILURE;
+        used += (size_t) extent[1];
+    }
+
+    IORequest *requests = malloc(max(number_of_extents, 1) * sizeof(IORequest));
+    if (requests == NULL)
+        return FAILURE;
+    size_t used = 0;
+    for (int i = 0; i < number_of_extents; i++) {
+        long long extent[2];
+        memcpy(extent, record + used, EXTENT_HEADER);
+        used += EXTENT_HEADER;
+        requests[i].fd = wav_fd;
+        requests[i].write = 1;
+        requests[i].buffer = record + used;
+        requests[i].size = (size_t) extent[1];
+        requests[i].offset = (off_t) extent[0];
+        requests[i].buffer_index = -1;
+        used += (size_t) extent[1];
+    }
+
+    int EXIT_CODE = runIO(getSharedIOQueue(), requests, number_of_extents);
+    for (int i = 0; EXIT_CODE == SUCCESS && i < number_of_extents; i++)
+        if ((size_t) requests[i].result != requests[i].size)
+            EXIT_CODE = FAILURE;
+    free(requests);
+
+    if (EXIT_CODE == SUCCESS && truncate_size > 0 && ftruncate(wav_fd, (off_t) truncate_size) != 0)
+        EXIT_CODE = FAILURE;
+    return EXIT_CODE;
+}
+
+/**
+ * @param state
+ * @param record
+ * @return 64 bit FNV-1a hash of @param state, without its checksum, and
+ * the state->record_size bytes of @param record
+ */
+private unsigned long long checksumOf(JournalState *state, u_char *record) {
+    unsigned long long checksum = 14695981039346656037ULL;
+    JournalState copy = *state;
+    copy.checksum = 0;
+
+    u_char *bytes = (u_char *) &copy;
+    for (size_t i = 0; i < sizeof(JournalState); i++)
+        checksum = (checksum ^ bytes[i]) * 1099511628211ULL;
+    for (long long i = 0; i < state->record_size; i++)
+        checksum = (checksum ^ record[i]) * 1099511628211ULL;
+    return checksum;
+}
@@ -0,0 +1,353 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    Memory.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <pthread.h>
+#include <sys/mman.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define ARENA_CHUNK (64 << 10)
+#define ARENA_ALIGN sizeof(long double)
+#define SMALLEST_CLASS 16          // log2 of the smallest pooled buffer, 64 KiB.
+#define NUMBER_OF_CLASSES 32
+#define POOL_LIMIT (256UL << 20)   // Bytes of idle buffers kept for reuse.
+#define HUGE_PAGE (2UL << 20)
+
+/**
+ * A chunk of an Arena, allocations are carved from data front to back.
+ */
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;
+    size_t used;
+    long double data[];
+} ArenaChunk;
+
+/**
+ * Per job allocator of small, short lived blocks that are all released at
+ * once by releaseArena().
+ */
+struct Arena {
+    ArenaChunk *chunks;
+    struct Arena *next;
+};
+
+/**
+ * A mapping handed out by getBuffer(), kept on the list of its size class
+ * while idle and on the in use list otherwise.
+ */
+typedef struct PoolBuffer {
+    void *data;
+    size_t size;
+    int huge;
+    struct PoolBuffer *next;
+} PoolBuffer;
+
+/**
+ * Idle buffers by size class, buffers in use and idle arenas, all guarded
+ * by lock.
+ */
+private struct {
+    PoolBuffer *idle[NUMBER_OF_CLASSES];
+    PoolBuffer *in_use;
+    size_t idle_bytes;
+    Arena *idle_arenas;
+    MemoryStats stats;
+    pthread_mutex_t lock;
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+private void *mapBuffer(size_t size, int *huge);
+
+private void unmapBuffer(PoolBuffer *buffer);
+
+private int sizeClass(size_t size);
+
+
+/**
+ * @return an empty Arena, reusing the chunks of a released one when
+ * possible, or NULL if out of memory.
+ */
+public Arena *acquireArena() {
+    pthread_mutex_lock(&pool.lock);
+    Arena *arena = pool.idle_arenas;
+    if (arena != NULL)
+        pool.idle_arenas = arena->next;
+    pool.stats.arenas_acquired++;
+    pthread_mutex_unlock(&pool.lock);
+
+    if (arena == NULL)
+        arena = calloc(1, sizeof(Arena));
+    return arena;
+}
+
+/**
+ * Allocates @param size bytes from an Arena, aligned for any type. Blocks
+ * are never freed on their own, only all together by releaseArena().
+ *
+ * @param arena
+ * @param size
+ * @return the block or NULL if out of memory
+ */
+public void *arenaAlloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+    ArenaChunk *chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t chunk_size = max(size, ARENA_CHUNK);
+        chunk = malloc(sizeof(ArenaChunk) + chunk_size);
+        if (chunk == NULL)
+            return NULL;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        __atomic_fetch_add(&pool.stats.arena_chunks, 1, __ATOMIC_RELAXED);
+    }
+
+    void *block = (u_char *) chunk->data + chunk->used;
+    chunk->used += size;
+    __atomic_fetch_add(&pool.stats.arena_allocations, 1, __ATOMIC_RELAXED);
+    return block;
+}
+
+/**
+ * Releases every block of an Arena and keeps it, with its first chunk, for
+ * the next acquireArena(). Oversized chunks go back to the system.
+ *
+ * @param arena, may be NULL
+ */
+public void releaseArena(Arena *arena) {
+    if (arena == NULL)
+        return;
+
+    ArenaChunk *keep = NULL;
+    while (arena->chunks != NULL) {
+        ArenaChunk *chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        if (keep == NULL && chunk->size == ARENA_CHUNK) {
+            keep = chunk;
+            keep->used = 0;
+            keep->next = NULL;
+        } else
+            free(chunk);
+    }
+    arena->chunks = keep;
+
+    pthread_mutex_lock(&pool.lock);
+    arena->next = pool.idle_arenas;
+    pool.idle_arenas = arena;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/**
+ * Gets a page aligned buffer of at least @param size bytes, reusing an idle
+ * buffer of the same size class if there is one. Buffers of 2 MiB and more
+ * are backed by huge pages when WAVENGINE_HUGEPAGES is set.
+ * Release it with releaseBuffer().
+ *
+ * @param size
+ * @return the buffer or NULL if out of memory
+ */
+public void *getBuffer(size_t size) {
+    int class = sizeClass(size);
+    if (class >= NUMBER_OF_CLASSES)
+        return NULL;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stats.buffer_requests++;
+    PoolBuffer *buffer = pool.idle[class];
+    if (buffer != NULL) {
+        pool.idle[class] = buffer->next;
+        pool.idle_bytes -= buffer->size;
+        pool.stats.buffer_reuses++;
+        buffer->next = pool.in_use;
+        pool.in_use = buffer;
+        pthread_mutex_unlock(&pool.lock);
+        return buffer->data;
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    // Map outside of the lock, other threads keep getting idle buffers
+    buffer = malloc(sizeof(PoolBuffer));
+    if (buffer == NULL)
+        return NULL;
+    buffer->size = (size_t) 1 << (class + SMALLEST_CLASS);
+    buffer->data = mapBuffer(buffer->size, &buffer->huge);
+    if (buffer->data == NULL) {
+        free(buffer);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stats.buffer_maps++;
+    pool.stats.huge_buffers += buffer->huge;
+    pool.stats.mapped_bytes += buffer->size;
+    pool.stats.peak_mapped_bytes = max(pool.stats.peak_mapped_bytes, pool.stats.mapped_bytes);
+    buffer->next = pool.in_use;
+    pool.in_use = buffer;
+    pthread_mutex_unlock(&pool.lock);
+    return buffer->data;
+}
+
+/**
+ * Returns a buffer of getBuffer() to the pool. Idle buffers beyond
+ * POOL_LIMIT bytes are unmapped.
+ *
+ * @param data, may be NULL
+ */
+public void releaseBuffer(void *data) {
+    if (data == NULL)
+        return;
+
+    pthread_mutex_lock(&pool.lock);
+    PoolBuffer **link = &pool.in_use;
+    while (*link != NULL && (*link)->data != data)
+        link = &(*link)->next;
+    PoolBuffer *buffer = *link;
+    if (buffer == NULL) {
+        pthread_mutex_unlock(&pool.lock);
+        return;
+    }
+    *link = buffer->next;
+
+    if (pool.idle_bytes + buffer->size <= POOL_LIMIT) {
+        int class = sizeClass(buffer->size);
+        buffer->next = pool.idle[class];
+        pool.idle[class] = buffer;
+        pool.idle_bytes += buffer->size;
+        buffer = NULL;
+    } else
+        pool.stats.mapped_bytes -= buffer->size;
+    pthread_mutex_unlock(&pool.lock);
+
+    if (buffer != NULL)
+        unmapBuffer(buffer);
+}
+
+/**
+ * Unmaps every idle buffer and frees every idle arena. Buffers and arenas
+ * still in use are left alone.
+ */
+public void freeMemoryPools() {
+    pthread_mutex_lock(&pool.lock);
+    for (int class = 0; class < NUMBER_OF_CLASSES; class++)
+        while (pool.idle[class] != NULL) {
+            PoolBuffer *buffer = pool.idle[class];
+            pool.idle[class] = buffer->next;
+            pool.stats.mapped_bytes -= buffer->size;
+            unmapBuffer(buffer);
+        }
+    pool.idle_bytes = 0;
+
+    while (pool.idle_arenas != NULL) {
+        Arena *arena = pool.idle_arenas;
+        pool.idle_arenas = arena->next;
+        while (arena->chunks != NULL) {
+            ArenaChunk *chunk = arena->chunks;
+            arena->chunks = chunk->next;
+            free(chunk);
+        }
+        free(arena);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/**
+ * @param stats, receives a snapshot of the allocation counters
+ */
+public void getMemoryStats(MemoryStats *stats) {
+    pthread_mutex_lock(&pool.lock);
+    *stats = pool.stats;
+    stats->arena_allocations = __atomic_load_n(&pool.stats.arena_allocations, __ATOMIC_RELAXED);
+    stats->arena_chunks = __atomic_load_n(&pool.stats.arena_chunks, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/**
+ * Prints the allocation counters to stderr when WAVENGINE_MEMSTATS is set.
+ */
+public void printMemoryStats() {
+    if (getenv("WAVENGINE_MEMSTATS") == NULL)
+        return;
+
+    MemoryStats stats;
+    getMemoryStats(&stats);
+    fprintf(stderr, "Buffers requested: %lu, reused: %lu, mapped: %lu, on huge pages: %lu\n"
+                    "Buffer bytes mapped: %lu, peak: %lu\n"
+                    "Arenas acquired: %lu, arena allocations: %lu, arena chunks: %lu\n",
+            stats.buffer_requests, stats.buffer_reuses, stats.buffer_maps, stats.huge_buffers,
+            stats.mapped_bytes, stats.peak_mapped_bytes,
+            stats.arenas_acquired, stats.arena_allocations, stats.arena_chunks);
+}
+
+/**
+ * Maps @param size bytes of anonymous memory, on huge pages if requested
+ * and available. Without reserved huge pages the kernel is still asked to
+ * back the mapping with transparent huge pages.
+ *
+ * @param size, a power of two
+ * @param huge, set to 1 if the mapping uses reserved huge pages
+ * @return the mapping or NULL
+ */
+private void *mapBuffer(size_t size, int *huge) {
+    int use_huge_pages = size >= HUGE_PAGE && getenv("WAVENGINE_HUGEPAGES") != NULL;
+    void *data = MAP_FAILED;
+    *huge = 0;
+
+#ifdef MAP_HUGETLB
+    if (use_huge_pages) {
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        *huge = data != MAP_FAILED;
+    }
+#endif
+    if (data == MAP_FAILED)
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        return NULL;
+
+#ifdef MADV_HUGEPAGE
+    if (use_huge_pages && !*huge)
+        madvise(data, size, MADV_HUGEPAGE);
+#endif
+    return data;
+}
+
+/**
+ * Unmaps a buffer and frees its bookkeeping.
+ *
+ * @param buffer
+ */
+private void unmapBuffer(PoolBuffer *buffer) {
+    munmap(buffer->data, buffer->size);
+    free(buffer);
+}
+
+/**
+ * @param size
+ * @return index of the smallest power of two size class holding
+ * @param size bytes
+ */
+private int sizeClass(size_t size) {
+    int class = 0;
+    while (((size_t) 1 << (class + SMALLEST_CLASS)) < size && class < NUMBER_OF_CLASSES)
+        class++;
+    return class;
+}
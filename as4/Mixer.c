@@ -22,12 +22,28 @@
  * @author Aristos Georgiou
  */
 
+/**
+ * Both inputs of a mix. Each input block holds a run of frames of the first
+ * file followed by as many frames of the second.
+ */
+typedef struct MixSource {
+    FileRange range1, range2;
+    size_t frame_size1, frame_size2;
+    size_t sample_size1, sample_size2;
+    u_int right_channel2;    // The right (or only) channel of the second file.
+    u_int frames;
+} MixSource;
+
+private ssize_t readMixFrames(void *context, u_char *block, size_t capacity, u_int sequence);
+
+private size_t mixFrames(void *context, u_char *input, size_t size, u_char *output);
+
 
 /**
  * Create a .wav that plays the left channel of wav_filename1.wav and the right
  * channel of wav_filename2.
  *
- * Works for any combination of stereo and mono inputs.
+ * Works for any combination of mono, stereo and multichannel inputs.
  *
  * Option ID: 3
  *
@@ -38,16 +54,23 @@
 public int mix(char *wav_filename1, char *wav_filename2) {
     int EXIT_CODE;
     Header *wav_header1 = NULL, *wav_header2 = NULL, *wav_header3 = NULL;
-    FILE *wav_file1 = NULL, *wav_file2 = NULL, *wav_file3 = NULL;
+    FILE *wav_file1 = NULL, *wav_file2 = NULL;
+    Output output = {NULL, -1, 0, -1};
     char *name = NULL;
+    int stream1 = isStream(wav_filename1), stream2 = isStream(wav_filename2);
+
+    if (stream1 && stream2) {
+        printf("Incompatible wav files: %s, %s\n\n", wav_filename1, wav_filename2);
+        return FAILURE;
+    }
 
     // Initialise wav_header1 from wav_file1
-    EXIT_CODE = getHeader(&wav_header1, &wav_file1, wav_filename1);
+    EXIT_CODE = getHeader(NULL, &wav_header1, &wav_file1, wav_filename1);
     if (EXIT_CODE != SUCCESS)
         goto END;
 
     // Initialise wav_header1 from wav_file2
-    EXIT_CODE = getHeader(&wav_header2, &wav_file2, wav_filename2);
+    EXIT_CODE = getHeader(NULL, &wav_header2, &wav_file2, wav_filename2);
     if (EXIT_CODE != SUCCESS)
         goto END;
 
@@ -58,16 +81,18 @@ public int mix(char *wav_filename1, char *wav_filename2) {
         goto END;
     }
 
-    // Create new file name
-    size_t size = strlen(wav_filename1) + strlen(wav_filename2) + 2;
-    name = malloc(size);
-    if (name == NULL) {
-        EXIT_CODE = FAILURE;
-        printf("Sorry, program run out of memory.\n\n");
-        goto END;
+    // Create new file name, with a stream as input the mix goes to stdout
+    if (!stream1 && !stream2) {
+        size_t size = strlen(wav_filename1) + strlen(wav_filename2) + 2;
+        name = malloc(size);
+        if (name == NULL) {
+            EXIT_CODE = FAILURE;
+            printf("Sorry, program run out of memory.\n\n");
+            goto END;
+        }
+        snprintf(name, size, "mix-%.*s-%s", (int) (strlen(wav_filename1) - 4), wav_filename1,
+                 wav_filename2);
     }
-    snprintf(name, size, "mix-%.*s-%s", (int) (strlen(wav_filename1) - 4), wav_filename1,
-             wav_filename2);
     {
         // Initialise wav_header3 from the min of header1 and header2
         wav_header3 = malloc(HEADER_SIZE);
@@ -81,31 +106,43 @@ public int mix(char *wav_filename1, char *wav_filename2) {
         else
             memcpy(wav_header3, wav_header2, HEADER_SIZE);
 
-        // Ensure stereo wav_header3
-        makeHeaderStereo(wav_header3);
-
-        // Open wav_file3 and write header3 to it
-        wav_file3 = fopen(name, "wb");
-        fwrite(wav_header3, HEADER_SIZE, 1, wav_file3);
-
-        // Create the buffer of LR samples for wav_file1
-        size_t sample_size1 = (size_t) wav_header1->blockAlign;
-        u_char sample1[sample_size1];
-
-        // Create the buffer of LR samples for wav_file2
-        size_t sample_size2 = (size_t) wav_header2->blockAlign;
-        u_char sample2[sample_size2];
+        // Ensure stereo wav_header3, as long as the shorter file
+        setChannelCount(wav_header3, 2);
+        MixSource source;
+        source.frame_size1 = (size_t) wav_header1->blockAlign;
+        source.frame_size2 = (size_t) wav_header2->blockAlign;
+        source.sample_size1 = source.frame_size1 / wav_header1->numChannels;
+        source.sample_size2 = source.frame_size2 / wav_header2->numChannels;
+        source.right_channel2 = wav_header2->numChannels > 1;
+        source.frames = min(wav_header1->subchunk2Size / wav_header1->blockAlign,
+                            wav_header2->subchunk2Size / wav_header2->blockAlign);
+        wav_header3->subchunk2Size = source.frames * wav_header3->blockAlign;
+        wav_header3->chunkSize = wav_header3->subchunk2Size + 36;
+        FileRange range1 = {fileno(wav_file1), HEADER_SIZE, HEADER_SIZE + (off_t) (source.frames * source.frame_size1),
+                            0, stream1, HEADER_SIZE};
+        FileRange range2 = {fileno(wav_file2), HEADER_SIZE, HEADER_SIZE + (off_t) (source.frames * source.frame_size2),
+                            0, stream2, HEADER_SIZE};
+        source.range1 = range1;
+        source.range2 = range2;
+
+        // Open the output and write header3 to it
+        EXIT_CODE = openOutput(&output, stream1 || stream2, name, wav_header3);
+        if (EXIT_CODE != SUCCESS)
+            goto END;
 
-        u_int min_sample = min(sample_size1, sample_size2);
-        for (register u_int q = 0; q < wav_header3->subchunk2Size / min_sample; q++) {
-            // Write left channel of wav_file1 to wav_file3
-            if (fread(&sample1, sample_size1, 1, wav_file1) != 1) break;
-            fwrite(sample1, sample_size1 / wav_header1->numChannels, 1, wav_file3);
+        // Frames of both files are read together and interleaved into LR frames
+        size_t block = getBlockSize((u_int) (source.frame_size1 + source.frame_size2));
+        size_t frames_per_block = block / (source.frame_size1 + source.frame_size2);
+        Pipeline pipeline = {readMixFrames, &source, mixFrames, &source, block,
+                             frames_per_block * (source.sample_size1 + source.sample_size2),
+                             output.fd, output.data_offset};
+        off_t input_size = stream1 || stream2 ? -1 : (off_t) source.frames * (off_t) (source.frame_size1 + source.frame_size2);
 
-            // Write right channel of wav_file2 to wav_file3
-            if (fread(&sample2, sample_size2, 1, wav_file2) != 1) break;
-            fwrite(sample2 + (sample_size2 / 2) * (wav_header2->numChannels - 1),
-                   sample_size2 / wav_header2->numChannels, 1, wav_file3);
+        if (runParallelPipeline(&pipeline, input_size) != SUCCESS
+         || finishOutput(&output, wav_header3, pipeline.written) != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            printf("Header information mismatch, exiting program.\n\n");
+            goto END;
         }
     }
 
@@ -116,6 +153,60 @@ public int mix(char *wav_filename1, char *wav_filename2) {
     freePointer(name);
     closeFile(wav_file1);
     closeFile(wav_file2);
-    closeFile(wav_file3);
+    closeOutput(&output);
     return EXIT_CODE;
 }
+
+/**
+ * Pipeline reader of a mix, reads the same run of frames from both files.
+ *
+ * @param context, the MixSource
+ * @param block
+ * @param capacity
+ * @param sequence
+ * @return bytes read, 0 after the last frame or -1 on error
+ */
+private ssize_t readMixFrames(void *context, u_char *block, size_t capacity, u_int sequence) {
+    MixSource *source = context;
+    size_t frames_per_block = capacity / (source->frame_size1 + source->frame_size2);
+    size_t first = (size_t) sequence * frames_per_block;
+    if (first >= source->frames)
+        return 0;
+
+    size_t frames = min(frames_per_block, source->frames - first);
+    size_t size1 = frames * source->frame_size1, size2 = frames * source->frame_size2;
+    ssize_t read1 = readRange(&source->range1, block, size1, (off_t) (first * source->frame_size1));
+    ssize_t read2 = readRange(&source->range2, block + size1, size2, (off_t) (first * source->frame_size2));
+    if (read1 < 0 || read2 < 0 || (size_t) read1 < size1 - size1 * source->range1.stream
+     || (size_t) read2 < size2 - size2 * source->range2.stream)
+        return -1;
+
+    // A stream that ends early ends the mix, its frames go right after those of the first file
+    size_t read_frames = min((size_t) read1 / source->frame_size1, (size_t) read2 / source->frame_size2);
+    if (read_frames < frames) {
+        memmove(block + read_frames * source->frame_size1, block + size1, read_frames * source->frame_size2);
+        source->frames = (u_int) (first + read_frames);
+    }
+    return (ssize_t) (read_frames * (source->frame_size1 + source->frame_size2));
+}
+
+/**
+ * Pipeline stage writing the left channel of the first file and the right
+ * channel of the second as one stereo frame.
+ *
+ * @param context, the MixSource
+ * @param input
+ * @param size
+ * @param output
+ * @return bytes in output
+ */
+private size_t mixFrames(void *context, u_char *input, size_t size, u_char *output) {
+    MixSource *source = context;
+    size_t frames = size / (source->frame_size1 + source->frame_size2);
+    const u_char *sources[2] = {input, input + frames * source->frame_size1};
+    size_t frame_sizes[2] = {source->frame_size1, source->frame_size2};
+    u_int channels[2] = {0, source->right_channel2};
+
+    gatherChannels(sources, frame_sizes, channels, 2, (u_int) source->sample_size1, frames, output);
+    return frames * (source->sample_size1 + source->sample_size2);
+}
@@ -0,0 +1,533 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    PeakPyramid.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define PEAK_BASE 256           // Frames summarized by an entry of level 0.
+#define MAX_POINTS 100000
+
+static const char PEAKS_MAGIC[8] = "WAVPKS1";
+
+/**
+ * Layout of a peak file, every section follows the previous one:
+ * PeakHeader, then the entries of level 0, 1, ... levels - 1, each level
+ * holding one PeakEntry per channel for every entry of the level.
+ * Entry i of level k summarizes frames [i * PEAK_BASE * 2^k, (i + 1) *
+ * PEAK_BASE * 2^k) and level k has half the entries of level k - 1, rounded
+ * up, down to a single entry. The size and modification time of the .wav
+ * file tell whether the peak file is still valid.
+ */
+typedef struct PeakHeader {
+    char magic[8];
+    u_int channels;
+    u_int sample_rate;
+    u_int frames;
+    u_int levels;
+    long long wav_size;
+    long long wav_mtime_sec;
+    long long wav_mtime_nsec;
+} PeakHeader;
+
+struct PeakEntry {
+    float min;
+    float max;
+    double squares;             // Sum of squared samples.
+};
+
+private int mapPeakFile(Peaks *peaks, char *peak_filename, struct stat *wav_stat);
+
+private int buildPeakFile(Peaks *peaks, char *wav_filename, char *peak_filename, struct stat *wav_stat);
+
+private u_int levelsOf(u_int frames, u_int *level_start);
+
+private void mergeEntry(PeakSummary *summary, const struct PeakEntry *entry, int channels);
+
+private int mergeFrames(Peaks *peaks, u_int start, u_int end, PeakSummary *summary);
+
+private void decodeSamples(const u_char *data, size_t count, int sample_size, float *values);
+
+
+/**
+ * Prints the minimum, maximum and RMS of every channel of a .wav file from
+ * @param start to @param end seconds, split into @param points equal parts
+ * for a waveform overview. Answers come from the peak file of the .wav
+ * file, built first if missing or out of date.
+ * Option ID: 20
+ *
+ * @param wav_filename
+ * @param start, in seconds
+ * @param end, in seconds, or negative for the end of the file
+ * @param points
+ * @return EXIT_CODE
+ */
+public int printPeaks(char *wav_filename, double start, double end, int points) {
+    int EXIT_CODE;
+    Peaks peaks;
+    PeakSummary *summary = NULL;
+
+    EXIT_CODE = openPeaks(&peaks, wav_filename);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    double rate = peaks.header.sampleRate;
+    double seconds = peaks.frames / max(rate, 1);
+    if (end < 0)
+        end = seconds;
+    if (start < 0 || start >= end || end > seconds || points < 1 || points > MAX_POINTS) {
+        EXIT_CODE = FAILURE;
+        printf("Parameters for seconds are invalid.\n\n");
+        goto END;
+    }
+
+    summary = malloc(peaks.header.numChannels * sizeof(PeakSummary));
+    if (summary == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    printf("Peaks of %s from %.3f s to %.3f s:\n", wav_filename, start, end);
+    for (int p = 0; p < points; p++) {
+        double from = start + (end - start) * p / points;
+        double to = start + (end - start) * (p + 1) / points;
+        EXIT_CODE = queryPeaks(&peaks, (u_int) (from * rate), min((u_int) (to * rate), peaks.frames), summary);
+        if (EXIT_CODE != SUCCESS) {
+            printf("Error in reading file: %s\n\n", wav_filename);
+            goto END;
+        }
+
+        if (points == 1) {
+            for (int c = 0; c < peaks.header.numChannels; c++)
+                printf("Channel %d: min %.4f, max %.4f, RMS %.4f\n", c + 1, summary[c].min, summary[c].max,
+                       summary[c].rms);
+            continue;
+        }
+        printf("%.3f s:", from);
+        for (int c = 0; c < peaks.header.numChannels; c++)
+            printf(" %.4f %.4f %.4f", summary[c].min, summary[c].max, summary[c].rms);
+        printf("\n");
+    }
+    printf("\n");
+
+    END:
+    freePointer(summary);
+    closePeaks(&peaks);
+    return EXIT_CODE;
+}
+
+/**
+ * Opens a .wav file with its peak file, wav_filename.peaks, mapped. A peak
+ * file that is missing, damaged or older than the .wav file is built again
+ * in one pass over the data. closePeaks() releases both.
+ *
+ * @param peaks
+ * @param wav_filename
+ * @return EXIT_CODE
+ */
+public int openPeaks(Peaks *peaks, char *wav_filename) {
+    int EXIT_CODE = SUCCESS;
+    char *peak_filename = NULL;
+    struct stat wav_stat;
+
+    memset(peaks, 0, sizeof(Peaks));
+    peaks->mapping = MAP_FAILED;
+    if (isStream(wav_filename)) {
+        printf("Streams are not supported: %s\n\n", wav_filename);
+        peaks->wav_fd = -1;
+        return FAILURE;
+    }
+
+    peaks->wav_fd = open(wav_filename, O_RDONLY);
+    if (peaks->wav_fd < 0 || fstat(peaks->wav_fd, &wav_stat) != 0) {
+        EXIT_CODE = FAILURE;
+        printf("Error in opening file: %s\n\n", wav_filename);
+        goto END;
+    }
+    if (preadFully(peaks->wav_fd, &peaks->header, HEADER_SIZE, 0) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        printf("File not even 44 bytes: %s\n\n", wav_filename);
+        goto END;
+    }
+    if (wavCheck(&peaks->header) == FAILURE || peaks->header.numChannels < 1
+     || peaks->header.blockAlign < peaks->header.numChannels) {
+        EXIT_CODE = FAILURE;
+        printf("Invalid wav header.\n\n");
+        goto END;
+    }
+    peaks->frames = peaks->header.subchunk2Size / peaks->header.blockAlign;
+    peaks->levels = levelsOf(peaks->frames, peaks->level_start);
+
+    peak_filename = malloc(7 + strlen(wav_filename));
+    if (peak_filename == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+    snprintf(peak_filename, 7 + strlen(wav_filename), "%s.peaks", wav_filename);
+
+    if (mapPeakFile(peaks, peak_filename, &wav_stat) != SUCCESS)
+        EXIT_CODE = buildPeakFile(peaks, wav_filename, peak_filename, &wav_stat);
+
+    END:
+    freePointer(peak_filename);
+    if (EXIT_CODE != SUCCESS)
+        closePeaks(peaks);
+    return EXIT_CODE;
+}
+
+/**
+ * Summarizes every channel over frames [start, end) of an open .wav file.
+ * Whole level 0 entries inside the range are covered by at most two
+ * entries per level, so only O(log n) entries are touched, and the frames
+ * before the first and after the last whole entry, fewer than PEAK_BASE
+ * each, are read from the .wav file.
+ *
+ * @param peaks
+ * @param start, first frame
+ * @param end, frame after the last
+ * @param summary, receives numChannels PeakSummary
+ * @return EXIT_CODE
+ */
+public int queryPeaks(Peaks *peaks, u_int start, u_int end, PeakSummary *summary) {
+    int channels = peaks->header.numChannels;
+    end = min(end, peaks->frames);
+
+    for (int c = 0; c < channels; c++) {
+        summary[c].min = 1;
+        summary[c].max = -1;
+        summary[c].rms = 0;
+    }
+    if (start >= end) {
+        memset(summary, 0, channels * sizeof(PeakSummary));
+        return SUCCESS;
+    }
+
+    u_int left = (u_int) (((unsigned long long) start + PEAK_BASE - 1) / PEAK_BASE);
+    u_int right = end / PEAK_BASE;
+    if (left >= right) {
+        if (mergeFrames(peaks, start, end, summary) != SUCCESS)
+            return FAILURE;
+    } else {
+        if (mergeFrames(peaks, start, left * PEAK_BASE, summary) != SUCCESS
+         || mergeFrames(peaks, right * PEAK_BASE, end, summary) != SUCCESS)
+            return FAILURE;
+
+        // Bottom up over the levels, taking the entries left and right that
+        // their parents would only partly cover
+        for (u_int level = 0; left < right; level++, left /= 2, right /= 2) {
+            const struct PeakEntry *entries = peaks->entries + (size_t) peaks->level_start[level] * channels;
+            if (left % 2 == 1)
+                mergeEntry(summary, entries + (size_t) left++ * channels, channels);
+            if (right % 2 == 1)
+                mergeEntry(summary, entries + (size_t) --right * channels, channels);
+        }
+    }
+
+    for (int c = 0; c < channels; c++)
+        summary[c].rms = sqrt(summary[c].rms / (end - start));
+    return SUCCESS;
+}
+
+/**
+ * Unmaps the peak file and closes the .wav file of openPeaks().
+ *
+ * @param peaks
+ */
+public void closePeaks(Peaks *peaks) {
+    if (peaks->mapping != MAP_FAILED && peaks->mapping != NULL)
+        munmap(peaks->mapping, peaks->mapping_size);
+    if (peaks->wav_fd >= 0)
+        close(peaks->wav_fd);
+    peaks->mapping = MAP_FAILED;
+    peaks->wav_fd = -1;
+}
+
+/**
+ * Maps an existing peak file if it belongs to the .wav file as it is now.
+ *
+ * @param peaks, with the header and levels of the .wav file
+ * @param peak_filename
+ * @param wav_stat
+ * @return EXIT_CODE, FAILURE if the peak file has to be built
+ */
+private int mapPeakFile(Peaks *peaks, char *peak_filename, struct stat *wav_stat) {
+    int fd = open(peak_filename, O_RDONLY);
+    struct stat peak_stat;
+    if (fd < 0)
+        return FAILURE;
+    if (fstat(fd, &peak_stat) != 0 || (size_t) peak_stat.st_size < sizeof(PeakHeader)) {
+        close(fd);
+        return FAILURE;
+    }
+
+    peaks->mapping_size = (size_t) peak_stat.st_size;
+    peaks->mapping = mmap(NULL, peaks->mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (peaks->mapping == MAP_FAILED)
+        return FAILURE;
+
+    PeakHeader *header = peaks->mapping;
+    size_t entries = peaks->levels > 0 ? peaks->level_start[peaks->levels - 1] + 1 : 0;
+    if (memcmp(header->magic, PEAKS_MAGIC, sizeof(header->magic)) != 0
+     || header->channels != (u_int) peaks->header.numChannels || header->frames != peaks->frames
+     || header->levels != peaks->levels || header->wav_size != (long long) wav_stat->st_size
+     || header->wav_mtime_sec != (long long) wav_stat->st_mtim.tv_sec
+     || header->wav_mtime_nsec != (long long) wav_stat->st_mtim.tv_nsec
+     || sizeof(PeakHeader) + entries * header->channels * sizeof(struct PeakEntry) != peaks->mapping_size) {
+        munmap(peaks->mapping, peaks->mapping_size);
+        peaks->mapping = MAP_FAILED;
+        return FAILURE;
+    }
+
+    peaks->entries = (const struct PeakEntry *) (header + 1);
+    return SUCCESS;
+}
+
+/**
+ * Builds the peak file of a .wav file in one pass over its data, then maps
+ * it. The file is written under a temporary name and renamed into place,
+ * so a reader never maps a half written one.
+ *
+ * @param peaks, with the header and levels of the .wav file
+ * @param wav_filename
+ * @param peak_filename
+ * @param wav_stat
+ * @return EXIT_CODE
+ */
+private int buildPeakFile(Peaks *peaks, char *wav_filename, char *peak_filename, struct stat *wav_stat) {
+    int EXIT_CODE = SUCCESS;
+    int channels = peaks->header.numChannels;
+    int sample_size = peaks->header.blockAlign / channels;
+    size_t number_of_entries = peaks->levels > 0 ? peaks->level_start[peaks->levels - 1] + 1 : 0;
+    struct PeakEntry *entries = NULL;
+    u_char *block = NULL;
+    float values[PACKED_TILE];
+    char *temporary_filename = NULL;
+    int fd = -1;
+
+    entries = malloc(max(number_of_entries * channels, 1) * sizeof(struct PeakEntry));
+    size_t block_size = getBlockSize((u_int) peaks->header.blockAlign);
+    block = getBuffer(block_size);
+    temporary_filename = malloc(8 + strlen(peak_filename));
+    if (entries == NULL || block == NULL || temporary_filename == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    // Level 0, PEAK_BASE frames at a time across the blocks
+    FileRange range = {peaks->wav_fd, HEADER_SIZE, HEADER_SIZE + (off_t) peaks->frames * peaks->header.blockAlign,
+                       0, 0, HEADER_SIZE};
+    u_int frame = 0;
+    for (off_t offset = 0; frame < peaks->frames; offset += (off_t) block_size) {
+        ssize_t size = readRange(&range, block, block_size, offset);
+        if (size <= 0) {
+            EXIT_CODE = FAILURE;
+            printf("Error in reading file: %s\n\n", wav_filename);
+            goto END;
+        }
+
+        // The samples are decoded a tile at a time, c and frame follow them
+        size_t count = (size_t) size / peaks->header.blockAlign * channels;
+        int c = 0;
+        for (size_t first = 0; first < count; first += PACKED_TILE) {
+            size_t tile = min((size_t) PACKED_TILE, count - first);
+            decodeSamples(block + first * sample_size, tile, sample_size, values);
+            for (size_t k = 0; k < tile; k++) {
+                struct PeakEntry *entry = entries + (size_t) (frame / PEAK_BASE) * channels + c;
+                float value = values[k];
+                if (frame % PEAK_BASE == 0) {
+                    entry->min = entry->max = value;
+                    entry->squares = 0;
+                }
+                entry->min = value < entry->min ? value : entry->min;
+                entry->max = value > entry->max ? value : entry->max;
+                entry->squares += (double) value * value;
+                if (++c == channels) {
+                    c = 0;
+                    frame++;
+                }
+            }
+        }
+    }
+
+    // Every other level merges pairs of the level below
+    for (u_int level = 1; level < peaks->levels; level++) {
+        struct PeakEntry *below = entries + (size_t) peaks->level_start[level - 1] * channels;
+        struct PeakEntry *above = entries + (size_t) peaks->level_start[level] * channels;
+        u_int count = peaks->level_start[level] - peaks->level_start[level - 1];
+        for (u_int i = 0; 2 * i < count; i++)
+            for (int c = 0; c < channels; c++) {
+                struct PeakEntry *first = &below[(size_t) 2 * i * channels + c];
+                struct PeakEntry *result = &above[(size_t) i * channels + c];
+                *result = *first;
+                if (2 * i + 1 < count) {
+                    struct PeakEntry *second = first + channels;
+                    result->min = min(first->min, second->min);
+                    result->max = max(first->max, second->max);
+                    result->squares += second->squares;
+                }
+            }
+    }
+
+    PeakHeader header;
+    memset(&header, 0, sizeof(PeakHeader));
+    memcpy(header.magic, PEAKS_MAGIC, sizeof(header.magic));
+    header.channels = (u_int) channels;
+    header.sample_rate = peaks->header.sampleRate;
+    header.frames = peaks->frames;
+    header.levels = peaks->levels;
+    header.wav_size = (long long) wav_stat->st_size;
+    header.wav_mtime_sec = (long long) wav_stat->st_mtim.tv_sec;
+    header.wav_mtime_nsec = (long long) wav_stat->st_mtim.tv_nsec;
+
+    snprintf(temporary_filename, 8 + strlen(peak_filename), "%s.XXXXXX", peak_filename);
+    fd = mkstemp(temporary_filename);
+    if (fd < 0) {
+        EXIT_CODE = FAILURE;
+        printf("Error in opening file: %s\n\n", peak_filename);
+        goto END;
+    }
+    if (pwriteFully(fd, &header, sizeof(PeakHeader), 0) != SUCCESS
+     || pwriteFully(fd, entries, number_of_entries * channels * sizeof(struct PeakEntry), sizeof(PeakHeader)) != SUCCESS
+     || fchmod(fd, 0644) != 0 || rename(temporary_filename, peak_filename) != 0) {
+        EXIT_CODE = FAILURE;
+        unlink(temporary_filename);
+        printf("Error in writing file: %s\n\n", peak_filename);
+        goto END;
+    }
+
+    if (mapPeakFile(peaks, peak_filename, wav_stat) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        printf("Error in opening file: %s\n\n", peak_filename);
+    }
+
+    END:
+    if (fd >= 0)
+        close(fd);
+    freePointer(entries);
+    releaseBuffer(block);
+    freePointer(temporary_filename);
+    return EXIT_CODE;
+}
+
+/**
+ * @param frames
+ * @param level_start, receives the first entry of every level
+ * @return number of levels of a pyramid over @param frames frames
+ */
+private u_int levelsOf(u_int frames, u_int *level_start) {
+    u_int count = (u_int) (((unsigned long long) frames + PEAK_BASE - 1) / PEAK_BASE);
+    u_int levels = 0, start = 0;
+
+    while (count > 0) {
+        level_start[levels++] = start;
+        start += count;
+        if (count == 1)
+            break;
+        count = (count + 1) / 2;
+    }
+    if (levels > 0)
+        level_start[levels] = start;
+    return levels;
+}
+
+/**
+ * Adds one pyramid entry of every channel to a summary, the rms field
+ * holding the sum of squares until the query is done.
+ *
+ * @param summary
+ * @param entry, of channel 0, the other channels follow
+ * @param channels
+ */
+private void mergeEntry(PeakSummary *summary, const struct PeakEntry *entry, int channels) {
+    for (int c = 0; c < channels; c++) {
+        summary[c].min = min(summary[c].min, entry[c].min);
+        summary[c].max = max(summary[c].max, entry[c].max);
+        summary[c].rms += entry[c].squares;
+    }
+}
+
+/**
+ * Adds frames [start, end) of the .wav file to a summary, reading them.
+ *
+ * @param peaks
+ * @param start
+ * @param end
+ * @param summary
+ * @return EXIT_CODE
+ */
+private int mergeFrames(Peaks *peaks, u_int start, u_int end, PeakSummary *summary) {
+    int channels = peaks->header.numChannels;
+    int sample_size = peaks->header.blockAlign / channels;
+    u_char data[1 << 16];       // Room for a frame of any blockAlign.
+    float values[PACKED_TILE];
+    size_t frames_per_read = sizeof(data) / peaks->header.blockAlign;
+
+    while (start < end) {
+        u_int frames = (u_int) min(frames_per_read, (size_t) (end - start));
+        if (preadFully(peaks->wav_fd, data, (size_t) frames * peaks->header.blockAlign,
+                       HEADER_SIZE + (off_t) start * peaks->header.blockAlign) != SUCCESS)
+            return FAILURE;
+
+        size_t count = (size_t) frames * channels;
+        int c = 0;
+        for (size_t first = 0; first < count; first += PACKED_TILE) {
+            size_t tile = min((size_t) PACKED_TILE, count - first);
+            decodeSamples(data + first * sample_size, tile, sample_size, values);
+            for (size_t k = 0; k < tile; k++) {
+                double value = values[k];
+                summary[c].min = min(summary[c].min, value);
+                summary[c].max = max(summary[c].max, value);
+                summary[c].rms += value * value;
+                if (++c == channels)
+                    c = 0;
+            }
+        }
+        start += frames;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Converts samples to floats as sampleToDouble() does, those of 24 bits
+ * through load24().
+ *
+ * @param data
+ * @param count, at most PACKED_TILE
+ * @param sample_size
+ * @param values, receives count floats
+ */
+private void decodeSamples(const u_char *data, size_t count, int sample_size, float *values) {
+    if (sample_size == 3) {
+        int packed[PACKED_TILE];
+        load24(data, packed, count);
+        for (size_t i = 0; i < count; i++)
+            values[i] = (float) (packed[i] / 8388608.0);
+    } else
+        for (size_t i = 0; i < count; i++)
+            values[i] = (float) sampleToDouble(data + i * sample_size, sample_size);
+}
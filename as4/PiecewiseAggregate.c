@@ -0,0 +1,218 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    PiecewiseAggregate.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define PAA_SEGMENT 8           // Bytes per segment of the finest level.
+#define PAA_FACTOR 8            // Segments of a level merged by the level above.
+#define BOUND_SLACK 1e-9        // Keeps rounding from rejecting a pair right at the threshold.
+
+private u_int segmentSize(int level);
+
+private int euclideanCascade(PAA *paa1, PAA *paa2, double threshold);
+
+private int lcssCascade(PAA *paa1, PAA *paa2, double threshold);
+
+
+/**
+ * Builds the piecewise aggregate approximation of a data buffer: at every
+ * level the sum, minimum and maximum of each whole segment, from segments
+ * of PAA_SEGMENT * PAA_FACTOR^(PAA_LEVELS - 1) bytes at level 0 down to
+ * PAA_SEGMENT bytes, and the histogram of the byte values.
+ *
+ * @param wav_data
+ * @param size
+ * @param paa, released with freePAA()
+ * @return EXIT_CODE
+ */
+public int buildPAA(u_char *wav_data, u_int size, PAA *paa) {
+    memset(paa, 0, sizeof(PAA));
+    paa->size = size;
+
+    for (int level = 0; level < PAA_LEVELS; level++) {
+        u_int segments = size / segmentSize(level);
+        paa->sums[level] = malloc(max(segments, 1) * sizeof(u_int));
+        paa->lows[level] = malloc(max(segments, 1));
+        paa->highs[level] = malloc(max(segments, 1));
+        if (paa->sums[level] == NULL || paa->lows[level] == NULL || paa->highs[level] == NULL) {
+            freePAA(paa);
+            return FAILURE;
+        }
+    }
+
+    for (u_int i = 0; i < size; i++)
+        paa->histogram[wav_data[i]]++;
+
+    // The finest level from the data, every other one from the level below
+    int finest = PAA_LEVELS - 1;
+    for (u_int s = 0; s < size / PAA_SEGMENT; s++) {
+        const u_char *segment = wav_data + (size_t) s * PAA_SEGMENT;
+        u_int sum = 0;
+        u_char low = 255, high = 0;
+        for (int i = 0; i < PAA_SEGMENT; i++) {
+            sum += segment[i];
+            low = min(low, segment[i]);
+            high = max(high, segment[i]);
+        }
+        paa->sums[finest][s] = sum;
+        paa->lows[finest][s] = low;
+        paa->highs[finest][s] = high;
+    }
+    for (int level = finest - 1; level >= 0; level--)
+        for (u_int s = 0; s < size / segmentSize(level); s++) {
+            u_int sum = 0;
+            u_char low = 255, high = 0;
+            for (u_int below = s * PAA_FACTOR; below < (s + 1) * PAA_FACTOR; below++) {
+                sum += paa->sums[level + 1][below];
+                low = min(low, paa->lows[level + 1][below]);
+                high = max(high, paa->highs[level + 1][below]);
+            }
+            paa->sums[level][s] = sum;
+            paa->lows[level][s] = low;
+            paa->highs[level][s] = high;
+        }
+    return SUCCESS;
+}
+
+/**
+ * Frees the levels of a PAA.
+ *
+ * @param paa
+ */
+public void freePAA(PAA *paa) {
+    for (int level = 0; level < PAA_LEVELS; level++) {
+        freePointer(paa->sums[level]);
+        freePointer(paa->lows[level]);
+        freePointer(paa->highs[level]);
+        paa->sums[level] = NULL;
+        paa->lows[level] = NULL;
+        paa->highs[level] = NULL;
+    }
+}
+
+/**
+ * Distance of two data buffers, computed exactly only if their
+ * approximations cannot prove it is above @param threshold. The bounds are
+ * tried coarse to fine and the cascade stops at the first level that
+ * proves the pair above the threshold, or below it, which leaves only the
+ * exact distance to compute.
+ *
+ * @param paa1, of wav_data1
+ * @param paa2, of wav_data2
+ * @param wav_data1
+ * @param wav_data2
+ * @param lcss, the lcss instead of the euclidean distance
+ * @param threshold
+ * @return distance, or INFINITY if it is proven above threshold
+ */
+public double cascadeDistance(PAA *paa1, PAA *paa2, u_char *wav_data1, u_char *wav_data2, int lcss, double threshold) {
+    if (lcss) {
+        if (lcssCascade(paa1, paa2, threshold) > 0)
+            return INFINITY;
+        return LCSS(wav_data1, wav_data2, paa1->size, paa2->size);
+    }
+
+    if (euclideanCascade(paa1, paa2, threshold) > 0)
+        return INFINITY;
+    return euclidean(wav_data1, wav_data2, paa1->size, paa2->size);
+}
+
+/**
+ * @param level
+ * @return bytes per segment of a level
+ */
+private u_int segmentSize(int level) {
+    u_int size = PAA_SEGMENT;
+    for (int i = level; i < PAA_LEVELS - 1; i++)
+        size *= PAA_FACTOR;
+    return size;
+}
+
+/**
+ * Bounds the euclidean distance over the first min(size1, size2) bytes at
+ * every level. For whole segments of w bytes with sums s1 and s2,
+ * (s1 - s2)^2 / w is at most the squared distance of the segment, and w
+ * times the square of the largest difference their ranges allow is at
+ * least it. Bytes after the last whole segment differ by at most 255.
+ *
+ * @param paa1
+ * @param paa2
+ * @param threshold
+ * @return 1 if the distance is proven above threshold, -1 if proven at
+ * most threshold, 0 if not proven either way
+ */
+private int euclideanCascade(PAA *paa1, PAA *paa2, double threshold) {
+    u_int size = min(paa1->size, paa2->size);
+
+    for (int level = 0; level < PAA_LEVELS; level++) {
+        u_int width = segmentSize(level);
+        u_int segments = size / width;
+        double lower = 0, upper = (double) (size - segments * width) * 255 * 255;
+
+        for (u_int s = 0; s < segments; s++) {
+            double difference = (double) paa1->sums[level][s] - paa2->sums[level][s];
+            int spread = max(paa1->highs[level][s] - paa2->lows[level][s],
+                             paa2->highs[level][s] - paa1->lows[level][s]);
+            lower += difference * difference / width;
+            upper += (double) width * spread * spread;
+        }
+
+        if (sqrt(lower) > threshold * (1 + BOUND_SLACK) + BOUND_SLACK)
+            return 1;
+        if (sqrt(upper) <= threshold)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * Bounds the lcss distance with the value histograms, coarse to fine. A
+ * common subsequence has no more bytes in any range of values than either
+ * buffer, so the sum over ranges of the smaller count bounds its length.
+ * Ranges of 16, then 4, then 1 value give ever tighter bounds.
+ *
+ * @param paa1
+ * @param paa2
+ * @param threshold
+ * @return 1 if the distance is proven above threshold, 0 otherwise
+ */
+private int lcssCascade(PAA *paa1, PAA *paa2, double threshold) {
+    u_int size = min(paa1->size, paa2->size);
+    if (size == 0)
+        return 0;
+
+    for (int width = 16; width >= 1; width /= 4) {
+        unsigned long long longest = 0;
+        for (int value = 0; value < 256; value += width) {
+            unsigned long long count1 = 0, count2 = 0;
+            for (int v = value; v < value + width; v++) {
+                count1 += paa1->histogram[v];
+                count2 += paa2->histogram[v];
+            }
+            longest += min(count1, count2);
+        }
+
+        if (1 - (double) longest / size > threshold * (1 + BOUND_SLACK) + BOUND_SLACK)
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,554 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    Pipeline.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define RING_BLOCKS 4
+#define SPINS_BEFORE_YIELD 64
+#define SPINS_BEFORE_SLEEP 1024  // Then a stage waits on the condition variable of its ring.
+#define RANGES_PER_THREAD 4      // Ranges of blocks per thread, so uneven ranges still balance.
+
+/**
+ * Single producer, single consumer ring of reusable blocks. The producer
+ * owns the slots in [tail, head + RING_BLOCKS), the consumer those in
+ * [head, tail); each side only ever writes its own index. A size of 0
+ * marks the end of the stream and a negative size an error. A side that
+ * waited too long sleeps on moved, and the other side only locks lock to
+ * wake it when sleepers says someone sleeps.
+ */
+typedef struct BlockRing {
+    u_char *blocks[RING_BLOCKS];
+    ssize_t sizes[RING_BLOCKS];
+    u_int head;
+    u_int tail;
+    int sleepers;
+    pthread_mutex_t lock;
+    pthread_cond_t moved;
+} BlockRing;
+
+/**
+ * Both rings of a running pipeline and the writer's outcome.
+ */
+typedef struct Stages {
+    Pipeline *pipeline;
+    BlockRing input;
+    BlockRing output;
+    int write_status;
+    off_t written;
+} Stages;
+
+/**
+ * A pipeline split into ranges of blocks that run on their own.
+ */
+typedef struct BlockRanges {
+    Pipeline *pipeline;
+    u_int number_of_blocks;
+    int number_of_ranges;
+    int status;
+    off_t written;
+} BlockRanges;
+
+private void runBlockRange(void *context, int range_id);
+
+private void *readerThread(void *argument);
+
+private void *writerThread(void *argument);
+
+private void initRing(BlockRing *ring);
+
+private void destroyRing(BlockRing *ring);
+
+private u_char *waitToProduce(BlockRing *ring);
+
+private void produce(BlockRing *ring, ssize_t size);
+
+private u_char *waitToConsume(BlockRing *ring, ssize_t *size);
+
+private void consume(BlockRing *ring);
+
+private void sleepUntilMoved(BlockRing *ring, u_int *index, u_int unchanged);
+
+private void wakeSleepers(BlockRing *ring);
+
+
+/**
+ * Runs a pipeline: a reader thread fills input blocks, the calling thread
+ * processes them into output blocks and a writer thread writes those
+ * sequentially from pipeline->output_offset. With RING_BLOCKS blocks
+ * between each pair of stages reading, processing and writing overlap.
+ *
+ * @param pipeline
+ * @return EXIT_CODE, FAILURE if reading or writing failed
+ */
+public int runPipeline(Pipeline *pipeline) {
+    int EXIT_CODE = SUCCESS;
+    Stages stages;
+    memset(&stages, 0, sizeof(Stages));
+    stages.pipeline = pipeline;
+    stages.write_status = SUCCESS;
+    initRing(&stages.input);
+    initRing(&stages.output);
+
+    for (int i = 0; i < RING_BLOCKS; i++) {
+        stages.input.blocks[i] = getBuffer(pipeline->input_block);
+        stages.output.blocks[i] = getBuffer(pipeline->output_block);
+        if (stages.input.blocks[i] == NULL || stages.output.blocks[i] == NULL) {
+            EXIT_CODE = FAILURE;
+            goto END;
+        }
+    }
+
+    pthread_t reader, writer;
+    if (pthread_create(&reader, NULL, readerThread, &stages) != 0) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    if (pthread_create(&writer, NULL, writerThread, &stages) != 0) {
+        // Without a writer the reader must still be drained before joining it
+        ssize_t size;
+        while (waitToConsume(&stages.input, &size) != NULL && size > 0)
+            consume(&stages.input);
+        pthread_join(reader, NULL);
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    for (;;) {
+        ssize_t size;
+        u_char *input = waitToConsume(&stages.input, &size);
+        u_char *output = waitToProduce(&stages.output);
+
+        if (size <= 0) {
+            if (size < 0)
+                EXIT_CODE = FAILURE;
+            produce(&stages.output, size);
+            break;
+        }
+
+        size_t output_size = size;
+        if (pipeline->process != NULL)
+            output_size = pipeline->process(pipeline->process_context, input, (size_t) size, output);
+        else
+            memcpy(output, input, (size_t) size);
+        consume(&stages.input);
+        produce(&stages.output, (ssize_t) output_size);
+    }
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    if (stages.write_status != SUCCESS)
+        EXIT_CODE = FAILURE;
+    pipeline->written = stages.written;
+
+    END:
+    for (int i = 0; i < RING_BLOCKS; i++) {
+        releaseBuffer(stages.input.blocks[i]);
+        releaseBuffer(stages.output.blocks[i]);
+    }
+    destroyRing(&stages.input);
+    destroyRing(&stages.output);
+    return EXIT_CODE;
+}
+
+/**
+ * Runs a pipeline on every thread of the pool. The blocks are split into
+ * contiguous ranges, each read, processed and written by one thread, with
+ * block k written at output_offset + k * output_block. So every block but
+ * the last must be full, the reader must read block k alone, and a full
+ * block must process into exactly output_block bytes. Falls back to
+ * runPipeline() for streams, unknown sizes and a single thread.
+ *
+ * @param pipeline
+ * @param input_size, bytes the reader will read, -1 if unknown
+ * @return EXIT_CODE, FAILURE if reading or writing failed
+ */
+public int runParallelPipeline(Pipeline *pipeline, off_t input_size) {
+    int threads = getThreadCount();
+    if (input_size <= (off_t) pipeline->input_block || pipeline->output_offset < 0 || threads == 1)
+        return runPipeline(pipeline);
+
+    off_t blocks = (input_size + (off_t) pipeline->input_block - 1) / (off_t) pipeline->input_block;
+    BlockRanges ranges = {pipeline, (u_int) blocks, (int) min(blocks, (off_t) threads * RANGES_PER_THREAD),
+                          SUCCESS, 0};
+    parallelFor(ranges.number_of_ranges, runBlockRange, &ranges);
+    pipeline->written = ranges.written;
+    return ranges.status;
+}
+
+/**
+ * Pipeline reader of a byte range of a file, front to back or, when
+ * range->backwards is set, in blocks from the back to the front. Blocks
+ * going backwards are aligned to the end of the range, so only the first
+ * block can be shorter than the others.
+ *
+ * @param context, the FileRange
+ * @param block
+ * @param capacity, bytes per block
+ * @param sequence, number of blocks read before this one
+ * @return bytes read, 0 after the end of the range or -1 on error
+ */
+public ssize_t readFileRange(void *context, u_char *block, size_t capacity, u_int sequence) {
+    FileRange *range = context;
+    off_t done = (off_t) sequence * (off_t) capacity;
+    if (!range->backwards)
+        return readRange(range, block, capacity, done);
+
+    off_t length = range->end - range->start;
+    if (done >= length)
+        return 0;
+    size_t size = (size_t) min((off_t) capacity, length - done);
+    if (readQueued(getSharedIOQueue(), range->fd, block, size, range->end - done - (off_t) size) != SUCCESS)
+        return -1;
+    return (ssize_t) size;
+}
+
+/**
+ * Reads up to @param size bytes at @param offset of a FileRange, clipped
+ * to its end, through the shared I/O queue. A stream is read sequentially,
+ * so offsets must follow each other; it skips to the start of the range
+ * first and may end early.
+ *
+ * @param range
+ * @param buffer
+ * @param size
+ * @param offset, from the start of the range
+ * @return bytes read, 0 after the end of the range or -1 on error
+ */
+public ssize_t readRange(FileRange *range, u_char *buffer, size_t size, off_t offset) {
+    if (!range->stream) {
+        off_t length = range->end - range->start;
+        if (offset >= length)
+            return 0;
+        size = (size_t) min((off_t) size, length - offset);
+        if (readQueued(getSharedIOQueue(), range->fd, buffer, size, range->start + offset) != SUCCESS)
+            return -1;
+        return (ssize_t) size;
+    }
+
+    // A pipe cannot seek, so the bytes before the range are read and dropped
+    while (range->position < range->start) {
+        ssize_t bytes = readFully(range->fd, buffer, (size_t) min((off_t) size, range->start - range->position));
+        if (bytes <= 0)
+            return bytes;
+        range->position += bytes;
+    }
+
+    if (range->end >= 0)
+        size = (size_t) max(min((off_t) size, range->end - range->position), 0);
+    ssize_t bytes = readFully(range->fd, buffer, size);
+    if (bytes > 0)
+        range->position += bytes;
+    return bytes;
+}
+
+/**
+ * Opens the output of a streaming operation and writes its header, to
+ * stdout with the sizes of a stream of unknown length, STREAM_SIZE, if
+ * @param stream is set and to @param output_filename otherwise.
+ *
+ * @param output
+ * @param stream
+ * @param output_filename
+ * @param wav_header
+ * @return EXIT_CODE
+ */
+public int openOutput(Output *output, int stream, char *output_filename, Header *wav_header) {
+    output->file = NULL;
+    output->header_offset = -1;
+
+    if (stream) {
+        // Only a regular file can have its header patched at the end
+        struct stat stdout_stat;
+        if (fstat(getStreamFd(), &stdout_stat) == 0 && S_ISREG(stdout_stat.st_mode))
+            output->header_offset = lseek(getStreamFd(), 0, SEEK_CUR);
+        output->fd = getStreamFd();
+        output->data_offset = -1;
+
+        Header header = *wav_header;
+        header.chunkSize = STREAM_SIZE;
+        header.subchunk2Size = STREAM_SIZE;
+        if (writeFully(getStreamFd(), &header, HEADER_SIZE) != SUCCESS) {
+            printf("Error in writing file: -\n\n");
+            return FAILURE;
+        }
+        return SUCCESS;
+    }
+
+    output->file = fopen(output_filename, "wb");
+    if (output->file == NULL) {
+        printf("Error in opening file: %s\n\n", output_filename);
+        return FAILURE;
+    }
+    fwrite(wav_header, HEADER_SIZE, 1, output->file);
+    fflush(output->file);
+    output->fd = fileno(output->file);
+    output->data_offset = HEADER_SIZE;
+    return SUCCESS;
+}
+
+/**
+ * Writes the real sizes into the header of an output on stdout, if stdout
+ * is a regular file. A pipe keeps the STREAM_SIZE sizes.
+ *
+ * @param output
+ * @param wav_header
+ * @param data_size, bytes of data written after the header
+ * @return EXIT_CODE
+ */
+public int finishOutput(Output *output, Header *wav_header, off_t data_size) {
+    if (output->header_offset < 0)
+        return SUCCESS;
+
+    Header header = *wav_header;
+    header.subchunk2Size = (u_int) min(data_size, (off_t) STREAM_SIZE - 36);
+    header.chunkSize = header.subchunk2Size + 36;
+    return pwriteFully(getStreamFd(), &header, HEADER_SIZE, output->header_offset);
+}
+
+/**
+ * Closes the output file, stdout stays open.
+ *
+ * @param output
+ */
+public void closeOutput(Output *output) {
+    closeFile(output->file);
+    output->file = NULL;
+}
+
+/**
+ * @param frame_size
+ * @return the largest multiple of @param frame_size that fits PIPELINE_BLOCK,
+ * or one frame for frames bigger than that.
+ */
+public size_t getBlockSize(u_int frame_size) {
+    frame_size = max(frame_size, 1);
+    return max(PIPELINE_BLOCK / frame_size, 1) * (size_t) frame_size;
+}
+
+/**
+ * Reads, processes and writes one range of the blocks of a pipeline.
+ *
+ * @param context, the BlockRanges
+ * @param range_id
+ */
+private void runBlockRange(void *context, int range_id) {
+    BlockRanges *ranges = context;
+    Pipeline *pipeline = ranges->pipeline;
+    u_int first = (u_int) ((unsigned long long) ranges->number_of_blocks * range_id / ranges->number_of_ranges);
+    u_int last = (u_int) ((unsigned long long) ranges->number_of_blocks * (range_id + 1) / ranges->number_of_ranges);
+    off_t written = 0;
+    int status = SUCCESS;
+
+    u_char *input = getBuffer(pipeline->input_block);
+    u_char *output = pipeline->process != NULL ? getBuffer(pipeline->output_block) : input;
+    if (input == NULL || output == NULL)
+        status = FAILURE;
+
+    for (u_int block = first; block < last && status == SUCCESS; block++) {
+        ssize_t size = pipeline->read(pipeline->read_context, input, pipeline->input_block, block);
+        if (size <= 0) {
+            status = size < 0 ? FAILURE : SUCCESS;
+            break;
+        }
+
+        size_t output_size = (size_t) size;
+        if (pipeline->process != NULL)
+            output_size = pipeline->process(pipeline->process_context, input, (size_t) size, output);
+        off_t offset = pipeline->output_offset + (off_t) block * (off_t) pipeline->output_block;
+        status = writeQueued(getSharedIOQueue(), pipeline->output_fd, output, output_size, offset);
+        written += (off_t) output_size;
+    }
+
+    releaseBuffer(input);
+    if (output != input)
+        releaseBuffer(output);
+    __atomic_fetch_add(&ranges->written, written, __ATOMIC_RELAXED);
+    if (status != SUCCESS)
+        __atomic_store_n(&ranges->status, FAILURE, __ATOMIC_RELAXED);
+}
+
+/**
+ * Reader stage, reads blocks until the source is exhausted or fails.
+ *
+ * @param argument, the Stages
+ * @return NULL
+ */
+private void *readerThread(void *argument) {
+    Stages *stages = argument;
+    Pipeline *pipeline = stages->pipeline;
+
+    for (u_int sequence = 0;; sequence++) {
+        u_char *block = waitToProduce(&stages->input);
+        ssize_t size = pipeline->read(pipeline->read_context, block, pipeline->input_block, sequence);
+        produce(&stages->input, size);
+        if (size <= 0)
+            break;
+    }
+    return NULL;
+}
+
+/**
+ * Writer stage, writes blocks back to back through the shared I/O queue,
+ * where they are in flight together with the reads of the reader stage,
+ * or at the current offset of output_fd if output_offset is -1. After a
+ * failed write it keeps consuming blocks so the other stages never block
+ * on a full ring.
+ *
+ * @param argument, the Stages
+ * @return NULL
+ */
+private void *writerThread(void *argument) {
+    Stages *stages = argument;
+    Pipeline *pipeline = stages->pipeline;
+    off_t offset = pipeline->output_offset;
+
+    for (;;) {
+        ssize_t size;
+        u_char *block = waitToConsume(&stages->output, &size);
+        if (size <= 0)
+            break;
+
+        if (stages->write_status == SUCCESS) {
+            int status = pipeline->output_offset < 0
+                         ? writeFully(pipeline->output_fd, block, (size_t) size)
+                         : writeQueued(getSharedIOQueue(), pipeline->output_fd, block, (size_t) size, offset);
+            if (status != SUCCESS)
+                stages->write_status = FAILURE;
+            else
+                stages->written += size;
+        }
+        offset += size;
+        consume(&stages->output);
+    }
+    return NULL;
+}
+
+/**
+ * @param ring, zeroed
+ */
+private void initRing(BlockRing *ring) {
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->moved, NULL);
+}
+
+/**
+ * @param ring
+ */
+private void destroyRing(BlockRing *ring) {
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->moved);
+}
+
+/**
+ * Spins, then yields, then sleeps, until the producer owns a free block.
+ *
+ * @param ring
+ * @return the block to fill
+ */
+private u_char *waitToProduce(BlockRing *ring) {
+    u_int tail = ring->tail;
+    for (int spins = 0; tail - __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == RING_BLOCKS; spins++) {
+        if (spins >= SPINS_BEFORE_SLEEP)
+            sleepUntilMoved(ring, &ring->head, tail - RING_BLOCKS);
+        else if (spins >= SPINS_BEFORE_YIELD)
+            sched_yield();
+    }
+    return ring->blocks[tail % RING_BLOCKS];
+}
+
+/**
+ * Publishes the block returned by waitToProduce() to the consumer.
+ *
+ * @param ring
+ * @param size, bytes in the block, 0 for the end or negative for an error
+ */
+private void produce(BlockRing *ring, ssize_t size) {
+    u_int tail = ring->tail;
+    ring->sizes[tail % RING_BLOCKS] = size;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    wakeSleepers(ring);
+}
+
+/**
+ * Spins, then yields, then sleeps, until the consumer owns a published
+ * block.
+ *
+ * @param ring
+ * @param size, receives the size the producer published
+ * @return the block to use
+ */
+private u_char *waitToConsume(BlockRing *ring, ssize_t *size) {
+    u_int head = ring->head;
+    for (int spins = 0; __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head; spins++) {
+        if (spins >= SPINS_BEFORE_SLEEP)
+            sleepUntilMoved(ring, &ring->tail, head);
+        else if (spins >= SPINS_BEFORE_YIELD)
+            sched_yield();
+    }
+    *size = ring->sizes[head % RING_BLOCKS];
+    return ring->blocks[head % RING_BLOCKS];
+}
+
+/**
+ * Hands the block returned by waitToConsume() back to the producer.
+ *
+ * @param ring
+ */
+private void consume(BlockRing *ring) {
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_SEQ_CST);
+    wakeSleepers(ring);
+}
+
+/**
+ * Sleeps until the other side moves the index it owns away from
+ * @param unchanged. Sleepers is raised before the index is read again and
+ * the index is stored before sleepers is read by wakeSleepers(), so one of
+ * the two sides always sees the other and no wake up is lost.
+ *
+ * @param ring
+ * @param index, head or tail of the ring
+ * @param unchanged
+ */
+private void sleepUntilMoved(BlockRing *ring, u_int *index, u_int unchanged) {
+    pthread_mutex_lock(&ring->lock);
+    __atomic_fetch_add(&ring->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(index, __ATOMIC_SEQ_CST) == unchanged)
+        pthread_cond_wait(&ring->moved, &ring->lock);
+    __atomic_fetch_sub(&ring->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+/**
+ * Wakes the other side if it sleeps in sleepUntilMoved().
+ *
+ * @param ring
+ */
+private void wakeSleepers(BlockRing *ring) {
+    if (__atomic_load_n(&ring->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_broadcast(&ring->moved);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
@@ -0,0 +1,710 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    RealTime.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define PERIOD_SLOTS 8              // Periods buffered between two stages, bounds the latency.
+#define SPINS_BEFORE_YIELD 64
+#define YIELDS_BEFORE_SLEEP 64
+#define WAIT_NANOSECONDS 100000     // Sleep of a stage that waited this long already.
+#define IDLE_SECONDS 1.0            // A file stops growing after this long without new data.
+#define MAX_PERIOD (1 << 16)        // Frames of the longest period.
+#define TONE_RATE 44100
+#define TONE_PERIOD 441             // Frames the synthetic source writes at once, 10 ms.
+
+/**
+ * Single producer, single consumer ring of periods, as the BlockRing of
+ * Pipeline.c but with the time every period arrived. Frames of 0 mark the
+ * end of the stream and -1 an error.
+ */
+typedef struct PeriodRing {
+    u_char *periods[PERIOD_SLOTS];
+    int frames[PERIOD_SLOTS];
+    double arrivals[PERIOD_SLOTS];  // When the last byte of the period was read.
+    u_int head;
+    u_int tail;
+} PeriodRing;
+
+/**
+ * Both rings of a running RealTime stream. Each counter is written by one
+ * stage only and read once the stages are joined.
+ */
+typedef struct LiveStages {
+    RealTime *stream;
+    PeriodRing input;
+    PeriodRing output;
+    int write_status;
+    int growing;                    // The input is a regular file that may still be written.
+    off_t remaining;                // Bytes of data left to read, -1 if unknown.
+    double latency_sum;
+} LiveStages;
+
+/**
+ * State of the effects processLive() applies, set up before the stream
+ * starts so that processing a period allocates nothing.
+ */
+typedef struct LiveEffect {
+    u_int sample_size;
+    u_int channels;
+    double gain;                    // Factor of -gain.
+    u_char *mix_data;               // Data of the file -mix takes the right channel of.
+    u_int mix_frames;
+    u_int mix_frame_size;
+    size_t mix_right_offset;
+    u_int mix_position;             // Next frame of mix_data.
+    char *message;                  // Text of -embed and its terminating '\0'.
+    u_int *message_slots;           // Bit of message each of the first bytes of data takes.
+    size_t message_bits;
+    size_t message_position;        // Next byte of data, counted from the start of the stream.
+} LiveEffect;
+
+private void *liveReaderThread(void *argument);
+
+private void *liveWriterThread(void *argument);
+
+private int readPeriod(LiveStages *stages, u_char *period, size_t size);
+
+private u_char *waitForSlot(PeriodRing *ring);
+
+private void publishPeriod(PeriodRing *ring, int frames, double arrival);
+
+private u_char *waitForPeriod(PeriodRing *ring, int *frames, double *arrival);
+
+private void releasePeriod(PeriodRing *ring);
+
+private void waitBriefly(int *spins);
+
+private double getMonotonicTime();
+
+private void applyGain(void *context, u_char *input, u_char *output, u_int frames);
+
+private void keepLeftSamples(void *context, u_char *input, u_char *output, u_int frames);
+
+private void mixLiveFrames(void *context, u_char *input, u_char *output, u_int frames);
+
+private void embedLiveBits(void *context, u_char *input, u_char *output, u_int frames);
+
+
+/**
+ * Runs a RealTime stream: a reader thread reads periods of stream->period
+ * frames from stream->input_fd, the calling thread hands each to
+ * stream->process() and a writer thread writes the results. The periods
+ * are allocated before the threads start and pass between them through
+ * lock-free rings of PERIOD_SLOTS, so the latency of a period is bounded
+ * by the rings and nothing is allocated or locked once data flows.
+ *
+ * A pipe or FIFO ends at its end of file. A regular file ends at the size
+ * of data in stream->header or, for a header of a stream of unknown
+ * length, once it has not grown for IDLE_SECONDS, so a file still being
+ * written is followed.
+ *
+ * @param stream
+ * @return EXIT_CODE, FAILURE if reading or writing failed
+ */
+public int runRealTime(RealTime *stream) {
+    int EXIT_CODE = SUCCESS;
+    LiveStages stages;
+    struct stat input_stat;
+
+    memset(&stages, 0, sizeof(LiveStages));
+    memset(&stream->stats, 0, sizeof(RealTimeStats));
+    stages.stream = stream;
+    stages.write_status = SUCCESS;
+    stages.growing = fstat(stream->input_fd, &input_stat) == 0 && S_ISREG(input_stat.st_mode);
+    stages.remaining = stream->header.subchunk2Size == STREAM_SIZE ? -1 : (off_t) stream->header.subchunk2Size;
+    stream->written = 0;
+
+    size_t input_size = (size_t) stream->period * stream->header.blockAlign;
+    size_t output_size = (size_t) stream->period * stream->output_frame_size;
+    for (int i = 0; i < PERIOD_SLOTS; i++) {
+        stages.input.periods[i] = getBuffer(input_size);
+        stages.output.periods[i] = getBuffer(output_size);
+        if (stages.input.periods[i] == NULL || stages.output.periods[i] == NULL) {
+            EXIT_CODE = FAILURE;
+            printf("Sorry, program run out of memory.\n\n");
+            goto END;
+        }
+    }
+
+    pthread_t reader, writer;
+    if (pthread_create(&reader, NULL, liveReaderThread, &stages) != 0) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    if (pthread_create(&writer, NULL, liveWriterThread, &stages) != 0) {
+        int frames;
+        double arrival;
+        while (waitForPeriod(&stages.input, &frames, &arrival) != NULL && frames > 0)
+            releasePeriod(&stages.input);
+        pthread_join(reader, NULL);
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    // Period k is due one period after period k - 1, from the first one on
+    double period_seconds = (double) stream->period / max(stream->header.sampleRate, 1);
+    double start = 0;
+    for (unsigned long long k = 0;; k++) {
+        int frames;
+        double arrival;
+        u_char *input = waitForPeriod(&stages.input, &frames, &arrival);
+        u_char *output = waitForSlot(&stages.output);
+
+        if (frames <= 0) {
+            if (frames < 0)
+                EXIT_CODE = FAILURE;
+            publishPeriod(&stages.output, frames, arrival);
+            break;
+        }
+
+        // A source that falls behind by more than a period starts the clock again
+        if (k == 0)
+            start = arrival;
+        else if (arrival > start + (k + 1) * period_seconds) {
+            stream->stats.underruns++;
+            start = arrival - k * period_seconds;
+        }
+
+        stream->process(stream->context, input, output, (u_int) frames);
+        releasePeriod(&stages.input);
+        publishPeriod(&stages.output, frames, arrival);
+        stream->stats.periods++;
+    }
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    if (stages.write_status != SUCCESS)
+        EXIT_CODE = FAILURE;
+    if (stream->stats.periods > 0)
+        stream->stats.mean_latency = stages.latency_sum / stream->stats.periods;
+
+    END:
+    for (int i = 0; i < PERIOD_SLOTS; i++) {
+        releaseBuffer(stages.input.periods[i]);
+        releaseBuffer(stages.output.periods[i]);
+    }
+    return EXIT_CODE;
+}
+
+/**
+ * Applies an effect to a live .wav stream of @param input_filename, a
+ * pipe, FIFO or file being written, or stdin for -, and writes the result
+ * to @param output_filename, or stdout for -, period by period. The
+ * counters of the run are printed to stderr.
+ * Option ID: 24
+ *
+ * @param input_filename
+ * @param output_filename
+ * @param period, frames per period
+ * @param effect, LIVE_GAIN, LIVE_MONO, LIVE_MIX or LIVE_EMBED
+ * @param parameter, dB of LIVE_GAIN, the .wav file of LIVE_MIX or the text
+ * file of LIVE_EMBED
+ * @return EXIT_CODE
+ */
+public int processLive(char *input_filename, char *output_filename, u_int period, int effect, char *parameter) {
+    int EXIT_CODE = SUCCESS;
+    RealTime stream;
+    LiveEffect live;
+    Output output = {NULL, -1, 0, -1};
+    Header *mix_header = NULL;
+    FILE *mix_file = NULL, *text_file = NULL;
+    int input_stream = isStream(input_filename), output_stream = isStream(output_filename);
+
+    memset(&stream, 0, sizeof(RealTime));
+    memset(&live, 0, sizeof(LiveEffect));
+    stream.input_fd = input_stream ? STDIN_FILENO : open(input_filename, O_RDONLY);
+    if (stream.input_fd < 0) {
+        printf("Error in opening file: %s\n\n", input_filename);
+        return FAILURE;
+    }
+
+    // The header is read unbuffered, so the data stays in the pipe
+    if (readFully(stream.input_fd, &stream.header, HEADER_SIZE) != HEADER_SIZE) {
+        EXIT_CODE = FAILURE;
+        printf("File not even 44 bytes: %s\n\n", input_filename);
+        goto END;
+    }
+    if (wavCheck(&stream.header) == FAILURE) {
+        EXIT_CODE = FAILURE;
+        printf("Invalid wav header.\n\n");
+        goto END;
+    }
+
+    live.channels = stream.header.numChannels;
+    live.sample_size = stream.header.blockAlign / max(stream.header.numChannels, 1);
+    Header output_header = stream.header;
+    stream.process = applyGain;
+    stream.context = &live;
+    switch (effect) {
+        case LIVE_GAIN:
+            live.gain = pow(10, atof(parameter) / 20);
+            break;
+        case LIVE_MONO:
+            if (makeHeaderMono(&output_header) != SUCCESS) {
+                EXIT_CODE = FAILURE;
+                printf("File already mono: %s\n\n", input_filename);
+                goto END;
+            }
+            stream.process = keepLeftSamples;
+            break;
+        case LIVE_MIX:
+            // The file is read whole before the stream starts
+            EXIT_CODE = getHeader(NULL, &mix_header, &mix_file, parameter);
+            if (EXIT_CODE != SUCCESS)
+                goto END;
+            if (mix_header->bitsPerSample != stream.header.bitsPerSample
+                || mix_header->sampleRate != stream.header.sampleRate || mix_header->numChannels == 0) {
+                EXIT_CODE = FAILURE;
+                printf("Incompatible wav files: %s, %s\n\n", input_filename, parameter);
+                goto END;
+            }
+            EXIT_CODE = getData(mix_header, mix_file, &live.mix_data);
+            if (EXIT_CODE != SUCCESS)
+                goto END;
+            live.mix_frame_size = mix_header->blockAlign;
+            live.mix_frames = mix_header->subchunk2Size / max(live.mix_frame_size, 1);
+            live.mix_right_offset = (size_t) live.sample_size * (mix_header->numChannels - 1);
+            output_header.numChannels = 2;
+            output_header.blockAlign = (s_int) (2 * live.sample_size);
+            output_header.byteRate = output_header.sampleRate * output_header.blockAlign;
+            stream.process = mixLiveFrames;
+            break;
+        case LIVE_EMBED: {
+            text_file = fopen(parameter, "rb");
+            if (text_file == NULL || fseek(text_file, 0, SEEK_END) != 0) {
+                EXIT_CODE = FAILURE;
+                printf("Error in opening file: %s\n\n", parameter);
+                goto END;
+            }
+            long length = ftell(text_file);
+            live.message = length < 0 ? NULL : calloc((size_t) length + 1, 1);
+            if (live.message == NULL) {
+                EXIT_CODE = FAILURE;
+                printf("Sorry, program run out of memory.\n\n");
+                goto END;
+            }
+            rewind(text_file);
+            if (fread(live.message, 1, (size_t) length, text_file) != (size_t) length) {
+                EXIT_CODE = FAILURE;
+                printf("Error in reading file: %s\n\n", parameter);
+                goto END;
+            }
+            // The bits go where -encodeText puts them, so -decodeText reads them back
+            int message_length = (int) strlen(live.message);
+            u_int *permutations = createPermutations(message_length, syskey);
+            live.message_bits = ((size_t) message_length + 1) * 8;
+            live.message_slots = malloc(live.message_bits * sizeof(u_int));
+            if (permutations == NULL || live.message_slots == NULL) {
+                freePointer(permutations);
+                EXIT_CODE = FAILURE;
+                printf("Sorry, program run out of memory.\n\n");
+                goto END;
+            }
+            for (u_int i = 0; i < live.message_bits; i++)
+                live.message_slots[permutations[i]] = i;
+            freePointer(permutations);
+            stream.process = embedLiveBits;
+            break;
+        }
+        default:
+            EXIT_CODE = FAILURE;
+            goto END;
+    }
+
+    // The length is known only at the end
+    if (stream.header.subchunk2Size != STREAM_SIZE) {
+        u_int frames = stream.header.subchunk2Size / stream.header.blockAlign;
+        output_header.subchunk2Size = frames * output_header.blockAlign;
+        output_header.chunkSize = output_header.subchunk2Size + 36;
+    }
+    EXIT_CODE = openOutput(&output, output_stream, output_filename, &output_header);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    stream.output_fd = output.fd;
+    stream.output_offset = output.data_offset;
+    stream.period = min(max(period, 1), MAX_PERIOD);
+    stream.output_frame_size = output_header.blockAlign;
+    if (runRealTime(&stream) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        printf("Error in writing file: %s\n\n", output_filename);
+    }
+
+    // The real sizes go into the header of a file, as finishOutput() does for stdout
+    output_header.subchunk2Size = (u_int) min(stream.written, (off_t) STREAM_SIZE - 36);
+    output_header.chunkSize = output_header.subchunk2Size + 36;
+    if (output.file != NULL && pwriteFully(output.fd, &output_header, HEADER_SIZE, 0) != SUCCESS)
+        EXIT_CODE = FAILURE;
+    else if (finishOutput(&output, &output_header, stream.written) != SUCCESS)
+        EXIT_CODE = FAILURE;
+
+    fprintf(stderr, "Periods: %llu of %u frames, underruns: %llu, overruns: %llu, "
+                    "latency: %.3f ms mean, %.3f ms max\n",
+            stream.stats.periods, stream.period, stream.stats.underruns, stream.stats.overruns,
+            stream.stats.mean_latency * 1000, stream.stats.max_latency * 1000);
+
+    END:
+    if (!input_stream && stream.input_fd >= 0)
+        close(stream.input_fd);
+    freePointer(mix_header);
+    releaseBuffer(live.mix_data);
+    freePointer(live.message);
+    freePointer(live.message_slots);
+    closeFile(mix_file);
+    closeFile(text_file);
+    closeOutput(&output);
+    return EXIT_CODE;
+}
+
+/**
+ * Writes a synthetic live source for processLive(): a sine tone of
+ * @param frequency Hz as a 16 bit stereo stream of unknown length, paced
+ * in periods of 10 ms at the pace of real time for @param seconds. Meant
+ * for a FIFO, which it opens once a reader opens the other end.
+ * Option ID: 25
+ *
+ * @param output_filename, or - for stdout
+ * @param seconds
+ * @param frequency
+ * @return EXIT_CODE
+ */
+public int writeTone(char *output_filename, double seconds, double frequency) {
+    int EXIT_CODE = SUCCESS;
+    Header header = {{'R', 'I', 'F', 'F'}, STREAM_SIZE, {'W', 'A', 'V', 'E'}, {'f', 'm', 't', ' '}, 16, 1, 2,
+                     TONE_RATE, TONE_RATE * 4, 4, 16, {'d', 'a', 't', 'a'}, STREAM_SIZE};
+    short period[TONE_PERIOD * 2];
+
+    int stream = isStream(output_filename);
+    int fd = stream ? getStreamFd() : open(output_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error in opening file: %s\n\n", output_filename);
+        return FAILURE;
+    }
+    if (writeFully(fd, &header, HEADER_SIZE) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    // Period k is written at start + k * 10 ms, however long writing took
+    struct timespec due;
+    clock_gettime(CLOCK_MONOTONIC, &due);
+    long long periods = (long long) (seconds * TONE_RATE / TONE_PERIOD);
+    for (long long k = 0; k < periods; k++) {
+        for (int i = 0; i < TONE_PERIOD; i++) {
+            double t = (double) (k * TONE_PERIOD + i) / TONE_RATE;
+            period[2 * i] = period[2 * i + 1] = (short) lrint(16384 * sin(2 * M_PI * frequency * t));
+        }
+        if (writeFully(fd, period, sizeof(period)) != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            goto END;
+        }
+
+        due.tv_nsec += 1000000000L / (TONE_RATE / TONE_PERIOD);
+        if (due.tv_nsec >= 1000000000L) {
+            due.tv_sec++;
+            due.tv_nsec -= 1000000000L;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+    }
+
+    END:
+    if (EXIT_CODE != SUCCESS)
+        printf("Error in writing file: %s\n\n", output_filename);
+    if (!stream)
+        close(fd);
+    return EXIT_CODE;
+}
+
+/**
+ * Reader stage, reads periods until the stream ends or fails. When the
+ * ring stays full for longer than a period after the last one arrived,
+ * the source waits in the pipe because processing has fallen behind, and
+ * that counts as an overrun.
+ *
+ * @param argument, the LiveStages
+ * @return NULL
+ */
+private void *liveReaderThread(void *argument) {
+    LiveStages *stages = argument;
+    RealTime *stream = stages->stream;
+    size_t frame_size = stream->header.blockAlign;
+    double period_seconds = (double) stream->period / max(stream->header.sampleRate, 1);
+    double arrival = -1;
+
+    for (;;) {
+        u_char *period = waitForSlot(&stages->input);
+        if (arrival >= 0 && getMonotonicTime() - arrival > period_seconds)
+            stream->stats.overruns++;
+
+        int size = readPeriod(stages, period, stream->period * frame_size);
+        arrival = getMonotonicTime();
+        int frames = size < 0 ? -1 : (int) (size / frame_size);
+        publishPeriod(&stages->input, frames, arrival);
+        if (frames <= 0)
+            break;
+    }
+    return NULL;
+}
+
+/**
+ * Writer stage, writes the processed periods back to back and measures
+ * the latency of each, from its arrival to its output. After a failed
+ * write it keeps releasing periods so the other stages never block.
+ *
+ * @param argument, the LiveStages
+ * @return NULL
+ */
+private void *liveWriterThread(void *argument) {
+    LiveStages *stages = argument;
+    RealTime *stream = stages->stream;
+    off_t offset = stream->output_offset;
+
+    for (;;) {
+        int frames;
+        double arrival;
+        u_char *period = waitForPeriod(&stages->output, &frames, &arrival);
+        if (frames <= 0)
+            break;
+
+        size_t size = (size_t) frames * stream->output_frame_size;
+        if (stages->write_status == SUCCESS) {
+            int status = stream->output_offset < 0 ? writeFully(stream->output_fd, period, size)
+                                                   : pwriteFully(stream->output_fd, period, size, offset);
+            if (status != SUCCESS)
+                stages->write_status = FAILURE;
+            else
+                stream->written += (off_t) size;
+        }
+        offset += (off_t) size;
+        releasePeriod(&stages->output);
+
+        double latency = getMonotonicTime() - arrival;
+        stages->latency_sum += latency;
+        stream->stats.max_latency = max(stream->stats.max_latency, latency);
+    }
+    return NULL;
+}
+
+/**
+ * Fills a period from the input, waiting for a regular file that is still
+ * being written to grow.
+ *
+ * @param stages
+ * @param period
+ * @param size, bytes of a full period
+ * @return bytes read, whole frames only, less than size at the end, -1 on
+ * error
+ */
+private int readPeriod(LiveStages *stages, u_char *period, size_t size) {
+    RealTime *stream = stages->stream;
+    size_t done = 0;
+    double idle_since = -1;
+
+    if (stages->remaining >= 0)
+        size = (size_t) min((off_t) size, stages->remaining);
+    while (done < size) {
+        ssize_t bytes = read(stream->input_fd, period + done, size - done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0)
+            return -1;
+        if (bytes > 0) {
+            done += (size_t) bytes;
+            idle_since = -1;
+            continue;
+        }
+        if (!stages->growing)
+            break;
+
+        // A file at its end may be written further
+        double now = getMonotonicTime();
+        if (idle_since < 0)
+            idle_since = now;
+        else if (now - idle_since >= IDLE_SECONDS)
+            break;
+        struct timespec pause = {0, WAIT_NANOSECONDS};
+        nanosleep(&pause, NULL);
+    }
+
+    if (stages->remaining >= 0)
+        stages->remaining -= (off_t) done;
+    return (int) (done - done % stream->header.blockAlign);
+}
+
+/**
+ * Waits until the producer owns a free slot.
+ *
+ * @param ring
+ * @return the period to fill
+ */
+private u_char *waitForSlot(PeriodRing *ring) {
+    u_int tail = ring->tail;
+    for (int spins = 0; tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == PERIOD_SLOTS;)
+        waitBriefly(&spins);
+    return ring->periods[tail % PERIOD_SLOTS];
+}
+
+/**
+ * Publishes the period returned by waitForSlot() to the consumer.
+ *
+ * @param ring
+ * @param frames, frames in the period, 0 for the end or -1 for an error
+ * @param arrival
+ */
+private void publishPeriod(PeriodRing *ring, int frames, double arrival) {
+    u_int tail = ring->tail;
+    ring->frames[tail % PERIOD_SLOTS] = frames;
+    ring->arrivals[tail % PERIOD_SLOTS] = arrival;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Waits until the consumer owns a published period.
+ *
+ * @param ring
+ * @param frames, receives the frames the producer published
+ * @param arrival, receives the time the period arrived
+ * @return the period to use
+ */
+private u_char *waitForPeriod(PeriodRing *ring, int *frames, double *arrival) {
+    u_int head = ring->head;
+    for (int spins = 0; __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head;)
+        waitBriefly(&spins);
+    *frames = ring->frames[head % PERIOD_SLOTS];
+    *arrival = ring->arrivals[head % PERIOD_SLOTS];
+    return ring->periods[head % PERIOD_SLOTS];
+}
+
+/**
+ * Hands the period returned by waitForPeriod() back to the producer.
+ *
+ * @param ring
+ */
+private void releasePeriod(PeriodRing *ring) {
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Spins, then yields, then sleeps, so a stage waiting on a live source
+ * reacts fast without keeping a processor busy for the whole period.
+ *
+ * @param spins, waits so far
+ */
+private void waitBriefly(int *spins) {
+    if (++*spins <= SPINS_BEFORE_YIELD)
+        return;
+    if (*spins <= SPINS_BEFORE_YIELD + YIELDS_BEFORE_SLEEP) {
+        sched_yield();
+        return;
+    }
+    struct timespec pause = {0, WAIT_NANOSECONDS};
+    nanosleep(&pause, NULL);
+}
+
+/**
+ * @return seconds of the monotonic clock
+ */
+private double getMonotonicTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Period callback of -gain, scales every sample, saturating at full scale.
+ *
+ * @param context, the LiveEffect
+ * @param input
+ * @param output
+ * @param frames
+ */
+private void applyGain(void *context, u_char *input, u_char *output, u_int frames) {
+    LiveEffect *live = context;
+    scaleSamples(input, output, (size_t) frames * live->channels, live->sample_size, live->gain);
+}
+
+/**
+ * Period callback of -mono, keeps the left sample of every frame.
+ *
+ * @param context, the LiveEffect
+ * @param input
+ * @param output
+ * @param frames
+ */
+private void keepLeftSamples(void *context, u_char *input, u_char *output, u_int frames) {
+    LiveEffect *live = context;
+    size_t frame_size = (size_t) live->sample_size * live->channels;
+
+    for (register u_int i = 0; i < frames; i++)
+        memcpy(output + (size_t) i * live->sample_size, input + i * frame_size, live->sample_size);
+}
+
+/**
+ * Period callback of -mix, the left sample of the stream and the right
+ * sample of the file, silence once the file ends.
+ *
+ * @param context, the LiveEffect
+ * @param input
+ * @param output
+ * @param frames
+ */
+private void mixLiveFrames(void *context, u_char *input, u_char *output, u_int frames) {
+    LiveEffect *live = context;
+    size_t sample_size = live->sample_size, frame_size = sample_size * live->channels;
+
+    for (register u_int i = 0; i < frames; i++) {
+        u_char *out = output + 2 * sample_size * i;
+        memcpy(out, input + i * frame_size, sample_size);
+        if (live->mix_position < live->mix_frames) {
+            memcpy(out + sample_size, live->mix_data + (size_t) live->mix_position * live->mix_frame_size
+                                      + live->mix_right_offset, sample_size);
+            live->mix_position++;
+        } else
+            writeSample(out + sample_size, (u_int) sample_size, 0);
+    }
+}
+
+/**
+ * Period callback of -embed, writes the bits of the message into the LSBs
+ * of the first bytes of data in the order createPermutations() gives, as
+ * -encodeText does, the stream being of unknown length.
+ *
+ * @param context, the LiveEffect
+ * @param input
+ * @param output
+ * @param frames
+ */
+private void embedLiveBits(void *context, u_char *input, u_char *output, u_int frames) {
+    LiveEffect *live = context;
+    size_t bytes = (size_t) frames * live->channels * live->sample_size;
+
+    memcpy(output, input, bytes);
+    for (size_t i = 0; i < bytes && live->message_position < live->message_bits; i++) {
+        u_int bit = live->message_slots[live->message_position++];
+        output[i] = (u_char) ((output[i] & 0xfe) | ((live->message[bit / 8] >> (7 - bit % 8)) & 1));
+    }
+}
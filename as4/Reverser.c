@@ -17,13 +17,33 @@
  */
 
 #include "Definitions.h"
+#include <sys/stat.h>
 
 /**
   * @author Aristos Georgiou
   */
 
+/**
+ * A stream read whole into memory, data holds its whole frames.
+ */
+typedef struct Spool {
+    u_char *buffer;
+    u_char *data;
+    size_t size;
+} Spool;
+
 private int reverseFile(char *wav_filename);
 
+private int spoolStream(int fd, off_t limit, size_t frame_size, Spool *spool);
+
+private ssize_t readSpool(void *context, u_char *block, size_t capacity, u_int sequence);
+
+private int reverseFileInPlace(char *wav_filename);
+
+private int reverseInto(Journal *journal, u_char *block, off_t from, off_t to, size_t size, size_t frame_size);
+
+private size_t reverseFrames(void *context, u_char *input, size_t size, u_char *output);
+
 
 /**
  * Reverses data of given .wav files.
@@ -41,6 +61,23 @@ public int reverseFiles(char **files, int number_of_files) {
     return EXIT_CODE;
 }
 
+/**
+ * Reverses data of given .wav files in place.
+ * Option ID: 5, with -inplace
+ *
+ * @param files
+ * @param number_of_files, number of files
+ * @return EXIT CODE
+ */
+public int reverseFilesInPlace(char **files, int number_of_files) {
+    int EXIT_CODE = SUCCESS;
+    for (int i = 0; i < number_of_files; i++)
+        if (reverseFileInPlace(files[i]) != SUCCESS)
+            EXIT_CODE = FAILURE;
+
+    return EXIT_CODE;
+}
+
 /**
  * Reverses data of given .wav file.
  *
@@ -49,53 +86,236 @@ public int reverseFiles(char **files, int number_of_files) {
  */
 private int reverseFile(char *wav_filename) {
     int EXIT_CODE;
+    Arena *arena = acquireArena();
     Header *wav_header = NULL;
-    FILE *wav_file1 = NULL, *wav_file2 = NULL;
+    FILE *wav_file1 = NULL;
+    Output output = {NULL, -1, 0, -1};
     char *new_filename = NULL;
+    Spool spool = {NULL, NULL, 0};
+    int stream = isStream(wav_filename);
+
+    if (arena == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return FAILURE;
+    }
 
     // Initialise wav_header from wav_file1
-    EXIT_CODE = getHeader(&wav_header, &wav_file1, wav_filename);
+    EXIT_CODE = getHeader(arena, &wav_header, &wav_file1, wav_filename);
     if (EXIT_CODE != SUCCESS)
         goto END;
 
-    // Create new file name
-    new_filename = malloc(10 + strlen(wav_filename));
-    if (new_filename == NULL) {
-        EXIT_CODE = FAILURE;
-        printf("Sorry, program run out of memory.\n\n");
-        goto END;
+    // Create new file name, a stream goes to stdout instead
+    if (!stream) {
+        new_filename = arenaAlloc(arena, 10 + strlen(wav_filename));
+        if (new_filename == NULL) {
+            EXIT_CODE = FAILURE;
+            printf("Sorry, program run out of memory.\n\n");
+            goto END;
+        }
+        snprintf(new_filename, 10 + strlen(wav_filename), "reverse-%s", wav_filename);
     }
-    snprintf(new_filename, 10 + strlen(wav_filename), "reverse-%s", wav_filename);
 
     {
-        // Open new file and write the original header to it
-        wav_file2 = fopen(new_filename, "wb");
-        fwrite(wav_header, HEADER_SIZE, 1, wav_file2);
+        size_t frame_size = max((size_t) wav_header->blockAlign, 1);
+        off_t end = HEADER_SIZE + (off_t) wav_header->subchunk2Size;
+        struct stat input;
+        int regular = stream && fstat(fileno(wav_file1), &input) == 0 && S_ISREG(input.st_mode);
+        if (regular)
+            end = min(end, input.st_size);
+        FileRange range = {fileno(wav_file1), end - (end - HEADER_SIZE) / (off_t) frame_size * (off_t) frame_size,
+                           end, 1, 0, 0};
 
-        u_char *data = malloc(wav_header->subchunk2Size);
-        if(data == NULL) {
-            EXIT_CODE = FAILURE;
-            printf("Sorry, program run out of memory.\n\n");
+        // The last frame of a pipe comes last, so a pipe is read whole first
+        if (stream && !regular) {
+            off_t limit = wav_header->subchunk2Size == STREAM_SIZE ? -1 : (off_t) wav_header->subchunk2Size;
+            EXIT_CODE = spoolStream(range.fd, limit, frame_size, &spool);
+            if (EXIT_CODE != SUCCESS) {
+                printf("Sorry, program run out of memory.\n\n");
+                goto END;
+            }
+        }
+
+        // Open the output and write the original header to it
+        EXIT_CODE = openOutput(&output, stream, new_filename, wav_header);
+        if (EXIT_CODE != SUCCESS)
             goto END;
+
+        // Read blocks from the end while earlier blocks are reversed and written,
+        // a file is split in ranges mirrored to the output on every thread
+        size_t block = getBlockSize(wav_header->blockAlign);
+        Pipeline pipeline = {readFileRange, &range, reverseFrames, &frame_size, block, block,
+                             output.fd, output.data_offset};
+        if (spool.buffer != NULL) {
+            pipeline.read = readSpool;
+            pipeline.read_context = &spool;
         }
-		
-        if(fread(data, wav_header->subchunk2Size, 1, wav_file1) != 1) {
+
+        if (runParallelPipeline(&pipeline, range.end - range.start) != SUCCESS
+         || finishOutput(&output, wav_header, pipeline.written) != SUCCESS) {
             EXIT_CODE = FAILURE;
             printf("Header information mismatch, exiting program.\n\n");
-			freePointer(data);
             goto END;
         }
+    }
+
+    END:
+    releaseArena(arena);
+    freePointer(spool.buffer);
+    closeFile(wav_file1);
+    closeOutput(&output);
+    return EXIT_CODE;
+}
+
+/**
+ * Reads a stream into memory up to its end or @param limit bytes, keeping
+ * its last whole frames.
+ *
+ * @param fd
+ * @param limit, -1 for the whole stream
+ * @param frame_size
+ * @param spool
+ * @return EXIT_CODE, FAILURE if out of memory or the stream failed
+ */
+private int spoolStream(int fd, off_t limit, size_t frame_size, Spool *spool) {
+    size_t capacity = 0, size = 0;
+    for (;;) {
+        if (size == capacity) {
+            capacity = max(2 * capacity, PIPELINE_BLOCK);
+            u_char *buffer = realloc(spool->buffer, capacity);
+            if (buffer == NULL)
+                return FAILURE;
+            spool->buffer = buffer;
+        }
+
+        size_t wanted = capacity - size;
+        if (limit >= 0)
+            wanted = (size_t) min((off_t) wanted, limit - (off_t) size);
+        ssize_t bytes = readFully(fd, spool->buffer + size, wanted);
+        if (bytes < 0)
+            return FAILURE;
+        size += (size_t) bytes;
+        if ((size_t) bytes < wanted || (limit >= 0 && (off_t) size == limit))
+            break;
+    }
+
+    spool->size = size / frame_size * frame_size;
+    spool->data = spool->buffer + size - spool->size;
+    return SUCCESS;
+}
+
+/**
+ * Pipeline reader of a Spool, in blocks from the back to the front like
+ * readFileRange().
+ *
+ * @param context, the Spool
+ * @param block
+ * @param capacity
+ * @param sequence
+ * @return bytes read, 0 after the start of the spool
+ */
+private ssize_t readSpool(void *context, u_char *block, size_t capacity, u_int sequence) {
+    Spool *spool = context;
+    size_t done = (size_t) sequence * capacity;
+    if (done >= spool->size)
+        return 0;
+
+    size_t size = min(capacity, spool->size - done);
+    memcpy(block, spool->data + spool->size - done - size, size);
+    return (ssize_t) size;
+}
+
+/**
+ * Reverses data of given .wav file in place, swapping symmetric blocks
+ * from both ends towards the middle. Every swap is one step of a journal,
+ * so an interrupted run continues where it stopped when run again.
+ *
+ * @param wav_filename
+ * @return EXIT_CODE
+ */
+private int reverseFileInPlace(char *wav_filename) {
+    int EXIT_CODE;
+    Journal journal;
+    u_char *block = NULL;
+
+    EXIT_CODE = openJournal(&journal, wav_filename, JOURNAL_REVERSE);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    size_t frame_size = max((size_t) journal.header.blockAlign, 1);
+    size_t block_size = getBlockSize(journal.header.blockAlign);
+    off_t end = HEADER_SIZE + (off_t) (journal.header.subchunk2Size / frame_size * frame_size);
+    long long pairs = (end - HEADER_SIZE) / (2 * (off_t) block_size);
 
-        for(int i = wav_header->subchunk2Size - wav_header->blockAlign; i >= 0; i -= wav_header->blockAlign)
-            fwrite(data + i, wav_header->blockAlign, 1, wav_file2);
+    // The middle can be up to two blocks long
+    block = getBuffer(2 * block_size);
+    if (block == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    // The last step reverses the middle that is left between the pairs
+    while (journal.step <= pairs) {
+        off_t front = HEADER_SIZE + journal.step * (off_t) block_size;
+        EXIT_CODE = beginRecord(&journal, 2 * block_size, 2);
+        if (EXIT_CODE != SUCCESS)
+            goto END;
 
-        freePointer(data);
+        if (journal.step < pairs) {
+            off_t back = end - (journal.step + 1) * (off_t) block_size;
+            EXIT_CODE = reverseInto(&journal, block, front, back, block_size, frame_size);
+            if (EXIT_CODE == SUCCESS)
+                EXIT_CODE = reverseInto(&journal, block, back, front, block_size, frame_size);
+        } else
+            EXIT_CODE = reverseInto(&journal, block, front, front,
+                                    (size_t) (end - pairs * (off_t) block_size - front), frame_size);
+        if (EXIT_CODE != SUCCESS) {
+            printf("Header information mismatch, exiting program.\n\n");
+            goto END;
+        }
+
+        EXIT_CODE = commitStep(&journal, 0);
+        if (EXIT_CODE != SUCCESS)
+            goto END;
     }
 
     END:
-    freePointer(wav_header);
-    freePointer(new_filename);
-    closeFile(wav_file1);
-    closeFile(wav_file2);
+    closeJournal(&journal, EXIT_CODE == SUCCESS);
+    releaseBuffer(block);
     return EXIT_CODE;
 }
+
+/**
+ * Reads @param size bytes at @param from and adds them, frames reversed,
+ * to the next step of a journal as the bytes at @param to.
+ *
+ * @param journal
+ * @param block, at least @param size bytes of scratch space
+ * @param from
+ * @param to
+ * @param size
+ * @param frame_size
+ * @return EXIT_CODE
+ */
+private int reverseInto(Journal *journal, u_char *block, off_t from, off_t to, size_t size, size_t frame_size) {
+    if (preadFully(journal->wav_fd, block, size, from) != SUCCESS)
+        return FAILURE;
+    reverseFrames(&frame_size, block, size, reserveExtent(journal, to, size));
+    return SUCCESS;
+}
+
+/**
+ * Pipeline stage writing the frames of a block in reverse order.
+ *
+ * @param context, the frame size
+ * @param input
+ * @param size
+ * @param output
+ * @return bytes in output
+ */
+private size_t reverseFrames(void *context, u_char *input, size_t size, u_char *output) {
+    size_t frame_size = *(size_t *) context;
+    for (register size_t i = 0; i < size; i += frame_size)
+        memcpy(output + size - i - frame_size, input + i, frame_size);
+    return size;
+}
@@ -0,0 +1,284 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    SampleConverter.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+  * @author Aristos Georgiou
+  */
+
+
+/**
+ * Converts one little endian PCM sample to a value in [-1, 1).
+ * 8 bit samples are unsigned, wider samples are signed.
+ *
+ * @param sample
+ * @param sample_size, bytes per sample
+ * @return the sample as a double
+ */
+public double sampleToDouble(const u_char *sample, int sample_size) {
+    switch (sample_size) {
+        case 1:
+            return (sample[0] - 128) / 128.0;
+        case 2:
+            return (short) (sample[0] | sample[1] << 8) / 32768.0;
+        case 3: {
+            int value = sample[0] | sample[1] << 8 | sample[2] << 16;
+            if (value & 0x800000)
+                value -= 0x1000000;
+            return value / 8388608.0;
+        }
+        case 4:
+            return (int) ((u_int) sample[0] | (u_int) sample[1] << 8
+                        | (u_int) sample[2] << 16 | (u_int) sample[3] << 24) / 2147483648.0;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Decodes the frames of a data chunk into one mono signal by averaging
+ * the channels of each frame.
+ *
+ * @param wav_header
+ * @param wav_data
+ * @param number_of_frames, receives the length of the returned signal
+ * @return malloc'd signal or NULL if out of memory
+ */
+public double *getMonoSamples(Header *wav_header, u_char *wav_data, u_int *number_of_frames) {
+    u_int frames = wav_header->subchunk2Size / wav_header->blockAlign;
+
+    double *samples = malloc(max(frames, 1) * sizeof(double));
+    if (samples == NULL)
+        return NULL;
+
+    decodeMonoFrames(wav_header, wav_data, frames, samples);
+    *number_of_frames = frames;
+    return samples;
+}
+
+/**
+ * Decodes @param number_of_frames frames of raw data into @param samples,
+ * averaging the channels of each frame.
+ *
+ * @param wav_header
+ * @param wav_data
+ * @param number_of_frames
+ * @param samples
+ */
+public void decodeMonoFrames(Header *wav_header, u_char *wav_data, u_int number_of_frames, double *samples) {
+    int channels = wav_header->numChannels;
+    int sample_size = wav_header->blockAlign / channels;
+
+    // Packed 24 bit frames are unpacked a tile at a time by load24()
+    if (sample_size == 3 && wav_header->blockAlign == 3 * channels && channels <= PACKED_TILE) {
+        int values[PACKED_TILE];
+        u_int tile = PACKED_TILE / channels;
+        for (u_int first = 0; first < number_of_frames; first += tile) {
+            u_int count = min(tile, number_of_frames - first);
+            load24(wav_data + (size_t) first * wav_header->blockAlign, values, (size_t) count * channels);
+            for (u_int i = 0; i < count; i++) {
+                double sum = 0;
+                for (int c = 0; c < channels; c++)
+                    sum += values[i * channels + c] / 8388608.0;
+                samples[first + i] = sum / channels;
+            }
+        }
+        return;
+    }
+
+    for (register u_int i = 0; i < number_of_frames; i++) {
+        u_char *frame = wav_data + (size_t) i * wav_header->blockAlign;
+        double sum = 0;
+        for (int c = 0; c < channels; c++)
+            sum += sampleToDouble(frame + c * sample_size, sample_size);
+        samples[i] = sum / channels;
+    }
+}
+
+/**
+ * Downsamples a signal to its amplitude envelope, the RMS of consecutive
+ * blocks of @param frames_per_point samples. With one frame per point the
+ * envelope is the rectified signal.
+ *
+ * @param signal
+ * @param length
+ * @param frames_per_point
+ * @param points, receives the length of the envelope
+ * @return malloc'd envelope or NULL if out of memory
+ */
+public double *getEnvelope(double *signal, u_int length, u_int frames_per_point, u_int *points) {
+    frames_per_point = max(frames_per_point, 1);
+    u_int n = (length + frames_per_point - 1) / frames_per_point;
+
+    double *envelope = malloc(max(n, 1) * sizeof(double));
+    if (envelope == NULL)
+        return NULL;
+
+    for (u_int p = 0; p < n; p++) {
+        u_int start = p * frames_per_point, end = min(start + frames_per_point, length);
+        double energy = 0;
+        for (register u_int i = start; i < end; i++)
+            energy += signal[i] * signal[i];
+        envelope[p] = sqrt(energy / (end - start));
+    }
+
+    *points = n;
+    return envelope;
+}
+
+/**
+ * Scales @param samples PCM samples by @param gain, saturating at full
+ * scale. input and output may be the same buffer.
+ *
+ * @param input
+ * @param output
+ * @param samples
+ * @param sample_size, bytes per sample
+ * @param gain
+ */
+public void scaleSamples(const u_char *input, u_char *output, size_t samples, u_int sample_size, double gain) {
+    double largest = ldexp(1, 8 * (int) sample_size - 1) - 1;
+
+    if (sample_size == 3) {
+        int values[PACKED_TILE];
+        for (size_t first = 0; first < samples; first += PACKED_TILE) {
+            size_t count = min((size_t) PACKED_TILE, samples - first);
+            load24(input + 3 * first, values, count);
+            for (size_t i = 0; i < count; i++) {
+                double value = values[i] * gain;
+                values[i] = (int) lrint(min(max(value, -largest - 1), largest));
+            }
+            store24(values, output + 3 * first, count);
+        }
+        return;
+    }
+    for (register size_t i = 0; i < samples; i++) {
+        double value = readSample(input + i * sample_size, sample_size) * gain;
+        value = min(max(value, -largest - 1), largest);
+        writeSample(output + i * sample_size, sample_size, lrint(value));
+    }
+}
+
+/**
+ * @param sample, little endian, unsigned for 8 bits
+ * @param sample_size
+ * @return the sample as a signed integer
+ */
+public long readSample(const u_char *sample, u_int sample_size) {
+    switch (sample_size) {
+        case 1:
+            return (long) sample[0] - 128;
+        case 2:
+            return (short) (sample[0] | sample[1] << 8);
+        case 3: {
+            long value = sample[0] | sample[1] << 8 | sample[2] << 16;
+            return value & 0x800000 ? value - 0x1000000 : value;
+        }
+        default:
+            return (int) ((u_int) sample[0] | (u_int) sample[1] << 8 | (u_int) sample[2] << 16 | (u_int) sample[3] << 24);
+    }
+}
+
+/**
+ * @param sample, receives @param value little endian, unsigned for 8 bits
+ * @param sample_size
+ * @param value
+ */
+public void writeSample(u_char *sample, u_int sample_size, long value) {
+    if (sample_size == 1) {
+        sample[0] = (u_char) (value + 128);
+        return;
+    }
+    for (u_int b = 0; b < sample_size; b++)
+        sample[b] = (u_char) ((unsigned long) value >> (8 * b));
+}
+
+/**
+ * Unpacks @param samples packed little endian 24 bit samples into 32 bit
+ * integers. With SSE2 four samples are spread into the four lanes of a
+ * register by byte shifts and masks, then sign extended by a shift pair,
+ * eight per step; the few samples left are unpacked one at a time.
+ *
+ * @param input
+ * @param output
+ * @param samples
+ */
+public void load24(const u_char *input, int *output, size_t samples) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i lane1 = _mm_set_epi32(0, 0, -1, 0), lane2 = _mm_set_epi32(0, -1, 0, 0);
+    const __m128i lane3 = _mm_set_epi32(-1, 0, 0, 0), lane0 = _mm_set_epi32(0, 0, 0, -1);
+    // Both loads of a step read 16 bytes from sample i and i + 4, so stop 10 samples short of the end
+    for (; i + 10 <= samples; i += 8) {
+        for (int half = 0; half < 2; half++) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (input + 3 * (i + 4 * half)));
+            __m128i v = _mm_or_si128(_mm_or_si128(_mm_and_si128(x, lane0),
+                                                  _mm_and_si128(_mm_slli_si128(x, 1), lane1)),
+                                     _mm_or_si128(_mm_and_si128(_mm_slli_si128(x, 2), lane2),
+                                                  _mm_and_si128(_mm_slli_si128(x, 3), lane3)));
+            _mm_storeu_si128((__m128i *) (output + i + 4 * half), _mm_srai_epi32(_mm_slli_epi32(v, 8), 8));
+        }
+    }
+#endif
+
+    for (; i < samples; i++) {
+        const u_char *sample = input + 3 * i;
+        output[i] = (int) ((u_int) sample[0] << 8 | (u_int) sample[1] << 16 | (u_int) sample[2] << 24) >> 8;
+    }
+}
+
+/**
+ * Packs the low 24 bits of @param samples integers into little endian 24
+ * bit samples, the inverse of load24(). With SSE2 the low three bytes of
+ * every lane are masked and shifted into place, four samples per step,
+ * storing exactly their 12 bytes, never past the last sample.
+ *
+ * @param input
+ * @param output
+ * @param samples
+ */
+public void store24(const int *input, u_char *output, size_t samples) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i low0 = _mm_set_epi32(0, 0, 0, 0xFFFFFF), low1 = _mm_set_epi32(0, 0, 0xFFFFFF, 0);
+    const __m128i low2 = _mm_set_epi32(0, 0xFFFFFF, 0, 0), low3 = _mm_set_epi32(0xFFFFFF, 0, 0, 0);
+    for (; i + 4 <= samples; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + i));
+        __m128i packed = _mm_or_si128(_mm_or_si128(_mm_and_si128(v, low0),
+                                                   _mm_srli_si128(_mm_and_si128(v, low1), 1)),
+                                      _mm_or_si128(_mm_srli_si128(_mm_and_si128(v, low2), 2),
+                                                   _mm_srli_si128(_mm_and_si128(v, low3), 3)));
+        int last = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+        _mm_storel_epi64((__m128i *) (output + 3 * i), packed);
+        memcpy(output + 3 * i + 8, &last, 4);
+    }
+#endif
+
+    for (; i < samples; i++) {
+        u_char *sample = output + 3 * i;
+        sample[0] = (u_char) input[i];
+        sample[1] = (u_char) (input[i] >> 8);
+        sample[2] = (u_char) (input[i] >> 16);
+    }
+}
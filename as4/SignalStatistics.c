@@ -0,0 +1,497 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    SignalStatistics.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define STATS_CSV 0
+#define STATS_JSON 1
+#define LANE_FLUSH 4096       // Vectors summed in 16 and 32 bit lanes before they are added up.
+
+/**
+ * Running sums of one channel, in sample units.
+ */
+typedef struct ChannelSums {
+    double sum;
+    double squares;
+    u_int peak;
+    unsigned long long clipped;
+    unsigned long long crossings;
+    int negative;             // Sign of the last sample, for crossings across blocks.
+} ChannelSums;
+
+/**
+ * Exact integer sums of one channel over one block of 16 bit samples.
+ */
+typedef struct BlockSums {
+    long long sum;
+    unsigned long long squares;
+    unsigned long long clipped;
+    unsigned long long crossings;
+    int top;
+} BlockSums;
+
+/**
+ * Statistics of the files of one -stats run.
+ */
+typedef struct StatsBatch {
+    char **files;
+    Header *headers;
+    ChannelStats **stats;
+    int *status;
+} StatsBatch;
+
+private void statsTask(void *context, int file_id);
+
+private void sumBlock16(const short *samples, size_t frames, int channels, ChannelSums *sums);
+
+private void sumBlock24(const u_char *data, size_t frames, int channels, ChannelSums *sums);
+
+private void sumBlock(const u_char *data, size_t frames, int channels, int sample_size, ChannelSums *sums);
+
+#ifdef __SSE2__
+private size_t sumLanes16(const short *samples, size_t frames, int channels, ChannelSums *sums, BlockSums *totals);
+#endif
+
+private void printStatsCSV(StatsBatch *batch, int number_of_files);
+
+private void printStatsJSON(StatsBatch *batch, int number_of_files);
+
+private void printDecibels(double level, int json);
+
+
+/**
+ * Prints the peak and RMS level, DC offset, clipped samples and zero
+ * crossing rate of every channel of .wav files, as CSV or as JSON. Files
+ * are measured in parallel, each in one pass.
+ * Option ID: 19
+ *
+ * @param files
+ * @param number_of_files
+ * @param json, print JSON instead of CSV
+ * @return EXIT_CODE
+ */
+public int printSignalStats(char **files, int number_of_files, int json) {
+    int EXIT_CODE = SUCCESS;
+    StatsBatch batch = {files, NULL, NULL, NULL};
+
+    batch.headers = calloc((size_t) number_of_files, sizeof(Header));
+    batch.stats = calloc((size_t) number_of_files, sizeof(ChannelStats *));
+    batch.status = calloc((size_t) number_of_files, sizeof(int));
+    if (batch.headers == NULL || batch.stats == NULL || batch.status == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    parallelFor(number_of_files, statsTask, &batch);
+    for (int i = 0; i < number_of_files; i++)
+        if (batch.status[i] != SUCCESS)
+            EXIT_CODE = FAILURE;
+
+    if (json == STATS_JSON)
+        printStatsJSON(&batch, number_of_files);
+    else
+        printStatsCSV(&batch, number_of_files);
+
+    END:
+    for (int i = 0; batch.stats != NULL && i < number_of_files; i++)
+        freePointer(batch.stats[i]);
+    freePointer(batch.headers);
+    freePointer(batch.stats);
+    freePointer(batch.status);
+    return EXIT_CODE;
+}
+
+/**
+ * Measures every channel of the data of a .wav file in one pass, block by
+ * block. The file is read from its current offset if it is a stream.
+ *
+ * @param wav_header
+ * @param fd, of the .wav file
+ * @param stream, read fd sequentially
+ * @param stats, receives numChannels ChannelStats
+ * @return EXIT_CODE
+ */
+public int getSignalStats(Header *wav_header, int fd, int stream, ChannelStats *stats) {
+    int channels = max(wav_header->numChannels, 1);
+    int sample_size = wav_header->blockAlign / channels;
+    if (sample_size < 1 || sample_size > 4)
+        return FAILURE;
+
+    ChannelSums sums[channels];
+    memset(sums, 0, sizeof(sums));
+
+    size_t block_size = getBlockSize(wav_header->blockAlign);
+    u_char *block = getBuffer(block_size);
+    if (block == NULL)
+        return FAILURE;
+
+    off_t data_size = (off_t) (wav_header->subchunk2Size / wav_header->blockAlign) * wav_header->blockAlign;
+    FileRange range = {fd, HEADER_SIZE, stream && wav_header->subchunk2Size == STREAM_SIZE ? -1 : HEADER_SIZE + data_size,
+                       0, stream, HEADER_SIZE};
+    unsigned long long frames = 0;
+    int EXIT_CODE = SUCCESS;
+    for (off_t offset = 0;; offset += (off_t) block_size) {
+        ssize_t size = readRange(&range, block, block_size, offset);
+        if (size <= 0) {
+            EXIT_CODE = size < 0 ? FAILURE : SUCCESS;
+            break;
+        }
+
+        size_t block_frames = (size_t) size / wav_header->blockAlign;
+        if (sample_size == 2)
+            sumBlock16((const short *) block, block_frames, channels, sums);
+        else if (sample_size == 3 && channels <= PACKED_TILE)
+            sumBlock24(block, block_frames, channels, sums);
+        else
+            sumBlock(block, block_frames, channels, sample_size, sums);
+        frames += block_frames;
+        if (block_frames * wav_header->blockAlign < (size_t) size)
+            break;
+    }
+    releaseBuffer(block);
+
+    double full_scale = (double) (1u << (8 * sample_size - 1));
+    double seconds = (double) frames / max(wav_header->sampleRate, 1);
+    for (int c = 0; c < channels; c++) {
+        double n = max((double) frames, 1);
+        stats[c].peak = sums[c].peak / full_scale;
+        stats[c].rms = sqrt(sums[c].squares / n) / full_scale;
+        stats[c].dc_offset = sums[c].sum / n / full_scale;
+        stats[c].clipped = sums[c].clipped;
+        stats[c].zero_crossing_rate = seconds > 0 ? sums[c].crossings / seconds : 0;
+    }
+    return EXIT_CODE;
+}
+
+/**
+ * Measures one file of a StatsBatch.
+ *
+ * @param context, the StatsBatch
+ * @param file_id
+ */
+private void statsTask(void *context, int file_id) {
+    StatsBatch *batch = context;
+    Arena *arena = acquireArena();
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+
+    batch->status[file_id] = FAILURE;
+    if (arena == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return;
+    }
+    if (getHeader(arena, &wav_header, &wav_file, batch->files[file_id]) != SUCCESS)
+        goto END;
+
+    batch->headers[file_id] = *wav_header;
+    batch->stats[file_id] = calloc(max(wav_header->numChannels, 1), sizeof(ChannelStats));
+    if (batch->stats[file_id] == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    if (getSignalStats(wav_header, fileno(wav_file), isStream(batch->files[file_id]), batch->stats[file_id]) != SUCCESS) {
+        printf("Error in reading file: %s\n\n", batch->files[file_id]);
+        goto END;
+    }
+    batch->status[file_id] = SUCCESS;
+
+    END:
+    closeFile(wav_file);
+    releaseArena(arena);
+}
+
+/**
+ * Adds a block of interleaved signed 16 bit frames to the sums of every
+ * channel. With SSE2, sumLanes16() sums most of a block of 1, 2, 4 or 8
+ * channels and the branch free loop the frames left. Its integer sums
+ * cannot overflow within one block.
+ *
+ * @param samples
+ * @param frames
+ * @param channels
+ * @param sums
+ */
+private void sumBlock16(const short *samples, size_t frames, int channels, ChannelSums *sums) {
+    BlockSums totals[channels];
+    size_t done = 0;
+    memset(totals, 0, sizeof(totals));
+
+#ifdef __SSE2__
+    if (8 % channels == 0)
+        done = sumLanes16(samples, frames, channels, sums, totals);
+#endif
+    for (int c = 0; c < channels; c++) {
+        long long sum = totals[c].sum;
+        unsigned long long squares = totals[c].squares, clipped = totals[c].clipped, crossings = totals[c].crossings;
+        int top = totals[c].top;
+        int negative = done > 0 ? samples[(done - 1) * channels + c] < 0 : sums[c].negative;
+
+        for (size_t i = done; i < frames; i++) {
+            int value = samples[i * channels + c];
+            int magnitude = value < 0 ? -value : value;
+            sum += value;
+            squares += (u_int) (value * value);
+            top = magnitude > top ? magnitude : top;
+            clipped += value == 32767 || value == -32768;
+            crossings += (value < 0) != negative;
+            negative = value < 0;
+        }
+
+        sums[c].sum += (double) sum;
+        sums[c].squares += (double) squares;
+        sums[c].peak = max(sums[c].peak, (u_int) top);
+        sums[c].clipped += clipped;
+        sums[c].crossings += crossings;
+        sums[c].negative = negative;
+    }
+}
+
+/**
+ * Adds a block of interleaved packed 24 bit frames to the sums of every
+ * channel, unpacking a tile of frames at a time with load24() so the
+ * sums run over 32 bit lanes like those of sumBlock16(). Squares of a
+ * tile stay below 2^56, so they are summed exactly as integers.
+ *
+ * @param data
+ * @param frames
+ * @param channels
+ * @param sums
+ */
+private void sumBlock24(const u_char *data, size_t frames, int channels, ChannelSums *sums) {
+    int values[PACKED_TILE];
+    size_t tile = PACKED_TILE / channels;
+
+    for (size_t first = 0; first < frames; first += tile) {
+        size_t count = min(tile, frames - first);
+        load24(data + first * channels * 3, values, count * channels);
+
+        for (int c = 0; c < channels; c++) {
+            long long sum = 0;
+            unsigned long long squares = 0, clipped = 0, crossings = 0;
+            int top = 0;
+            int negative = sums[c].negative;
+
+            for (size_t i = 0; i < count; i++) {
+                int value = values[i * channels + c];
+                int magnitude = value < 0 ? -value : value;
+                sum += value;
+                squares += (unsigned long long) ((long long) value * value);
+                top = magnitude > top ? magnitude : top;
+                clipped += value == 8388607 || value == -8388608;
+                crossings += (value < 0) != negative;
+                negative = value < 0;
+            }
+
+            sums[c].sum += (double) sum;
+            sums[c].squares += (double) squares;
+            sums[c].peak = max(sums[c].peak, (u_int) top);
+            sums[c].clipped += clipped;
+            sums[c].crossings += crossings;
+            sums[c].negative = negative;
+        }
+    }
+}
+
+/**
+ * Adds a block of interleaved frames of 8, 24 or 32 bit samples to the
+ * sums of every channel.
+ *
+ * @param data
+ * @param frames
+ * @param channels
+ * @param sample_size
+ * @param sums
+ */
+private void sumBlock(const u_char *data, size_t frames, int channels, int sample_size, ChannelSums *sums) {
+    long long largest = (1LL << (8 * sample_size - 1)) - 1;
+
+    for (size_t i = 0; i < frames; i++)
+        for (int c = 0; c < channels; c++) {
+            const u_char *sample = data + (i * channels + c) * sample_size;
+            long long value;
+            if (sample_size == 1)
+                value = sample[0] - 128;
+            else if (sample_size == 3)
+                value = (int) ((u_int) sample[0] << 8 | (u_int) sample[1] << 16 | (u_int) sample[2] << 24) >> 8;
+            else
+                value = (int) ((u_int) sample[0] | (u_int) sample[1] << 8
+                             | (u_int) sample[2] << 16 | (u_int) sample[3] << 24);
+
+            u_int magnitude = (u_int) (value < 0 ? -value : value);
+            sums[c].sum += (double) value;
+            sums[c].squares += (double) value * value;
+            sums[c].peak = max(sums[c].peak, magnitude);
+            sums[c].clipped += value == largest || value == -largest - 1;
+            sums[c].crossings += (value < 0) != sums[c].negative;
+            sums[c].negative = value < 0;
+        }
+}
+
+#ifdef __SSE2__
+/**
+ * The part of sumBlock16() over whole vectors of 8 samples, whose lane k
+ * always holds channel k % channels. The previous sample of a lane, for
+ * the zero crossings, lies channels samples before it. The counters of
+ * 16 and 32 bit lanes are added up every LANE_FLUSH vectors, before they
+ * could overflow.
+ *
+ * @param samples
+ * @param frames
+ * @param channels, 1, 2, 4 or 8
+ * @param sums, for the sign of the last sample of the previous block
+ * @param totals, receives the sums of every channel
+ * @return frames summed
+ */
+private size_t sumLanes16(const short *samples, size_t frames, int channels, ChannelSums *sums, BlockSums *totals) {
+    size_t vectors = frames * channels / 8;
+    short previous_first[8];
+    for (int k = 0; k < 8 && vectors > 0; k++)
+        previous_first[k] = k < channels ? (short) -sums[k].negative : samples[k - channels];
+
+    __m128i zero = _mm_setzero_si128(), highest = zero, lowest = zero;
+    __m128i largest = _mm_set1_epi16(32767), smallest = _mm_set1_epi16(-32768);
+    for (size_t first = 0; first < vectors; first += LANE_FLUSH) {
+        size_t last = min(first + LANE_FLUSH, vectors);
+        __m128i sum_low = zero, sum_high = zero, clipped = zero, crossings = zero;
+        __m128i squares[4] = {zero, zero, zero, zero};
+
+        for (size_t v = first; v < last; v++) {
+            const short *lanes = samples + 8 * v;
+            __m128i values = _mm_loadu_si128((const __m128i *) lanes);
+            __m128i previous = _mm_loadu_si128((const __m128i *) (v == 0 ? previous_first : lanes - channels));
+            __m128i signs = _mm_srai_epi16(values, 15);
+
+            sum_low = _mm_add_epi32(sum_low, _mm_unpacklo_epi16(values, signs));
+            sum_high = _mm_add_epi32(sum_high, _mm_unpackhi_epi16(values, signs));
+            // Pairs of a sample and 0, so every 32 bit lane holds one square
+            __m128i wide_low = _mm_unpacklo_epi16(values, zero), wide_high = _mm_unpackhi_epi16(values, zero);
+            __m128i square_low = _mm_madd_epi16(wide_low, wide_low), square_high = _mm_madd_epi16(wide_high, wide_high);
+            squares[0] = _mm_add_epi64(squares[0], _mm_unpacklo_epi32(square_low, zero));
+            squares[1] = _mm_add_epi64(squares[1], _mm_unpackhi_epi32(square_low, zero));
+            squares[2] = _mm_add_epi64(squares[2], _mm_unpacklo_epi32(square_high, zero));
+            squares[3] = _mm_add_epi64(squares[3], _mm_unpackhi_epi32(square_high, zero));
+            highest = _mm_max_epi16(highest, values);
+            lowest = _mm_min_epi16(lowest, values);
+            clipped = _mm_sub_epi16(clipped, _mm_or_si128(_mm_cmpeq_epi16(values, largest),
+                                                          _mm_cmpeq_epi16(values, smallest)));
+            crossings = _mm_sub_epi16(crossings, _mm_xor_si128(signs, _mm_srai_epi16(previous, 15)));
+        }
+
+        int lane_sums[8];
+        unsigned long long lane_squares[8];
+        short lane_clipped[8], lane_crossings[8];
+        _mm_storeu_si128((__m128i *) lane_sums, sum_low);
+        _mm_storeu_si128((__m128i *) (lane_sums + 4), sum_high);
+        for (int k = 0; k < 4; k++)
+            _mm_storeu_si128((__m128i *) (lane_squares + 2 * k), squares[k]);
+        _mm_storeu_si128((__m128i *) lane_clipped, clipped);
+        _mm_storeu_si128((__m128i *) lane_crossings, crossings);
+        for (int k = 0; k < 8; k++) {
+            totals[k % channels].sum += lane_sums[k];
+            totals[k % channels].squares += lane_squares[k];
+            totals[k % channels].clipped += (u_short) lane_clipped[k];
+            totals[k % channels].crossings += (u_short) lane_crossings[k];
+        }
+    }
+
+    short lane_highest[8], lane_lowest[8];
+    _mm_storeu_si128((__m128i *) lane_highest, highest);
+    _mm_storeu_si128((__m128i *) lane_lowest, lowest);
+    for (int k = 0; k < 8 && vectors > 0; k++)
+        totals[k % channels].top = max(totals[k % channels].top, max(lane_highest[k], -lane_lowest[k]));
+    return vectors * 8 / channels;
+}
+#endif
+
+/**
+ * Prints the statistics of a batch as CSV, one line per channel.
+ *
+ * @param batch
+ * @param number_of_files
+ */
+private void printStatsCSV(StatsBatch *batch, int number_of_files) {
+    printf("file,channel,peak_dbfs,rms_dbfs,dc_offset,clipped_samples,zero_crossing_rate\n");
+    for (int i = 0; i < number_of_files; i++) {
+        if (batch->status[i] != SUCCESS)
+            continue;
+        for (int c = 0; c < batch->headers[i].numChannels; c++) {
+            ChannelStats *stats = &batch->stats[i][c];
+            printQuoted(batch->files[i], STATS_CSV);
+            printf(",%d,", c + 1);
+            printDecibels(stats->peak, STATS_CSV);
+            printf(",");
+            printDecibels(stats->rms, STATS_CSV);
+            printf(",%.6f,%llu,%.3f\n", stats->dc_offset, stats->clipped, stats->zero_crossing_rate);
+        }
+    }
+}
+
+/**
+ * Prints the statistics of a batch as a JSON array with one object per
+ * file.
+ *
+ * @param batch
+ * @param number_of_files
+ */
+private void printStatsJSON(StatsBatch *batch, int number_of_files) {
+    int first = 1;
+    printf("[");
+    for (int i = 0; i < number_of_files; i++) {
+        if (batch->status[i] != SUCCESS)
+            continue;
+        printf(first ? "\n  {\"file\": " : ",\n  {\"file\": ");
+        first = 0;
+        printQuoted(batch->files[i], STATS_JSON);
+        printf(", \"sample_rate\": %u, \"channels\": [", batch->headers[i].sampleRate);
+
+        for (int c = 0; c < batch->headers[i].numChannels; c++) {
+            ChannelStats *stats = &batch->stats[i][c];
+            printf("%s\n    {\"channel\": %d, \"peak_dbfs\": ", c > 0 ? "," : "", c + 1);
+            printDecibels(stats->peak, STATS_JSON);
+            printf(", \"rms_dbfs\": ");
+            printDecibels(stats->rms, STATS_JSON);
+            printf(", \"dc_offset\": %.6f, \"clipped_samples\": %llu, \"zero_crossing_rate\": %.3f}",
+                   stats->dc_offset, stats->clipped, stats->zero_crossing_rate);
+        }
+        printf("\n  ]}");
+    }
+    printf("\n]\n");
+}
+
+/**
+ * Prints a level relative to full scale in dBFS. Silence has no level in
+ * decibels, it is printed as -inf in CSV and null in JSON.
+ *
+ * @param level
+ * @param json
+ */
+private void printDecibels(double level, int json) {
+    if (level > 0)
+        printf("%.2f", 20 * log10(level));
+    else
+        printf(json == STATS_JSON ? "null" : "-inf");
+}
@@ -0,0 +1,566 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    SilenceDetector.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define WINDOW_MS 10
+#define HYSTERESIS 0.5        // Sound ends 6 dB under the level that starts it.
+#define PEAK_MARGIN 10.0      // A peak 20 dB over the threshold starts sound too.
+#define MIN_SOUND_MS 50       // Shorter sounds are clicks, not segments.
+#define PAD_MS 20             // Kept around every segment, for its attack.
+#define TRIM_SILENCE 0.3      // Seconds of silence that set a click at either end apart.
+
+/**
+ * State of a pass over the data, window by window. Segments of sound are
+ * collected in frames, [starts[i], ends[i]).
+ */
+typedef struct SilenceScan {
+    Header *wav_header;
+    u_int frames;
+    u_int window_frames;
+    double open;              // RMS that starts sound, relative to full scale.
+    double close;             // RMS under which sound may end.
+    u_int min_silence;        // Windows of silence that end a segment.
+    u_int min_sound;
+    u_int pad;
+    int sounding;
+    u_int sound_start;        // Window.
+    u_int silent_windows;     // Silent windows since the last loud one.
+    u_int *starts;
+    u_int *ends;
+    int number_of_segments;
+    int capacity;
+} SilenceScan;
+
+private int scanSilence(char *wav_filename, Header *wav_header, FILE *wav_file, double threshold_db,
+                        double min_silence, SilenceScan *scan);
+
+private int nextWindow(SilenceScan *scan, u_int window, double rms, double peak);
+
+private int closeSegment(SilenceScan *scan, u_int start_window, u_int end_window);
+
+private double windowLevel(const u_char *data, size_t number_of_samples, int sample_size, double *peak);
+
+private void measure8(const u_char *samples, size_t n, unsigned long long *energy, u_int *peak);
+
+private void measure16(const short *samples, size_t n, unsigned long long *energy, u_int *peak);
+
+private void measure24(const u_char *samples, size_t n, double *energy, u_int *peak);
+
+private void measure32(const int *samples, size_t n, double *energy, u_int *peak);
+
+#ifdef __SSE2__
+private void accumulate16(__m128i values, __m128i *sums, __m128i *highest, __m128i *lowest);
+
+private u_int reduce16(__m128i sums, __m128i highest, __m128i lowest, unsigned long long *energy);
+#endif
+
+
+/**
+ * Trims the silence at the start and the end of a .wav file into
+ * trimmed-wav_filename.
+ * Option ID: 17
+ *
+ * @param wav_filename
+ * @param threshold_db, decibels under full scale below which is silence
+ * @return EXIT_CODE
+ */
+public int trimSilence(char *wav_filename, double threshold_db) {
+    int EXIT_CODE;
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+    Output output = {NULL, -1, 0, -1};
+    char *new_wav_filename = NULL;
+    SilenceScan scan;
+    memset(&scan, 0, sizeof(SilenceScan));
+
+    EXIT_CODE = getHeader(NULL, &wav_header, &wav_file, wav_filename);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    // Everything from the first segment of sound to the last is kept
+    EXIT_CODE = scanSilence(wav_filename, wav_header, wav_file, threshold_db, TRIM_SILENCE, &scan);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+    if (scan.number_of_segments == 0) {
+        printf("No sound above the threshold in %s.\n\n", wav_filename);
+        goto END;
+    }
+
+    new_wav_filename = malloc(9 + strlen(wav_filename));
+    if (new_wav_filename == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+    snprintf(new_wav_filename, 9 + strlen(wav_filename), "trimmed-%s", wav_filename);
+
+    {
+        u_int first = scan.starts[0], last = scan.ends[scan.number_of_segments - 1];
+        printf("Kept %.3f s to %.3f s of %s\n\n", (double) first / wav_header->sampleRate,
+               (double) last / wav_header->sampleRate, wav_filename);
+
+        off_t start = HEADER_SIZE + (off_t) first * wav_header->blockAlign;
+        wav_header->subchunk2Size = (last - first) * wav_header->blockAlign;
+        wav_header->chunkSize = wav_header->subchunk2Size + 36;
+
+        EXIT_CODE = openOutput(&output, 0, new_wav_filename, wav_header);
+        if (EXIT_CODE != SUCCESS)
+            goto END;
+
+        FileRange range = {fileno(wav_file), start, start + (off_t) wav_header->subchunk2Size, 0, 0, HEADER_SIZE};
+        size_t block = getBlockSize(wav_header->blockAlign);
+        Pipeline pipeline = {readFileRange, &range, NULL, NULL, block, block, output.fd, output.data_offset};
+
+        if (runParallelPipeline(&pipeline, range.end - range.start) != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            printf("Header information mismatch, exiting program.\n\n");
+            goto END;
+        }
+    }
+
+    END:
+    freePointer(wav_header);
+    freePointer(new_wav_filename);
+    freePointer(scan.starts);
+    freePointer(scan.ends);
+    closeFile(wav_file);
+    closeOutput(&output);
+    return EXIT_CODE;
+}
+
+/**
+ * Splits a .wav file at its pauses into segment-i-wav_filename files, one
+ * per stretch of sound, and prints where every segment lies.
+ * Option ID: 18
+ *
+ * @param wav_filename
+ * @param threshold_db, decibels under full scale below which is silence
+ * @param min_silence, seconds of silence that end a segment
+ * @return EXIT_CODE
+ */
+public int splitOnSilence(char *wav_filename, double threshold_db, double min_silence) {
+    int EXIT_CODE;
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+    SilenceScan scan;
+    memset(&scan, 0, sizeof(SilenceScan));
+
+    EXIT_CODE = getHeader(NULL, &wav_header, &wav_file, wav_filename);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    EXIT_CODE = scanSilence(wav_filename, wav_header, wav_file, threshold_db, min_silence, &scan);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+    if (scan.number_of_segments == 0) {
+        printf("No sound above the threshold in %s.\n\n", wav_filename);
+        goto END;
+    }
+
+    for (int i = 0; i < scan.number_of_segments; i++)
+        printf("Segment %d: %.3f s to %.3f s\n", i + 1, (double) scan.starts[i] / wav_header->sampleRate,
+               (double) scan.ends[i] / wav_header->sampleRate);
+    printf("\n");
+
+    EXIT_CODE = writeSegments("segment", wav_filename, wav_header, fileno(wav_file), scan.starts, scan.ends,
+                              scan.number_of_segments);
+
+    END:
+    freePointer(wav_header);
+    freePointer(scan.starts);
+    freePointer(scan.ends);
+    closeFile(wav_file);
+    return EXIT_CODE;
+}
+
+/**
+ * Finds the segments of sound of a .wav file in one pass over its data,
+ * block by block, measuring the RMS and peak of every WINDOW_MS window.
+ * Sound starts at a window reaching the threshold, or a peak PEAK_MARGIN
+ * over it, and ends after @param min_silence seconds under HYSTERESIS
+ * times the threshold. A threshold above full scale, which no sample can
+ * reach, is rejected.
+ *
+ * @param wav_filename
+ * @param wav_header
+ * @param wav_file
+ * @param threshold_db, decibels under full scale, 0 or more
+ * @param min_silence, seconds
+ * @param scan, receives the segments
+ * @return EXIT_CODE
+ */
+private int scanSilence(char *wav_filename, Header *wav_header, FILE *wav_file, double threshold_db,
+                        double min_silence, SilenceScan *scan) {
+    if (isStream(wav_filename)) {
+        printf("Streams are not supported: %s\n\n", wav_filename);
+        return FAILURE;
+    }
+    if (!(threshold_db >= 0) || isinf(threshold_db)) {
+        printf("Parameters for threshold are invalid.\n\n");
+        return FAILURE;
+    }
+
+    int sample_size = wav_header->blockAlign / max(wav_header->numChannels, 1);
+    if (sample_size < 1 || sample_size > 4) {
+        printf("Unsupported sample size: %s\n\n", wav_filename);
+        return FAILURE;
+    }
+
+    u_int window_per_second = 1000 / WINDOW_MS;
+    scan->wav_header = wav_header;
+    scan->frames = wav_header->subchunk2Size / wav_header->blockAlign;
+    scan->window_frames = max(wav_header->sampleRate / window_per_second, 1);
+    scan->open = pow(10, -threshold_db / 20);
+    scan->close = scan->open * HYSTERESIS;
+    scan->min_silence = (u_int) max(ceil(min_silence * window_per_second), 1);
+    scan->min_sound = MIN_SOUND_MS / WINDOW_MS;
+    scan->pad = PAD_MS / WINDOW_MS;
+
+    size_t window_size = (size_t) scan->window_frames * wav_header->blockAlign;
+    size_t windows_per_block = max(PIPELINE_BLOCK / window_size, 1);
+    u_char *block = getBuffer(windows_per_block * window_size);
+    if (block == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return FAILURE;
+    }
+
+    // The data is read once, a block of whole windows at a time
+    int EXIT_CODE = SUCCESS;
+    FileRange range = {fileno(wav_file), HEADER_SIZE, HEADER_SIZE + (off_t) scan->frames * wav_header->blockAlign,
+                       0, 0, HEADER_SIZE};
+    u_int window = 0;
+    for (off_t offset = 0; EXIT_CODE == SUCCESS; offset += (off_t) (windows_per_block * window_size)) {
+        ssize_t size = readRange(&range, block, windows_per_block * window_size, offset);
+        if (size < 0) {
+            EXIT_CODE = FAILURE;
+            printf("Header information mismatch, exiting program.\n\n");
+            break;
+        }
+        if (size == 0)
+            break;
+
+        for (size_t used = 0; used < (size_t) size && EXIT_CODE == SUCCESS; used += window_size, window++) {
+            size_t bytes = min(window_size, (size_t) size - used);
+            double peak;
+            double rms = windowLevel(block + used, bytes / sample_size, sample_size, &peak);
+            EXIT_CODE = nextWindow(scan, window, rms, peak);
+        }
+    }
+    releaseBuffer(block);
+
+    if (EXIT_CODE == SUCCESS && scan->sounding)
+        EXIT_CODE = closeSegment(scan, scan->sound_start, window - scan->silent_windows);
+    return EXIT_CODE;
+}
+
+/**
+ * Moves the state of a scan past one window.
+ *
+ * @param scan
+ * @param window
+ * @param rms, of the window, relative to full scale
+ * @param peak, of the window, relative to full scale
+ * @return EXIT_CODE
+ */
+private int nextWindow(SilenceScan *scan, u_int window, double rms, double peak) {
+    int loud = scan->sounding ? rms >= scan->close || peak >= scan->open
+                              : rms >= scan->open || peak >= scan->open * PEAK_MARGIN;
+
+    if (!scan->sounding) {
+        if (loud) {
+            scan->sounding = 1;
+            scan->sound_start = window;
+            scan->silent_windows = 0;
+        }
+        return SUCCESS;
+    }
+
+    if (loud) {
+        scan->silent_windows = 0;
+        return SUCCESS;
+    }
+    if (++scan->silent_windows < scan->min_silence)
+        return SUCCESS;
+
+    scan->sounding = 0;
+    return closeSegment(scan, scan->sound_start, window + 1 - scan->silent_windows);
+}
+
+/**
+ * Adds the sound in windows [start_window, end_window) as a segment,
+ * padded by PAD_MS on both sides, unless it is shorter than MIN_SOUND_MS.
+ *
+ * @param scan
+ * @param start_window
+ * @param end_window
+ * @return EXIT_CODE
+ */
+private int closeSegment(SilenceScan *scan, u_int start_window, u_int end_window) {
+    if (end_window - start_window < scan->min_sound)
+        return SUCCESS;
+
+    if (scan->number_of_segments == scan->capacity) {
+        scan->capacity = max(2 * scan->capacity, 64);
+        u_int *starts = realloc(scan->starts, scan->capacity * sizeof(u_int));
+        if (starts != NULL)
+            scan->starts = starts;
+        u_int *ends = realloc(scan->ends, scan->capacity * sizeof(u_int));
+        if (ends != NULL)
+            scan->ends = ends;
+        if (starts == NULL || ends == NULL) {
+            printf("Sorry, program run out of memory.\n\n");
+            return FAILURE;
+        }
+    }
+
+    u_int previous_end = scan->number_of_segments > 0 ? scan->ends[scan->number_of_segments - 1] : 0;
+    unsigned long long start = (unsigned long long) (start_window - min(start_window, scan->pad)) * scan->window_frames;
+    unsigned long long end = (unsigned long long) (end_window + scan->pad) * scan->window_frames;
+    scan->starts[scan->number_of_segments] = (u_int) max(start, previous_end);
+    scan->ends[scan->number_of_segments] = (u_int) min(end, scan->frames);
+    scan->number_of_segments++;
+    return SUCCESS;
+}
+
+/**
+ * @param data, little endian PCM samples of all channels
+ * @param number_of_samples
+ * @param sample_size, bytes per sample, 1 to 4
+ * @param peak, receives the largest magnitude relative to full scale
+ * @return RMS of the samples relative to full scale
+ */
+private double windowLevel(const u_char *data, size_t number_of_samples, int sample_size, double *peak) {
+    unsigned long long integer_energy = 0;
+    double energy = 0;
+    u_int top = 0;
+    double full_scale = 1;
+
+    switch (sample_size) {
+        case 1:
+            measure8(data, number_of_samples, &integer_energy, &top);
+            energy = (double) integer_energy;
+            full_scale = 128.0;
+            break;
+        case 2:
+            measure16((const short *) data, number_of_samples, &integer_energy, &top);
+            energy = (double) integer_energy;
+            full_scale = 32768.0;
+            break;
+        case 3:
+            measure24(data, number_of_samples, &energy, &top);
+            full_scale = 8388608.0;
+            break;
+        case 4:
+            measure32((const int *) data, number_of_samples, &energy, &top);
+            full_scale = 2147483648.0;
+            break;
+    }
+
+    *peak = top / full_scale;
+    return number_of_samples > 0 ? sqrt(energy / number_of_samples) / full_scale : 0;
+}
+
+/**
+ * Energy and peak of unsigned 8 bit samples. With SSE2, 16 samples per
+ * step are widened to 16 bits and measured as measure16() does, the rest
+ * by a branch free loop.
+ *
+ * @param samples
+ * @param n
+ * @param energy, receives the sum of squares
+ * @param peak, receives the largest magnitude
+ */
+private void measure8(const u_char *samples, size_t n, unsigned long long *energy, u_int *peak) {
+    unsigned long long sum = 0;
+    u_int top = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128(), bias = _mm_set1_epi16(128);
+    __m128i sums = zero, highest = zero, lowest = zero;
+    for (; i + 16 <= n; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (samples + i));
+        accumulate16(_mm_sub_epi16(_mm_unpacklo_epi8(bytes, zero), bias), &sums, &highest, &lowest);
+        accumulate16(_mm_sub_epi16(_mm_unpackhi_epi8(bytes, zero), bias), &sums, &highest, &lowest);
+    }
+    top = reduce16(sums, highest, lowest, &sum);
+#endif
+    for (; i < n; i++) {
+        int value = samples[i] - 128;
+        u_int magnitude = (u_int) (value < 0 ? -value : value);
+        sum += (u_int) (value * value);
+        top = magnitude > top ? magnitude : top;
+    }
+    *energy = sum;
+    *peak = top;
+}
+
+/**
+ * Energy and peak of signed 16 bit samples, read in the byte order of the
+ * host, which is little endian on every platform we build for. With SSE2,
+ * 8 samples per step.
+ *
+ * @param samples
+ * @param n
+ * @param energy
+ * @param peak
+ */
+private void measure16(const short *samples, size_t n, unsigned long long *energy, u_int *peak) {
+    unsigned long long sum = 0;
+    u_int top = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128i sums = _mm_setzero_si128(), highest = _mm_setzero_si128(), lowest = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8)
+        accumulate16(_mm_loadu_si128((const __m128i *) (samples + i)), &sums, &highest, &lowest);
+    top = reduce16(sums, highest, lowest, &sum);
+#endif
+    for (; i < n; i++) {
+        int value = samples[i];
+        u_int magnitude = (u_int) (value < 0 ? -value : value);
+        sum += (u_int) (value * value);
+        top = magnitude > top ? magnitude : top;
+    }
+    *energy = sum;
+    *peak = top;
+}
+
+/**
+ * Energy and peak of packed signed 24 bit samples, unpacked a tile at a
+ * time by load24(). With SSE2, 4 unpacked samples per step, whose squares
+ * need the 64 bit lanes of _mm_mul_epu32().
+ *
+ * @param samples
+ * @param n
+ * @param energy
+ * @param peak
+ */
+private void measure24(const u_char *samples, size_t n, double *energy, u_int *peak) {
+    int values[PACKED_TILE];
+    double sum = 0;
+    u_int top = 0;
+    for (size_t first = 0; first < n; first += PACKED_TILE) {
+        size_t count = min((size_t) PACKED_TILE, n - first);
+        unsigned long long squares = 0;
+        size_t i = 0;
+        load24(samples + 3 * first, values, count);
+
+#ifdef __SSE2__
+        __m128i sums = _mm_setzero_si128(), tops = _mm_setzero_si128();
+        for (; i + 4 <= count; i += 4) {
+            __m128i value = _mm_loadu_si128((const __m128i *) (values + i));
+            __m128i sign = _mm_srai_epi32(value, 31);
+            __m128i magnitude = _mm_sub_epi32(_mm_xor_si128(value, sign), sign);
+            __m128i odd = _mm_srli_epi64(magnitude, 32);
+            sums = _mm_add_epi64(sums, _mm_mul_epu32(magnitude, magnitude));
+            sums = _mm_add_epi64(sums, _mm_mul_epu32(odd, odd));
+            __m128i larger = _mm_cmpgt_epi32(magnitude, tops);
+            tops = _mm_or_si128(_mm_and_si128(larger, magnitude), _mm_andnot_si128(larger, tops));
+        }
+        unsigned long long lanes[2];
+        u_int magnitudes[4];
+        _mm_storeu_si128((__m128i *) lanes, sums);
+        _mm_storeu_si128((__m128i *) magnitudes, tops);
+        squares = lanes[0] + lanes[1];
+        for (int k = 0; k < 4; k++)
+            top = magnitudes[k] > top ? magnitudes[k] : top;
+#endif
+        for (; i < count; i++) {
+            int value = values[i];
+            u_int magnitude = (u_int) (value < 0 ? -value : value);
+            squares += (unsigned long long) ((long long) value * value);
+            top = magnitude > top ? magnitude : top;
+        }
+        sum += (double) squares;
+    }
+    *energy = sum;
+    *peak = top;
+}
+
+/**
+ * Energy and peak of signed 32 bit samples.
+ *
+ * @param samples
+ * @param n
+ * @param energy
+ * @param peak
+ */
+private void measure32(const int *samples, size_t n, double *energy, u_int *peak) {
+    double sum = 0;
+    u_int top = 0;
+    for (size_t i = 0; i < n; i++) {
+        long long value = samples[i];
+        u_int magnitude = (u_int) (value < 0 ? -value : value);
+        sum += (double) value * value;
+        top = magnitude > top ? magnitude : top;
+    }
+    *energy = sum;
+    *peak = top;
+}
+
+#ifdef __SSE2__
+/**
+ * Adds the squares of 8 signed 16 bit samples to two 64 bit lanes and
+ * keeps their extremes. _mm_madd_epi16() sums squares in pairs, at most
+ * 2^31, which fits a 32 bit lane read as unsigned.
+ *
+ * @param values
+ * @param sums
+ * @param highest, largest sample per lane
+ * @param lowest, smallest sample per lane
+ */
+private void accumulate16(__m128i values, __m128i *sums, __m128i *highest, __m128i *lowest) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i squares = _mm_madd_epi16(values, values);
+    *sums = _mm_add_epi64(*sums, _mm_unpacklo_epi32(squares, zero));
+    *sums = _mm_add_epi64(*sums, _mm_unpackhi_epi32(squares, zero));
+    *highest = _mm_max_epi16(*highest, values);
+    *lowest = _mm_min_epi16(*lowest, values);
+}
+
+/**
+ * @param sums
+ * @param highest
+ * @param lowest
+ * @param energy, receives the sum of the lanes of sums
+ * @return the largest magnitude of the extremes
+ */
+private u_int reduce16(__m128i sums, __m128i highest, __m128i lowest, unsigned long long *energy) {
+    unsigned long long lanes[2];
+    short high[8], low[8];
+    u_int top = 0;
+    _mm_storeu_si128((__m128i *) lanes, sums);
+    _mm_storeu_si128((__m128i *) high, highest);
+    _mm_storeu_si128((__m128i *) low, lowest);
+    for (int k = 0; k < 8; k++) {
+        top = (u_int) high[k] > top ? (u_int) high[k] : top;
+        top = (u_int) -low[k] > top ? (u_int) -low[k] : top;
+    }
+    *energy = lanes[0] + lanes[1];
+    return top;
+}
+#endif
@@ -1,17 +1,104 @@
 #include "Definitions.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /**
   * @author Aristos Georgiou
   */
 
-private double euclidean(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2);
+#define EUCLIDEAN_RANGE (1 << 20)   // Smallest range of a parallel euclidean(), in bytes.
+#define EUCLIDEAN_RANGES 256
+#define EUCLIDEAN_FLUSH 4096        // Vectors summed in 32 bit lanes before they are added up.
+#define MATRIX_TILE 16              // Files per side of a tile of a similarity matrix.
+#define CHECKPOINT_SECONDS 300      // Between checkpoints of an LCSS, WAVENGINE_CHECKPOINT overrides.
+#define PROGRESS_SECONDS 10
+#define CHECK_CELLS (1 << 24)       // LCSS cells between looks at the clock.
+#define LCSS_INTERRUPTED -2
 
-private double LCSS(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2);
+static const char CHECKPOINT_MAGIC[8] = "WAVLCS1";
+
+/**
+ * Both buffers of a euclidean() or euclidean24() and the partial sum of
+ * every range.
+ */
+typedef struct EuclideanRanges {
+    u_char *wav_data1;
+    u_char *wav_data2;
+    u_int size;                     // In bytes, or in samples if packed.
+    u_int range_size;
+    int packed;                     // Of euclidean24().
+    double *sums;
+} EuclideanRanges;
+
+/**
+ * Files of a similarity matrix, each loaded once, and the distance of
+ * every pair i < j of them, row after row.
+ */
+typedef struct SimilarityMatrix {
+    char **files;
+    int number_of_files;
+    int lcss;
+    double threshold;               // Negative for a dense matrix.
+    int tiles_per_side;
+    Header *headers;
+    u_char **data;
+    PAA *approximations;            // Only with a threshold.
+    int *status;
+    double *distances;
+} SimilarityMatrix;
+
+/**
+ * Frontier of an LCSS saved to a checkpoint file: the DP row of next_row
+ * - 1, which follows the header, or once finished the distance. The hash of
+ * both data buffers ties the checkpoint to the files it was made for.
+ */
+typedef struct LCSSCheckpoint {
+    char magic[8];
+    u_int rows;
+    u_int cols;
+    u_int next_row;
+    u_int finished;
+    double distance;
+    unsigned long long data_hash;
+    unsigned long long row_hash;
+} LCSSCheckpoint;
+
+private double sumRanges(u_char *wav_data1, u_char *wav_data2, u_int size, int packed);
+
+private void sumSquaredRange(void *context, int range_id);
+
+private unsigned long long sumSquared(const u_char *wav_data1, const u_char *wav_data2, u_int start, u_int end);
+
+private double sumSquared24(const u_char *wav_data1, const u_char *wav_data2, u_int start, u_int end);
+
+private void loadMatrixFile(void *context, int file_id);
+
+private void computeTile(void *context, int tile_id);
+
+private size_t pairIndex(int i, int j, int number_of_files);
+
+private int loadCheckpoint(char *checkpoint_filename, LCSSCheckpoint *checkpoint, u_int *row);
+
+private int saveCheckpoint(char *checkpoint_filename, LCSSCheckpoint *checkpoint, u_int *row);
+
+private unsigned long long hashOf(const void *data, size_t size, unsigned long long hash);
+
+private void requestStop(int signal_number);
+
+private volatile sig_atomic_t stop_requested = 0;        // The signal caught, 0 for none.
+
+private struct sigaction previous_actions[2];   // Of SIGTERM and SIGINT while requestStop() handles them.
 
 
 /**
  * Prints euclidean and lcss distances of file[0] in comparison with
- * the rest.
+ * the rest. A SIGTERM or SIGINT during a long lcss saves its progress to
+ * file.lcss and stops, and running the same comparison again resumes it.
+ * Once every comparison is done, the checkpoints of this run are removed.
  *
  * @param files
  * @param number_of_files
@@ -22,15 +109,26 @@ public int calculateDistance(char **files, int number_of_files) {
     Header *wav_header1 = NULL;
     FILE *wav_file1 = NULL;
     u_char *wav_file_data1 = NULL;
+    int *checkpointed = NULL;
+    int stopped = 0;
+
+    // A long LCSS checkpoints and stops on these instead of losing its work
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    stop_requested = 0;
+    sigaction(SIGTERM, &action, &previous_actions[0]);
+    sigaction(SIGINT, &action, &previous_actions[1]);
 
     // Initialise wav_header1 from first file to be compared with the rest
-    EXIT_CODE = getHeader(&wav_header1, &wav_file1, files[0]);
+    EXIT_CODE = getHeader(NULL, &wav_header1, &wav_file1, files[0]);
     if (EXIT_CODE != SUCCESS)
         goto END;
 
     // Initialise wav_file_data1 from the data of first file
-    wav_file_data1 = malloc(wav_header1->subchunk2Size);
-    if(wav_file_data1 == NULL) {
+    wav_file_data1 = getBuffer(wav_header1->subchunk2Size);
+    checkpointed = calloc((size_t) number_of_files, sizeof(int));
+    if(wav_file_data1 == NULL || checkpointed == NULL) {
         EXIT_CODE = FAILURE;
         printf("Sorry, program run out of memory.\n\n");
         goto END;
@@ -42,14 +140,21 @@ public int calculateDistance(char **files, int number_of_files) {
         goto END;
     }
 
-    // Read the rest of files and compare with first
-    for (int i = 1; i < number_of_files; i++) {
+    // Read the rest of files and compare with first, until a stop is requested
+    for (int i = 1; i < number_of_files && !stopped; i++) {
+        Arena *arena = acquireArena();
         Header *wav_header2 = NULL;
         FILE *wav_file2 = NULL;
         u_char *wav_file_data2 = NULL;
 
+        if (arena == NULL) {
+            EXIT_CODE = FAILURE;
+            printf("Sorry, program run out of memory.\n\n");
+            goto LOOP;
+        }
+
         // Initialise wav_header2 from wav_file[i]
-        EXIT_CODE = getHeader(&wav_header2, &wav_file2, files[i]);
+        EXIT_CODE = getHeader(arena, &wav_header2, &wav_file2, files[i]);
         if (EXIT_CODE != SUCCESS)
             goto LOOP;
 
@@ -62,7 +167,7 @@ public int calculateDistance(char **files, int number_of_files) {
         }
 
         // Initialise wav_file_data2 from the data wav_file[i]
-        wav_file_data2 = malloc(wav_header2->subchunk2Size);
+        wav_file_data2 = getBuffer(wav_header2->subchunk2Size);
         if(wav_file_data2 == NULL) {
             EXIT_CODE = FAILURE;
             printf("Sorry, program run out of memory.\n\n");
@@ -75,24 +180,161 @@ public int calculateDistance(char **files, int number_of_files) {
             goto LOOP;
         }
 
-        double distance1 = euclidean(wav_file_data1, wav_file_data2,
-                                     wav_header1->subchunk2Size, wav_header2->subchunk2Size);
+        double distance1 = wav_header1->bitsPerSample == 24
+                           ? euclidean24(wav_file_data1, wav_file_data2,
+                                         wav_header1->subchunk2Size, wav_header2->subchunk2Size)
+                           : euclidean(wav_file_data1, wav_file_data2,
+                                       wav_header1->subchunk2Size, wav_header2->subchunk2Size);
         printf("Euclidean distance: %.3f\n", distance1);
 
-        double distance2 = LCSS(wav_file_data1, wav_file_data2,
-                                wav_header1->subchunk2Size, wav_header2->subchunk2Size);
-        printf("LCSS distance: %.3f\n\n", distance2);
+        // Checkpoints go next to the file compared with the first
+        char *checkpoint_filename = arenaAlloc(arena, 6 + strlen(files[i]));
+        if (checkpoint_filename != NULL)
+            snprintf(checkpoint_filename, 6 + strlen(files[i]), "%s.lcss", files[i]);
+
+        double distance2 = resumableLCSS(wav_file_data1, wav_file_data2,
+                                         wav_header1->subchunk2Size, wav_header2->subchunk2Size, checkpoint_filename,
+                                         &checkpointed[i]);
+        if (distance2 == LCSS_INTERRUPTED)
+            stopped = 1;
+        else
+            printf("LCSS distance: %.3f\n\n", distance2);
 
         LOOP:
-        freePointer(wav_header2);
-        freePointer(wav_file_data2);
+        releaseArena(arena);
+        releaseBuffer(wav_file_data2);
         closeFile(wav_file2);
+
+        // A stop caught outside an LCSS ends the run between two comparisons
+        if (stop_requested && !stopped) {
+            if (i + 1 < number_of_files)
+                printf("Stopped before comparing %s. Run the same command again to resume.\n\n", files[i + 1]);
+            stopped = 1;
+        }
+        if (stopped)
+            EXIT_CODE = FAILURE;
+    }
+    if (stopped)
+        goto END;
+
+    // Every comparison is done, the finished ones kept for a rerun are not
+    // needed. A file.lcss of another comparison is not this run's to remove
+    for (int i = 1; i < number_of_files; i++) {
+        if (!checkpointed[i])
+            continue;
+        char checkpoint_filename[strlen(files[i]) + 6];
+        snprintf(checkpoint_filename, sizeof(checkpoint_filename), "%s.lcss", files[i]);
+        unlink(checkpoint_filename);
     }
 
     END:
+    sigaction(SIGTERM, &previous_actions[0], NULL);
+    sigaction(SIGINT, &previous_actions[1], NULL);
     freePointer(wav_header1);
-    freePointer(wav_file_data1);
+    freePointer(checkpointed);
+    releaseBuffer(wav_file_data1);
     closeFile(wav_file1);
+
+    // With the work saved, end the way the signal would have ended the program
+    int signal_number = stop_requested;
+    stop_requested = 0;
+    if (stopped && signal_number != 0 && previous_actions[signal_number == SIGINT].sa_handler == SIG_DFL) {
+        fflush(stdout);
+        raise(signal_number);
+    }
+    return EXIT_CODE;
+}
+
+/**
+ * Prints the euclidean or lcss distance of every pair of files, as a dense
+ * CSV matrix or, given a threshold, as a CSV list of the pairs no farther
+ * apart than it. Every file is read once and the pairs are computed in
+ * square tiles of MATRIX_TILE by MATRIX_TILE files, so the data of a tile
+ * stays in cache while all its pairs use it. Tiles are handed out one at a
+ * time to the threads that are free, row after row, so consecutive tiles
+ * share their row of files. With a threshold, pairs whose approximations
+ * prove them farther apart are never compared in full.
+ * Option ID: 21
+ *
+ * @param files
+ * @param number_of_files
+ * @param lcss, use the lcss instead of the euclidean distance
+ * @param threshold, largest distance listed, or negative for a dense matrix
+ * @return EXIT_CODE
+ */
+public int similarityMatrix(char **files, int number_of_files, int lcss, double threshold) {
+    int EXIT_CODE = SUCCESS;
+    SimilarityMatrix matrix = {files, number_of_files, lcss, threshold,
+                               (number_of_files + MATRIX_TILE - 1) / MATRIX_TILE, NULL, NULL, NULL, NULL, NULL};
+    size_t pairs = (size_t) number_of_files * (number_of_files - 1) / 2;
+
+    matrix.headers = calloc((size_t) number_of_files, sizeof(Header));
+    matrix.data = calloc((size_t) number_of_files, sizeof(u_char *));
+    matrix.status = calloc((size_t) number_of_files, sizeof(int));
+    matrix.distances = malloc(max(pairs, 1) * sizeof(double));
+    if (threshold >= 0)
+        matrix.approximations = calloc((size_t) number_of_files, sizeof(PAA));
+    if (matrix.headers == NULL || matrix.data == NULL || matrix.status == NULL || matrix.distances == NULL
+     || (threshold >= 0 && matrix.approximations == NULL)) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+
+    parallelFor(number_of_files, loadMatrixFile, &matrix);
+    parallelFor(matrix.tiles_per_side * (matrix.tiles_per_side + 1) / 2, computeTile, &matrix);
+    for (int i = 0; i < number_of_files; i++)
+        if (matrix.status[i] != SUCCESS)
+            EXIT_CODE = FAILURE;
+
+    // Files that could not be read are left out, incompatible pairs print as -
+    if (threshold < 0) {
+        printf("\"file\"");
+        for (int j = 0; j < number_of_files; j++)
+            if (matrix.status[j] == SUCCESS) {
+                printf(",");
+                printQuoted(files[j], 0);
+            }
+        printf("\n");
+    } else
+        printf("file1,file2,distance\n");
+
+    for (int i = 0; i < number_of_files; i++) {
+        if (matrix.status[i] != SUCCESS)
+            continue;
+        if (threshold < 0)
+            printQuoted(files[i], 0);
+
+        for (int j = threshold < 0 ? 0 : i + 1; j < number_of_files; j++) {
+            if (matrix.status[j] != SUCCESS)
+                continue;
+            double distance = i == j ? 0 : matrix.distances[pairIndex(min(i, j), max(i, j), number_of_files)];
+            if (threshold < 0) {
+                if (isnan(distance))
+                    printf(",-");
+                else
+                    printf(",%.3f", distance);
+            } else if (distance <= threshold) {
+                printQuoted(files[i], 0);
+                printf(",");
+                printQuoted(files[j], 0);
+                printf(",%.3f\n", distance);
+            }
+        }
+        if (threshold < 0)
+            printf("\n");
+    }
+
+    END:
+    for (int i = 0; matrix.data != NULL && i < number_of_files; i++)
+        releaseBuffer(matrix.data[i]);
+    for (int i = 0; matrix.approximations != NULL && i < number_of_files; i++)
+        freePAA(&matrix.approximations[i]);
+    freePointer(matrix.approximations);
+    freePointer(matrix.headers);
+    freePointer(matrix.data);
+    freePointer(matrix.status);
+    freePointer(matrix.distances);
     return EXIT_CODE;
 }
 
@@ -105,14 +347,45 @@ public int calculateDistance(char **files, int number_of_files) {
  * @param size2
  * @return euclidean distance
  */
-private double euclidean(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2) {
-    double euclidean = 0;
+public double euclidean(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2) {
+    return sumRanges(wav_data1, wav_data2, min(size1, size2), 0);
+}
 
-    // Compare parallel both data
-    for (register u_int i = 0; i < min(size1, size2); i++) {
-        int diff = abs(wav_data1[i] - wav_data2[i]);
-        euclidean += (diff * diff);
-    }
+/**
+ * Calculates euclidean distance between the packed 24 bit samples of 2
+ * data buffers, over the first min(size1, size2) / 3 samples.
+ *
+ * @param wav_data1
+ * @param wav_data2
+ * @param size1, in bytes
+ * @param size2, in bytes
+ * @return euclidean distance
+ */
+public double euclidean24(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2) {
+    return sumRanges(wav_data1, wav_data2, min(size1, size2) / 3, 1);
+}
+
+/**
+ * Sums the squared differences of both data in ranges on every thread.
+ *
+ * @param wav_data1
+ * @param wav_data2
+ * @param size, in bytes, or in samples if packed
+ * @param packed, the data are packed 24 bit samples
+ * @return square root of the sum
+ */
+private double sumRanges(u_char *wav_data1, u_char *wav_data2, u_int size, int packed) {
+    double sums[EUCLIDEAN_RANGES] = {0};
+    EuclideanRanges ranges = {wav_data1, wav_data2, size, 0, packed, sums};
+    ranges.range_size = (u_int) max(((unsigned long long) ranges.size + EUCLIDEAN_RANGES - 1) / EUCLIDEAN_RANGES,
+                                    packed ? EUCLIDEAN_RANGE / 3 : EUCLIDEAN_RANGE);
+    int number_of_ranges = (int) (((unsigned long long) ranges.size + ranges.range_size - 1) / ranges.range_size);
+
+    // The ranges depend only on the size, so every run adds the same sums in the same order
+    parallelFor(number_of_ranges, sumSquaredRange, &ranges);
+    double euclidean = 0;
+    for (int i = 0; i < number_of_ranges; i++)
+        euclidean += sums[i];
     return sqrt(euclidean);
 }
 
@@ -125,8 +398,37 @@ private double euclidean(u_char *wav_data1, u_char *wav_data2, u_int size1, u_in
  * @param size2
  * @return lcss distance
  */
-private double LCSS(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2) {
+public double LCSS(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2) {
+    return resumableLCSS(wav_data1, wav_data2, size1, size2, NULL, NULL);
+}
+
+/**
+ * LCSS() that can be interrupted and resumed. Every CHECKPOINT_SECONDS,
+ * or WAVENGINE_CHECKPOINT seconds if set, the DP row and the row it was
+ * reached at are saved to @param checkpoint_filename, and a later call on
+ * the same data continues from there. Once a checkpoint was written the
+ * finished distance is kept in it too, so a rerun does not redo it; the
+ * caller removes the file when it no longer needs it, if @param
+ * checkpointed says it holds this LCSS. A file of other data under the
+ * same name is left alone until this LCSS saves over it. Progress goes to
+ * stderr every PROGRESS_SECONDS, and a SIGTERM or SIGINT caught by
+ * calculateDistance() saves a checkpoint and stops at the end of the row
+ * being filled. One caught during the last row lets the LCSS finish.
+ *
+ * @param wav_data1
+ * @param wav_data2
+ * @param size1
+ * @param size2
+ * @param checkpoint_filename, or NULL to never checkpoint
+ * @param checkpointed, set to 1 if checkpoint_filename was resumed from or
+ * saved to, 0 otherwise, or NULL
+ * @return lcss distance, -1 if out of memory, LCSS_INTERRUPTED if stopped
+ */
+public double resumableLCSS(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int size2,
+                            char *checkpoint_filename, int *checkpointed) {
     double LCSS = -1;
+    LCSSCheckpoint checkpoint;
+    int saved = 0;
 
     // Find out which data will represent the columns to save more space
     u_int rows = max(size1, size2);
@@ -146,8 +448,36 @@ private double LCSS(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int siz
     }
     row2[0] = 0;
 
+    u_int first_row = 1;
+    int interval = CHECKPOINT_SECONDS;
+    time_t next_checkpoint = 0, next_progress = 0;
+    if (checkpoint_filename != NULL) {
+        memset(&checkpoint, 0, sizeof(LCSSCheckpoint));
+        memcpy(checkpoint.magic, CHECKPOINT_MAGIC, sizeof(checkpoint.magic));
+        checkpoint.rows = rows;
+        checkpoint.cols = cols;
+        checkpoint.data_hash = hashOf(wav_data2, rows, hashOf(wav_data1, cols, 14695981039346656037ULL));
+
+        if (loadCheckpoint(checkpoint_filename, &checkpoint, row1) == SUCCESS) {
+            saved = 1;
+            if (checkpoint.finished) {
+                LCSS = checkpoint.distance;
+                goto END;
+            }
+            first_row = checkpoint.next_row;
+            printf("Resuming interrupted LCSS from %s.\n", checkpoint_filename);
+        }
+
+        char *seconds = getenv("WAVENGINE_CHECKPOINT");
+        if (seconds != NULL && atoi(seconds) > 0)
+            interval = atoi(seconds);
+        next_checkpoint = time(NULL) + interval;
+        next_progress = time(NULL) + PROGRESS_SECONDS;
+    }
+    u_int rows_per_check = max(CHECK_CELLS / max(cols, 1), 1);
+
     // Fill in the 2 rows, bottom-up approach with top-down fill
-    for (register u_int i = 1; i < rows + 1; i++) {
+    for (register u_int i = first_row; i < rows + 1; i++) {
         for (register u_int j = 1; j < cols + 1; j++) {
             if (wav_data1[j - 1] == wav_data2[i - 1])
                 row2[j] = 1 + row1[j - 1];
@@ -157,12 +487,318 @@ private double LCSS(u_char *wav_data1, u_char *wav_data2, u_int size1, u_int siz
         u_int *temp = row1;
         row1 = row2;
         row2 = temp;
+
+        // The flag is looked at every row, the clock every rows_per_check rows
+        if (checkpoint_filename == NULL || i == rows || (!stop_requested && (i - first_row) % rows_per_check != 0))
+            continue;
+
+        // Row i is done, a resumed run starts at i + 1
+        time_t now = time(NULL);
+        if (now >= next_progress) {
+            fprintf(stderr, "LCSS %.1f%% done, row %u of %u.\n", 100.0 * i / rows, i, rows);
+            next_progress = now + PROGRESS_SECONDS;
+        }
+        if (stop_requested || now >= next_checkpoint) {
+            checkpoint.next_row = i + 1;
+            if (saveCheckpoint(checkpoint_filename, &checkpoint, row1) != SUCCESS) {
+                printf("Error in writing file: %s\n\n", checkpoint_filename);
+                goto END;
+            }
+            saved = 1;
+            next_checkpoint = now + interval;
+        }
+        if (stop_requested) {
+            printf("Stopped, LCSS saved to %s. Run the same command again to resume.\n\n", checkpoint_filename);
+            LCSS = LCSS_INTERRUPTED;
+            goto END;
+        }
+    }
+    // Convert to distance, the last row is row1 after the final swap
+    LCSS = 1 - ((double) row1[cols] / cols);
+
+    // A stop during the last row still keeps the finished distance for the rerun
+    if (saved || (checkpoint_filename != NULL && stop_requested)) {
+        checkpoint.finished = 1;
+        checkpoint.distance = LCSS;
+        if (saveCheckpoint(checkpoint_filename, &checkpoint, row1) != SUCCESS)
+            printf("Error in writing file: %s\n\n", checkpoint_filename);
+        saved = 1;
     }
-    // Convert to distance
-    LCSS = 1 - ((double) row2[cols] / cols);
 
     END:
+    if (checkpointed != NULL)
+        *checkpointed = saved;
     freePointer(row1);
     freePointer(row2);
     return LCSS;
-}
\ No newline at end of file
+}
+
+/**
+ * Sums the squared differences of one range of a euclidean().
+ *
+ * @param context, the EuclideanRanges
+ * @param range_id
+ */
+private void sumSquaredRange(void *context, int range_id) {
+    EuclideanRanges *ranges = context;
+    u_int start = (u_int) range_id * ranges->range_size;
+    u_int end = (u_int) min((unsigned long long) start + ranges->range_size, ranges->size);
+    ranges->sums[range_id] = ranges->packed ? sumSquared24(ranges->wav_data1, ranges->wav_data2, start, end)
+                                            : (double) sumSquared(ranges->wav_data1, ranges->wav_data2, start, end);
+}
+
+/**
+ * The distance of every sample size but 24 bits is over the bytes of the
+ * data, as -similarity always reported it. With SSE2, 16 bytes per step are widened
+ * to 16 bits and their differences squared and summed in pairs by
+ * _mm_madd_epi16(), the rest byte by byte.
+ *
+ * @param wav_data1
+ * @param wav_data2
+ * @param start
+ * @param end
+ * @return sum of the squared differences of bytes [start, end) of both data
+ */
+private unsigned long long sumSquared(const u_char *wav_data1, const u_char *wav_data2, u_int start, u_int end) {
+    unsigned long long sum = 0;
+    register u_int i = start;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= end) {
+        // A lane gains at most 4 * 255^2 a step, so EUCLIDEAN_FLUSH steps fit 32 bits
+        u_int last = i + 16 * min((end - i) / 16, EUCLIDEAN_FLUSH);
+        __m128i sums = zero;
+        for (; i < last; i += 16) {
+            __m128i bytes1 = _mm_loadu_si128((const __m128i *) (wav_data1 + i));
+            __m128i bytes2 = _mm_loadu_si128((const __m128i *) (wav_data2 + i));
+            __m128i low = _mm_sub_epi16(_mm_unpacklo_epi8(bytes1, zero), _mm_unpacklo_epi8(bytes2, zero));
+            __m128i high = _mm_sub_epi16(_mm_unpackhi_epi8(bytes1, zero), _mm_unpackhi_epi8(bytes2, zero));
+            sums = _mm_add_epi32(sums, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+        }
+        u_int lanes[4];
+        _mm_storeu_si128((__m128i *) lanes, sums);
+        sum += (unsigned long long) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+    // Compare parallel both data
+    for (; i < end; i++) {
+        int diff = abs(wav_data1[i] - wav_data2[i]);
+        sum += (u_int) (diff * diff);
+    }
+    return sum;
+}
+
+/**
+ * Unpacks both data a PACKED_TILE of samples at a time with load24() and
+ * sums the squared differences of the samples.
+ *
+ * @param wav_data1
+ * @param wav_data2
+ * @param start
+ * @param end
+ * @return sum of the squared differences of samples [start, end) of both data
+ */
+private double sumSquared24(const u_char *wav_data1, const u_char *wav_data2, u_int start, u_int end) {
+    int samples1[PACKED_TILE], samples2[PACKED_TILE];
+    double sum = 0;
+
+    for (u_int first = start; first < end; first += PACKED_TILE) {
+        size_t count = min((size_t) PACKED_TILE, (size_t) (end - first));
+        load24(wav_data1 + 3 * (size_t) first, samples1, count);
+        load24(wav_data2 + 3 * (size_t) first, samples2, count);
+        // A tile sums less than PACKED_TILE * 2^48, exact in 64 bits
+        unsigned long long tile = 0;
+        for (size_t i = 0; i < count; i++) {
+            long long diff = (long long) samples1[i] - samples2[i];
+            tile += (unsigned long long) (diff * diff);
+        }
+        sum += (double) tile;
+    }
+    return sum;
+}
+
+/**
+ * Reads the header and data of one file of a SimilarityMatrix.
+ *
+ * @param context, the SimilarityMatrix
+ * @param file_id
+ */
+private void loadMatrixFile(void *context, int file_id) {
+    SimilarityMatrix *matrix = context;
+    Arena *arena = acquireArena();
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+
+    matrix->status[file_id] = FAILURE;
+    if (arena == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return;
+    }
+
+    if (getHeader(arena, &wav_header, &wav_file, matrix->files[file_id]) == SUCCESS
+     && getData(wav_header, wav_file, &matrix->data[file_id]) == SUCCESS) {
+        matrix->headers[file_id] = *wav_header;
+        matrix->status[file_id] = SUCCESS;
+        // The bounds are over bytes, pairs of 24 bit files are compared sample by sample
+        if (matrix->approximations != NULL && (matrix->lcss || wav_header->bitsPerSample != 24)
+         && buildPAA(matrix->data[file_id], wav_header->subchunk2Size, &matrix->approximations[file_id]) != SUCCESS) {
+            printf("Sorry, program run out of memory.\n\n");
+            matrix->status[file_id] = FAILURE;
+        }
+    }
+
+    releaseArena(arena);
+    closeFile(wav_file);
+}
+
+/**
+ * Computes the distances of the pairs i < j of one tile of a
+ * SimilarityMatrix. Tiles are numbered row after row over the upper
+ * triangle of tiles, the diagonal included.
+ *
+ * @param context, the SimilarityMatrix
+ * @param tile_id
+ */
+private void computeTile(void *context, int tile_id) {
+    SimilarityMatrix *matrix = context;
+    int row = 0;
+    while (tile_id >= matrix->tiles_per_side - row) {
+        tile_id -= matrix->tiles_per_side - row;
+        row++;
+    }
+    int column = row + tile_id;
+
+    int last_i = min((row + 1) * MATRIX_TILE, matrix->number_of_files);
+    int last_j = min((column + 1) * MATRIX_TILE, matrix->number_of_files);
+    for (int i = row * MATRIX_TILE; i < last_i; i++)
+        for (int j = max(column * MATRIX_TILE, i + 1); j < last_j; j++) {
+            Header *header1 = &matrix->headers[i], *header2 = &matrix->headers[j];
+            double *distance = &matrix->distances[pairIndex(i, j, matrix->number_of_files)];
+
+            if (matrix->status[i] != SUCCESS || matrix->status[j] != SUCCESS
+             || header1->bitsPerSample != header2->bitsPerSample || header1->numChannels != header2->numChannels)
+                *distance = NAN;
+            else if (matrix->approximations != NULL && (matrix->lcss || header1->bitsPerSample != 24))
+                *distance = cascadeDistance(&matrix->approximations[i], &matrix->approximations[j],
+                                            matrix->data[i], matrix->data[j], matrix->lcss, matrix->threshold);
+            else if (matrix->lcss)
+                *distance = LCSS(matrix->data[i], matrix->data[j], header1->subchunk2Size, header2->subchunk2Size);
+            else if (header1->bitsPerSample == 24)
+                *distance = sqrt(sumSquared24(matrix->data[i], matrix->data[j], 0,
+                                              min(header1->subchunk2Size, header2->subchunk2Size) / 3));
+            else
+                *distance = sqrt((double) sumSquared(matrix->data[i], matrix->data[j], 0,
+                                                     min(header1->subchunk2Size, header2->subchunk2Size)));
+        }
+}
+
+/**
+ * @param i
+ * @param j, greater than i
+ * @param number_of_files
+ * @return index of the pair i < j among the pairs of a SimilarityMatrix
+ */
+private size_t pairIndex(int i, int j, int number_of_files) {
+    return (size_t) i * (2 * (size_t) number_of_files - i - 1) / 2 + (size_t) (j - i - 1);
+}
+
+/**
+ * Reads the checkpoint of an LCSS if it belongs to the same data.
+ *
+ * @param checkpoint_filename
+ * @param checkpoint, with the rows, cols and data hash to match, receives
+ * the saved checkpoint
+ * @param row, receives the saved DP row of cols + 1 entries
+ * @return EXIT_CODE, FAILURE if there is no usable checkpoint
+ */
+private int loadCheckpoint(char *checkpoint_filename, LCSSCheckpoint *checkpoint, u_int *row) {
+    LCSSCheckpoint saved;
+    size_t row_size = ((size_t) checkpoint->cols + 1) * sizeof(u_int);
+    u_int *saved_row = NULL;
+    int fd = open(checkpoint_filename, O_RDONLY);
+    if (fd < 0)
+        return FAILURE;
+
+    int EXIT_CODE = preadFully(fd, &saved, sizeof(LCSSCheckpoint), 0);
+    if (EXIT_CODE == SUCCESS && (memcmp(saved.magic, CHECKPOINT_MAGIC, sizeof(saved.magic)) != 0
+     || saved.rows != checkpoint->rows || saved.cols != checkpoint->cols || saved.data_hash != checkpoint->data_hash
+     || (!saved.finished && (saved.next_row < 1 || saved.next_row > saved.rows))))
+        EXIT_CODE = FAILURE;
+
+    // The row is only taken once its hash matched, a damaged one is never used
+    if (EXIT_CODE == SUCCESS && (saved_row = malloc(row_size)) == NULL)
+        EXIT_CODE = FAILURE;
+    if (EXIT_CODE == SUCCESS)
+        EXIT_CODE = preadFully(fd, saved_row, row_size, sizeof(LCSSCheckpoint));
+    if (EXIT_CODE == SUCCESS && hashOf(saved_row, row_size, 14695981039346656037ULL) != saved.row_hash)
+        EXIT_CODE = FAILURE;
+    close(fd);
+
+    if (EXIT_CODE == SUCCESS) {
+        memcpy(row, saved_row, row_size);
+        *checkpoint = saved;
+    }
+    freePointer(saved_row);
+    return EXIT_CODE;
+}
+
+/**
+ * Writes the checkpoint of an LCSS durably under a temporary name and
+ * renames it over the last one, so a crash leaves one of them whole.
+ *
+ * @param checkpoint_filename
+ * @param checkpoint
+ * @param row, the DP row of next_row - 1
+ * @return EXIT_CODE
+ */
+private int saveCheckpoint(char *checkpoint_filename, LCSSCheckpoint *checkpoint, u_int *row) {
+    size_t row_size = ((size_t) checkpoint->cols + 1) * sizeof(u_int);
+    char *temporary_filename = malloc(8 + strlen(checkpoint_filename));
+    if (temporary_filename == NULL)
+        return FAILURE;
+    snprintf(temporary_filename, 8 + strlen(checkpoint_filename), "%s.XXXXXX", checkpoint_filename);
+
+    checkpoint->row_hash = hashOf(row, row_size, 14695981039346656037ULL);
+    int fd = mkstemp(temporary_filename);
+    int EXIT_CODE = fd < 0 ? FAILURE : SUCCESS;
+    if (EXIT_CODE == SUCCESS && (pwriteFully(fd, checkpoint, sizeof(LCSSCheckpoint), 0) != SUCCESS
+     || pwriteFully(fd, row, row_size, sizeof(LCSSCheckpoint)) != SUCCESS || fdatasync(fd) != 0
+     || fchmod(fd, 0644) != 0 || rename(temporary_filename, checkpoint_filename) != 0)) {
+        EXIT_CODE = FAILURE;
+        unlink(temporary_filename);
+    }
+
+    if (fd >= 0)
+        close(fd);
+    freePointer(temporary_filename);
+    return EXIT_CODE;
+}
+
+/**
+ * @param data
+ * @param size
+ * @param hash, to continue from
+ * @return FNV-1a hash of @param data continuing @param hash
+ */
+private unsigned long long hashOf(const void *data, size_t size, unsigned long long hash) {
+    const u_char *bytes = data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash;
+}
+
+/**
+ * Handles SIGTERM and SIGINT during calculateDistance(): the running LCSS
+ * saves a checkpoint and stops. A handler installed before, such as the
+ * one of the daemon, still runs.
+ *
+ * @param signal_number
+ */
+private void requestStop(int signal_number) {
+    stop_requested = signal_number;
+
+    struct sigaction *previous = &previous_actions[signal_number == SIGINT];
+    if (!(previous->sa_flags & SA_SIGINFO) && previous->sa_handler != SIG_DFL && previous->sa_handler != SIG_IGN)
+        previous->sa_handler(signal_number);
+}
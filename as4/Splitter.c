@@ -0,0 +1,365 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    Splitter.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <errno.h>
+#include <fcntl.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+/**
+ * Segments of a .wav file, segment i holds the frames in
+ * [starts[i], ends[i]).
+ */
+typedef struct Segments {
+    char *prefix;
+    char *wav_filename;
+    Header *wav_header;
+    int fd;
+    u_int *starts;
+    u_int *ends;
+    int number_of_segments;
+    int digits;             // Of the segment numbers in the file names.
+    int *status;
+} Segments;
+
+private void writeSegment(void *context, int segment_id);
+
+private int readCues(char *cue_filename, Header *wav_header, u_int frames, u_int **bounds, int *number_of_segments);
+
+
+/**
+ * Splits a .wav file into @param number_of_segments parts of equal length.
+ * Option ID: 16, with -count
+ *
+ * @param wav_filename
+ * @param number_of_segments
+ * @return EXIT_CODE
+ */
+public int splitByCount(char *wav_filename, int number_of_segments) {
+    int EXIT_CODE;
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+    u_int *bounds = NULL;
+
+    EXIT_CODE = getHeader(NULL, &wav_header, &wav_file, wav_filename);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    u_int frames = wav_header->subchunk2Size / max(wav_header->blockAlign, 1);
+    if (number_of_segments <= 0 || (u_int) number_of_segments > frames) {
+        EXIT_CODE = FAILURE;
+        printf("Parameters for segments are invalid.\n\n");
+        goto END;
+    }
+
+    bounds = malloc((number_of_segments + 1) * sizeof(u_int));
+    if (bounds == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+    for (int i = 0; i <= number_of_segments; i++)
+        bounds[i] = (u_int) ((unsigned long long) frames * i / number_of_segments);
+
+    EXIT_CODE = writeSegments("split", wav_filename, wav_header, fileno(wav_file), bounds, bounds + 1,
+                              number_of_segments);
+
+    END:
+    freePointer(wav_header);
+    freePointer(bounds);
+    closeFile(wav_file);
+    return EXIT_CODE;
+}
+
+/**
+ * Splits a .wav file into parts of @param seconds each, the last one
+ * holding what is left.
+ * Option ID: 16, with -seconds
+ *
+ * @param wav_filename
+ * @param seconds
+ * @return EXIT_CODE
+ */
+public int splitBySeconds(char *wav_filename, double seconds) {
+    int EXIT_CODE;
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+    u_int *bounds = NULL;
+
+    EXIT_CODE = getHeader(NULL, &wav_header, &wav_file, wav_filename);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    u_int frames = wav_header->subchunk2Size / max(wav_header->blockAlign, 1);
+    double segment_frames = round(seconds * wav_header->sampleRate);
+    if (segment_frames < 1 || frames == 0 || frames / segment_frames >= 1 << 30) {
+        EXIT_CODE = FAILURE;
+        printf("Parameters for seconds are invalid.\n\n");
+        goto END;
+    }
+
+    int number_of_segments = (int) ceil(frames / min(segment_frames, (double) frames));
+    bounds = malloc((number_of_segments + 1) * sizeof(u_int));
+    if (bounds == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+    for (int i = 0; i <= number_of_segments; i++)
+        bounds[i] = (u_int) min(i * segment_frames, (double) frames);
+
+    EXIT_CODE = writeSegments("split", wav_filename, wav_header, fileno(wav_file), bounds, bounds + 1,
+                              number_of_segments);
+
+    END:
+    freePointer(wav_header);
+    freePointer(bounds);
+    closeFile(wav_file);
+    return EXIT_CODE;
+}
+
+/**
+ * Splits a .wav file at the start times listed in a cue file, each segment
+ * running up to the next cue or the end of the file. The cue file holds
+ * start times in seconds, ascending, separated by white space; lines
+ * starting with # are comments.
+ * Option ID: 16, with -cue
+ *
+ * @param wav_filename
+ * @param cue_filename
+ * @return EXIT_CODE
+ */
+public int splitByCues(char *wav_filename, char *cue_filename) {
+    int EXIT_CODE;
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+    u_int *bounds = NULL;
+    int number_of_segments = 0;
+
+    EXIT_CODE = getHeader(NULL, &wav_header, &wav_file, wav_filename);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    u_int frames = wav_header->subchunk2Size / max(wav_header->blockAlign, 1);
+    EXIT_CODE = readCues(cue_filename, wav_header, frames, &bounds, &number_of_segments);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    EXIT_CODE = writeSegments("split", wav_filename, wav_header, fileno(wav_file), bounds, bounds + 1,
+                              number_of_segments);
+
+    END:
+    freePointer(wav_header);
+    freePointer(bounds);
+    closeFile(wav_file);
+    return EXIT_CODE;
+}
+
+/**
+ * Writes every segment of a .wav file to prefix-i-wav_filename, numbered
+ * from 1, on every thread. Segments that do not overlap read the source
+ * once in all.
+ *
+ * @param prefix
+ * @param wav_filename
+ * @param wav_header
+ * @param fd, of the .wav file
+ * @param starts, first frame of every segment
+ * @param ends, frame after the last of every segment
+ * @param number_of_segments
+ * @return EXIT_CODE
+ */
+public int writeSegments(char *prefix, char *wav_filename, Header *wav_header, int fd,
+                         u_int *starts, u_int *ends, int number_of_segments) {
+    int EXIT_CODE = SUCCESS;
+    Segments segments = {prefix, wav_filename, wav_header, fd, starts, ends, number_of_segments, 1, NULL};
+    for (int n = number_of_segments; n >= 10; n /= 10)
+        segments.digits++;
+
+    segments.status = calloc((size_t) number_of_segments, sizeof(int));
+    if (segments.status == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return FAILURE;
+    }
+
+    parallelFor(number_of_segments, writeSegment, &segments);
+    for (int i = 0; i < number_of_segments; i++)
+        if (segments.status[i] != SUCCESS)
+            EXIT_CODE = FAILURE;
+
+    free(segments.status);
+    return EXIT_CODE;
+}
+
+/**
+ * Writes one segment with a header built from the header of the source.
+ *
+ * @param context, the Segments
+ * @param segment_id
+ */
+private void writeSegment(void *context, int segment_id) {
+    Segments *segments = context;
+    Arena *arena = acquireArena();
+    int fd = -1;
+
+    size_t size = strlen(segments->prefix) + strlen(segments->wav_filename) + segments->digits + 3;
+    char *name = arena != NULL ? arenaAlloc(arena, size) : NULL;
+    if (name == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        segments->status[segment_id] = FAILURE;
+        goto END;
+    }
+    snprintf(name, size, "%s-%0*d-%s", segments->prefix, segments->digits, segment_id + 1, segments->wav_filename);
+
+    fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error in opening file: %s\n\n", name);
+        segments->status[segment_id] = FAILURE;
+        goto END;
+    }
+
+    Header header = *segments->wav_header;
+    u_int first = segments->starts[segment_id], last = segments->ends[segment_id];
+    header.subchunk2Size = (last - first) * header.blockAlign;
+    header.chunkSize = header.subchunk2Size + 36;
+
+    off_t start = HEADER_SIZE + (off_t) first * header.blockAlign;
+    if (pwriteFully(fd, &header, HEADER_SIZE, 0) != SUCCESS
+     || copyRange(segments->fd, start, fd, HEADER_SIZE, (off_t) header.subchunk2Size) != SUCCESS) {
+        printf("Error in writing file: %s\n\n", name);
+        segments->status[segment_id] = FAILURE;
+    }
+
+    END:
+    if (fd >= 0)
+        close(fd);
+    releaseArena(arena);
+}
+
+/**
+ * Copies @param size bytes between files, in the kernel with
+ * copy_file_range() where the file systems allow it, through a pooled
+ * buffer otherwise.
+ *
+ * @param in_fd
+ * @param in_offset
+ * @param out_fd
+ * @param out_offset
+ * @param size
+ * @return EXIT_CODE, FAILURE also if the source ends early
+ */
+public int copyRange(int in_fd, off_t in_offset, int out_fd, off_t out_offset, off_t size) {
+    while (size > 0) {
+        ssize_t bytes = copy_file_range(in_fd, &in_offset, out_fd, &out_offset, (size_t) size, 0);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP))
+            break;
+        if (bytes <= 0)
+            return FAILURE;
+        size -= bytes;
+    }
+    if (size == 0)
+        return SUCCESS;
+
+    u_char *buffer = getBuffer(PIPELINE_BLOCK);
+    if (buffer == NULL)
+        return FAILURE;
+    while (size > 0) {
+        size_t bytes = (size_t) min(size, (off_t) PIPELINE_BLOCK);
+        if (preadFully(in_fd, buffer, bytes, in_offset) != SUCCESS
+         || pwriteFully(out_fd, buffer, bytes, out_offset) != SUCCESS) {
+            releaseBuffer(buffer);
+            return FAILURE;
+        }
+        in_offset += (off_t) bytes;
+        out_offset += (off_t) bytes;
+        size -= (off_t) bytes;
+    }
+    releaseBuffer(buffer);
+    return SUCCESS;
+}
+
+/**
+ * Reads the start times of a cue file into segment bounds. Lines are read
+ * whole, however long, so a cue is never cut in two.
+ *
+ * @param cue_filename
+ * @param wav_header
+ * @param frames, of the file to split
+ * @param bounds, receives number_of_segments + 1 frames, malloc'd
+ * @param number_of_segments
+ * @return EXIT_CODE
+ */
+private int readCues(char *cue_filename, Header *wav_header, u_int frames, u_int **bounds, int *number_of_segments) {
+    FILE *cue_file = fopen(cue_filename, "r");
+    if (cue_file == NULL) {
+        printf("Error in opening file: %s\n\n", cue_filename);
+        return FAILURE;
+    }
+
+    int EXIT_CODE = SUCCESS;
+    int capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    *number_of_segments = 0;
+    while (getline(&line, &line_size, cue_file) != -1) {
+        char *next = line, *end;
+        if (line[0] == '#')
+            continue;
+
+        for (double seconds = strtod(next, &end); end != next; seconds = strtod(next, &end)) {
+            next = end;
+            double frame = round(seconds * wav_header->sampleRate);
+            u_int previous = *number_of_segments > 0 ? (*bounds)[*number_of_segments - 1] : 0;
+            if (seconds < 0 || frame >= frames || (*number_of_segments > 0 && frame <= previous)) {
+                printf("Parameters for seconds are invalid.\n\n");
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+
+            // Room for this cue and the end of the file after it
+            if (*number_of_segments + 2 > capacity) {
+                capacity = max(2 * capacity, 64);
+                u_int *grown = realloc(*bounds, capacity * sizeof(u_int));
+                if (grown == NULL) {
+                    printf("Sorry, program run out of memory.\n\n");
+                    EXIT_CODE = FAILURE;
+                    goto END;
+                }
+                *bounds = grown;
+            }
+            (*bounds)[(*number_of_segments)++] = (u_int) frame;
+        }
+    }
+
+    if (*number_of_segments == 0) {
+        printf("Parameters for seconds are invalid.\n\n");
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    (*bounds)[*number_of_segments] = frames;
+
+    END:
+    free(line);
+    fclose(cue_file);
+    return EXIT_CODE;
+}
@@ -24,10 +24,15 @@
 
 private int convertToMono(char *wav_filename);
 
+private int convertToMonoInPlace(char *wav_filename);
+
+private void selectFirstChannel(ChannelRoute *route, Header *wav_header);
+
 
 /**
- * Convert .wav files from Stereo to Mono by deleting right channel and changing
- * header information regarding numChannels.
+ * Convert .wav files from Stereo, or any number of channels, to Mono by
+ * keeping the first (left) channel and changing header information regarding
+ * numChannels.
  * Option ID: 2
  *
  * @param files
@@ -43,67 +48,180 @@ public int convertToMonos(char **files, int number_of_files) {
 }
 
 /**
- * Convert a .wav file from Stereo to Mono by deleting right channel.
+ * Convert .wav files from Stereo to Mono in place.
+ * Option ID: 2, with -inplace
+ *
+ * @param files
+ * @param number_of_files, number of files
+ * @return EXIT CODE
+ */
+public int convertToMonosInPlace(char **files, int number_of_files) {
+    int EXIT_CODE = SUCCESS;
+    for (int i = 0; i < number_of_files; i++)
+        if (convertToMonoInPlace(files[i]) != SUCCESS)
+            EXIT_CODE = FAILURE;
+
+    return EXIT_CODE;
+}
+
+/**
+ * Convert a .wav file from Stereo to Mono by deleting all but the left channel.
  *
  * @param wav_filename
  * @return EXIT CODE
  */
 private int convertToMono(char *wav_filename) {
     int EXIT_CODE;
+    Arena *arena = acquireArena();
     Header *wav_header = NULL;
-    FILE *wav_file = NULL, *new_wav_file = NULL;
+    FILE *wav_file = NULL;
+    Output output = {NULL, -1, 0, -1};
     char *new_wav_filename = NULL;
+    ChannelRoute route;
+    int stream = isStream(wav_filename);
 
-    EXIT_CODE = getHeader(&wav_header, &wav_file, wav_filename);
+    if (arena == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return FAILURE;
+    }
+
+    EXIT_CODE = getHeader(arena, &wav_header, &wav_file, wav_filename);
     if (EXIT_CODE != SUCCESS)
         goto END;
+    int unknown_size = stream && wav_header->subchunk2Size == STREAM_SIZE;
+    size_t frame_size = (size_t) wav_header->blockAlign;
 
+    selectFirstChannel(&route, wav_header);
     EXIT_CODE = makeHeaderMono(wav_header);
     if (EXIT_CODE != SUCCESS) {
         printf("File already mono: %s\n\n", wav_filename);
         goto END;
     }
 
-    // Create new file name
-    new_wav_filename = malloc(5 + strlen(wav_filename));
-    if (new_wav_filename == NULL) {
+    // Create new file name, a stream goes to stdout instead
+    if (!stream) {
+        new_wav_filename = arenaAlloc(arena, 5 + strlen(wav_filename));
+        if (new_wav_filename == NULL) {
+            EXIT_CODE = FAILURE;
+            printf("Sorry, program run out of memory.\n\n");
+            goto END;
+        }
+        snprintf(new_wav_filename, 5 + strlen(wav_filename), "new-%s", wav_filename);
+    }
+
+    {
+        // Open the output and write the modified header to it
+        EXIT_CODE = openOutput(&output, stream, new_wav_filename, wav_header);
+        if (EXIT_CODE != SUCCESS)
+            goto END;
+
+        // Stream the frames, keeping the first channel of each
+        FileRange range = {fileno(wav_file), HEADER_SIZE,
+                           unknown_size ? -1 : HEADER_SIZE + (off_t) (wav_header->subchunk2Size / wav_header->blockAlign) * frame_size,
+                           0, stream, HEADER_SIZE};
+        size_t block = getBlockSize((u_int) frame_size);
+        Pipeline pipeline = {readFileRange, &range, routeFrames, &route, block,
+                             block / frame_size * wav_header->blockAlign, output.fd, output.data_offset};
+
+        if (runParallelPipeline(&pipeline, unknown_size ? -1 : range.end - range.start) != SUCCESS
+         || finishOutput(&output, wav_header, pipeline.written) != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            printf("Header information mismatch, exiting program.\n\n");
+            goto END;
+        }
+    }
+
+    END:
+    releaseArena(arena);
+    closeFile(wav_file);
+    closeOutput(&output);
+    return EXIT_CODE;
+}
+
+/**
+ * Convert a .wav file from Stereo to Mono in place, compacting the first
+ * channel of every block towards the start of the data, then writing the
+ * mono header and truncating the file. Every block is one step of a
+ * journal, so an interrupted run continues where it stopped when run again.
+ *
+ * @param wav_filename
+ * @return EXIT CODE
+ */
+private int convertToMonoInPlace(char *wav_filename) {
+    int EXIT_CODE;
+    Journal journal;
+    u_char *block = NULL;
+    ChannelRoute route;
+
+    EXIT_CODE = openJournal(&journal, wav_filename, JOURNAL_MONO);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    Header mono_header = journal.header;
+    selectFirstChannel(&route, &journal.header);
+    EXIT_CODE = makeHeaderMono(&mono_header);
+    if (EXIT_CODE != SUCCESS) {
+        printf("File already mono: %s\n\n", wav_filename);
+        goto END;
+    }
+
+    size_t channel_size = (size_t) mono_header.blockAlign;
+    size_t frame_size = max((size_t) journal.header.blockAlign, 1);
+    size_t block_size = getBlockSize((u_int) frame_size);
+    off_t frames = journal.header.subchunk2Size / frame_size;
+    off_t frames_per_block = block_size / frame_size;
+    long long blocks = (frames + frames_per_block - 1) / frames_per_block;
+
+    block = getBuffer(block_size);
+    if (block == NULL) {
         EXIT_CODE = FAILURE;
         printf("Sorry, program run out of memory.\n\n");
         goto END;
     }
-    snprintf(new_wav_filename, 5 + strlen(wav_filename), "new-%s", wav_filename);
 
-    {
-        // Open new file and write the modified header to it
-        new_wav_file = fopen(new_wav_filename, "wb");
-        fwrite(wav_header, HEADER_SIZE, 1, new_wav_file);
-
-        // Buffer for half samples
-        size_t channel_size = (size_t) wav_header->blockAlign;
-        u_char sample[channel_size];
-
-        for (register u_int i = 0; i < wav_header->subchunk2Size / channel_size; i++) {
-            // Read and write left channel to new file
-            if (fread(sample, channel_size, 1, wav_file) != 1) {
-                EXIT_CODE = FAILURE;
-                printf("Header information mismatch, exiting program.\n\n");
-                goto END;
-            }
-            fwrite(sample, channel_size, 1, new_wav_file);
-
-            // Skip right channel
-            if (fread(sample, channel_size, 1, wav_file) != 1) {
-                EXIT_CODE = FAILURE;
-                printf("Header information mismatch, exiting program.\n\n");
-                goto END;
-            }
+    // Block k only moves to bytes that blocks up to k have already been read from
+    while (journal.step < blocks) {
+        off_t first = journal.step * frames_per_block;
+        size_t size = (size_t) (min(frames - first, frames_per_block) * frame_size);
+        EXIT_CODE = beginRecord(&journal, frames_per_block * channel_size, 1);
+        if (EXIT_CODE != SUCCESS)
+            goto END;
+
+        if (preadFully(journal.wav_fd, block, size, HEADER_SIZE + first * (off_t) frame_size) != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            printf("Header information mismatch, exiting program.\n\n");
+            goto END;
         }
+        routeFrames(&route, block, size,
+                    reserveExtent(&journal, HEADER_SIZE + first * (off_t) channel_size, size / frame_size * channel_size));
+
+        EXIT_CODE = commitStep(&journal, 0);
+        if (EXIT_CODE != SUCCESS)
+            goto END;
+    }
+
+    // The last step writes the mono header and cuts off what is left of the other channels
+    if (journal.step == blocks) {
+        EXIT_CODE = beginRecord(&journal, HEADER_SIZE, 1);
+        if (EXIT_CODE != SUCCESS)
+            goto END;
+        memcpy(reserveExtent(&journal, 0, HEADER_SIZE), &mono_header, HEADER_SIZE);
+        EXIT_CODE = commitStep(&journal, HEADER_SIZE + frames * (off_t) channel_size);
     }
 
     END:
-    freePointer(wav_header);
-    freePointer(new_wav_filename);
-    closeFile(wav_file);
-    closeFile(new_wav_file);
+    closeJournal(&journal, EXIT_CODE == SUCCESS);
+    releaseBuffer(block);
     return EXIT_CODE;
 }
+
+/**
+ * Makes the route keeping the first channel of the frames of a Header.
+ *
+ * @param route
+ * @param wav_header
+ */
+private void selectFirstChannel(ChannelRoute *route, Header *wav_header) {
+    u_int channels = max(wav_header->numChannels, 1), first = 0;
+    selectChannels(route, channels, wav_header->blockAlign / channels, &first, 1);
+}
@@ -0,0 +1,218 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    ThreadPool.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+/**
+ * Shared state of one parallelFor() call.
+ */
+typedef struct ParallelLoop {
+    void (*task)(void *context, int task_id);
+    void *context;
+    int number_of_tasks;
+    int next_task;
+    int helpers;            // Pool threads working on the loop.
+    int max_helpers;
+    pthread_mutex_t lock;
+    struct ParallelLoop *next;
+} ParallelLoop;
+
+/**
+ * Threads kept waiting for loops between parallelFor() calls, so a loop
+ * does not pay for creating its threads. Guarded by lock.
+ */
+private struct {
+    ParallelLoop *loops;    // Loops that may still want helpers.
+    int threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work;    // A loop was posted.
+    pthread_cond_t done;    // A helper left a loop.
+} pool = {NULL, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+private void *poolThread(void *argument);
+
+private void runTasks(ParallelLoop *loop);
+
+private ParallelLoop *findLoop();
+
+private void removeLoop(ParallelLoop *loop);
+
+
+/**
+ * @return number of worker threads, WAVENGINE_THREADS if set, otherwise
+ * the number of online processors.
+ */
+public int getThreadCount() {
+    char *threads = getenv("WAVENGINE_THREADS");
+    if (threads != NULL && atoi(threads) > 0)
+        return atoi(threads);
+
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return processors > 0 ? (int) processors : 1;
+}
+
+/**
+ * Runs task(context, i) for every i in [0..number_of_tasks - 1] on up to
+ * getThreadCount() threads, the calling thread included. Tasks are handed
+ * out one at a time so uneven tasks still balance.
+ *
+ * @param number_of_tasks
+ * @param task
+ * @param context, passed unchanged to every task
+ * @return EXIT_CODE, SUCCESS once every task has run
+ */
+public int parallelFor(int number_of_tasks, void (*task)(void *context, int task_id), void *context) {
+    return parallelForThreads(getThreadCount(), number_of_tasks, task, context);
+}
+
+/**
+ * parallelFor() on up to @param number_of_threads threads, for tasks that
+ * mostly wait, such as blocking I/O, and want more threads than processors.
+ * The helper threads come from a pool that grows to the largest number
+ * asked for and is reused by later calls, nested ones included.
+ *
+ * @param number_of_threads
+ * @param number_of_tasks
+ * @param task
+ * @param context
+ * @return EXIT_CODE, SUCCESS once every task has run
+ */
+public int parallelForThreads(int number_of_threads, int number_of_tasks,
+                              void (*task)(void *context, int task_id), void *context) {
+    ParallelLoop loop = {task, context, number_of_tasks, 0, 0, min(number_of_threads, number_of_tasks) - 1,
+                         PTHREAD_MUTEX_INITIALIZER, NULL};
+
+    if (loop.max_helpers > 0) {
+        pthread_mutex_lock(&pool.lock);
+
+        // Threads that fail to start simply leave more tasks for the rest
+        pthread_t thread;
+        while (pool.threads < loop.max_helpers && pthread_create(&thread, NULL, poolThread, NULL) == 0) {
+            pthread_detach(thread);
+            pool.threads++;
+        }
+        loop.next = pool.loops;
+        pool.loops = &loop;
+        pthread_cond_broadcast(&pool.work);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    runTasks(&loop);
+
+    // Every task is handed out, wait for the helpers still running one
+    if (loop.max_helpers > 0) {
+        pthread_mutex_lock(&pool.lock);
+        removeLoop(&loop);
+        while (loop.helpers > 0)
+            pthread_cond_wait(&pool.done, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    pthread_mutex_destroy(&loop.lock);
+    return SUCCESS;
+}
+
+/**
+ * A thread of the pool, helps with posted loops for as long as the
+ * program runs.
+ *
+ * @param argument, unused
+ * @return NULL
+ */
+private void *poolThread(void *argument) {
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        ParallelLoop *loop = findLoop();
+        if (loop == NULL) {
+            pthread_cond_wait(&pool.work, &pool.lock);
+            continue;
+        }
+
+        loop->helpers++;
+        pthread_mutex_unlock(&pool.lock);
+        runTasks(loop);
+        pthread_mutex_lock(&pool.lock);
+
+        removeLoop(loop);
+        if (--loop->helpers == 0)
+            pthread_cond_broadcast(&pool.done);
+    }
+    return argument;
+}
+
+/**
+ * Runs tasks of a ParallelLoop until none are left.
+ *
+ * @param loop
+ */
+private void runTasks(ParallelLoop *loop) {
+    for (;;) {
+        pthread_mutex_lock(&loop->lock);
+        int task_id = loop->next_task++;
+        pthread_mutex_unlock(&loop->lock);
+
+        if (task_id >= loop->number_of_tasks)
+            break;
+        loop->task(loop->context, task_id);
+    }
+}
+
+/**
+ * Called with pool.lock held.
+ *
+ * @return a posted loop with tasks left and room for another helper, or
+ * NULL. Loops without tasks left are dropped on the way.
+ */
+private ParallelLoop *findLoop() {
+    ParallelLoop **link = &pool.loops;
+    while (*link != NULL) {
+        ParallelLoop *loop = *link;
+        pthread_mutex_lock(&loop->lock);
+        int tasks_left = loop->next_task < loop->number_of_tasks;
+        pthread_mutex_unlock(&loop->lock);
+
+        if (!tasks_left) {
+            *link = loop->next;
+            continue;
+        }
+        if (loop->helpers < loop->max_helpers)
+            return loop;
+        link = &loop->next;
+    }
+    return NULL;
+}
+
+/**
+ * Takes a loop off the posted loops if it is still there. Called with
+ * pool.lock held.
+ *
+ * @param loop
+ */
+private void removeLoop(ParallelLoop *loop) {
+    for (ParallelLoop **link = &pool.loops; *link != NULL; link = &(*link)->next)
+        if (*link == loop) {
+            *link = loop->next;
+            return;
+        }
+}
@@ -0,0 +1,485 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    TimeWarper.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Definitions.h"
+#include <pthread.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define ENVELOPE_MS 10
+#define BAND_PERCENT 10
+
+#define NOT_PRUNED 0
+#define PRUNED_BY_KIM 1
+#define PRUNED_BY_KEOGH 2
+#define ABANDONED 3
+
+/**
+ * Scratch space of one worker, handed out from a free list so buffers are
+ * reused across candidates instead of being allocated for each of them.
+ */
+typedef struct Workspace {
+    double *buffer;
+    u_int *deques;
+    struct Workspace *next;
+} Workspace;
+
+/**
+ * State shared by the workers of one nearest neighbour scan.
+ */
+typedef struct Scan {
+    char **files;
+    double *query;          // z-normalised envelope of files[0].
+    double *query_lower;    // Sakoe-Chiba envelope of the query.
+    double *query_upper;
+    u_int length;
+    u_int band;
+    u_int frames_per_point;
+    double best;            // Best squared distance so far.
+    double *distances;
+    int *outcomes;
+    int *status;
+    Workspace *free_workspaces;
+    pthread_mutex_t lock;
+} Scan;
+
+private void scanCandidate(void *context, int candidate_id);
+
+private double *readEnvelope(char *wav_filename, u_int frames_per_point, u_int *points);
+
+private void resample(double *signal, u_int length, double *resampled, u_int new_length);
+
+private void zNormalise(double *signal, u_int length);
+
+private void lowerUpperEnvelope(const double *signal, u_int length, u_int band,
+                                double *lower, double *upper, u_int *deques);
+
+private double lbKeogh(const double *signal, const double *lower, const double *upper, u_int length,
+                       double best_so_far, double *contributions);
+
+
+/**
+ * Finds the file closest to file[0] by Dynamic Time Warping of their
+ * amplitude envelopes. Candidates are scanned in parallel and discarded as
+ * early as possible by LB_Kim, then LB_Keogh in both directions, and finally
+ * by abandoning the banded DTW once it exceeds the best distance so far.
+ * Option ID: 13
+ *
+ * @param files
+ * @param number_of_files
+ * @return EXIT_CODE
+ */
+public int dtwNearest(char **files, int number_of_files) {
+    int EXIT_CODE = SUCCESS;
+    Scan scan;
+    memset(&scan, 0, sizeof(Scan));
+    u_int *deques = NULL;
+    int candidates = number_of_files - 1;
+
+    scan.files = files + 1;
+    scan.best = INFINITY;
+    pthread_mutex_init(&scan.lock, NULL);
+
+    // Points of ENVELOPE_MS, the sample rate of the query decides their frames
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+    EXIT_CODE = getHeader(NULL, &wav_header, &wav_file, files[0]);
+    if (EXIT_CODE == SUCCESS)
+        scan.frames_per_point = max(wav_header->sampleRate * ENVELOPE_MS / 1000, 1);
+    freePointer(wav_header);
+    closeFile(wav_file);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    scan.query = readEnvelope(files[0], scan.frames_per_point, &scan.length);
+    if (scan.query == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    if (scan.length < 2) {
+        EXIT_CODE = FAILURE;
+        printf("File too short: %s\n\n", files[0]);
+        goto END;
+    }
+    zNormalise(scan.query, scan.length);
+    scan.band = max(scan.length * BAND_PERCENT / 100, 1);
+
+    scan.query_lower = malloc(2 * scan.length * sizeof(double));
+    deques = malloc(2 * scan.length * sizeof(u_int));
+    scan.distances = calloc((size_t) candidates, sizeof(double));
+    scan.outcomes = calloc((size_t) candidates, sizeof(int));
+    scan.status = calloc((size_t) candidates, sizeof(int));
+    if (scan.query_lower == NULL || deques == NULL || scan.distances == NULL
+     || scan.outcomes == NULL || scan.status == NULL) {
+        EXIT_CODE = FAILURE;
+        printf("Sorry, program run out of memory.\n\n");
+        goto END;
+    }
+    scan.query_upper = scan.query_lower + scan.length;
+    lowerUpperEnvelope(scan.query, scan.length, scan.band, scan.query_lower, scan.query_upper, deques);
+
+    parallelFor(candidates, scanCandidate, &scan);
+
+    int nearest = -1;
+    for (int i = 0; i < candidates; i++) {
+        if (scan.status[i] != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            continue;
+        }
+        printf("%s: ", scan.files[i]);
+        switch (scan.outcomes[i]) {
+            case PRUNED_BY_KIM:
+                printf("pruned by LB_Kim\n");
+                break;
+            case PRUNED_BY_KEOGH:
+                printf("pruned by LB_Keogh\n");
+                break;
+            case ABANDONED:
+                printf("abandoned early\n");
+                break;
+            default:
+                printf("DTW distance: %.3f\n", sqrt(scan.distances[i]));
+                if (nearest < 0 || scan.distances[i] < scan.distances[nearest])
+                    nearest = i;
+                break;
+        }
+    }
+    if (nearest >= 0)
+        printf("Nearest neighbour: %s, DTW distance: %.3f\n\n", scan.files[nearest],
+               sqrt(scan.distances[nearest]));
+
+    END:
+    while (scan.free_workspaces != NULL) {
+        Workspace *next = scan.free_workspaces->next;
+        freePointer(scan.free_workspaces->buffer);
+        freePointer(scan.free_workspaces->deques);
+        free(scan.free_workspaces);
+        scan.free_workspaces = next;
+    }
+    pthread_mutex_destroy(&scan.lock);
+    freePointer(scan.query);
+    freePointer(scan.query_lower);
+    freePointer(scan.distances);
+    freePointer(scan.outcomes);
+    freePointer(scan.status);
+    freePointer(deques);
+    return EXIT_CODE;
+}
+
+/**
+ * Banded DTW between two equally long signals with squared point costs,
+ * using two rows of @param length + 1 values. After each row the cheapest
+ * cell plus the bound on the rows left is compared with @param best_so_far,
+ * and the computation is abandoned as soon as it cannot win.
+ *
+ * @param query
+ * @param candidate
+ * @param length
+ * @param band, largest allowed warp in points
+ * @param cumulative_bound, cumulative_bound[k] bounds the cost left after row k, may be NULL
+ * @param bound_shift, row i is followed by cumulative_bound[i + bound_shift]
+ * @param best_so_far
+ * @param rows, scratch space of 2 * (length + 1) values
+ * @return squared DTW distance, or INFINITY if abandoned
+ */
+public double dtwDistance(const double *query, const double *candidate, u_int length, u_int band,
+                          const double *cumulative_bound, u_int bound_shift, double best_so_far,
+                          double *rows) {
+    // Row i holds candidate point i - 1, column j query point j - 1
+    double *previous = rows, *current = rows + length + 1;
+
+    for (u_int j = 0; j <= length; j++)
+        previous[j] = INFINITY;
+    previous[0] = 0;
+
+    for (u_int i = 1; i <= length; i++) {
+        u_int from = i > band ? i - band : 1, to = min(i + band, length);
+        double row_minimum = INFINITY;
+
+        for (u_int j = 0; j <= length; j++)
+            current[j] = INFINITY;
+        for (register u_int j = from; j <= to; j++) {
+            double cost = candidate[i - 1] - query[j - 1];
+            double best_step = min(previous[j - 1], min(previous[j], current[j - 1]));
+            current[j] = cost * cost + best_step;
+            row_minimum = min(row_minimum, current[j]);
+        }
+
+        double remaining = 0;
+        if (cumulative_bound != NULL && i + bound_shift <= length)
+            remaining = cumulative_bound[i + bound_shift];
+        if (row_minimum + remaining >= best_so_far)
+            return INFINITY;
+
+        double *temp = previous;
+        previous = current;
+        current = temp;
+    }
+    return previous[length];
+}
+
+/**
+ * Computes the DTW distance of one candidate file to the query, unless one
+ * of the lower bounds proves it cannot be the nearest neighbour.
+ *
+ * @param context, the Scan
+ * @param candidate_id
+ */
+private void scanCandidate(void *context, int candidate_id) {
+    Scan *scan = context;
+    u_int n = scan->length, points;
+    Workspace *workspace = NULL;
+
+    double *envelope = readEnvelope(scan->files[candidate_id], scan->frames_per_point, &points);
+    if (envelope == NULL || points < 2) {
+        if (envelope != NULL)
+            printf("File too short: %s\n\n", scan->files[candidate_id]);
+        scan->status[candidate_id] = FAILURE;
+        goto END;
+    }
+
+    pthread_mutex_lock(&scan->lock);
+    workspace = scan->free_workspaces;
+    if (workspace != NULL)
+        scan->free_workspaces = workspace->next;
+    pthread_mutex_unlock(&scan->lock);
+
+    if (workspace == NULL) {
+        workspace = calloc(1, sizeof(Workspace));
+        if (workspace != NULL) {
+            workspace->buffer = malloc((8 * (size_t) n + 3) * sizeof(double));
+            workspace->deques = malloc(2 * (size_t) n * sizeof(u_int));
+        }
+        if (workspace == NULL || workspace->buffer == NULL || workspace->deques == NULL) {
+            printf("Sorry, program run out of memory.\n\n");
+            scan->status[candidate_id] = FAILURE;
+            goto END;
+        }
+    }
+    double *candidate = workspace->buffer, *lower = candidate + n, *upper = lower + n;
+    double *contributions = upper + n, *reverse_contributions = contributions + n;
+    double *bound = reverse_contributions + n, *rows = bound + n + 1;
+
+    // Compare whole sounds: stretch the candidate to the query length
+    resample(envelope, points, candidate, n);
+    zNormalise(candidate, n);
+
+    pthread_mutex_lock(&scan->lock);
+    double best = scan->best;
+    pthread_mutex_unlock(&scan->lock);
+
+    // LB_Kim: the first and last points are always aligned with each other
+    double kim = (candidate[0] - scan->query[0]) * (candidate[0] - scan->query[0])
+               + (candidate[n - 1] - scan->query[n - 1]) * (candidate[n - 1] - scan->query[n - 1]);
+    if (kim >= best) {
+        scan->outcomes[candidate_id] = PRUNED_BY_KIM;
+        goto END;
+    }
+
+    // LB_Keogh of the candidate against the query envelope, then the reverse
+    double keogh = lbKeogh(candidate, scan->query_lower, scan->query_upper, n, best, contributions);
+    if (keogh >= best) {
+        scan->outcomes[candidate_id] = PRUNED_BY_KEOGH;
+        goto END;
+    }
+
+    lowerUpperEnvelope(candidate, n, scan->band, lower, upper, workspace->deques);
+    double reverse_keogh = lbKeogh(scan->query, lower, upper, n, best, reverse_contributions);
+    if (reverse_keogh >= best) {
+        scan->outcomes[candidate_id] = PRUNED_BY_KEOGH;
+        goto END;
+    }
+
+    // After row i the candidate points from i on are left, but query points
+    // are only certainly left from i + band on
+    u_int bound_shift = 0;
+    if (reverse_keogh > keogh) {
+        contributions = reverse_contributions;
+        bound_shift = scan->band;
+    }
+    bound[n] = 0;
+    for (u_int k = n; k > 0; k--)
+        bound[k - 1] = bound[k] + contributions[k - 1];
+    double distance = dtwDistance(scan->query, candidate, n, scan->band, bound, bound_shift, best, rows);
+    if (distance == INFINITY) {
+        scan->outcomes[candidate_id] = ABANDONED;
+        goto END;
+    }
+
+    scan->distances[candidate_id] = distance;
+    pthread_mutex_lock(&scan->lock);
+    if (distance < scan->best)
+        scan->best = distance;
+    pthread_mutex_unlock(&scan->lock);
+
+    END:
+    if (workspace != NULL) {
+        pthread_mutex_lock(&scan->lock);
+        workspace->next = scan->free_workspaces;
+        scan->free_workspaces = workspace;
+        pthread_mutex_unlock(&scan->lock);
+    }
+    freePointer(envelope);
+}
+
+/**
+ * Reads a .wav file and returns the envelope of its mono signal.
+ *
+ * @param wav_filename
+ * @param frames_per_point
+ * @param points
+ * @return malloc'd envelope or NULL on failure
+ */
+private double *readEnvelope(char *wav_filename, u_int frames_per_point, u_int *points) {
+    Arena *arena = acquireArena();
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+    u_char *wav_data = NULL;
+    double *signal = NULL, *envelope = NULL;
+    u_int length;
+
+    if (arena == NULL) {
+        printf("Sorry, program run out of memory.\n\n");
+        return NULL;
+    }
+
+    if (getHeader(arena, &wav_header, &wav_file, wav_filename) != SUCCESS
+     || getData(wav_header, wav_file, &wav_data) != SUCCESS)
+        goto END;
+
+    signal = getMonoSamples(wav_header, wav_data, &length);
+    if (signal != NULL)
+        envelope = getEnvelope(signal, length, frames_per_point, points);
+    if (envelope == NULL)
+        printf("Sorry, program run out of memory.\n\n");
+
+    END:
+    releaseArena(arena);
+    releaseBuffer(wav_data);
+    freePointer(signal);
+    closeFile(wav_file);
+    return envelope;
+}
+
+/**
+ * Linear interpolation of a signal to @param new_length points.
+ *
+ * @param signal
+ * @param length
+ * @param resampled
+ * @param new_length
+ */
+private void resample(double *signal, u_int length, double *resampled, u_int new_length) {
+    double scale = (double) (length - 1) / (new_length - 1);
+    for (u_int i = 0; i < new_length; i++) {
+        double position = i * scale;
+        u_int left = min((u_int) position, length - 2);
+        double fraction = position - left;
+        resampled[i] = signal[left] * (1 - fraction) + signal[left + 1] * fraction;
+    }
+}
+
+/**
+ * Shifts and scales a signal to zero mean and unit deviation.
+ *
+ * @param signal
+ * @param length
+ */
+private void zNormalise(double *signal, u_int length) {
+    double mean = 0, deviation = 0;
+    for (u_int i = 0; i < length; i++)
+        mean += signal[i];
+    mean /= length;
+    for (u_int i = 0; i < length; i++)
+        deviation += (signal[i] - mean) * (signal[i] - mean);
+    deviation = sqrt(deviation / length);
+    if (deviation == 0)
+        deviation = 1;
+    for (u_int i = 0; i < length; i++)
+        signal[i] = (signal[i] - mean) / deviation;
+}
+
+/**
+ * Running minimum and maximum of every window [i - band, i + band] in
+ * O(length), keeping the candidates of each in a monotonic deque.
+ *
+ * @param signal
+ * @param length
+ * @param band
+ * @param lower
+ * @param upper
+ * @param deques, scratch space of 2 * length indices
+ */
+private void lowerUpperEnvelope(const double *signal, u_int length, u_int band,
+                                double *lower, double *upper, u_int *deques) {
+    u_int *minima = deques, *maxima = deques + length;
+    u_int min_head = 0, min_tail = 0, max_head = 0, max_tail = 0;
+
+    for (u_int k = 0; k < length + band; k++) {
+        if (k < length) {
+            while (min_tail > min_head && signal[minima[min_tail - 1]] >= signal[k])
+                min_tail--;
+            minima[min_tail++] = k;
+            while (max_tail > max_head && signal[maxima[max_tail - 1]] <= signal[k])
+                max_tail--;
+            maxima[max_tail++] = k;
+        }
+        if (k < band)
+            continue;
+
+        // Window of point k - band is [k - 2 * band, k]
+        u_int i = k - band;
+        while (minima[min_head] + 2 * band < k)
+            min_head++;
+        while (maxima[max_head] + 2 * band < k)
+            max_head++;
+        lower[i] = signal[minima[min_head]];
+        upper[i] = signal[maxima[max_head]];
+    }
+}
+
+/**
+ * LB_Keogh: the squared distance of every point from the envelope of the
+ * other signal. Stops once @param best_so_far is reached.
+ *
+ * @param signal
+ * @param lower
+ * @param upper
+ * @param length
+ * @param best_so_far
+ * @param contributions, receives the bound of every point
+ * @return lower bound of the squared DTW distance
+ */
+private double lbKeogh(const double *signal, const double *lower, const double *upper, u_int length,
+                       double best_so_far, double *contributions) {
+    double bound = 0;
+    for (register u_int i = 0; i < length; i++) {
+        double excess = 0;
+        if (signal[i] > upper[i])
+            excess = signal[i] - upper[i];
+        else if (signal[i] < lower[i])
+            excess = lower[i] - signal[i];
+        contributions[i] = excess * excess;
+        bound += contributions[i];
+        if (bound >= best_so_far)
+            break;
+    }
+    return bound;
+}
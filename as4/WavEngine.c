@@ -31,8 +31,12 @@ private int getOption(int *option, char *argument);
 
 private void showOptions();
 
+private int writesStream(int option, int argc, char *arguments[]);
+
 private int isNumeric(const char *string);
 
+private int isDecimal(const char *string);
+
 
 /**
  * Entry point of our program.
@@ -44,6 +48,93 @@ private int isNumeric(const char *string);
 public int main(int argc, char *arguments[]) {
     int EXIT_CODE = SUCCESS;
 
+    int option = -1;
+    if (argc > 1)
+        getOption(&option, arguments[1]);
+
+    // With the .wav stream on stdout every message goes to stderr
+    if (writesStream(option, argc, arguments))
+        separateStream();
+
+    // The daemon runs every job it is sent through runJob() itself
+    if (option == 14 && argc == 3)
+        EXIT_CODE = runDaemon(arguments[2]);
+    else if (option == 15 && argc > 3)
+        EXIT_CODE = runClient(arguments[2], &arguments[3], argc - 3);
+    else
+        EXIT_CODE = runJob(argc, arguments);
+
+    if (EXIT_CODE != SUCCESS) {
+        printf("/*  Copyright (C) 2018 Aristos Georgiou, Arsenios Dracoudis.\n"
+               "\n"
+               "    WavEngine.c is part of as4/wavengine.\n"
+               "\n"
+               "    as4/wavengine is free software: you can redistribute it and/or modify\n"
+               "    it under the terms of the GNU General Public License as published by\n"
+               "    the Free Software Foundation, either version 3 of the License, or\n"
+               "    (at your option) any later version.\n"
+               "\n"
+               "    as4/wavengine is distributed in the hope that it will be useful,\n"
+               "    but WITHOUT ANY WARRANTY; without even the implied warranty of\n"
+               "    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n"
+               "    GNU General Public License for more details.\n"
+               "\n"
+               "    You should have received a copy of the GNU General Public License\n"
+               "    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.\n"
+               " */\n\n");
+        printf("Use ./wavengine -help ,for options.\n");
+    }
+    printMemoryStats();
+    freeMemoryPools();
+    return EXIT_CODE;
+}
+
+/**
+ * @param option
+ * @param argc, number of arguments given
+ * @param arguments
+ * @return if the option writes a .wav stream to stdout, because its
+ * output, or for the options that stream from stdin to stdout an input, is -
+ */
+private int writesStream(int option, int argc, char *arguments[]) {
+    switch (option) {
+        case 2:
+        case 3:
+        case 4:
+        case 5:
+        case 29:
+            for (int i = 2; i < argc; i++)
+                if (isStream(arguments[i]))
+                    return 1;
+            return 0;
+        case 24:
+            return argc > 2 && isStream(arguments[argc - 1]);
+        case 25:
+            return argc > 2 && isStream(arguments[2]);
+        case 27:
+            return argc > 3 && isStream(arguments[3]);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Runs the option given by @param arguments, as main() would.
+ *
+ * @param argc, number of arguments given
+ * @param arguments, arguments[0] is the program name
+ * @return EXIT_CODE
+ */
+public int runJob(int argc, char *arguments[]) {
+    int EXIT_CODE = SUCCESS;
+
+    // -inplace before -mono, -reverse or -encodeText changes the files themselves
+    int in_place = argc > 1 && strcmp(arguments[1], "-inplace") == 0;
+    if (in_place) {
+        arguments++;
+        argc--;
+    }
+
     if (argc <= 1) {
         EXIT_CODE = FAILURE;
         goto END;
@@ -51,6 +142,10 @@ public int main(int argc, char *arguments[]) {
 
     int option;
     getOption(&option, arguments[1]);
+    if (in_place && option != 2 && option != 5 && option != 7) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
 
     switch (option) {
         case 0:
@@ -72,7 +167,10 @@ public int main(int argc, char *arguments[]) {
                 EXIT_CODE = FAILURE;
                 goto END;
             }
-            EXIT_CODE = convertToMonos(&arguments[2], argc - 2);
+            if (in_place)
+                EXIT_CODE = convertToMonosInPlace(&arguments[2], argc - 2);
+            else
+                EXIT_CODE = convertToMonos(&arguments[2], argc - 2);
             break;
         case 3:
             if (argc != 4) {
@@ -93,7 +191,10 @@ public int main(int argc, char *arguments[]) {
                 EXIT_CODE = FAILURE;
                 goto END;
             }
-            EXIT_CODE = reverseFiles(&arguments[2], argc - 2);
+            if (in_place)
+                EXIT_CODE = reverseFilesInPlace(&arguments[2], argc - 2);
+            else
+                EXIT_CODE = reverseFiles(&arguments[2], argc - 2);
             break;
         case 6:
             if (argc <= 3) {
@@ -107,7 +208,10 @@ public int main(int argc, char *arguments[]) {
                 EXIT_CODE = FAILURE;
                 goto END;
             }
-            EXIT_CODE = encodeToFile(arguments[2], arguments[3]);
+            if (in_place)
+                EXIT_CODE = encodeInPlace(arguments[2], arguments[3]);
+            else
+                EXIT_CODE = encodeToFile(arguments[2], arguments[3]);
             break;
         case 8:
             if (argc != 5 || !isNumeric(arguments[3])) {
@@ -116,32 +220,209 @@ public int main(int argc, char *arguments[]) {
             }
             EXIT_CODE = decodeFromFile(arguments[2], atoi(arguments[3]), arguments[4]);
             break;
+        case 9:
+            if (argc <= 3) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = correlateFiles(&arguments[2], argc - 2);
+            break;
+        case 10:
+            if ((argc != 4 && argc != 5) || (argc == 5 && !isDecimal(arguments[4]))) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = findClip(arguments[2], arguments[3], argc == 5 ? atof(arguments[4]) : 0.1);
+            break;
+        case 11:
+            if (argc <= 3) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = buildIndex(arguments[2], &arguments[3], argc - 3);
+            break;
+        case 12:
+            if (argc != 4) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = lookupIndex(arguments[2], arguments[3]);
+            break;
+        case 13:
+            if (argc <= 3) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = dtwNearest(&arguments[2], argc - 2);
+            break;
+        case 17:
+            if ((argc != 3 && argc != 4) || (argc == 4 && !isDecimal(arguments[3]))) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = trimSilence(arguments[2], argc == 4 ? atof(arguments[3]) : 40);
+            break;
+        case 18:
+            if (argc < 3 || argc > 5 || (argc >= 4 && !isDecimal(arguments[3]))
+             || (argc == 5 && (!isDecimal(arguments[4]) || atof(arguments[4]) <= 0))) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = splitOnSilence(arguments[2], argc >= 4 ? atof(arguments[3]) : 40,
+                                       argc == 5 ? atof(arguments[4]) : 0.3);
+            break;
+        case 16:
+            if (argc != 5) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            if (strcmp(arguments[3], "-count") == 0 && isNumeric(arguments[4]))
+                EXIT_CODE = splitByCount(arguments[2], atoi(arguments[4]));
+            else if (strcmp(arguments[3], "-seconds") == 0 && isDecimal(arguments[4]))
+                EXIT_CODE = splitBySeconds(arguments[2], atof(arguments[4]));
+            else if (strcmp(arguments[3], "-cue") == 0)
+                EXIT_CODE = splitByCues(arguments[2], arguments[4]);
+            else
+                EXIT_CODE = FAILURE;
+            break;
+        case 19: {
+            int json = argc > 2 && strcmp(arguments[2], "-json") == 0;
+            int first = argc > 2 && (json || strcmp(arguments[2], "-csv") == 0) ? 3 : 2;
+            if (argc <= first) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = printSignalStats(&arguments[first], argc - first, json);
+            break;
+        }
+        case 20:
+            if ((argc != 3 && argc != 5 && argc != 6) || (argc >= 5 && (!isDecimal(arguments[3])
+             || !isDecimal(arguments[4]))) || (argc == 6 && !isNumeric(arguments[5]))) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = printPeaks(arguments[2], argc >= 5 ? atof(arguments[3]) : 0, argc >= 5 ? atof(arguments[4]) : -1,
+                                   argc == 6 ? atoi(arguments[5]) : 1);
+            break;
+        case 21: {
+            int first = 2, lcss = 0;
+            double threshold = -1;
+            if (first < argc && strcmp(arguments[first], "-lcss") == 0) {
+                lcss = 1;
+                first++;
+            }
+            if (first + 1 < argc && strcmp(arguments[first], "-threshold") == 0 && isDecimal(arguments[first + 1])) {
+                threshold = atof(arguments[first + 1]);
+                first += 2;
+            }
+            if (argc - first < 2) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = similarityMatrix(&arguments[first], argc - first, lcss, threshold);
+            break;
+        }
+        case 22:
+            if ((argc != 4 && argc != 5) || (argc == 5 && !isNumeric(arguments[4]))) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = printAlignment(arguments[2], arguments[3], argc == 5 ? (u_int) atoi(arguments[4]) : 32);
+            break;
+        case 23: {
+            int first = argc > 3 && strcmp(arguments[2], "-cache") == 0 ? 4 : 2;
+            if (argc - first < 2) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = findDuplicates(&arguments[first], argc - first, first == 4 ? arguments[3] : NULL);
+            break;
+        }
+        case 24: {
+            int first = 2, effect = 0;
+            u_int period = 256;
+            if (first + 1 < argc && strcmp(arguments[first], "-period") == 0 && isNumeric(arguments[first + 1])) {
+                period = (u_int) atoi(arguments[first + 1]);
+                first += 2;
+            }
+            char *parameter = first + 1 < argc ? arguments[first + 1] : NULL;
+            if (first < argc && strcmp(arguments[first], "-gain") == 0 && parameter != NULL
+             && isDecimal(parameter + (parameter[0] == '-')))
+                effect = LIVE_GAIN;
+            else if (first < argc && strcmp(arguments[first], "-mix") == 0)
+                effect = LIVE_MIX;
+            else if (first < argc && strcmp(arguments[first], "-embed") == 0)
+                effect = LIVE_EMBED;
+            else if (first < argc && strcmp(arguments[first], "-mono") == 0) {
+                effect = LIVE_MONO;
+                first--;
+            }
+            if (effect == 0 || argc - first != 4) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = processLive(arguments[first + 2], arguments[first + 3], period, effect, parameter);
+            break;
+        }
+        case 25:
+            if ((argc != 4 && argc != 5) || !isDecimal(arguments[3]) || (argc == 5 && !isDecimal(arguments[4]))) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = writeTone(arguments[2], atof(arguments[3]), argc == 5 ? atof(arguments[4]) : 440);
+            break;
+        case 26:
+            if (argc < 5) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            if (strcmp(arguments[3], "-chop") == 0 && argc == 7 && isDecimal(arguments[5]) && isDecimal(arguments[6]))
+                EXIT_CODE = editFiles(arguments[2], EDIT_CHOP, &arguments[4], 1, atof(arguments[5]), atof(arguments[6]));
+            else if (strcmp(arguments[3], "-reverse") == 0 && argc == 5)
+                EXIT_CODE = editFiles(arguments[2], EDIT_REVERSE, &arguments[4], 1, 0, 0);
+            else if (strcmp(arguments[3], "-gain") == 0 && argc == 6
+                  && isDecimal(arguments[5] + (arguments[5][0] == '-')))
+                EXIT_CODE = editFiles(arguments[2], EDIT_GAIN, &arguments[4], 1, atof(arguments[5]), 0);
+            else if (strcmp(arguments[3], "-concat") == 0 && argc >= 6)
+                EXIT_CODE = editFiles(arguments[2], EDIT_CONCAT, &arguments[4], argc - 4, 0, 0);
+            else
+                EXIT_CODE = FAILURE;
+            break;
+        case 27:
+            if ((argc != 4 && argc != 6) || (argc == 6 && (!isDecimal(arguments[4]) || !isDecimal(arguments[5])))) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = renderEditList(arguments[2], arguments[3], argc == 6 ? atof(arguments[4]) : 0,
+                                       argc == 6 ? atof(arguments[5]) : -1);
+            break;
+        case 28: {
+            int first = 2;
+            double seconds = 0;
+            if (first + 1 < argc && strcmp(arguments[first], "-crossfade") == 0 && isDecimal(arguments[first + 1])) {
+                seconds = atof(arguments[first + 1]);
+                first += 2;
+            }
+            if (argc - first < 2) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = concatenateFiles(arguments[first], &arguments[first + 1], argc - first - 1, seconds);
+            break;
+        }
+        case 29:
+            if (argc <= 3) {
+                EXIT_CODE = FAILURE;
+                goto END;
+            }
+            EXIT_CODE = routeFiles(arguments[2], &arguments[3], argc - 3);
+            break;
         default:
             EXIT_CODE = FAILURE;
             break;
     }
 
     END:
-    if (EXIT_CODE != SUCCESS) {
-        printf("/*  Copyright (C) 2018 Aristos Georgiou, Arsenios Dracoudis.\n"
-               "\n"
-               "    WavEngine.c is part of as4/wavengine.\n"
-               "\n"
-               "    as4/wavengine is free software: you can redistribute it and/or modify\n"
-               "    it under the terms of the GNU General Public License as published by\n"
-               "    the Free Software Foundation, either version 3 of the License, or\n"
-               "    (at your option) any later version.\n"
-               "\n"
-               "    as4/wavengine is distributed in the hope that it will be useful,\n"
-               "    but WITHOUT ANY WARRANTY; without even the implied warranty of\n"
-               "    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n"
-               "    GNU General Public License for more details.\n"
-               "\n"
-               "    You should have received a copy of the GNU General Public License\n"
-               "    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.\n"
-               " */\n\n");
-        printf("Use ./wavengine -help ,for options.\n");
-    }
     return EXIT_CODE;
 }
 
@@ -157,6 +438,33 @@ public int main(int argc, char *arguments[]) {
 * –similarity (.wav)+, Prints LCSS and Eclidean distance of files.  ID: 6
 * –encodeText a.wav text.txt, Encodes text into a.wav file.         ID: 7
 * –decodeText a.wav msgLen out.txt, Decodes msg into out.txt        ID: 8
+* –correlate (.wav)+, Prints best lag and aligned distances.        ID: 9
+* –find probe.wav a.wav [0.1], Finds occurrences of probe in a.wav. ID: 10
+* –index out.idx (.wav)+, Writes fingerprint index of files.        ID: 11
+* –lookup out.idx probe.wav, Finds indexed files containing probe.  ID: 12
+* –dtw (.wav)+, Finds the file nearest to the first by DTW.        ID: 13
+* –daemon a.sock, Serves jobs on the Unix socket a.sock.            ID: 14
+* –client a.sock [–repeat n] –option ..., Runs a job on a daemon.   ID: 15
+* –split a.wav –count n|–seconds s|–cue cues.txt, Splits a.wav.    ID: 16
+* –trim a.wav [40], Trims silence under -40 dBFS from both ends.   ID: 17
+* –splitOnSilence a.wav [40 [0.3]], Splits a.wav at its pauses.    ID: 18
+* –stats [–csv|–json] (.wav)+, Prints levels of every channel.      ID: 19
+* –peaks a.wav [2 4 [n]], Prints min, max and RMS from a peak file. ID: 20
+* –similarityMatrix [–lcss] [–threshold t] (.wav)+, All pairs.      ID: 21
+* –align a.wav b.wav [32], Prints the ranges an LCSS matches.       ID: 22
+* –dedup [–cache file] (.wav)+, Groups files with the same data.    ID: 23
+* –realtime [–period n] –gain dB|–mono|–mix b.wav|–embed t.txt in out, ID: 24
+* –tone out seconds [440], Writes a live test tone to a FIFO.       ID: 25
+* –edit out.edl –chop|–reverse|–gain|–concat in ..., Edits a list. ID: 26
+* –render in.edl out.wav [2 4], Renders an edit list or a region.    ID: 27
+* –concat [–crossfade s] out.wav (.wav)+, Joins files gaplessly.    ID: 28
+* –route 2,0,1|mono|0.5*0+0.5*1 (.wav)+, Remaps channels of files.  ID: 29
+*
+* –inplace may precede –mono, –reverse and –encodeText to change the
+* given files themselves instead of writing new ones.
+*
+* A file name of - given to –mono, –mix, –chop, –reverse or –route reads stdin and
+* writes the result to stdout.
 *
 * @param option
 * @param argument, argument to be parsed as an option
@@ -181,6 +489,48 @@ private int getOption(int *option, char *argument) {
         *option = 7;
     else if (strcmp(argument, "-decodeText") == 0)
         *option = 8;
+    else if (strcmp(argument, "-correlate") == 0)
+        *option = 9;
+    else if (strcmp(argument, "-find") == 0)
+        *option = 10;
+    else if (strcmp(argument, "-index") == 0)
+        *option = 11;
+    else if (strcmp(argument, "-lookup") == 0)
+        *option = 12;
+    else if (strcmp(argument, "-dtw") == 0)
+        *option = 13;
+    else if (strcmp(argument, "-daemon") == 0)
+        *option = 14;
+    else if (strcmp(argument, "-client") == 0)
+        *option = 15;
+    else if (strcmp(argument, "-split") == 0)
+        *option = 16;
+    else if (strcmp(argument, "-trim") == 0)
+        *option = 17;
+    else if (strcmp(argument, "-splitOnSilence") == 0)
+        *option = 18;
+    else if (strcmp(argument, "-stats") == 0)
+        *option = 19;
+    else if (strcmp(argument, "-peaks") == 0)
+        *option = 20;
+    else if (strcmp(argument, "-similarityMatrix") == 0)
+        *option = 21;
+    else if (strcmp(argument, "-align") == 0)
+        *option = 22;
+    else if (strcmp(argument, "-dedup") == 0)
+        *option = 23;
+    else if (strcmp(argument, "-realtime") == 0)
+        *option = 24;
+    else if (strcmp(argument, "-tone") == 0)
+        *option = 25;
+    else if (strcmp(argument, "-edit") == 0)
+        *option = 26;
+    else if (strcmp(argument, "-render") == 0)
+        *option = 27;
+    else if (strcmp(argument, "-concat") == 0)
+        *option = 28;
+    else if (strcmp(argument, "-route") == 0)
+        *option = 29;
     else
         *option = -1;
 
@@ -198,7 +548,30 @@ private void showOptions() {
     printf("-reverse (.wav)+ to reverse a .wav file.\n");
     printf("-similarity (.wav)+, Prints LCSS and Eclidean distance of files\n");
     printf("-encodeText a.wav text.txt, Encodes text into a.wav file.\n");
-    printf("-decodeText a.wav msgLen out.txt, Decodes msg from a.wav into out.txt\n\n");
+    printf("-decodeText a.wav msgLen out.txt, Decodes msg from a.wav into out.txt\n");
+    printf("-correlate (.wav)+, Prints best lag, peak correlation and aligned distances of files\n");
+    printf("-find probe.wav a.wav [threshold], Prints offsets of a.wav where probe.wav occurs\n");
+    printf("-index out.idx (.wav)+, Writes a fingerprint index of files to out.idx\n");
+    printf("-lookup out.idx probe.wav, Prints indexed files that contain probe.wav and where\n");
+    printf("-dtw (.wav)+, Prints DTW distances of files from the first and its nearest neighbour\n");
+    printf("-inplace -mono|-reverse|-encodeText ..., Changes the given files themselves, resumable if interrupted\n");
+    printf("- as a file of -mono, -mix, -chop, -reverse or -route, Reads it from stdin and writes the result to stdout\n");
+    printf("-daemon a.sock, Keeps serving jobs sent to the Unix socket a.sock\n");
+    printf("-client a.sock [-repeat n] -option ..., Runs a job on the daemon of a.sock, n times\n");
+    printf("-split a.wav -count n|-seconds s|-cue cues.txt, Splits a.wav into split-i-a.wav files\n");
+    printf("-trim a.wav [dB], Trims silence quieter than -dB dBFS, 40 by default, from both ends of a.wav\n");
+    printf("-splitOnSilence a.wav [dB [seconds]], Splits a.wav at pauses of 0.3 s or the seconds given\n");
+    printf("-stats [-csv|-json] (.wav)+, Prints peak, RMS, DC offset, clipping and zero crossings of every channel\n");
+    printf("-peaks a.wav [2 4 [n]], Prints min, max and RMS of a.wav from 2s to 4s in n parts, kept in a.wav.peaks\n");
+    printf("-similarityMatrix [-lcss] [-threshold t] (.wav)+, Prints distances of all pairs, or the pairs within t\n");
+    printf("-align a.wav b.wav [bytes], Prints the LCSS of a.wav and b.wav and its matched runs of 32 or more bytes\n");
+    printf("-dedup [-cache file] (.wav)+, Groups files whose data is the same, keeping hashes in file\n");
+    printf("-realtime [-period n] -gain dB|-mono|-mix b.wav|-embed text.txt in out, Processes a live stream\n");
+    printf("-tone out seconds [Hz], Writes a sine tone to out at the pace of real time, to feed -realtime\n");
+    printf("-edit out.edl -chop in 2 4|-reverse in|-gain in dB|-concat (in)+, Writes an edit list of .wav files or lists\n");
+    printf("-render in.edl out.wav [2 4], Renders an edit list, or its part from 2s to 4s, into out.wav\n");
+    printf("-concat [-crossfade s] out.wav (.wav)+, Joins files into out.wav, crossfading s seconds between them\n");
+    printf("-route spec (.wav)+, Remaps channels into route-a.wav, spec 1,0 swaps, mono averages, 0.5*0+0.5*1 mixes\n\n");
 }
 
 /**
@@ -213,4 +586,22 @@ private int isNumeric(const char *string) {
         string++;
     }
     return 1;
-}
\ No newline at end of file
+}
+/**
+ *
+ * @param string
+ * @return if string is a non negative decimal number such as 0.25
+ */
+private int isDecimal(const char *string) {
+    int digits = 0, dots = 0;
+    while (*string != '\0') {
+        if (*string == '.')
+            dots++;
+        else if (*string >= '0' && *string <= '9')
+            digits++;
+        else
+            return 0;
+        string++;
+    }
+    return digits > 0 && dots <= 1;
+}
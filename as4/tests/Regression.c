@@ -0,0 +1,2468 @@
+/*  Copyright (C) 2018 Aristos Georgiou
+
+    Regression.c is part of as4/wavengine.
+
+    as4/wavengine is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    as4/wavengine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with as4/wavengine.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../Definitions.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/**
+  * @author Aristos Georgiou
+  */
+
+#define QUEUED_PARTS 6
+#define MEMORY_TASKS 16
+#define MATRIX_FILES 24      // Two tiles of a -similarityMatrix per side.
+
+/**
+ * A file read in parts by threads sharing one I/O queue.
+ */
+typedef struct QueuedParts {
+    IOQueue *queue;
+    int fd;
+    u_char *buffer;
+    size_t size;
+    int status[QUEUED_PARTS];
+} QueuedParts;
+
+/**
+ * Regression checks of numeric results that once came out silently wrong,
+ * built and run by "make check" against every object but WavEngine.o.
+ */
+
+private int checkCorrelationLag();
+
+private int checkQueuedRead();
+
+private void readQueuedPart(void *context, int part);
+
+private int checkCheckpointResume();
+
+private int checkStopSignals();
+
+private int checkLCSSValue();
+
+private int stopWavEngine(char **arguments, int signal_number);
+
+private int checkPacked24();
+
+private int checkFingerprintLookup();
+
+private int checkClipSearch();
+
+private int checkNearestNeighbour();
+
+private int checkPipelineOutput();
+
+private int checkMemoryPools();
+
+private void useMemoryPools(void *context, int task_id);
+
+private int checkJournalReplay();
+
+private int checkStreaming();
+
+private int checkDaemonRoundTrip();
+
+private int checkParallelRanges();
+
+private int runRangedOperations(char *threads, char *suffix);
+
+private int checkSplit();
+
+private int compareSegments(char *wav_filename, short *samples, u_int *bounds, int number_of_segments);
+
+private int checkTrim();
+
+private int checkSignalStats();
+
+private int compareSignalStats(s_int num_channels, s_int bits_per_sample);
+
+private int checkPeaks();
+
+private int comparePeaks(s_int num_channels, s_int bits_per_sample);
+
+private int checkMatrixPruning();
+
+private int compareMatrices(char **files, int lcss);
+
+private int checkDuplicates();
+
+private int countGroups(char **files, int number_of_files, char *cache_filename, char *expected);
+
+private int checkLiveEmbed();
+
+private int checkEditRender();
+
+private int checkConcat();
+
+private int compareConcat(s_int bits_per_sample);
+
+private int checkRouteDownmix();
+
+private int compareRoute(s_int bits_per_sample);
+
+private int checkEuclidean24();
+
+private int findDistances(char **files, double threshold, double *distances, int expected);
+
+private int writeTestFile(char *wav_filename, u_char *data, u_int size);
+
+private int writeWavFile(char *wav_filename, s_int num_channels, s_int bits_per_sample, u_int sample_rate,
+                         void *data, u_int size);
+
+private u_char *readWholeFile(char *filename, size_t *size);
+
+private int compareWavFile(char *wav_filename, s_int num_channels, u_char *data, u_int size);
+
+private int sameFiles(char *filename1, char *filename2, int skip_sizes);
+
+private pid_t startWavEngine(char **arguments);
+
+private int captureOutput();
+
+private char *releaseOutput(int saved_stdout);
+
+private void *interruptSoon(void *argument);
+
+private void ignoreSignal(int signal_number);
+
+private double noise(unsigned long long *state);
+
+
+/**
+ * The daemon of Daemon.o runs jobs through runJob(), it is not under test.
+ *
+ * @param argc
+ * @param arguments
+ * @return FAILURE
+ */
+public int runJob(int argc, char *arguments[]) {
+    return FAILURE;
+}
+
+/**
+ * Runs every check.
+ *
+ * @return the number of failed checks
+ */
+int main() {
+    int failed = 0;
+    failed += checkCorrelationLag() != SUCCESS;
+    failed += checkQueuedRead() != SUCCESS;
+    failed += checkCheckpointResume() != SUCCESS;
+    failed += checkStopSignals() != SUCCESS;
+    failed += checkLCSSValue() != SUCCESS;
+    failed += checkPacked24() != SUCCESS;
+    failed += checkFingerprintLookup() != SUCCESS;
+    failed += checkClipSearch() != SUCCESS;
+    failed += checkNearestNeighbour() != SUCCESS;
+    failed += checkPipelineOutput() != SUCCESS;
+    failed += checkMemoryPools() != SUCCESS;
+    failed += checkJournalReplay() != SUCCESS;
+    failed += checkStreaming() != SUCCESS;
+    failed += checkDaemonRoundTrip() != SUCCESS;
+    failed += checkParallelRanges() != SUCCESS;
+    failed += checkSplit() != SUCCESS;
+    failed += checkTrim() != SUCCESS;
+    failed += checkSignalStats() != SUCCESS;
+    failed += checkPeaks() != SUCCESS;
+    failed += checkMatrixPruning() != SUCCESS;
+    failed += checkDuplicates() != SUCCESS;
+    failed += checkLiveEmbed() != SUCCESS;
+    failed += checkEditRender() != SUCCESS;
+    failed += checkConcat() != SUCCESS;
+    failed += checkRouteDownmix() != SUCCESS;
+    failed += checkEuclidean24() != SUCCESS;
+
+    printf(failed ? "%d checks failed.\n" : "All checks passed.\n", failed);
+    return failed;
+}
+
+/**
+ * A part cut out of a signal must be found where it was cut, with a
+ * coefficient of 1, however much shorter than the signal it is.
+ *
+ * @return EXIT_CODE
+ */
+private int checkCorrelationLag() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 1;
+    u_int length = 20000;
+    double *signal = malloc(length * sizeof(double));
+    double *shifted = malloc(length * sizeof(double));
+    if (signal == NULL || shifted == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (u_int i = 0; i < length; i++)
+        signal[i] = noise(&state);
+
+    // signal2 = signal1[1000:2000], and signal2 = 500 frames of noise, then signal1
+    int lag;
+    double coefficient;
+    if (crossCorrelate(signal, length, signal + 1000, 1000, &lag, &coefficient) != SUCCESS
+     || lag != -1000 || coefficient < 0.999) {
+        printf("FAIL correlation of a part: lag %d, coefficient %.3f\n", lag, coefficient);
+        EXIT_CODE = FAILURE;
+    }
+    for (u_int i = 0; i < length; i++)
+        shifted[i] = i < 500 ? noise(&state) : signal[i - 500];
+    if (crossCorrelate(signal, length, shifted, length, &lag, &coefficient) != SUCCESS
+     || lag != 500 || coefficient < 0.999) {
+        printf("FAIL correlation of a delayed signal: lag %d, coefficient %.3f\n", lag, coefficient);
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    freePointer(signal);
+    freePointer(shifted);
+    freeFFTPlans();
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS correlation lag\n");
+    return EXIT_CODE;
+}
+
+/**
+ * A file read through an I/O queue, by either backend, must come back
+ * whole, also when threads read parts of it through the queue at once, a
+ * read past its end must fail rather than hang, and a file written
+ * through the queue must read back the same.
+ *
+ * @return EXIT_CODE
+ */
+private int checkQueuedRead() {
+    int EXIT_CODE = SUCCESS;
+    char filename[] = "queued.tmp", copy_filename[] = "queued-copy.tmp";
+    size_t size = 5 * IO_CHUNK + 12345;
+    u_char *data = malloc(size), *read_back = malloc(size);
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    int copy_fd = open(copy_filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    char *backend = getenv("WAVENGINE_IO");
+    backend = backend != NULL ? strdup(backend) : NULL;
+    if (data == NULL || read_back == NULL || fd < 0 || copy_fd < 0) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (size_t i = 0; i < size; i++)
+        data[i] = (u_char) (i * 2654435761u >> 13);
+    if (pwriteFully(fd, data, size, 0) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    for (int threads = 0; threads < 2; threads++) {
+        IOQueue queue;
+        if (threads)
+            setenv("WAVENGINE_IO", "threads", 1);
+        openIOQueue(&queue, IO_DEPTH);
+        const char *name = getIOBackend(&queue);
+
+        memset(read_back, 0, size);
+        if (readQueued(&queue, fd, read_back + 1, size - 1, 1) != SUCCESS
+         || memcmp(data + 1, read_back + 1, size - 1) != 0) {
+            printf("FAIL queued read through %s\n", name);
+            EXIT_CODE = FAILURE;
+        }
+        if (readQueued(&queue, fd, read_back, size, 1) != FAILURE) {
+            printf("FAIL queued read past the end through %s\n", name);
+            EXIT_CODE = FAILURE;
+        }
+
+        QueuedParts parts = {&queue, fd, read_back, size, {SUCCESS, SUCCESS, SUCCESS, SUCCESS, SUCCESS, SUCCESS}};
+        memset(read_back, 0, size);
+        parallelForThreads(QUEUED_PARTS, QUEUED_PARTS, readQueuedPart, &parts);
+        for (int part = 0; part < QUEUED_PARTS; part++)
+            if (parts.status[part] != SUCCESS)
+                EXIT_CODE = FAILURE;
+        if (EXIT_CODE != SUCCESS || memcmp(data, read_back, size) != 0) {
+            printf("FAIL queued reads of %d threads at once through %s\n", QUEUED_PARTS, name);
+            EXIT_CODE = FAILURE;
+        }
+
+        memset(read_back, 0, size);
+        if (writeQueued(&queue, copy_fd, data, size, 0) != SUCCESS
+         || preadFully(copy_fd, read_back, size, 0) != SUCCESS || memcmp(data, read_back, size) != 0) {
+            printf("FAIL queued write through %s\n", name);
+            EXIT_CODE = FAILURE;
+        }
+        closeIOQueue(&queue);
+    }
+
+    END:
+    if (backend != NULL)
+        setenv("WAVENGINE_IO", backend, 1);
+    else
+        unsetenv("WAVENGINE_IO");
+    free(backend);
+    if (fd >= 0) {
+        close(fd);
+        unlink(filename);
+    }
+    if (copy_fd >= 0) {
+        close(copy_fd);
+        unlink(copy_filename);
+    }
+    free(data);
+    free(read_back);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS queued I/O\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Reads one of QUEUED_PARTS parts of a file through a shared queue.
+ *
+ * @param context, the QueuedParts
+ * @param part
+ */
+private void readQueuedPart(void *context, int part) {
+    QueuedParts *parts = context;
+    size_t start = parts->size * part / QUEUED_PARTS, end = parts->size * (part + 1) / QUEUED_PARTS;
+    parts->status[part] = readQueued(parts->queue, parts->fd, parts->buffer + start, end - start, (off_t) start);
+}
+
+/**
+ * An LCSS of calculateDistance() stopped by SIGINT must save a checkpoint
+ * and fail, resuming from the checkpoint must give the distance of an LCSS
+ * that was never stopped, and so must a damaged checkpoint, which is
+ * ignored.
+ *
+ * @return EXIT_CODE
+ */
+private int checkCheckpointResume() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 2;
+    u_int size = 20000;
+    char *files[2] = {"resume-a.wav", "resume-b.wav"};
+    char checkpoint_filename[] = "resume-b.wav.lcss", damaged_filename[] = "damaged.lcss";
+    u_char *data1 = malloc(size), *data2 = malloc(size), *checkpoint = NULL;
+    struct stat status;
+    if (data1 == NULL || data2 == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (u_int i = 0; i < size; i++) {
+        data1[i] = (u_char) (128 + 16 * noise(&state));
+        data2[i] = (u_char) (128 + 16 * noise(&state));
+    }
+    if (writeTestFile(files[0], data1, size) != SUCCESS || writeTestFile(files[1], data2, size) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    // The handler in place before calculateDistance() keeps the SIGINT from ending the checks
+    struct sigaction action, previous;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = ignoreSignal;
+    sigaction(SIGINT, &action, &previous);
+    pthread_t interrupter;
+    int stopped = FAILURE;
+    if (pthread_create(&interrupter, NULL, interruptSoon, NULL) == 0) {
+        fflush(stdout);
+        int saved_stdout = dup(STDOUT_FILENO), quiet = open("/dev/null", O_WRONLY);
+        dup2(quiet, STDOUT_FILENO);
+        stopped = calculateDistance(files, 2);
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        close(quiet);
+        pthread_join(interrupter, NULL);
+    }
+    sigaction(SIGINT, &previous, NULL);
+    if (stopped != FAILURE || stat(checkpoint_filename, &status) != 0) {
+        printf("FAIL interrupted LCSS saved no checkpoint\n");
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    // A large value in the middle of the saved row would raise the distance if it were used
+    int fd = open(checkpoint_filename, O_RDONLY), damaged = open(damaged_filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    checkpoint = malloc((size_t) status.st_size);
+    if (fd < 0 || damaged < 0 || checkpoint == NULL || preadFully(fd, checkpoint, (size_t) status.st_size, 0) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+    } else {
+        memset(checkpoint + status.st_size - 4 * (size / 2), 0x7F, 4);
+        EXIT_CODE = pwriteFully(damaged, checkpoint, (size_t) status.st_size, 0);
+    }
+    if (fd >= 0)
+        close(fd);
+    if (damaged >= 0)
+        close(damaged);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    double expected = LCSS(data1, data2, size, size);
+    double from_damaged = resumableLCSS(data1, data2, size, size, damaged_filename, NULL);
+    double resumed = resumableLCSS(data1, data2, size, size, checkpoint_filename, NULL);
+    if (from_damaged != expected) {
+        printf("FAIL LCSS from a damaged checkpoint: %.6f instead of %.6f\n", from_damaged, expected);
+        EXIT_CODE = FAILURE;
+    }
+    if (resumed != expected) {
+        printf("FAIL resumed LCSS: %.6f instead of %.6f\n", resumed, expected);
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    unlink(files[0]);
+    unlink(files[1]);
+    unlink(checkpoint_filename);
+    unlink(damaged_filename);
+    free(data1);
+    free(data2);
+    free(checkpoint);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS checkpoint resume\n");
+    return EXIT_CODE;
+}
+
+/**
+ * load24() and store24() must agree with readSample() and writeSample()
+ * for every length, so for every tail after the vectors, and store24()
+ * must not write past the last sample.
+ *
+ * @return EXIT_CODE
+ */
+private int checkPacked24() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 3;
+    u_char packed[3 * 300 + 16], stored[3 * 300 + 16];
+    int values[300];
+
+    for (size_t i = 0; i < sizeof(packed); i++)
+        packed[i] = (u_char) (128 + 127 * noise(&state));
+    // The extremes, -2^23 and 2^23 - 1, and the values around 0
+    memcpy(packed, "\x00\x00\x80\xff\xff\x7f\xff\xff\xff\x00\x00\x00\x01\x00\x00", 15);
+
+    for (size_t length = 0; length < 300 && EXIT_CODE == SUCCESS; length++) {
+        load24(packed, values, length);
+        for (size_t i = 0; i < length; i++)
+            if (values[i] != readSample(packed + 3 * i, 3)) {
+                printf("FAIL load24 of %zu samples, sample %zu: %d instead of %ld\n", length, i, values[i],
+                       readSample(packed + 3 * i, 3));
+                EXIT_CODE = FAILURE;
+                break;
+            }
+
+        memset(stored, 0xA5, sizeof(stored));
+        store24(values, stored, length);
+        for (size_t i = 0; i < length && EXIT_CODE == SUCCESS; i++) {
+            u_char expected[3];
+            writeSample(expected, 3, values[i]);
+            if (memcmp(stored + 3 * i, expected, 3) != 0) {
+                printf("FAIL store24 of %zu samples, sample %zu\n", length, i);
+                EXIT_CODE = FAILURE;
+            }
+        }
+        for (size_t i = 3 * length; i < sizeof(stored) && EXIT_CODE == SUCCESS; i++)
+            if (stored[i] != 0xA5) {
+                printf("FAIL store24 of %zu samples wrote byte %zu past them\n", length, i - 3 * length);
+                EXIT_CODE = FAILURE;
+            }
+    }
+
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS packed 24 bit samples\n");
+    return EXIT_CODE;
+}
+
+/**
+ * An excerpt of an indexed file must be looked up in that file at the
+ * offset it was cut from, and a corpus too small to fill even the fewest
+ * buckets, down to a silent file without landmarks, must still index and
+ * look up.
+ *
+ * @return EXIT_CODE
+ */
+private int checkFingerprintLookup() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 4;
+    u_int length = 11025 * 8, excerpt_start = 128 * 200, excerpt_length = 11025 * 2;
+    char *files[2] = {"indexed-a.wav", "indexed-b.wav"};
+    char *tiny[2] = {"tiny.wav", "silent.wav"};
+    short *signal = malloc(2 * length * sizeof(short));
+    short silence[400] = {0};
+    char *output = NULL;
+    if (signal == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (u_int i = 0; i < 2 * length; i++)
+        signal[i] = (short) (8000 * noise(&state));
+    if (writeWavFile(files[0], 1, 16, 11025, signal, length * sizeof(short)) != SUCCESS
+     || writeWavFile(files[1], 1, 16, 11025, signal + length, length * sizeof(short)) != SUCCESS
+     || writeWavFile("excerpt.wav", 1, 16, 11025, signal + length + excerpt_start,
+                     excerpt_length * sizeof(short)) != SUCCESS
+     || writeWavFile(tiny[0], 1, 16, 11025, signal, 2000 * sizeof(short)) != SUCCESS
+     || writeWavFile(tiny[1], 1, 16, 11025, silence, sizeof(silence)) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    // The excerpt starts on a hop, so its frames are frames of indexed-b.wav
+    int saved_stdout = captureOutput();
+    int built = buildIndex("corpus.idx", files, 2), looked_up = lookupIndex("corpus.idx", "excerpt.wav");
+    output = releaseOutput(saved_stdout);
+    char expected[64], *best = output ? strstr(output, "Match: ") : NULL;
+    sprintf(expected, "Match: %s at %.3f s", files[1], excerpt_start / 11025.0);
+    if (built != SUCCESS || looked_up != SUCCESS || best == NULL || strncmp(best, expected, strlen(expected)) != 0) {
+        printf("FAIL lookup of an excerpt, expected \"%s\", got:\n%s", expected, output ? output : "");
+        EXIT_CODE = FAILURE;
+    }
+    freePointer(output);
+    output = NULL;
+
+    saved_stdout = captureOutput();
+    built = buildIndex("tiny.idx", tiny, 2);
+    looked_up = lookupIndex("tiny.idx", tiny[0]);
+    int looked_up_silence = lookupIndex("tiny.idx", tiny[1]);
+    output = releaseOutput(saved_stdout);
+    if (built != SUCCESS || looked_up != SUCCESS || looked_up_silence != SUCCESS) {
+        printf("FAIL index of a tiny corpus:\n%s", output ? output : "");
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    unlink(files[0]);
+    unlink(files[1]);
+    unlink(tiny[0]);
+    unlink(tiny[1]);
+    unlink("excerpt.wav");
+    unlink("corpus.idx");
+    unlink("tiny.idx");
+    free(signal);
+    freePointer(output);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS fingerprint lookup\n");
+    return EXIT_CODE;
+}
+
+/**
+ * A quieter copy of a clip planted in noise must be found once, at the frame
+ * it was planted, here where one block of the search hands over to the next.
+ *
+ * @return EXIT_CODE
+ */
+private int checkClipSearch() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 5;
+    u_int length = 100000, clip_length = 1000, planted = 64000;
+    short *haystack = malloc(length * sizeof(short)), clip[1000];
+    char *output = NULL;
+    if (haystack == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (u_int i = 0; i < length; i++)
+        haystack[i] = (short) (8000 * noise(&state));
+    for (u_int i = 0; i < clip_length; i++)
+        clip[i] = (short) (8000 * noise(&state));
+    for (u_int i = 0; i < clip_length; i++)
+        haystack[planted + i] = (short) (clip[i] / 2);
+    if (writeWavFile("haystack.wav", 1, 16, 8000, haystack, length * sizeof(short)) != SUCCESS
+     || writeWavFile("clip.wav", 1, 16, 8000, clip, sizeof(clip)) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    int saved_stdout = captureOutput();
+    int found = findClip("clip.wav", "haystack.wav", 0.1);
+    output = releaseOutput(saved_stdout);
+    char expected[64];
+    sprintf(expected, "Match at frame %u (", planted);
+    if (found != SUCCESS || output == NULL || strncmp(output, expected, strlen(expected)) != 0
+     || strstr(output, "\n1 matches found.") == NULL) {
+        printf("FAIL search of a planted clip at frame %u, got:\n%s", planted, output ? output : "");
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    unlink("haystack.wav");
+    unlink("clip.wav");
+    free(haystack);
+    freePointer(output);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS clip search\n");
+    return EXIT_CODE;
+}
+
+/**
+ * The nearest neighbour of a pruned -dtw scan must be the file, and the
+ * distance, that comparing the query with each candidate alone finds, as
+ * nothing can be pruned before a first distance is known.
+ *
+ * @return EXIT_CODE
+ */
+private int checkNearestNeighbour() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 6;
+    u_int length = 8000;
+    short *signal = malloc(length * sizeof(short));
+    char names[9][16] = {{0}}, *files[9], *output = NULL;
+    double brute_distance = INFINITY;
+    int brute_nearest = -1;
+    if (signal == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    // Noise under envelopes that drift further from the query's
+    for (int f = 0; f < 9; f++) {
+        double rate = 3 + 0.4 * f * (f % 2 ? 1 : -1), phase = 0.2 * f;
+        for (u_int i = 0; i < length; i++)
+            signal[i] = (short) (16000 * fabs(sin(rate * 3.14159265 * i / length + phase)) * noise(&state));
+        sprintf(names[f], "dtw-%d.wav", f);
+        files[f] = names[f];
+        if (writeWavFile(files[f], 1, 16, 8000, signal, length * sizeof(short)) != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            goto END;
+        }
+    }
+
+    int saved_stdout = captureOutput();
+    for (int f = 1; f < 9; f++) {
+        char *pair[2] = {files[0], files[f]};
+        int compared = dtwNearest(pair, 2);
+        char *pair_output = releaseOutput(saved_stdout);
+        char *line = pair_output ? strstr(pair_output, "Nearest neighbour: ") : NULL;
+        char *distance = line ? strstr(line, "DTW distance: ") : NULL;
+        if (compared != SUCCESS || distance == NULL) {
+            printf("FAIL DTW of %s alone:\n%s", files[f], pair_output ? pair_output : "");
+            EXIT_CODE = FAILURE;
+        } else if (atof(distance + 14) < brute_distance) {
+            brute_distance = atof(distance + 14);
+            brute_nearest = f;
+        }
+        freePointer(pair_output);
+        saved_stdout = captureOutput();
+    }
+    int scanned = dtwNearest(files, 9);
+    output = releaseOutput(saved_stdout);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    char expected[64];
+    sprintf(expected, "Nearest neighbour: %s, DTW distance: %.3f\n", files[brute_nearest], brute_distance);
+    if (scanned != SUCCESS || output == NULL || strstr(output, expected) == NULL) {
+        printf("FAIL pruned DTW scan, expected \"%s\", got:\n%s", expected, output ? output : "");
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    for (int f = 0; f < 9; f++)
+        unlink(names[f]);
+    free(signal);
+    freePointer(output);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS nearest neighbour\n");
+    return EXIT_CODE;
+}
+
+/**
+ * -mono, -reverse and -chop stream a file through a pipeline of blocks
+ * that wraps its rings several times, and must write what copying the
+ * frames one by one writes, the partial last block included.
+ *
+ * @return EXIT_CODE
+ */
+private int checkPipelineOutput() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 7;
+    u_int frames = 5 * PIPELINE_BLOCK / 4 + 4321, start = 5 * 8000, end = 150 * 8000;
+    short *stereo = malloc(frames * 2 * sizeof(short)), *expected = malloc(frames * 2 * sizeof(short));
+    char *files[1] = {"piped.wav"};
+    if (stereo == NULL || expected == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (u_int i = 0; i < 2 * frames; i++)
+        stereo[i] = (short) (30000 * noise(&state));
+    if (writeWavFile(files[0], 2, 16, 8000, stereo, frames * 2 * sizeof(short)) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    int saved_stdout = captureOutput();
+    int converted = convertToMonos(files, 1), reversed = reverseFiles(files, 1);
+    int chopped = chop(files[0], start / 8000, end / 8000);
+    freePointer(releaseOutput(saved_stdout));
+    if (converted != SUCCESS || reversed != SUCCESS || chopped != SUCCESS) {
+        printf("FAIL pipelines of -mono, -reverse or -chop failed\n");
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    for (u_int i = 0; i < frames; i++)
+        expected[i] = stereo[2 * i];
+    if (compareWavFile("new-piped.wav", 1, (u_char *) expected, frames * sizeof(short)) != SUCCESS) {
+        printf("FAIL -mono pipeline output\n");
+        EXIT_CODE = FAILURE;
+    }
+    for (u_int i = 0; i < frames; i++) {
+        expected[2 * i] = stereo[2 * (frames - 1 - i)];
+        expected[2 * i + 1] = stereo[2 * (frames - 1 - i) + 1];
+    }
+    if (compareWavFile("reverse-piped.wav", 2, (u_char *) expected, frames * 2 * sizeof(short)) != SUCCESS) {
+        printf("FAIL -reverse pipeline output\n");
+        EXIT_CODE = FAILURE;
+    }
+    if (compareWavFile("chopped-piped.wav", 2, (u_char *) (stereo + 2 * start),
+                       (end - start) * 2 * sizeof(short)) != SUCCESS) {
+        printf("FAIL -chop pipeline output\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    unlink(files[0]);
+    unlink("new-piped.wav");
+    unlink("reverse-piped.wav");
+    unlink("chopped-piped.wav");
+    free(stereo);
+    free(expected);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS pipeline output\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Threads taking pooled buffers and arena blocks at once must each get
+ * memory of their own: page aligned buffers, aligned arena blocks, none of
+ * them overlapping. A released buffer must be handed out again.
+ *
+ * @return EXIT_CODE
+ */
+private int checkMemoryPools() {
+    int EXIT_CODE = SUCCESS;
+    int status[MEMORY_TASKS];
+    MemoryStats before, after;
+
+    parallelFor(MEMORY_TASKS, useMemoryPools, status);
+    for (int task = 0; task < MEMORY_TASKS; task++)
+        if (status[task] != SUCCESS) {
+            printf("FAIL pooled memory of task %d was not its own or not aligned\n", task);
+            EXIT_CODE = FAILURE;
+        }
+
+    getMemoryStats(&before);
+    void *buffer = getBuffer(100000);
+    getMemoryStats(&after);
+    if (buffer == NULL || after.buffer_reuses != before.buffer_reuses + 1) {
+        printf("FAIL a released buffer was not reused\n");
+        EXIT_CODE = FAILURE;
+    }
+    releaseBuffer(buffer);
+
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS memory pools\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Fills buffers and arena blocks of several sizes, one larger than an
+ * arena chunk, with the task id and checks them after all are taken.
+ *
+ * @param context, the status of every task
+ * @param task_id
+ */
+private void useMemoryPools(void *context, int task_id) {
+    int *status = context;
+    size_t sizes[4] = {1000, 100000, 3 << 20, 100 << 10};
+    u_char *buffers[4], *blocks[4];
+    Arena *arena = acquireArena();
+    status[task_id] = arena != NULL ? SUCCESS : FAILURE;
+
+    for (int round = 0; round < 20 && status[task_id] == SUCCESS; round++) {
+        for (int i = 0; i < 4; i++) {
+            buffers[i] = getBuffer(sizes[i]);
+            blocks[i] = arenaAlloc(arena, sizes[i] + (size_t) i);
+            if (buffers[i] == NULL || blocks[i] == NULL || (uintptr_t) buffers[i] % 4096 != 0
+             || (uintptr_t) blocks[i] % sizeof(long double) != 0) {
+                status[task_id] = FAILURE;
+                return;
+            }
+            memset(buffers[i], 8 * task_id + 2 * i, sizes[i]);
+            memset(blocks[i], 8 * task_id + 2 * i + 1, sizes[i] + (size_t) i);
+        }
+        for (int i = 0; i < 4; i++) {
+            for (size_t j = 0; j < sizes[i]; j++)
+                if (buffers[i][j] != (u_char) (8 * task_id + 2 * i)
+                 || blocks[i][j] != (u_char) (8 * task_id + 2 * i + 1))
+                    status[task_id] = FAILURE;
+            releaseBuffer(buffers[i]);
+        }
+        releaseArena(arena);
+    }
+}
+
+/**
+ * A record that reached the journal but not the file must be replayed by
+ * the next openJournal(), a torn one must not, and an -inplace -reverse
+ * killed before its first step, then again between two steps, must finish
+ * as if it never stopped.
+ *
+ * @return EXIT_CODE
+ */
+private int checkJournalReplay() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 8;
+    u_int size = 64 << 20;
+    char *files[1] = {"journaled.wav"}, journal_filename[] = "journaled.wav.journal";
+    u_char *data = malloc(size), *expected = malloc(size), original[8];
+    Journal journal;
+    if (data == NULL || expected == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (u_int i = 0; i < size; i++)
+        data[i] = (u_char) (128 + 127 * noise(&state));
+    if (writeWavFile(files[0], 2, 16, 8000, data, size) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    // Step 0 writes 8 bytes, then the file loses them as if the power went out
+    int saved_stdout = captureOutput();
+    int journaled = openJournal(&journal, files[0], JOURNAL_REVERSE) == SUCCESS
+                    && beginRecord(&journal, 8, 1) == SUCCESS;
+    if (journaled)
+        memcpy(reserveExtent(&journal, HEADER_SIZE, 8), "replayed", 8);
+    journaled = journaled && commitStep(&journal, 0) == SUCCESS;
+    closeJournal(&journal, 0);
+    int fd = open(files[0], O_RDWR);
+    journaled = journaled && fd >= 0 && pwriteFully(fd, data, 8, HEADER_SIZE) == SUCCESS;
+    int reopened = openJournal(&journal, files[0], JOURNAL_REVERSE);
+    long long step = journal.step;
+    closeJournal(&journal, 1);
+    journaled = journaled && preadFully(fd, original, 8, HEADER_SIZE) == SUCCESS;
+    freePointer(releaseOutput(saved_stdout));
+    if (!journaled || reopened != SUCCESS || step != 1 || memcmp(original, "replayed", 8) != 0) {
+        printf("FAIL journal replay: step %lld, file starts with \"%.8s\"\n", step, original);
+        EXIT_CODE = FAILURE;
+    }
+
+    // The same, but the record is torn in the journal too
+    saved_stdout = captureOutput();
+    journaled = fd >= 0 && pwriteFully(fd, data, 8, HEADER_SIZE) == SUCCESS
+                && openJournal(&journal, files[0], JOURNAL_REVERSE) == SUCCESS && beginRecord(&journal, 8, 1) == SUCCESS;
+    if (journaled)
+        memcpy(reserveExtent(&journal, HEADER_SIZE, 8), "replayed", 8);
+    journaled = journaled && commitStep(&journal, 0) == SUCCESS;
+    int journal_fd = journal.fd;
+    journaled = journaled && pwriteFully(journal_fd, "torn", 4, 4096 + 16) == SUCCESS
+                && pwriteFully(fd, data, 8, HEADER_SIZE) == SUCCESS;
+    closeJournal(&journal, 0);
+    reopened = openJournal(&journal, files[0], JOURNAL_REVERSE);
+    step = journal.step;
+    closeJournal(&journal, 1);
+    journaled = journaled && preadFully(fd, original, 8, HEADER_SIZE) == SUCCESS;
+    freePointer(releaseOutput(saved_stdout));
+    if (!journaled || reopened != SUCCESS || step != 0 || memcmp(original, data, 8) != 0) {
+        printf("FAIL torn journal record: step %lld, file starts with \"%.8s\"\n", step, original);
+        EXIT_CODE = FAILURE;
+    }
+    if (fd >= 0)
+        close(fd);
+    if (EXIT_CODE != SUCCESS)
+        goto END;
+
+    // Kill a run as soon as it created its journal, then a resumed run some steps later
+    char *arguments[] = {"../wavengine", "-inplace", "-reverse", files[0], NULL};
+    struct stat status;
+    for (int run = 0; run < 2; run++) {
+        pid_t pid = startWavEngine(arguments);
+        struct timespec poll = {0, 100000}, steps = {0, 30000000};
+        for (int waited = 0; pid > 0 && stat(journal_filename, &status) != 0 && waited < 100000; waited++)
+            nanosleep(&poll, NULL);
+        if (run == 1)
+            nanosleep(&steps, NULL);
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+        if (stat(journal_filename, &status) != 0) {
+            printf("FAIL -inplace -reverse was not killed in the middle\n");
+            EXIT_CODE = FAILURE;
+            goto END;
+        }
+    }
+    saved_stdout = captureOutput();
+    int resumed = reverseFilesInPlace(files, 1);
+    freePointer(releaseOutput(saved_stdout));
+    for (u_int i = 0; i < size; i += 4)
+        memcpy(expected + i, data + size - 4 - i, 4);
+    if (resumed != SUCCESS || compareWavFile(files[0], 2, expected, size) != SUCCESS
+     || stat(journal_filename, &status) == 0) {
+        printf("FAIL -inplace -reverse resumed after a kill\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    unlink(files[0]);
+    unlink(journal_filename);
+    free(data);
+    free(expected);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS journal replay\n");
+    return EXIT_CODE;
+}
+
+/**
+ * An operation on - must write to stdout what it writes to its file for a
+ * file name: byte for byte if stdout is a file, whose header sizes are
+ * patched at the end, and with the sizes of an unknown length otherwise.
+ * It must not matter whether stdin is a file or a pipe.
+ *
+ * @return EXIT_CODE
+ */
+private int checkStreaming() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 9;
+    u_int frames = 3 * PIPELINE_BLOCK / 4 + 999;
+    short *samples = malloc(frames * 2 * sizeof(short));
+    // Each operation on a file, its output, and the same operation on -
+    char *operations[][3] = {{"-mono streamed.wav", "new-streamed.wav", "-mono -"},
+                             {"-reverse streamed.wav", "reverse-streamed.wav", "-reverse -"},
+                             {"-chop streamed.wav 1 60", "chopped-streamed.wav", "-chop - 1 60"},
+                             {"-route 1,0 streamed.wav", "route-streamed.wav", "-route 1,0 -"},
+                             {"-mix streamed.wav other.wav", "mix-streamed-other.wav", "-mix - other.wav"}};
+    int number_of_operations = sizeof(operations) / sizeof(operations[0]);
+    if (samples == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (u_int i = 0; i < 2 * frames; i++)
+        samples[i] = (short) (30000 * noise(&state));
+    if (writeWavFile("streamed.wav", 2, 16, 8000, samples, frames * 2 * sizeof(short)) != SUCCESS
+     || writeWavFile("other.wav", 1, 16, 8000, samples, frames * sizeof(short)) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    for (int i = 0; i < number_of_operations; i++) {
+        char command[256];
+        snprintf(command, sizeof(command), "../wavengine %s > /dev/null", operations[i][0]);
+        int from_file = system(command);
+        snprintf(command, sizeof(command), "../wavengine %s < streamed.wav > stdout.wav", operations[i][2]);
+        int to_file = system(command);
+        snprintf(command, sizeof(command), "cat streamed.wav | ../wavengine %s | cat > piped.wav", operations[i][2]);
+        int piped = system(command);
+
+        if (from_file != 0 || to_file != 0 || piped != 0
+         || sameFiles(operations[i][1], "stdout.wav", 0) != SUCCESS
+         || sameFiles(operations[i][1], "piped.wav", 1) != SUCCESS) {
+            printf("FAIL %s differs from %s\n", operations[i][2], operations[i][0]);
+            EXIT_CODE = FAILURE;
+        }
+        unlink(operations[i][1]);
+    }
+
+    END:
+    unlink("streamed.wav");
+    unlink("other.wav");
+    unlink("stdout.wav");
+    unlink("piped.wav");
+    free(samples);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS streaming through -\n");
+    return EXIT_CODE;
+}
+
+/**
+ * A job sent through -client must print on the client what it prints when
+ * run by itself, stdout on stdout and stderr on stderr, and end the client
+ * with its exit code.
+ *
+ * @return EXIT_CODE
+ */
+private int checkDaemonRoundTrip() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 13;
+    u_int frames = 4000;
+    short samples[2 * 4000];
+    char *arguments[] = {"../wavengine", "-daemon", "round-trip.sock", NULL};
+    pid_t pid = -1;
+    char *direct = NULL, *relayed = NULL, *errors = NULL;
+    size_t direct_size = 0, relayed_size = 0, errors_size = 0;
+
+    for (u_int i = 0; i < 2 * frames; i++)
+        samples[i] = (short) (20000 * noise(&state));
+    unlink("round-trip.sock");
+    if (writeWavFile("daemon.wav", 2, 16, 8000, samples, sizeof(samples)) != SUCCESS
+     || (pid = startWavEngine(arguments)) < 0) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    struct stat socket_stat;
+    for (int tries = 0; stat("round-trip.sock", &socket_stat) != 0; tries++) {
+        if (tries == 500) {
+            printf("FAIL daemon did not open its socket\n");
+            EXIT_CODE = FAILURE;
+            goto END;
+        }
+        usleep(10000);
+    }
+
+    // stdout of a job, the same as run by itself
+    int stats_direct = system("../wavengine -stats daemon.wav > direct.txt 2> /dev/null");
+    int stats_relayed = system("../wavengine -client round-trip.sock -stats daemon.wav > relayed.txt 2> errors.txt");
+    direct = (char *) readWholeFile("direct.txt", &direct_size);
+    relayed = (char *) readWholeFile("relayed.txt", &relayed_size);
+    free(readWholeFile("errors.txt", &errors_size));
+    if (stats_direct != 0 || stats_relayed != 0 || direct == NULL || relayed == NULL || direct_size == 0
+     || direct_size != relayed_size || memcmp(direct, relayed, direct_size) != 0 || errors_size != 0) {
+        printf("FAIL -client -stats printed other than -stats\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    // stderr of a job, not mixed into stdout
+    int live = system("../wavengine -client round-trip.sock -realtime -gain -3 daemon.wav live.wav"
+                      " > relayed.txt 2> errors.txt");
+    free(relayed);
+    relayed = (char *) readWholeFile("relayed.txt", &relayed_size);
+    errors = (char *) readWholeFile("errors.txt", &errors_size);
+    if (live != 0 || relayed == NULL || relayed_size != 0 || errors == NULL
+     || errors_size < 8 || memcmp(errors, "Periods:", 8) != 0) {
+        printf("FAIL -client -realtime did not print its counters to stderr\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    // The exit code of a failed job
+    if (system("../wavengine -client round-trip.sock -stats missing.wav > /dev/null 2>&1") == 0) {
+        printf("FAIL -client succeeded on a failed job\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    if (pid > 0) {
+        kill(pid, SIGINT);
+        waitpid(pid, NULL, 0);
+    }
+    unlink("round-trip.sock");
+    unlink("daemon.wav");
+    unlink("live.wav");
+    unlink("direct.txt");
+    unlink("relayed.txt");
+    unlink("errors.txt");
+    free(direct);
+    free(relayed);
+    free(errors);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS daemon and client round trip\n");
+    return EXIT_CODE;
+}
+
+/**
+ * -mono, -reverse and -mix split over frame ranges on several threads must
+ * write what they write on one thread, and euclidean() summed per range
+ * must be the distance of a plain loop.
+ *
+ * @return EXIT_CODE
+ */
+private int checkParallelRanges() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 17;
+    u_int frames = PIPELINE_BLOCK + 1234, size = (4 << 20) + 333;
+    short *samples = malloc(frames * 2 * sizeof(short));
+    u_char *data1 = malloc(size), *data2 = malloc(size);
+    char *saved_threads = getenv("WAVENGINE_THREADS");
+    saved_threads = saved_threads != NULL ? strdup(saved_threads) : NULL;
+    char *outputs[] = {"new-ranged", "reverse-ranged", "mix-ranged-other"};
+    if (samples == NULL || data1 == NULL || data2 == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (u_int i = 0; i < 2 * frames; i++)
+        samples[i] = (short) (30000 * noise(&state));
+    if (writeWavFile("ranged.wav", 2, 16, 8000, samples, frames * 2 * sizeof(short)) != SUCCESS
+     || writeWavFile("other.wav", 2, 16, 8000, samples + 2 * 777, (frames - 777) * 2 * sizeof(short)) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    if (runRangedOperations("1", "serial") != SUCCESS || runRangedOperations("4", "parallel") != SUCCESS) {
+        printf("FAIL -mono, -reverse or -mix failed on frame ranges\n");
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (int i = 0; i < 3; i++) {
+        char serial[64], parallel[64];
+        snprintf(serial, sizeof(serial), "%s-serial.wav", outputs[i]);
+        snprintf(parallel, sizeof(parallel), "%s-parallel.wav", outputs[i]);
+        if (sameFiles(serial, parallel, 0) != SUCCESS) {
+            printf("FAIL %s.wav of 4 threads differs from 1 thread\n", outputs[i]);
+            EXIT_CODE = FAILURE;
+        }
+        unlink(serial);
+        unlink(parallel);
+    }
+
+    unsigned long long sum = 0;
+    for (u_int i = 0; i < size; i++) {
+        data1[i] = (u_char) (128 + 127 * noise(&state));
+        data2[i] = (u_char) (128 + 127 * noise(&state));
+        long long difference = (long long) data1[i] - data2[i];
+        sum += (unsigned long long) (difference * difference);
+    }
+    setenv("WAVENGINE_THREADS", "4", 1);
+    double ranged = euclidean(data1, data2, size, size + 1);
+    if (ranged != sqrt((double) sum)) {
+        printf("FAIL euclidean() over ranges: %f, expected %f\n", ranged, sqrt((double) sum));
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    if (saved_threads != NULL)
+        setenv("WAVENGINE_THREADS", saved_threads, 1);
+    else
+        unsetenv("WAVENGINE_THREADS");
+    unlink("ranged.wav");
+    unlink("other.wav");
+    free(saved_threads);
+    free(samples);
+    free(data1);
+    free(data2);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS parallel frame ranges\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Runs -mono, -reverse and -mix of ranged.wav on @param threads threads
+ * and renames their outputs to end in -@param suffix.
+ *
+ * @param threads, WAVENGINE_THREADS
+ * @param suffix
+ * @return EXIT_CODE
+ */
+private int runRangedOperations(char *threads, char *suffix) {
+    char *files[1] = {"ranged.wav"};
+    char *outputs[] = {"new-ranged", "reverse-ranged", "mix-ranged-other"};
+    setenv("WAVENGINE_THREADS", threads, 1);
+
+    int saved_stdout = captureOutput();
+    int EXIT_CODE = convertToMonos(files, 1) == SUCCESS && reverseFiles(files, 1) == SUCCESS
+                    && mix(files[0], "other.wav") == SUCCESS ? SUCCESS : FAILURE;
+    freePointer(releaseOutput(saved_stdout));
+
+    for (int i = 0; i < 3; i++) {
+        char output[64], renamed[64];
+        snprintf(output, sizeof(output), "%s.wav", outputs[i]);
+        snprintf(renamed, sizeof(renamed), "%s-%s.wav", outputs[i], suffix);
+        if (rename(output, renamed) != 0)
+            EXIT_CODE = FAILURE;
+    }
+    return EXIT_CODE;
+}
+
+/**
+ * The segments of -split by count, by seconds and by a cue file must hold
+ * the frames of the file between their bounds, whatever the length of the
+ * lines of the cue file.
+ *
+ * @return EXIT_CODE
+ */
+private int checkSplit() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 19;
+    u_int frames = 10 * 8000 + 37;
+    short *samples = malloc(frames * 2 * sizeof(short));
+    u_int bounds[41];
+    if (samples == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (u_int i = 0; i < 2 * frames; i++)
+        samples[i] = (short) (30000 * noise(&state));
+    if (writeWavFile("split.wav", 2, 16, 8000, samples, frames * 2 * sizeof(short)) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    int saved_stdout = captureOutput();
+    int by_count = splitByCount("split.wav", 3);
+    freePointer(releaseOutput(saved_stdout));
+    for (int i = 0; i <= 3; i++)
+        bounds[i] = frames * i / 3;
+    if (by_count != SUCCESS || compareSegments("split.wav", samples, bounds, 3) != SUCCESS) {
+        printf("FAIL -split -count 3\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    saved_stdout = captureOutput();
+    int by_seconds = splitBySeconds("split.wav", 4);
+    freePointer(releaseOutput(saved_stdout));
+    u_int second_bounds[] = {0, 4 * 8000, 8 * 8000, frames};
+    if (by_seconds != SUCCESS || compareSegments("split.wav", samples, second_bounds, 3) != SUCCESS) {
+        printf("FAIL -split -seconds 4\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    // Every cue on one line far longer than any line buffer
+    FILE *cue_file = fopen("split.cue", "w");
+    if (cue_file == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    fprintf(cue_file, "# 40 cues of a quarter second\n");
+    for (int i = 0; i < 40; i++) {
+        fprintf(cue_file, "%.6f ", i * 0.25);
+        bounds[i] = (u_int) i * 2000;
+    }
+    fprintf(cue_file, "\n");
+    fclose(cue_file);
+    bounds[40] = frames;
+    saved_stdout = captureOutput();
+    int by_cues = splitByCues("split.wav", "split.cue");
+    freePointer(releaseOutput(saved_stdout));
+    if (by_cues != SUCCESS || compareSegments("split.wav", samples, bounds, 40) != SUCCESS) {
+        printf("FAIL -split -cue of one long line\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    unlink("split.wav");
+    unlink("split.cue");
+    free(samples);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS -split segments\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Compares the segments -split wrote of 16 bit stereo samples with the
+ * frames between their bounds, and removes them.
+ *
+ * @param wav_filename, the file that was split
+ * @param samples
+ * @param bounds, number_of_segments + 1 frames
+ * @param number_of_segments
+ * @return EXIT_CODE
+ */
+private int compareSegments(char *wav_filename, short *samples, u_int *bounds, int number_of_segments) {
+    int EXIT_CODE = SUCCESS;
+    int digits = number_of_segments >= 10 ? 2 : 1;
+    for (int i = 0; i < number_of_segments; i++) {
+        char segment[64];
+        snprintf(segment, sizeof(segment), "split-%0*d-%s", digits, i + 1, wav_filename);
+        if (compareWavFile(segment, 2, (u_char *) (samples + 2 * bounds[i]),
+                           (bounds[i + 1] - bounds[i]) * 2 * sizeof(short)) != SUCCESS)
+            EXIT_CODE = FAILURE;
+        unlink(segment);
+    }
+    return EXIT_CODE;
+}
+
+/**
+ * -trim of a tone between two silences must keep the tone and PAD_MS of
+ * silence on either side, and a threshold above full scale must be
+ * rejected.
+ *
+ * @return EXIT_CODE
+ */
+private int checkTrim() {
+    int EXIT_CODE = SUCCESS;
+    // 10 ms windows of 80 frames: a tone from window 100 to window 300
+    u_int frames = 4 * 8000, start = 8000, end = 3 * 8000, pad = 160;
+    short *samples = calloc(frames, sizeof(short));
+    char *output = NULL;
+    if (samples == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (u_int i = start; i < end; i++)
+        samples[i] = (short) (8000 * sin(2 * M_PI * 440 * i / 8000));
+    if (writeWavFile("tone.wav", 1, 16, 8000, samples, frames * sizeof(short)) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    int saved_stdout = captureOutput();
+    int trimmed = trimSilence("tone.wav", 40);
+    int above_full_scale = trimSilence("tone.wav", -6);
+    output = releaseOutput(saved_stdout);
+    if (trimmed != SUCCESS || compareWavFile("trimmed-tone.wav", 1, (u_char *) (samples + start - pad),
+                                             (end - start + 2 * pad) * sizeof(short)) != SUCCESS) {
+        printf("FAIL -trim of a tone kept other than the tone and its padding\n");
+        EXIT_CODE = FAILURE;
+    }
+    if (above_full_scale == SUCCESS || output == NULL || strstr(output, "threshold are invalid") == NULL) {
+        printf("FAIL -trim accepted a threshold above full scale\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    unlink("tone.wav");
+    unlink("trimmed-tone.wav");
+    free(samples);
+    freePointer(output);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS -trim of a tone\n");
+    return EXIT_CODE;
+}
+
+/**
+ * -stats of clipped tones must be the peak, RMS, DC offset, clipped
+ * samples and zero crossings of a plain loop over the samples, for the
+ * vector kernels of 16 and 24 bit samples and the generic one alike.
+ *
+ * @return EXIT_CODE
+ */
+private int checkSignalStats() {
+    int EXIT_CODE = SUCCESS;
+    // 16 bit stereo and 24 bit take the vector kernels, 3 channels and 32 bit the generic loop
+    s_int layouts[][2] = {{2, 16}, {3, 16}, {2, 24}, {1, 32}};
+    for (int i = 0; i < 4; i++)
+        if (compareSignalStats(layouts[i][0], layouts[i][1]) != SUCCESS) {
+            printf("FAIL -stats of %d channels of %d bits\n", layouts[i][0], layouts[i][1]);
+            EXIT_CODE = FAILURE;
+        }
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS -stats of tones\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Writes a tone per channel, the first one clipped, and compares the
+ * ChannelStats of getSignalStats() with those of a plain loop.
+ *
+ * @param num_channels, 3 at most
+ * @param bits_per_sample
+ * @return EXIT_CODE
+ */
+private int compareSignalStats(s_int num_channels, s_int bits_per_sample) {
+    int EXIT_CODE = SUCCESS;
+    u_int frames = 300001, sample_size = bits_per_sample / 8;
+    u_int size = frames * num_channels * sample_size;
+    long largest = (1L << (bits_per_sample - 1)) - 1;
+    double full_scale = (double) (largest + 1);
+    u_char *data = malloc(size);
+    ChannelStats stats[3], measured[3];
+    Header *wav_header = NULL;
+    FILE *wav_file = NULL;
+    if (data == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    for (int c = 0; c < num_channels; c++) {
+        double peak = 0, squares = 0, sum = 0, crossings = 0;
+        unsigned long long clipped = 0;
+        int negative = 0;
+        for (u_int i = 0; i < frames; i++) {
+            double level = (c == 0 ? 1.2 : 0.5 / (c + 1)) * sin(2 * M_PI * 300 * (c + 1) * i / 8000) + 0.01 * c;
+            long value = (long) round(max(min(level * full_scale, (double) largest), -full_scale));
+            writeSample(data + ((size_t) i * num_channels + c) * sample_size, sample_size, value);
+            peak = max(peak, fabs((double) value));
+            squares += (double) value * value;
+            sum += (double) value;
+            clipped += value == largest || value == -largest - 1;
+            crossings += (value < 0) != negative;
+            negative = value < 0;
+        }
+        stats[c].peak = peak / full_scale;
+        stats[c].rms = sqrt(squares / frames) / full_scale;
+        stats[c].dc_offset = sum / frames / full_scale;
+        stats[c].clipped = clipped;
+        stats[c].zero_crossing_rate = crossings / (frames / 8000.0);
+    }
+    if (writeWavFile("stats.wav", num_channels, bits_per_sample, 8000, data, size) != SUCCESS
+     || getHeader(NULL, &wav_header, &wav_file, "stats.wav") != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    if (getSignalStats(wav_header, fileno(wav_file), 0, measured) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (int c = 0; c < num_channels; c++)
+        if (fabs(measured[c].peak - stats[c].peak) > 1e-12 || fabs(measured[c].rms - stats[c].rms) > 1e-9
+         || fabs(measured[c].dc_offset - stats[c].dc_offset) > 1e-9 || measured[c].clipped != stats[c].clipped
+         || fabs(measured[c].zero_crossing_rate - stats[c].zero_crossing_rate) > 1e-6
+         || (c == 0 && stats[c].clipped == 0)) {
+            printf("FAIL channel %d: peak %f, rms %f, dc %f, clipped %llu, zcr %f instead of "
+                   "%f, %f, %f, %llu, %f\n", c + 1, measured[c].peak, measured[c].rms, measured[c].dc_offset,
+                   measured[c].clipped, measured[c].zero_crossing_rate, stats[c].peak, stats[c].rms,
+                   stats[c].dc_offset, stats[c].clipped, stats[c].zero_crossing_rate);
+            EXIT_CODE = FAILURE;
+        }
+
+    END:
+    freePointer(wav_header);
+    closeFile(wav_file);
+    unlink("stats.wav");
+    free(data);
+    return EXIT_CODE;
+}
+
+/**
+ * -peaks over any range of frames, answered from a peak file just built
+ * or one mapped again, must be the minimum, maximum and RMS of a linear
+ * scan of the range.
+ *
+ * @return EXIT_CODE
+ */
+private int checkPeaks() {
+    int EXIT_CODE = SUCCESS;
+    s_int layouts[][2] = {{2, 16}, {1, 24}, {3, 8}};
+    for (int i = 0; i < 3; i++)
+        if (comparePeaks(layouts[i][0], layouts[i][1]) != SUCCESS) {
+            printf("FAIL -peaks of %d channels of %d bits\n", layouts[i][0], layouts[i][1]);
+            EXIT_CODE = FAILURE;
+        }
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS -peaks against a linear scan\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Writes noise and compares queryPeaks() over ranges of every length and
+ * alignment with a linear scan, with the peak file built and then mapped.
+ *
+ * @param num_channels, 3 at most
+ * @param bits_per_sample
+ * @return EXIT_CODE
+ */
+private int comparePeaks(s_int num_channels, s_int bits_per_sample) {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 23;
+    u_int frames = 200077, sample_size = bits_per_sample / 8;
+    u_int size = frames * num_channels * sample_size;
+    u_char *data = malloc(size);
+    Peaks peaks;
+    PeakSummary summary[3];
+    if (data == NULL)
+        return FAILURE;
+    for (u_int i = 0; i < size; i++)
+        data[i] = (u_char) (128 + 127 * noise(&state));
+    if (writeWavFile("peaks.wav", num_channels, bits_per_sample, 8000, data, size) != SUCCESS) {
+        free(data);
+        return FAILURE;
+    }
+    unlink("peaks.wav.peaks");
+
+    for (int pass = 0; pass < 2 && EXIT_CODE == SUCCESS; pass++) {
+        if (openPeaks(&peaks, "peaks.wav") != SUCCESS) {
+            EXIT_CODE = FAILURE;
+            break;
+        }
+        for (int query = 0; query < 300 && EXIT_CODE == SUCCESS; query++) {
+            // The whole file, ranges within one base entry, then any range
+            u_int start = 0, end = frames;
+            if (query > 0 && query < 50) {
+                start = (u_int) ((noise(&state) + 1) / 2 * (frames - 300));
+                end = start + 1 + (u_int) ((noise(&state) + 1) / 2 * 300);
+            } else if (query > 0) {
+                start = (u_int) ((noise(&state) + 1) / 2 * frames);
+                end = start + 1 + (u_int) ((noise(&state) + 1) / 2 * (frames - start));
+            }
+            if (queryPeaks(&peaks, start, end, summary) != SUCCESS) {
+                EXIT_CODE = FAILURE;
+                break;
+            }
+
+            for (int c = 0; c < num_channels; c++) {
+                double lowest = 1, highest = -1, squares = 0;
+                for (u_int i = start; i < end; i++) {
+                    double value = (float) sampleToDouble(data + ((size_t) i * num_channels + c) * sample_size,
+                                                          (int) sample_size);
+                    lowest = min(lowest, value);
+                    highest = max(highest, value);
+                    squares += value * value;
+                }
+                double rms = sqrt(squares / (end - start));
+                if (summary[c].min != lowest || summary[c].max != highest || fabs(summary[c].rms - rms) > 1e-9) {
+                    printf("FAIL frames %u to %u, channel %d: %f %f %f instead of %f %f %f\n", start, end, c + 1,
+                           summary[c].min, summary[c].max, summary[c].rms, lowest, highest, rms);
+                    EXIT_CODE = FAILURE;
+                    break;
+                }
+            }
+        }
+        closePeaks(&peaks);
+    }
+
+    unlink("peaks.wav");
+    unlink("peaks.wav.peaks");
+    free(data);
+    return EXIT_CODE;
+}
+
+/**
+ * -similarityMatrix -threshold must list exactly the pairs of the dense
+ * matrix no farther apart than the threshold, with the same distances,
+ * however many pairs its bounds prune, for the euclidean and the lcss
+ * distance, across more than one tile.
+ *
+ * @return EXIT_CODE
+ */
+private int checkMatrixPruning() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 29;
+    char *files[MATRIX_FILES], names[MATRIX_FILES][16];
+    u_char data[4096 + 37 * MATRIX_FILES];
+
+    // Three families of slow tones around different levels, which the
+    // bounds tell apart, each member noisier than the last
+    for (int lcss = 0; lcss < 2 && EXIT_CODE == SUCCESS; lcss++) {
+        for (int k = 0; k < MATRIX_FILES; k++) {
+            u_int size = (u_int) (lcss ? 256 + 7 * k : 4096 + 37 * k);
+            for (u_int i = 0; i < size; i++)
+                data[i] = (u_char) (128 + 60 * (k % 3 - 1) + 40 * sin(2 * M_PI * i / (300 + 200 * (k % 3)))
+                                    + k * noise(&state));
+            snprintf(names[k], sizeof(names[k]), "m%02d.wav", k);
+            files[k] = names[k];
+            if (writeTestFile(files[k], data, size) != SUCCESS)
+                EXIT_CODE = FAILURE;
+        }
+        if (EXIT_CODE == SUCCESS && compareMatrices(files, lcss) != SUCCESS) {
+            printf("FAIL pruned -similarityMatrix%s differs from the dense matrix\n", lcss ? " -lcss" : "");
+            EXIT_CODE = FAILURE;
+        }
+        for (int k = 0; k < MATRIX_FILES; k++)
+            unlink(names[k]);
+    }
+
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS pruned -similarityMatrix\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Prints the dense matrix of MATRIX_FILES files m00.wav, m01.wav ... and
+ * the list under a threshold about a third of the pairs are within, and
+ * compares the two.
+ *
+ * @param files
+ * @param lcss
+ * @return EXIT_CODE
+ */
+private int compareMatrices(char **files, int lcss) {
+    int EXIT_CODE = SUCCESS;
+    char dense[MATRIX_FILES][MATRIX_FILES][16], listed[MATRIX_FILES][MATRIX_FILES][16];
+    double sorted[MATRIX_FILES * MATRIX_FILES];
+    int pairs = 0;
+    char *save_line, *save_field;
+    memset(listed, 0, sizeof(listed));
+
+    int saved_stdout = captureOutput();
+    int status = similarityMatrix(files, MATRIX_FILES, lcss, -1);
+    char *output = releaseOutput(saved_stdout);
+    if (status != SUCCESS || output == NULL) {
+        freePointer(output);
+        return FAILURE;
+    }
+    char *line = strtok_r(output, "\n", &save_line);
+    for (int i = 0; i < MATRIX_FILES && (line = strtok_r(NULL, "\n", &save_line)) != NULL; i++) {
+        char *field = strtok_r(line, ",", &save_field);
+        for (int j = 0; j < MATRIX_FILES && (field = strtok_r(NULL, ",", &save_field)) != NULL; j++) {
+            snprintf(dense[i][j], sizeof(dense[i][j]), "%s", field);
+            if (j > i)
+                sorted[pairs++] = atof(field);
+        }
+    }
+    free(output);
+    if (pairs != MATRIX_FILES * (MATRIX_FILES - 1) / 2)
+        return FAILURE;
+
+    // About a third of the distances, the rest pruned or computed and left
+    // out. Printed distances are rounded, so the threshold lies in a gap
+    for (int i = 1; i < pairs; i++)
+        for (int j = i; j > 0 && sorted[j - 1] > sorted[j]; j--) {
+            double swap = sorted[j];
+            sorted[j] = sorted[j - 1];
+            sorted[j - 1] = swap;
+        }
+    int below = pairs / 3;
+    while (below < pairs - 1 && sorted[below + 1] - sorted[below] < 0.002)
+        below++;
+    double threshold = sorted[below] + 0.001;
+
+    saved_stdout = captureOutput();
+    status = similarityMatrix(files, MATRIX_FILES, lcss, threshold);
+    output = releaseOutput(saved_stdout);
+    if (status != SUCCESS || output == NULL) {
+        freePointer(output);
+        return FAILURE;
+    }
+    strtok_r(output, "\n", &save_line);
+    while ((line = strtok_r(NULL, "\n", &save_line)) != NULL) {
+        int i, j;
+        char distance[16];
+        if (sscanf(line, "\"m%d.wav\",\"m%d.wav\",%15s", &i, &j, distance) != 3
+         || i < 0 || j <= i || j >= MATRIX_FILES) {
+            EXIT_CODE = FAILURE;
+            break;
+        }
+        snprintf(listed[i][j], sizeof(listed[i][j]), "%s", distance);
+    }
+    free(output);
+
+    for (int i = 0; i < MATRIX_FILES; i++)
+        for (int j = i + 1; j < MATRIX_FILES; j++)
+            if (atof(dense[i][j]) <= threshold ? strcmp(dense[i][j], listed[i][j]) != 0 : listed[i][j][0] != '\0') {
+                printf("FAIL m%02d.wav and m%02d.wav: %s in the matrix, \"%s\" listed under %.3f\n", i, j,
+                       dense[i][j], listed[i][j], threshold);
+                EXIT_CODE = FAILURE;
+            }
+    return EXIT_CODE;
+}
+
+/**
+ * -similarity stopped by SIGTERM, then resumed and stopped by SIGINT, must
+ * end by the signal with its checkpoint saved each time, and the run that
+ * completes must print the distances of LCSS() and remove its checkpoint,
+ * but not the file.lcss of another comparison.
+ *
+ * @return EXIT_CODE
+ */
+private int checkStopSignals() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 31;
+    u_int size = 30000, small_size = 3000;
+    char *arguments[] = {"../wavengine", "-similarity", "stop-a.wav", "stop-b.wav", "stop-c.wav", NULL};
+    u_char *data1 = malloc(size), *data2 = malloc(size);
+    char *output = NULL, *foreign = NULL;
+    size_t output_size = 0, foreign_size = 0;
+    struct stat status;
+    if (data1 == NULL || data2 == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (u_int i = 0; i < size; i++) {
+        data1[i] = (u_char) (128 + 16 * noise(&state));
+        data2[i] = (u_char) (128 + 16 * noise(&state));
+    }
+    FILE *other = fopen("stop-c.wav.lcss", "w");
+    if (writeTestFile("stop-a.wav", data1, size) != SUCCESS || writeTestFile("stop-b.wav", data2, size) != SUCCESS
+     || writeTestFile("stop-c.wav", data2, small_size) != SUCCESS || other == NULL
+     || fputs("checkpoint of another comparison", other) == EOF) {
+        EXIT_CODE = FAILURE;
+        if (other != NULL)
+            fclose(other);
+        goto END;
+    }
+    fclose(other);
+
+    if (stopWavEngine(arguments, SIGTERM) != SUCCESS || stat("stop-b.wav.lcss", &status) != 0) {
+        printf("FAIL -similarity stopped by SIGTERM saved no checkpoint\n");
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    if (stopWavEngine(arguments, SIGINT) != SUCCESS || stat("stop-b.wav.lcss", &status) != 0) {
+        printf("FAIL resumed -similarity stopped by SIGINT saved no checkpoint\n");
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    char expected[128];
+    snprintf(expected, sizeof(expected), "LCSS distance: %.3f\n\nEuclidean distance: %.3f\nLCSS distance: %.3f\n",
+             LCSS(data1, data2, size, size), euclidean(data1, data2, size, small_size),
+             LCSS(data1, data2, size, small_size));
+    int completed = system("../wavengine -similarity stop-a.wav stop-b.wav stop-c.wav > stop.txt");
+    output = (char *) readWholeFile("stop.txt", &output_size);
+    foreign = (char *) readWholeFile("stop-c.wav.lcss", &foreign_size);
+    if (completed != 0 || output == NULL || strstr(output, expected) == NULL) {
+        printf("FAIL resumed -similarity printed other distances than LCSS()\n");
+        EXIT_CODE = FAILURE;
+    }
+    if (stat("stop-b.wav.lcss", &status) == 0) {
+        printf("FAIL completed -similarity kept its checkpoint\n");
+        EXIT_CODE = FAILURE;
+    }
+    if (foreign == NULL || foreign_size != strlen("checkpoint of another comparison")) {
+        printf("FAIL completed -similarity removed the checkpoint of another comparison\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    unlink("stop-a.wav");
+    unlink("stop-b.wav");
+    unlink("stop-c.wav");
+    unlink("stop-b.wav.lcss");
+    unlink("stop-c.wav.lcss");
+    unlink("stop.txt");
+    free(data1);
+    free(data2);
+    free(output);
+    free(foreign);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS SIGTERM and SIGINT stop and resume -similarity\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Runs wavengine and sends it @param signal_number a moment later, while
+ * it is busy.
+ *
+ * @param arguments
+ * @param signal_number
+ * @return EXIT_CODE, SUCCESS if it ended by the signal
+ */
+private int stopWavEngine(char **arguments, int signal_number) {
+    struct timespec delay = {0, 150000000};
+    int status;
+    pid_t pid = startWavEngine(arguments);
+    if (pid < 0)
+        return FAILURE;
+    nanosleep(&delay, NULL);
+    kill(pid, signal_number);
+    if (waitpid(pid, &status, 0) != pid)
+        return FAILURE;
+    return WIFSIGNALED(status) && WTERMSIG(status) == signal_number ? SUCCESS : FAILURE;
+}
+
+/**
+ * LCSS() of known pairs must count the last byte of the longer buffer: a
+ * buffer is at distance 0 from itself, and from a shorter one whose only
+ * byte matches its last. It must agree with the length alignLCSS() finds.
+ *
+ * @return EXIT_CODE
+ */
+private int checkLCSSValue() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 37;
+    u_char text1[] = "ABCBDAB", text2[] = "BDCABA", last[] = {1, 2, 3}, only[] = {3};
+    u_char noise1[1000], noise2[777];
+    u_int matches[1000];
+    for (int i = 0; i < 1000; i++)
+        noise1[i] = (u_char) (128 + 8 * noise(&state));
+    for (int i = 0; i < 777; i++)
+        noise2[i] = (u_char) (128 + 8 * noise(&state));
+
+    // The LCSS of ABCBDAB and BDCABA is 4 long, BCBA
+    struct {
+        u_char *data1, *data2;
+        u_int size1, size2;
+        double distance;
+    } pairs[] = {{text1, text2, 7, 6, 1 - 4.0 / 6}, {text1, text1, 7, 7, 0}, {last, only, 3, 1, 0},
+                 {noise1, noise1, 1000, 1000, 0}};
+    for (int i = 0; i < 4; i++) {
+        double distance = LCSS(pairs[i].data1, pairs[i].data2, pairs[i].size1, pairs[i].size2);
+        if (fabs(distance - pairs[i].distance) > 1e-12) {
+            printf("FAIL LCSS() of pair %d: %.6f instead of %.6f\n", i + 1, distance, pairs[i].distance);
+            EXIT_CODE = FAILURE;
+        }
+    }
+
+    long long length = alignLCSS(noise1, noise2, 1000, 777, matches);
+    double distance = LCSS(noise1, noise2, 1000, 777);
+    if (length < 0 || distance != 1 - (double) length / 777) {
+        printf("FAIL LCSS() of noise: %.6f, alignLCSS() found %lld of 777\n", distance, length);
+        EXIT_CODE = FAILURE;
+    }
+
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS LCSS of known pairs\n");
+    return EXIT_CODE;
+}
+
+/**
+ * -dedup must group files of the same data whatever their headers, and
+ * nothing else: not a file of other data as long, not a file given twice
+ * or through a hard link, and not a file whose cached hash says the data
+ * is the same when it is not.
+ *
+ * @return EXIT_CODE
+ */
+private int checkDuplicates() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 41;
+    u_char data[5000], other[5000];
+    char *files[] = {"dedup-a.wav", "dedup-b.wav", "dedup-c.wav", "dedup-d.wav"};
+    char *repeated[] = {"dedup-a.wav", "dedup-a.wav", "dedup-link.wav"};
+    unsigned long long *cache = NULL;
+    size_t cache_size = 0;
+    struct stat a_stat, c_stat;
+    for (int i = 0; i < 5000; i++) {
+        data[i] = (u_char) (128 + 100 * noise(&state));
+        other[i] = (u_char) (128 + 100 * noise(&state));
+    }
+    unlink("dedup.cache");
+    unlink("dedup-link.wav");
+    if (writeTestFile(files[0], data, 5000) != SUCCESS
+     || writeWavFile(files[1], 2, 8, 22050, data, 5000) != SUCCESS
+     || writeTestFile(files[2], other, 5000) != SUCCESS || writeTestFile(files[3], data, 4999) != SUCCESS
+     || link(files[0], "dedup-link.wav") != 0) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    if (countGroups(files, 4, "dedup.cache", "Duplicates, 5000 bytes of data:\n  dedup-a.wav\n  dedup-b.wav\n"
+                                             "4 files, 1 groups") != SUCCESS) {
+        printf("FAIL -dedup grouped other than the files of the same data\n");
+        EXIT_CODE = FAILURE;
+    }
+    if (countGroups(repeated, 3, NULL, "3 files, 0 groups") != SUCCESS) {
+        printf("FAIL -dedup grouped a file with itself\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    // A cached hash of dedup-c.wav made the same as that of dedup-a.wav
+    cache = (unsigned long long *) readWholeFile("dedup.cache", &cache_size);
+    if (cache == NULL || stat(files[0], &a_stat) != 0 || stat(files[2], &c_stat) != 0) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    unsigned long long *records = (unsigned long long *) ((u_char *) cache + 12), *a_hash = NULL, *c_hash = NULL;
+    for (size_t i = 0; 12 + 48 * (i + 1) <= cache_size; i++) {
+        unsigned long long record[6];
+        memcpy(record, records + 6 * i, sizeof(record));
+        if (record[1] == (unsigned long long) a_stat.st_ino)
+            a_hash = records + 6 * i + 5;
+        else if (record[1] == (unsigned long long) c_stat.st_ino)
+            c_hash = records + 6 * i + 5;
+    }
+    int fd = open("dedup.cache", O_WRONLY);
+    if (a_hash == NULL || c_hash == NULL || fd < 0) {
+        printf("FAIL -dedup cached no hash of dedup-a.wav or dedup-c.wav\n");
+        EXIT_CODE = FAILURE;
+    } else {
+        memcpy(c_hash, a_hash, 8);
+        if (pwriteFully(fd, cache, cache_size, 0) != SUCCESS
+         || countGroups(files, 4, "dedup.cache", "Duplicates, 5000 bytes of data:\n  dedup-a.wav\n  dedup-b.wav\n"
+                                                 "4 files, 1 groups") != SUCCESS) {
+            printf("FAIL -dedup grouped files of the same hash but other data\n");
+            EXIT_CODE = FAILURE;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+
+    END:
+    for (int i = 0; i < 4; i++)
+        unlink(files[i]);
+    unlink("dedup-link.wav");
+    unlink("dedup.cache");
+    free(cache);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS -dedup groups only the same data\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Runs -dedup and looks for @param expected in what it prints.
+ *
+ * @param files
+ * @param number_of_files
+ * @param cache_filename, or NULL
+ * @param expected
+ * @return EXIT_CODE
+ */
+private int countGroups(char **files, int number_of_files, char *cache_filename, char *expected) {
+    int saved_stdout = captureOutput();
+    int status = findDuplicates(files, number_of_files, cache_filename);
+    char *output = releaseOutput(saved_stdout);
+    int EXIT_CODE = status == SUCCESS && output != NULL && strstr(output, expected) != NULL ? SUCCESS : FAILURE;
+    if (EXIT_CODE != SUCCESS && output != NULL)
+        printf("%s", output);
+    freePointer(output);
+    return EXIT_CODE;
+}
+
+/**
+ * -realtime -embed must put the text where -encodeText does, so that the
+ * stream decodes with -decodeText, and -realtime -mix must refuse a file
+ * of another sample rate.
+ *
+ * @return EXIT_CODE
+ */
+private int checkLiveEmbed() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 43;
+    short samples[2 * 3000];
+    char text[] = "Streamed into the low bits.", decoded[sizeof(text)] = {0};
+    for (int i = 0; i < 2 * 3000; i++)
+        samples[i] = (short) (30000 * noise(&state));
+    FILE *text_file = fopen("live.txt", "wb");
+    if (text_file == NULL || fwrite(text, strlen(text), 1, text_file) != 1 || fclose(text_file) != 0
+     || writeWavFile("live-in.wav", 2, 16, 8000, samples, sizeof(samples)) != SUCCESS
+     || writeWavFile("live-rate.wav", 2, 16, 11025, samples, sizeof(samples)) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    int live = system("../wavengine -realtime -period 64 -embed live.txt live-in.wav live.wav > /dev/null 2>&1");
+    int encoded = system("../wavengine -encodeText live-in.wav live.txt > /dev/null");
+    char command[128];
+    snprintf(command, sizeof(command), "../wavengine -decodeText live.wav %d live-out.txt > /dev/null",
+             (int) strlen(text));
+    int decode = system(command);
+    FILE *decoded_file = fopen("live-out.txt", "rb");
+    size_t read = decoded_file == NULL ? 0 : fread(decoded, 1, sizeof(decoded), decoded_file);
+    closeFile(decoded_file);
+    if (live != 0 || encoded != 0 || sameFiles("live.wav", "new-live-in.wav", 0) != SUCCESS) {
+        printf("FAIL -realtime -embed wrote other bits than -encodeText\n");
+        EXIT_CODE = FAILURE;
+    }
+    if (decode != 0 || read != sizeof(text) || memcmp(decoded, text, sizeof(text)) != 0) {
+        printf("FAIL -decodeText did not read back the text of -realtime -embed\n");
+        EXIT_CODE = FAILURE;
+    }
+    if (system("../wavengine -realtime -mix live-rate.wav live-in.wav live.wav > /dev/null 2>&1") == 0) {
+        printf("FAIL -realtime -mix took a file of another sample rate\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    unlink("live.txt");
+    unlink("live-in.wav");
+    unlink("live-rate.wav");
+    unlink("live.wav");
+    unlink("new-live-in.wav");
+    unlink("live-out.txt");
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS -realtime -embed decodes with -decodeText\n");
+    return EXIT_CODE;
+}
+
+/**
+ * An edit list rendered must hold what -chop and -reverse write for the
+ * same edits, and must not render once a source was rewritten at another
+ * sample rate.
+ *
+ * @return EXIT_CODE
+ */
+private int checkEditRender() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 47;
+    u_int frames = 4 * 8000;
+    short *samples = malloc(frames * 2 * sizeof(short));
+    if (samples == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    for (u_int i = 0; i < 2 * frames; i++)
+        samples[i] = (short) (30000 * noise(&state));
+    if (writeWavFile("edit.wav", 2, 16, 8000, samples, frames * 2 * sizeof(short)) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    int listed = system("../wavengine -edit chop.edl -chop edit.wav 1 3 > /dev/null"
+                        " && ../wavengine -edit reverse.edl -reverse chop.edl > /dev/null");
+    int chopped = system("../wavengine -chop edit.wav 1 3 > /dev/null"
+                         " && ../wavengine -reverse chopped-edit.wav > /dev/null");
+    int rendered = system("../wavengine -render chop.edl chop-render.wav > /dev/null"
+                          " && ../wavengine -render reverse.edl reverse-render.wav > /dev/null");
+    if (listed != 0 || chopped != 0 || rendered != 0
+     || sameFiles("chop-render.wav", "chopped-edit.wav", 0) != SUCCESS
+     || sameFiles("reverse-render.wav", "reverse-chopped-edit.wav", 0) != SUCCESS) {
+        printf("FAIL -render of an edit list differs from -chop and -reverse\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    if (writeWavFile("edit.wav", 2, 16, 11025, samples, frames * 2 * sizeof(short)) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    if (system("../wavengine -render chop.edl chop-render.wav > /dev/null") == 0) {
+        printf("FAIL -render played a source rewritten at another sample rate\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    END:
+    unlink("edit.wav");
+    unlink("chop.edl");
+    unlink("reverse.edl");
+    unlink("chopped-edit.wav");
+    unlink("reverse-chopped-edit.wav");
+    unlink("chop-render.wav");
+    unlink("reverse-render.wav");
+    free(samples);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS -render matches -chop and -reverse\n");
+    return EXIT_CODE;
+}
+
+/**
+ * -concat must give back every file as it was, one after the other, and
+ * with -crossfade the linear blend of the frames that overlap.
+ *
+ * @return EXIT_CODE
+ */
+private int checkConcat() {
+    int EXIT_CODE = SUCCESS;
+    s_int bits[] = {8, 16, 24};
+    for (int i = 0; i < 3; i++)
+        if (compareConcat(bits[i]) != SUCCESS) {
+            printf("FAIL -concat of %d bit files\n", bits[i]);
+            EXIT_CODE = FAILURE;
+        }
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS -concat gives back the files it joins\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Joins three stereo files of noise, without and with a crossfade of 100
+ * frames, and compares the output sample by sample. A blend may round
+ * one step off, as the kernels compute in float.
+ *
+ * @param bits_per_sample
+ * @return EXIT_CODE
+ */
+private int compareConcat(s_int bits_per_sample) {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 53;
+    u_int frames[] = {3001, 1500, 2200}, sample_size = bits_per_sample / 8, frame_size = 2 * sample_size, fade = 100;
+    u_int size = (frames[0] + frames[1] + frames[2]) * frame_size;
+    u_char *data = malloc(size), *file = NULL;
+    size_t file_size = 0;
+    if (data == NULL)
+        return FAILURE;
+    for (u_int i = 0; i < size; i++)
+        data[i] = (u_char) (128 + 127 * noise(&state));
+    if (writeWavFile("concat-a.wav", 2, bits_per_sample, 8000, data, frames[0] * frame_size) != SUCCESS
+     || writeWavFile("concat-b.wav", 2, bits_per_sample, 8000, data + frames[0] * frame_size,
+                     frames[1] * frame_size) != SUCCESS
+     || writeWavFile("concat-c.wav", 2, bits_per_sample, 8000, data + (frames[0] + frames[1]) * frame_size,
+                     frames[2] * frame_size) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    if (system("../wavengine -concat concat.wav concat-a.wav concat-b.wav concat-c.wav > /dev/null") != 0
+     || compareWavFile("concat.wav", 2, data, size) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    // 100 frames at 8000 Hz
+    if (system("../wavengine -concat -crossfade 0.0125 concat.wav concat-a.wav concat-b.wav concat-c.wav"
+               " > /dev/null") != 0 || (file = readWholeFile("concat.wav", &file_size)) == NULL
+     || file_size != HEADER_SIZE + size - 2 * fade * frame_size) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    u_char *output = file + HEADER_SIZE;
+    u_int input_frame = 0, output_frame = 0;
+    for (int f = 0; f < 3 && EXIT_CODE == SUCCESS; f++) {
+        u_int head = f > 0 ? fade : 0, tail = f < 2 ? fade : 0;
+        for (u_int i = head; i < frames[f] && EXIT_CODE == SUCCESS; i++, output_frame++)
+            for (u_int c = 0; c < 2; c++) {
+                long expected = readSample(data + (size_t) (input_frame + i) * frame_size + c * sample_size, sample_size);
+                if (i >= frames[f] - tail) {
+                    long next = readSample(data + (size_t) (input_frame + frames[f] + i - (frames[f] - tail)) * frame_size
+                                           + c * sample_size, sample_size);
+                    double ramp = (i - (frames[f] - tail) + 0.5) / fade;
+                    expected = lrint(expected + (next - expected) * ramp);
+                }
+                long actual = readSample(output + (size_t) output_frame * frame_size + c * sample_size, sample_size);
+                if (labs(actual - expected) > 1)
+                    EXIT_CODE = FAILURE;
+            }
+        input_frame += frames[f];
+    }
+
+    END:
+    unlink("concat-a.wav");
+    unlink("concat-b.wav");
+    unlink("concat-c.wav");
+    unlink("concat.wav");
+    free(data);
+    free(file);
+    return EXIT_CODE;
+}
+
+/**
+ * -route must write every output channel as the weighted sum of its
+ * inputs, saturated at full scale, and refuse a header whose block does
+ * not split into its channels.
+ *
+ * @return EXIT_CODE
+ */
+private int checkRouteDownmix() {
+    int EXIT_CODE = SUCCESS;
+    s_int bits[] = {8, 16, 24};
+    for (int i = 0; i < 3; i++)
+        if (compareRoute(bits[i]) != SUCCESS) {
+            printf("FAIL -route of %d bit files\n", bits[i]);
+            EXIT_CODE = FAILURE;
+        }
+
+    // 3 channels of 16 bits in blocks of 7 bytes
+    u_char data[7 * 100] = {0};
+    size_t size = 0;
+    u_char *file = NULL;
+    if (writeWavFile("route-odd.wav", 3, 16, 8000, data, sizeof(data)) != SUCCESS
+     || (file = readWholeFile("route-odd.wav", &size)) == NULL) {
+        EXIT_CODE = FAILURE;
+    } else {
+        ((Header *) file)->blockAlign = 7;
+        FILE *odd_file = fopen("route-odd.wav", "wb");
+        int written = odd_file != NULL && fwrite(file, size, 1, odd_file) == 1;
+        closeFile(odd_file);
+        if (!written || system("../wavengine -route 0,1 route-odd.wav > /dev/null") == 0) {
+            printf("FAIL -route took a block of 7 bytes for 3 channels\n");
+            EXIT_CODE = FAILURE;
+        }
+    }
+    unlink("route-odd.wav");
+    unlink("route-route-odd.wav");
+    free(file);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS -route downmixes to the weighted sums\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Routes three channels of noise through 0.5*0+0.5*1,2,1.5*2 and compares
+ * every sample with its weighted sum computed here, the last channel
+ * saturating.
+ *
+ * @param bits_per_sample
+ * @return EXIT_CODE
+ */
+private int compareRoute(s_int bits_per_sample) {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 59;
+    u_int frames = 5003, sample_size = bits_per_sample / 8, size = frames * 3 * sample_size;
+    double weights[3][3] = {{0.5, 0.5, 0}, {0, 0, 1}, {0, 0, 1.5}};
+    double largest = ldexp(1, bits_per_sample - 1) - 1;
+    u_char *data = malloc(size), *file = NULL;
+    size_t file_size = 0;
+    if (data == NULL)
+        return FAILURE;
+    for (u_int i = 0; i < size; i++)
+        data[i] = (u_char) (128 + 127 * noise(&state));
+    if (writeWavFile("routed.wav", 3, bits_per_sample, 8000, data, size) != SUCCESS
+     || system("../wavengine -route 0.5*0+0.5*1,2,1.5*2 routed.wav > /dev/null") != 0
+     || (file = readWholeFile("route-routed.wav", &file_size)) == NULL
+     || file_size != HEADER_SIZE + (size_t) size || ((Header *) file)->numChannels != 3) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    for (u_int f = 0; f < frames && EXIT_CODE == SUCCESS; f++)
+        for (u_int o = 0; o < 3; o++) {
+            double sum = 0;
+            for (u_int c = 0; c < 3; c++)
+                sum += weights[o][c] * (double) readSample(data + (f * 3 + c) * sample_size, sample_size);
+            long expected = lrint(min(max(sum, -largest - 1), largest));
+            if (readSample(file + HEADER_SIZE + (f * 3 + o) * sample_size, sample_size) != expected)
+                EXIT_CODE = FAILURE;
+        }
+
+    END:
+    unlink("routed.wav");
+    unlink("route-routed.wav");
+    free(data);
+    free(file);
+    return EXIT_CODE;
+}
+
+/**
+ * The euclidean distance of 24 bit data must be over its samples: from
+ * euclidean24() over enough samples for several ranges, and as printed by
+ * -similarity and by -similarityMatrix, dense and with a threshold.
+ *
+ * @return EXIT_CODE
+ */
+private int checkEuclidean24() {
+    int EXIT_CODE = SUCCESS;
+    unsigned long long state = 61;
+    u_int samples1 = 900001, samples2 = 700003, frames = 500;
+    u_char *data1 = malloc(3 * (size_t) samples1), *data2 = malloc(3 * (size_t) samples2);
+    u_char near[3 * 2 * 500], other[3 * 2 * 500];
+    char *files[] = {"e24-a.wav", "e24-b.wav", "e24-c.wav"};
+    if (data1 == NULL || data2 == NULL) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+
+    for (size_t i = 0; i < 3 * (size_t) samples1; i++)
+        data1[i] = (u_char) (128 + 127 * noise(&state));
+    for (size_t i = 0; i < 3 * (size_t) samples2; i++)
+        data2[i] = (u_char) (128 + 127 * noise(&state));
+    long double sum = 0;
+    for (u_int i = 0; i < samples2; i++) {
+        long double difference = readSample(data1 + 3 * i, 3) - readSample(data2 + 3 * i, 3);
+        sum += difference * difference;
+    }
+    double expected = sqrt((double) sum), distance = euclidean24(data1, data2, 3 * samples1, 3 * samples2);
+    if (fabs(distance - expected) > 1e-9 * expected) {
+        printf("FAIL euclidean24 gave %.3f instead of %.3f\n", distance, expected);
+        EXIT_CODE = FAILURE;
+    }
+
+    // e24-b.wav is e24-a.wav moved by a few steps, e24-c.wav other noise
+    double distances[3] = {0, 0, 0};
+    for (u_int i = 0; i < 2 * frames; i++) {
+        long sample = readSample(data1 + 3 * i, 3);
+        writeSample(near + 3 * i, 3, sample + (sample > 0 ? -(long) (i % 7) : (long) (i % 7)));
+        memcpy(other + 3 * i, data2 + 3 * i, 3);
+    }
+    for (u_int i = 0; i < 2 * frames; i++) {
+        long a = readSample(data1 + 3 * i, 3), b = readSample(near + 3 * i, 3), c = readSample(other + 3 * i, 3);
+        distances[0] += (double) (a - b) * (a - b);
+        distances[1] += (double) (a - c) * (a - c);
+        distances[2] += (double) (b - c) * (b - c);
+    }
+    for (int i = 0; i < 3; i++)
+        distances[i] = sqrt(distances[i]);
+    if (writeWavFile(files[0], 2, 24, 8000, data1, sizeof(near)) != SUCCESS
+     || writeWavFile(files[1], 2, 24, 8000, near, sizeof(near)) != SUCCESS
+     || writeWavFile(files[2], 2, 24, 8000, other, sizeof(other)) != SUCCESS) {
+        EXIT_CODE = FAILURE;
+        goto END;
+    }
+    if (findDistances(files, -1, distances, 3) != SUCCESS) {
+        printf("FAIL -similarityMatrix of 24 bit files is not over their samples\n");
+        EXIT_CODE = FAILURE;
+    }
+    if (findDistances(files, (distances[0] + min(distances[1], distances[2])) / 2, distances, 1) != SUCCESS) {
+        printf("FAIL -similarityMatrix -threshold of 24 bit files listed other than the near pair\n");
+        EXIT_CODE = FAILURE;
+    }
+
+    char expected_line[64];
+    snprintf(expected_line, sizeof(expected_line), "Euclidean distance: %.3f\n", distances[0]);
+    int saved_stdout = captureOutput();
+    int status = calculateDistance(files, 2);
+    char *output = releaseOutput(saved_stdout);
+    if (status != SUCCESS || output == NULL || strstr(output, expected_line) == NULL) {
+        printf("FAIL -similarity of 24 bit files is not over their samples\n");
+        EXIT_CODE = FAILURE;
+    }
+    freePointer(output);
+
+    END:
+    for (int i = 0; i < 3; i++)
+        unlink(files[i]);
+    free(data1);
+    free(data2);
+    if (EXIT_CODE == SUCCESS)
+        printf("PASS euclidean distance of 24 bit samples\n");
+    return EXIT_CODE;
+}
+
+/**
+ * Runs -similarityMatrix on three files and looks for the first @param
+ * expected of their distances, of the pairs a-b, a-c and b-c, in what it
+ * prints, and for none of the others.
+ *
+ * @param files
+ * @param threshold, negative for a dense matrix
+ * @param distances
+ * @param expected
+ * @return EXIT_CODE
+ */
+private int findDistances(char **files, double threshold, double *distances, int expected) {
+    int saved_stdout = captureOutput();
+    int status = similarityMatrix(files, 3, 0, threshold);
+    char *output = releaseOutput(saved_stdout);
+    int EXIT_CODE = status == SUCCESS && output != NULL ? SUCCESS : FAILURE;
+    for (int i = 0; i < 3 && EXIT_CODE == SUCCESS; i++) {
+        char distance[32];
+        snprintf(distance, sizeof(distance), ",%.3f", distances[i]);
+        if ((strstr(output, distance) != NULL) != (i < expected))
+            EXIT_CODE = FAILURE;
+    }
+    if (EXIT_CODE != SUCCESS && output != NULL)
+        printf("%s", output);
+    freePointer(output);
+    return EXIT_CODE;
+}
+
+/**
+ * Writes 8 bit mono samples as a .wav file.
+ *
+ * @param wav_filename
+ * @param data
+ * @param size
+ * @return EXIT_CODE
+ */
+private int writeTestFile(char *wav_filename, u_char *data, u_int size) {
+    return writeWavFile(wav_filename, 1, 8, 8000, data, size);
+}
+
+/**
+ * Writes interleaved PCM samples as a .wav file.
+ *
+ * @param wav_filename
+ * @param num_channels
+ * @param bits_per_sample
+ * @param sample_rate
+ * @param data
+ * @param size, in bytes
+ * @return EXIT_CODE
+ */
+private int writeWavFile(char *wav_filename, s_int num_channels, s_int bits_per_sample, u_int sample_rate,
+                         void *data, u_int size) {
+    s_int block_align = (s_int) (num_channels * bits_per_sample / 8);
+    Header header = {{'R', 'I', 'F', 'F'}, 36 + size, {'W', 'A', 'V', 'E'}, {'f', 'm', 't', ' '}, 16, 1,
+                     num_channels, sample_rate, sample_rate * block_align, block_align, bits_per_sample,
+                     {'d', 'a', 't', 'a'}, size};
+    FILE *wav_file = fopen(wav_filename, "wb");
+    if (wav_file == NULL)
+        return FAILURE;
+    int EXIT_CODE = fwrite(&header, HEADER_SIZE, 1, wav_file) == 1 && fwrite(data, size, 1, wav_file) == 1
+                    ? SUCCESS : FAILURE;
+    return fclose(wav_file) == 0 ? EXIT_CODE : FAILURE;
+}
+
+/**
+ * @param filename
+ * @param size, receives the size of the file
+ * @return the malloc'd bytes of the whole file, or NULL
+ */
+private u_char *readWholeFile(char *filename, size_t *size) {
+    u_char *data = NULL;
+    struct stat status;
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0 && fstat(fd, &status) == 0) {
+        *size = (size_t) status.st_size;
+        data = malloc(max(*size, 1));
+        if (data != NULL && preadFully(fd, data, *size, 0) != SUCCESS) {
+            free(data);
+            data = NULL;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+    return data;
+}
+
+/**
+ * @param wav_filename
+ * @param num_channels
+ * @param data
+ * @param size
+ * @return SUCCESS if @param wav_filename has @param num_channels channels,
+ * sizes that match its data and exactly @param data as its data
+ */
+private int compareWavFile(char *wav_filename, s_int num_channels, u_char *data, u_int size) {
+    size_t file_size;
+    u_char *file = readWholeFile(wav_filename, &file_size);
+    Header *header = (Header *) file;
+    int EXIT_CODE = file != NULL && file_size == HEADER_SIZE + (size_t) size && header->numChannels == num_channels
+                    && header->subchunk2Size == size && header->chunkSize == 36 + size
+                    && memcmp(file + HEADER_SIZE, data, size) == 0 ? SUCCESS : FAILURE;
+    free(file);
+    return EXIT_CODE;
+}
+
+/**
+ * @param filename1
+ * @param filename2
+ * @param skip_sizes, if set the chunk sizes of the headers may differ
+ * @return SUCCESS if both files are the same
+ */
+private int sameFiles(char *filename1, char *filename2, int skip_sizes) {
+    size_t size1 = 0, size2 = 0;
+    u_char *file1 = readWholeFile(filename1, &size1), *file2 = readWholeFile(filename2, &size2);
+    int EXIT_CODE = file1 != NULL && file2 != NULL && size1 == size2 && size1 >= HEADER_SIZE ? SUCCESS : FAILURE;
+    if (EXIT_CODE == SUCCESS && skip_sizes) {
+        Header *header1 = (Header *) file1, *header2 = (Header *) file2;
+        header2->chunkSize = header1->chunkSize;
+        header2->subchunk2Size = header1->subchunk2Size;
+    }
+    if (EXIT_CODE == SUCCESS && memcmp(file1, file2, size1) != 0)
+        EXIT_CODE = FAILURE;
+    free(file1);
+    free(file2);
+    return EXIT_CODE;
+}
+
+/**
+ * Runs the wavengine binary, built next to the tests, in a child process.
+ *
+ * @param arguments, NULL terminated, arguments[0] is the binary
+ * @return the pid of the child, or -1
+ */
+private pid_t startWavEngine(char **arguments) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int quiet = open("/dev/null", O_WRONLY);
+        dup2(quiet, STDOUT_FILENO);
+        execv(arguments[0], arguments);
+        _exit(127);
+    }
+    return pid;
+}
+
+/**
+ * Sends stdout to a file until releaseOutput().
+ *
+ * @return the descriptor of the previous stdout
+ */
+private int captureOutput() {
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO), capture = open("output.tmp", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    dup2(capture, STDOUT_FILENO);
+    close(capture);
+    return saved_stdout;
+}
+
+/**
+ * Puts back the stdout that captureOutput() replaced.
+ *
+ * @param saved_stdout
+ * @return what was printed in between, or NULL
+ */
+private char *releaseOutput(int saved_stdout) {
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    char *output = NULL;
+    FILE *capture = fopen("output.tmp", "rb");
+    if (capture != NULL && fseek(capture, 0, SEEK_END) == 0) {
+        long size = ftell(capture);
+        rewind(capture);
+        output = size >= 0 ? malloc((size_t) size + 1) : NULL;
+        if (output != NULL)
+            output[fread(output, 1, (size_t) size, capture)] = '\0';
+    }
+    closeFile(capture);
+    unlink("output.tmp");
+    return output;
+}
+
+/**
+ * Sends SIGINT to the process 100 ms after it started.
+ *
+ * @param argument
+ * @return NULL
+ */
+private void *interruptSoon(void *argument) {
+    struct timespec delay = {0, 100000000};
+    nanosleep(&delay, NULL);
+    kill(getpid(), SIGINT);
+    return NULL;
+}
+
+/**
+ * @param signal_number
+ */
+private void ignoreSignal(int signal_number) {
+}
+
+/**
+ * @param state, of a 64 bit linear congruential generator
+ * @return uniform noise in [-1, 1)
+ */
+private double noise(unsigned long long *state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (double) (*state >> 11) / 4503599627370496.0 - 1;
+}